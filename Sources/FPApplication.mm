@@ -258,6 +258,13 @@ void FPApplication::Init() {
 	SetMenuIcon(kFPCommandAUSynthOut, CFSTR("misc/au.png"));
 #endif
 
+	// Put Switch Undo Branch under Redo
+	if (GetIndMenuItemWithCommandID(NULL, kHICommandRedo, 1, &menu, &item) == noErr) {
+		TString branchStr;
+		branchStr.SetLocalized(CFSTR("Switch Undo Branch"));
+		(void)InsertMenuItemTextWithCFString(menu, branchStr.GetCFStringRef(), item, kMenuItemAttrUpdateSingleItem, kFPCommandSwitchBranch);
+	}
+
 	// Get rid of Sparkle Update if it's disabled
 #if !SPARKLE_SUPPORT
 	err = GetIndMenuItemWithCommandID(NULL, kFPCommandCheckForUpdate, 1, &menu, &item);
@@ -1052,6 +1059,27 @@ bool FPApplication::UpdateCommandStatus(MenuCommand cid, MenuRef menu, MenuItemI
 			break;
 		}
 
+		case kFPCommandSwitchBranch:
+			if (IsDialogFront())
+				handled = false;
+			else {
+				TString		branchTitle;
+				FPHistory	*hist = ActiveHistory();
+
+				// Name the branch that's next in turn
+				CFStringRef	action = hist->BranchName();
+				if (action) {
+					branchTitle.SetLocalized(CFSTR("Switch to Branch "));
+					branchTitle += action;
+				}
+				else
+					branchTitle.SetLocalized(CFSTR("Switch Undo Branch"));
+
+				(void)SetMenuItemTextWithCFString(menu, index, branchTitle.GetCFStringRef());
+				enable = hist->BranchCount() > 0;
+			}
+			break;
+
 		//
 		// These items can be handled by the system
 		//	so just let them through here.
@@ -1544,6 +1572,13 @@ OSStatus FPApplication::HandleCommand(MenuCommand cid, MenuRef menu, MenuItemInd
 				ActiveHistory()->DoRedo();
 			break;
 
+		case kFPCommandSwitchBranch:
+			if (IsDialogFront())
+				err = eventNotHandledErr;
+			else
+				ActiveHistory()->DoSwitchBranch();
+			break;
+
 		case kHICommandCut:
 		case kHICommandCopy:
 		case kHICommandPaste:
@@ -2932,7 +2967,7 @@ void FPApplication::DoSetNoteModifier(SInt16 offset, bool undoable) {
 	if (!locked) {
 		if (undoable) {
 			event = StartUndo(UN_MODIFY, offset ? ( (offset < 0) ? CFSTR("Flatten Tone") : CFSTR("Sharpen Tone") ) : CFSTR("Natural Tone") );
-			event->SaveDataBefore(CFSTR("modifier"), oldModifier);
+			event->SaveDataBefore(kHistoryModifier, oldModifier);
 		}
 
 		globalChord.SetRoot(scalePalette->CurrentTone());
@@ -2941,7 +2976,7 @@ void FPApplication::DoSetNoteModifier(SInt16 offset, bool undoable) {
 		ReflectChordChanges();
 
 		if (undoable) {
-			event->SaveDataAfter(CFSTR("modifier"), offset);
+			event->SaveDataAfter(kHistoryModifier, offset);
 			event->Commit();
 		}
 	}
@@ -3024,7 +3059,7 @@ void FPApplication::DoSetGuitarTuning(const FPTuningInfo &t, bool undoable) {
 	if (undoable) {
 		event = StartUndo(UN_TUNING_CHANGE, CFSTR("Change Tuning"));
 		TDictionary *dict = guitarPalette->CurrentTuning().GetDictionary();
-		event->SaveDataBefore(CFSTR("tuning"), dict->GetDictionaryRef());
+		event->SaveDataBefore(kHistoryTuning, dict->GetDictionaryRef());
 		delete dict;
 	}
 
@@ -3035,7 +3070,7 @@ void FPApplication::DoSetGuitarTuning(const FPTuningInfo &t, bool undoable) {
 		if ( !undoable || wind->AskTuningChange() ) {
 			if (undoable) {
 				if (size > 0)
-					event->SaveGroupsBefore(0, size - 1);
+					event->SaveDeltaBefore(0, size - 1);
 				else
 					event->SaveCurrentBefore();
 			}
@@ -3065,7 +3100,7 @@ void FPApplication::DoSetGuitarTuning(const FPTuningInfo &t, bool undoable) {
 
 	if (doCommit) {
 		TDictionary *dict = t.GetDictionary();
-		event->SaveDataAfter(CFSTR("tuning"), dict->GetDictionaryRef());
+		event->SaveDataAfter(kHistoryTuning, dict->GetDictionaryRef());
 		delete dict;
 		event->Commit();
 	}
@@ -3281,6 +3316,10 @@ FPDocWindow* FPApplication::OpenDocument(const FSRef &fref) {
 			AddToRecentItems(*wind->document);
 			DoWindowActivated(wind);	// Do this before showing, because the scale must be set before drawing
 			wind->Show();
+
+			// Bring back edits that were lost in a crash
+			if (wind->history->RecoverJournal(*wind->document))
+				wind->UpdateScrollState();
 		}
 		else {
 			delete wind;
@@ -3930,9 +3969,9 @@ void FPApplication::DoSetMidiChannel(PartIndex part, UInt16 channel, bool undoab
 			FPHistoryEvent *event = StartUndo(UN_MIDI_CHANNEL, CFSTR("Change MIDI Channel"));
 			event->SetPartAgnostic();
 			event->SetMergeUnderInterim(30);
-			event->SaveDataBefore(CFSTR("part"), part);
-			event->SaveDataBefore(CFSTR("channel"), oldChannel);
-			event->SaveDataAfter(CFSTR("channel"), channel);
+			event->SaveDataBefore(kHistoryPart, part);
+			event->SaveDataBefore(kHistoryChannel, oldChannel);
+			event->SaveDataAfter(kHistoryChannel, channel);
 			event->Commit();
 		}
 	}
@@ -3977,9 +4016,9 @@ void FPApplication::DoSetInstrument(PartIndex part, UInt16 inTrueGM, bool undoab
 			FPHistoryEvent *event = StartUndo(UN_INSTRUMENT, CFSTR("Change Instrument"));
 			event->SetPartAgnostic();
 			event->SetMergeUnderInterim(30);
-			event->SaveDataBefore(CFSTR("part"), part);
-			event->SaveDataBefore(CFSTR("instrument"), oldTrueGM);
-			event->SaveDataAfter(CFSTR("instrument"), inTrueGM);
+			event->SaveDataBefore(kHistoryPart, part);
+			event->SaveDataBefore(kHistoryInstrument, oldTrueGM);
+			event->SaveDataAfter(kHistoryInstrument, inTrueGM);
 			event->Commit();
 		}
 	}
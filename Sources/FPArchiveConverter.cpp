@@ -0,0 +1,274 @@
+/*
+ *  FPArchiveConverter.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPArchiveConverter.h"
+
+#if !DEMO_ONLY
+
+#include "FPDocument.h"
+#include "FPClassicFormat.h"
+#include "TWorkGroup.h"
+
+#include <set>
+#include <fts.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define kDocumentExtension	".fret"
+
+
+FPArchiveConverter::FPArchiveConverter(const char *source, const char *dest, bool toBinary) {
+	sourceRoot	= source;
+	destRoot	= dest;
+	binary		= toBinary;
+	chunkStart	= 0;
+
+	// Relative paths are cut from the walked paths, so no trailing slash
+	while (sourceRoot.length() > 1 && sourceRoot[sourceRoot.length() - 1] == '/')
+		sourceRoot.erase(sourceRoot.length() - 1);
+
+	while (destRoot.length() > 1 && destRoot[destRoot.length() - 1] == '/')
+		destRoot.erase(destRoot.length() - 1);
+}
+
+
+/*!
+ * Run
+ *
+ *	Convert all the documents in the source folder, a
+ *	chunk at a time, and report the results in order.
+ *
+ *	Returns the first error encountered, if any.
+ */
+OSStatus FPArchiveConverter::Run(UInt16 maxThreads) {
+	OSStatus	err = Collect();
+	UInt32		total = itemList.size(), converted = 0;
+	double		seconds = 0;
+
+	if (err != noErr) {
+		fprintf(stderr, "FretPet: Can't read the folder \"%s\"\n", sourceRoot.c_str());
+		return err;
+	}
+
+	TWorkGroup group(ConvertJob, this);
+
+	for (chunkStart=0; chunkStart<total; chunkStart+=kConvertChunkSize) {
+		UInt32 chunkEnd = MIN(chunkStart + kConvertChunkSize, total);
+
+		// Document init uses the player and palettes, so create here
+		for (UInt32 i=chunkStart; i<chunkEnd; i++)
+			if (itemList[i].result == noErr)
+				itemList[i].doc = new FPDocument(NULL);
+
+		group.Run(chunkEnd - chunkStart, maxThreads);
+
+		for (UInt32 i=chunkStart; i<chunkEnd; i++) {
+			FPConvertItem &item = itemList[i];
+
+			if (item.result == noErr) {
+				fprintf(stdout, "OK\t%s\n", item.path.c_str());
+				converted++;
+			}
+			else {
+				fprintf(stdout, "failed (%ld)\t%s\n", (long)item.result, item.path.c_str());
+				if (err == noErr)
+					err = item.result;
+			}
+
+			fprintf(stderr, "%10.2f ms\t%s\n", item.seconds * 1000.0, item.path.c_str());
+			seconds += item.seconds;
+
+			delete item.doc;
+			item.doc = NULL;
+		}
+	}
+
+	fflush(stdout);
+	fprintf(stderr, "FretPet: Converted %lu of %lu documents (%.2f s of work)\n", (unsigned long)converted, (unsigned long)total, seconds);
+
+	return err;
+}
+
+
+//
+// CompareEntries
+//
+//	Visit files in byte order of their names, so the
+//	report comes out the same on every run.
+//
+static int CompareEntries(const FTSENT **a, const FTSENT **b) {
+	return strcmp((*a)->fts_name, (*b)->fts_name);
+}
+
+
+/*!
+ * Collect
+ *
+ *	Walk the source folder and list every document found.
+ *	Hidden files and folders are skipped, and so is the
+ *	destination folder if it's inside the source.
+ *
+ *	Two documents that would be written to the same path
+ *	are an error for the second one, so the output never
+ *	depends on which thread finishes first.
+ */
+OSStatus FPArchiveConverter::Collect() {
+	struct stat				destInfo;
+	bool					hasDest = (stat(destRoot.c_str(), &destInfo) == 0);
+	std::set<std::string>	destSet;
+	char					*roots[] = { (char*)sourceRoot.c_str(), NULL };
+
+	itemList.clear();
+
+	FTS *fts = fts_open(roots, FTS_PHYSICAL | FTS_NOCHDIR, CompareEntries);
+	if (fts == NULL)
+		return fnfErr;
+
+	FTSENT *ent;
+	while ((ent = fts_read(fts)) != NULL) {
+		switch (ent->fts_info) {
+			case FTS_D:
+				if (ent->fts_level > 0 && ent->fts_name[0] == '.')
+					(void)fts_set(fts, ent, FTS_SKIP);
+				else if (hasDest && ent->fts_statp->st_dev == destInfo.st_dev && ent->fts_statp->st_ino == destInfo.st_ino)
+					(void)fts_set(fts, ent, FTS_SKIP);
+				break;
+
+			case FTS_F:
+				if (ent->fts_name[0] != '.' && IsDocument(ent->fts_accpath, ent->fts_name)) {
+					FPConvertItem item;
+					item.path		= ent->fts_path + sourceRoot.length() + 1;
+					item.destPath	= item.path;
+					item.doc		= NULL;
+					item.result		= noErr;
+					item.seconds	= 0;
+
+					size_t extLength = strlen(kDocumentExtension);
+					if (item.path.length() <= extLength || strcasecmp(item.path.c_str() + item.path.length() - extLength, kDocumentExtension))
+						item.destPath += kDocumentExtension;
+
+					if (!destSet.insert(item.destPath).second)
+						item.result = dupFNErr;
+
+					itemList.push_back(item);
+				}
+				break;
+		}
+	}
+
+	fts_close(fts);
+
+	return noErr;
+}
+
+
+/*!
+ * IsDocument
+ *
+ *	Documents have the .fret extension, except for classic
+ *	files, which are known by the ID at the start.
+ */
+bool FPArchiveConverter::IsDocument(const char *path, const char *name) {
+	size_t nameLength = strlen(name), extLength = strlen(kDocumentExtension);
+
+	if (nameLength > extLength && !strcasecmp(name + nameLength - extLength, kDocumentExtension))
+		return true;
+
+	bool	isClassic = false;
+	int		fd = open(path, O_RDONLY);
+
+	if (fd >= 0) {
+		UInt32 fileType;
+		if (read(fd, &fileType, sizeof(fileType)) == sizeof(fileType))
+			isClassic = FPClassicParser::IsClassicType(EndianU32_BtoN(fileType));
+
+		close(fd);
+	}
+
+	return isClassic;
+}
+
+
+/*!
+ * ConvertJob
+ *
+ *	Worker entry point for a single file
+ */
+void FPArchiveConverter::ConvertJob(void *context, UInt32 index) {
+	FPArchiveConverter	*self = (FPArchiveConverter*)context;
+	FPConvertItem		&item = self->itemList[self->chunkStart + index];
+
+	if (item.doc != NULL)
+		item.result = self->Convert(item);
+}
+
+
+/*!
+ * Convert
+ *
+ *	Read one document and write it in the current format
+ */
+OSStatus FPArchiveConverter::Convert(FPConvertItem &item) const {
+	double		start = CFAbsoluteTimeGetCurrent();
+	std::string	source = sourceRoot + "/" + item.path,
+				dest = destRoot + "/" + item.destPath;
+	FPDocument	*doc = item.doc;
+
+	doc->Specify(source.c_str());
+
+	OSStatus err = doc->Exists() ? doc->InitFromFile() : fnfErr;
+	doc->Close();
+
+	if (err == noErr)
+		err = MakeFolders(dest);
+
+	// TFile can only specify a file that exists
+	if (err == noErr) {
+		int fd = open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			err = ioErr;
+		else
+			close(fd);
+	}
+
+	if (err == noErr) {
+		doc->Specify(dest.c_str());
+		err = doc->OpenWrite();
+	}
+
+	if (err == noErr)
+		err = binary ? doc->WriteBinaryFormat() : doc->WriteXMLFormat();
+
+	doc->Close();
+
+	item.seconds = CFAbsoluteTimeGetCurrent() - start;
+
+	return err;
+}
+
+
+/*!
+ * MakeFolders
+ *
+ *	Create the folders leading to a destination file.
+ *	Other workers may be creating the same folders.
+ */
+OSStatus FPArchiveConverter::MakeFolders(const std::string &path) const {
+	for (size_t slash = path.find('/', destRoot.length()); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+		std::string folder = path.substr(0, slash);
+
+		if (folder.length() && mkdir(folder.c_str(), 0755) != 0 && errno != EEXIST)
+			return ioErr;
+	}
+
+	return noErr;
+}
+
+#endif
@@ -0,0 +1,77 @@
+/*!
+ *	@file FPArchiveConverter.h
+ *
+ *	@brief Convert a folder of old documents to the current format
+ *
+ *	The converter walks a folder tree and converts every FretPet
+ *	document it finds into a second folder with the same layout.
+ *	Classic files are recognized by their file ID and others by
+ *	the .fret extension. Converted files always end in .fret.
+ *
+ *	Files are visited in sorted order and converted a chunk at a
+ *	time. Documents are created on the calling thread, since that
+ *	touches the player and palettes, then read and written in
+ *	parallel by a TWorkGroup. Each worker takes the next file as
+ *	soon as it's free, so a few large files don't hold up the rest.
+ *
+ *	The report on stdout lists every file in sorted order with its
+ *	result, so two runs over the same archive can be diffed. The
+ *	time spent on each file goes to stderr.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPARCHIVECONVERTER_H
+#define FPARCHIVECONVERTER_H
+
+#include <string>
+#include <vector>
+
+class FPDocument;
+
+#define kConvertChunkSize	256		//!< Documents in memory at once
+
+//! One file to convert
+typedef struct {
+	std::string		path;			//!< The path relative to the source folder
+	std::string		destPath;		//!< The path relative to the destination
+	FPDocument		*doc;			//!< The document while it's converted
+	OSStatus		result;			//!< The result of the conversion
+	double			seconds;		//!< Time spent reading and writing
+} FPConvertItem;
+
+typedef std::vector<FPConvertItem> FPConvertList;
+
+#pragma mark -
+//-----------------------------------------------
+//
+// FPArchiveConverter
+//
+class FPArchiveConverter {
+	private:
+		std::string			sourceRoot;		//!< The folder to convert
+		std::string			destRoot;		//!< The folder for converted files
+		bool				binary;			//!< Write the binary format
+		FPConvertList		itemList;		//!< Every file found, sorted
+		UInt32				chunkStart;		//!< The first item of the running chunk
+
+	public:
+		FPArchiveConverter(const char *source, const char *dest, bool toBinary);
+		~FPArchiveConverter() {}
+
+		OSStatus			Run(UInt16 maxThreads=0);
+
+	private:
+		OSStatus			Collect();
+		static bool			IsDocument(const char *path, const char *name);
+		OSStatus			Convert(FPConvertItem &item) const;
+		OSStatus			MakeFolders(const std::string &path) const;
+
+		static void			ConvertJob(void *context, UInt32 index);
+};
+
+#endif
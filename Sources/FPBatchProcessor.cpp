@@ -0,0 +1,414 @@
+/*
+ *  FPBatchProcessor.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPBatchProcessor.h"
+
+#include "FPDocument.h"
+#include "FPExportFile.h"
+#include "FPPreferences.h"
+#include "TWorkGroup.h"
+#include "TByteSink.h"
+#include "FPTabWriter.h"
+
+#define kBatchSeparators	",;\n"
+#define kBatchWhitespace	" \t"
+
+
+FPBatchProcessor::FPBatchProcessor() {
+	chunkStart	= 0;
+	format1		= false;
+}
+
+
+/*!
+ * ParseScript
+ *
+ *	Compile a script of comma-separated steps, such as
+ *	"load, transpose +2, harmonize up, export midi"
+ */
+bool FPBatchProcessor::ParseScript(const char *script) {
+	char	*copy = new char[strlen(script) + 1], *last;
+	bool	good = true;
+
+	strcpy(copy, script);
+	stepList.clear();
+
+	for (char *step = strtok_r(copy, kBatchSeparators, &last); good && step; step = strtok_r(NULL, kBatchSeparators, &last))
+		good = ParseStep(step);
+
+	delete [] copy;
+	return good;
+}
+
+
+/*!
+ * ParseStep
+ *
+ *	Add a single step to the list. Filters are folded
+ *	into the pipeline of the step before, if it has one.
+ */
+bool FPBatchProcessor::ParseStep(char *step) {
+	char	*last,
+			*word = strtok_r(step, kBatchWhitespace, &last),
+			*arg1 = word ? strtok_r(NULL, kBatchWhitespace, &last) : NULL,
+			*arg2 = arg1 ? strtok_r(NULL, kBatchWhitespace, &last) : NULL,
+			*arg3 = arg2 ? strtok_r(NULL, kBatchWhitespace, &last) : NULL;
+
+	if (word == NULL || !strcasecmp(word, "load") || !strcasecmp(word, "open"))
+		return true;
+
+	if (!strcasecmp(word, "transpose") && arg1)
+		AppendTransform(kTransformTranspose, atoi(arg1));
+
+	else if (!strcasecmp(word, "harmonize") && arg1) {
+		SInt16 steps;
+		if (!strcasecmp(arg1, "up"))
+			steps = 1;
+		else if (!strcasecmp(arg1, "down"))
+			steps = -1;
+		else
+			steps = atoi(arg1);
+
+		AppendTransform(kTransformHarmonize, steps);
+	}
+
+	else if (!strcasecmp(word, "invert"))
+		AppendTransform(kTransformInvertTones);
+
+	else if (!strcasecmp(word, "reverse") || !strcasecmp(word, "hflip"))
+		AppendTransform(kTransformReversePattern);
+
+	else if (!strcasecmp(word, "flip") || !strcasecmp(word, "vflip"))
+		AppendTransform(kTransformFlipPattern);
+
+	else if (!strcasecmp(word, "clone") && arg1 && atoi(arg1) > 1) {
+		FPBatchStep newStep;
+		newStep.type		= kBatchClone;
+		newStep.count		= atoi(arg1);
+		newStep.transpose	= arg2 ? NOTEMOD(atoi(arg2)) : 0;
+		newStep.harmonize	= 0;
+		if (arg3) ADD_MOD(newStep.harmonize, atoi(arg3), NUM_STEPS);
+		stepList.push_back(newStep);
+	}
+
+	else if (!strcasecmp(word, "save")) {
+		FPBatchStep newStep;
+
+		if (arg1 == NULL)
+			newStep.type = kBatchSave;
+		else if (!strcasecmp(arg1, "xml"))
+			newStep.type = kBatchSaveXML;
+		else if (!strcasecmp(arg1, "binary"))
+			newStep.type = kBatchSaveBinary;
+		else {
+			fprintf(stderr, "FretPet: Unknown save format \"%s\"\n", arg1);
+			return false;
+		}
+
+		stepList.push_back(newStep);
+	}
+
+#if !DEMO_ONLY
+	else if (!strcasecmp(word, "export") && arg1) {
+		FPBatchStep newStep;
+
+		if (!strcasecmp(arg1, "midi"))
+			newStep.type = kBatchExportMidi;
+		else if (!strcasecmp(arg1, "midi0"))
+			newStep.type = kBatchExportMidi0;
+		else if (!strcasecmp(arg1, "midi1"))
+			newStep.type = kBatchExportMidi1;
+		else if (!strcasecmp(arg1, "sunvox"))
+			newStep.type = kBatchExportSunvox;
+		else if (!strcasecmp(arg1, "wave") || !strcasecmp(arg1, "wav"))
+			newStep.type = kBatchExportWave;
+		else if (!strcasecmp(arg1, "tab"))
+			newStep.type = kBatchExportTab;
+		else if (!strcasecmp(arg1, "chart"))
+			newStep.type = kBatchExportChart;
+		else if (!strcasecmp(arg1, "musicxml"))
+			newStep.type = kBatchExportMusicXML;
+		else {
+			fprintf(stderr, "FretPet: Unknown export format \"%s\"\n", arg1);
+			return false;
+		}
+
+		stepList.push_back(newStep);
+	}
+#endif
+
+	else {
+		fprintf(stderr, "FretPet: Unknown batch step \"%s\"\n", word);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*!
+ * AppendTransform
+ */
+void FPBatchProcessor::AppendTransform(FPTransformType type, SInt16 amount) {
+	if (stepList.empty() || stepList.back().type != kBatchTransform) {
+		FPBatchStep newStep;
+		newStep.type = kBatchTransform;
+		stepList.push_back(newStep);
+	}
+
+	stepList.back().pipeline.Append(type, amount);
+}
+
+
+/*!
+ * Run
+ *
+ *	Process all the documents, a chunk at a time.
+ *	Results are reported in the same order as the files.
+ *
+ *	Returns the first error encountered, if any.
+ */
+OSStatus FPBatchProcessor::Run(int fileCount, char * const filePath[], UInt16 maxThreads) {
+	OSStatus	err = noErr;
+
+	jobList.resize(fileCount);
+	for (int i=0; i<fileCount; i++) {
+		jobList[i].path		= filePath[i];
+		jobList[i].doc		= NULL;
+		jobList[i].result	= fnfErr;
+	}
+
+	// Read the MIDI format preference once, up front
+	format1 = preferences.GetBoolean(kPrefFormat1, FALSE);
+
+	TWorkGroup group(ProcessJob, this);
+
+	for (chunkStart=0; chunkStart<(UInt32)fileCount; chunkStart+=kBatchChunkSize) {
+		UInt32 chunkEnd = MIN(chunkStart + kBatchChunkSize, (UInt32)fileCount);
+
+		for (UInt32 i=chunkStart; i<chunkEnd; i++)
+			Load(jobList[i]);
+
+		group.Run(chunkEnd - chunkStart, maxThreads);
+
+		for (UInt32 i=chunkStart; i<chunkEnd; i++) {
+			FPBatchJob &job = jobList[i];
+
+			if (job.result == noErr)
+				fprintf(stderr, "%s: OK\n", job.path);
+			else {
+				fprintf(stderr, "%s: failed (%ld)\n", job.path, (long)job.result);
+				if (err == noErr)
+					err = job.result;
+			}
+
+			delete job.doc;
+			job.doc = NULL;
+		}
+	}
+
+	jobList.clear();
+
+	return err;
+}
+
+
+/*!
+ * Load
+ *
+ *	Load one document for a job. Document init uses
+ *	the player and palettes, so this is only done on
+ *	the main thread.
+ */
+void FPBatchProcessor::Load(FPBatchJob &job) {
+	TFile file(job.path);
+
+	if (file.Exists()) {
+		job.doc = new FPDocument(NULL);
+		job.result = job.doc->InitFromFile(file.FileRef());
+		job.doc->Close();
+
+		if (job.result != noErr) {
+			delete job.doc;
+			job.doc = NULL;
+		}
+	}
+}
+
+
+/*!
+ * ProcessJob
+ *
+ *	Worker entry point for a single document
+ */
+void FPBatchProcessor::ProcessJob(void *context, UInt32 index) {
+	FPBatchProcessor	*self = (FPBatchProcessor*)context;
+	FPBatchJob			&job = self->jobList[self->chunkStart + index];
+
+	if (job.doc != NULL)
+		job.result = self->Process(job.doc);
+}
+
+
+/*!
+ * Process
+ *
+ *	Run all the steps on one document
+ */
+OSStatus FPBatchProcessor::Process(FPDocument *doc) const {
+	OSStatus	err = noErr;
+	PartMask	allParts = BIT(DOC_PARTS) - 1;
+
+	for (FPBatchStepList::const_iterator itr = stepList.begin(); err == noErr && itr != stepList.end(); itr++) {
+		switch (itr->type) {
+			case kBatchTransform:
+				if (doc->Size()) {
+					// Steps are shared by every thread, so finger with a copy
+					FPTransformPipeline pipeline(itr->pipeline);
+					pipeline.SetTuning(doc->Tuning().tone);
+					pipeline.SetScale(doc->ScaleMode());
+					pipeline.Commit(doc->ChordGroupArray(), 0, doc->Size() - 1, allParts);
+				}
+				break;
+
+			case kBatchClone:
+				if (doc->Size())
+					(void)doc->CloneGroups(0, doc->Size() - 1, itr->count, allParts, itr->transpose, itr->harmonize);
+				break;
+
+#if !DEMO_ONLY
+			case kBatchExportMidi:
+				err = WriteExport(doc, format1 ? doc->GetFormat1() : doc->GetFormat0(), CFSTR(".mid"));
+				break;
+
+			case kBatchExportMidi0:
+				err = WriteExport(doc, doc->GetFormat0(), CFSTR(".mid"));
+				break;
+
+			case kBatchExportMidi1:
+				err = WriteExport(doc, doc->GetFormat1(), CFSTR(".mid"));
+				break;
+
+			case kBatchExportSunvox:
+				err = WriteExport(doc, doc->GetSunvoxFormat(), CFSTR(".sunvox"));
+				break;
+
+			case kBatchExportWave:
+				err = WriteStreamExport(doc, itr->type, CFSTR(".wav"));
+				break;
+
+			case kBatchExportTab:
+				err = WriteStreamExport(doc, itr->type, CFSTR(".tab.txt"));
+				break;
+
+			case kBatchExportChart:
+				err = WriteStreamExport(doc, itr->type, CFSTR(".chart.txt"));
+				break;
+
+			case kBatchExportMusicXML:
+				err = WriteStreamExport(doc, itr->type, CFSTR(".musicxml"));
+				break;
+#endif
+
+			case kBatchSaveXML:
+			case kBatchSaveBinary:
+				doc->SetBinaryFormat(itr->type == kBatchSaveBinary);
+				// fall through
+
+			case kBatchSave:
+				err = doc->OpenAndSave();
+				doc->Close();
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	return err;
+}
+
+
+/*!
+ * WriteExport
+ *
+ *	Write exported data next to the document,
+ *	replacing the document's extension.
+ */
+OSStatus FPBatchProcessor::WriteExport(FPDocument *doc, Handle data, CFStringRef extension) const {
+	if (data == NULL)
+		return memFullErr;
+
+	CFStringRef	baseName = CFStringTrimExtension(doc->BaseName());
+	CFStringRef	fileName = CFStringCreateWithFormat(kCFAllocatorDefault, NULL, CFSTR("%@%@"), baseName, extension);
+
+	TFile		outFile;
+	OSStatus	err = outFile.CreateSibling(*doc, fileName);
+
+	if (err == noErr)
+		err = outFile.OpenWrite();
+
+	if (err == noErr)
+		err = outFile.Write(*data, GetHandleSize(data));
+
+	outFile.Close();
+
+	DisposeHandle(data);
+	CFRELEASE(fileName);
+	CFRELEASE(baseName);
+
+	return err;
+}
+
+
+/*!
+ * WriteStreamExport
+ *
+ *	Write an export next to the document, streaming it
+ *	to the file as it's made, for exports that can be
+ *	much larger than the document.
+ */
+OSStatus FPBatchProcessor::WriteStreamExport(FPDocument *doc, FPBatchStepType type, CFStringRef extension) const {
+	CFStringRef	baseName = CFStringTrimExtension(doc->BaseName());
+	CFStringRef	fileName = CFStringCreateWithFormat(kCFAllocatorDefault, NULL, CFSTR("%@%@"), baseName, extension);
+
+	TFile		outFile;
+	OSStatus	err = outFile.CreateSibling(*doc, fileName);
+
+	if (err == noErr)
+		err = outFile.OpenWrite();
+
+	if (err == noErr) {
+		TByteSink sink(outFile);
+
+		switch (type) {
+			case kBatchExportWave:
+				err = doc->WriteWaveFormat(sink);
+				break;
+
+			case kBatchExportMusicXML:
+				err = doc->WriteMusicXML(sink);
+				break;
+
+			default:
+				err = doc->WriteTablature(sink, (type == kBatchExportTab) ? kTabStyleTablature : kTabStyleChart);
+				break;
+		}
+
+		if (err == noErr)
+			err = sink.Finish();
+	}
+
+	outFile.Close();
+
+	CFRELEASE(fileName);
+	CFRELEASE(baseName);
+
+	return err;
+}
+
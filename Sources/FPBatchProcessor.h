@@ -0,0 +1,104 @@
+/*!
+ *	@file FPBatchProcessor.h
+ *
+ *	@brief Apply a script of filters and exports to many documents
+ *
+ *	The batch processor works on documents that have no window.
+ *	A script like "transpose +2, harmonize up, export midi" is
+ *	compiled once into a list of steps. Runs of filters become a
+ *	single FPTransformPipeline, so they are fused before any
+ *	document is touched.
+ *
+ *	Documents are handled a chunk at a time. Each chunk is loaded
+ *	on the calling thread, then filtered, exported and saved in
+ *	parallel using a TWorkGroup, then released. Each document is
+ *	only ever handled by one thread. Filters and clones only use
+ *	the document's own scale and tuning, so workers never look at
+ *	the player, and the palettes are only read while the calling
+ *	thread waits for the chunk.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPBATCHPROCESSOR_H
+#define FPBATCHPROCESSOR_H
+
+#include "FPTransformPipeline.h"
+#include <vector>
+
+class FPDocument;
+
+//! The kinds of batch steps
+enum FPBatchStepType {
+	kBatchTransform,				//!< Apply a transform pipeline to all chords
+	kBatchClone,					//!< Clone the whole document
+	kBatchExportMidi,				//!< Export MIDI using the format preference
+	kBatchExportMidi0,				//!< Export a Format 0 MIDI file
+	kBatchExportMidi1,				//!< Export a Format 1 MIDI file
+	kBatchExportSunvox,				//!< Export a Sunvox file
+	kBatchExportWave,				//!< Render to a WAV file
+	kBatchExportTab,				//!< Write text tablature
+	kBatchExportChart,				//!< Write a text chord chart
+	kBatchExportMusicXML,			//!< Write a MusicXML score
+	kBatchSave,						//!< Save the document in place
+	kBatchSaveXML,					//!< Save in place as XML
+	kBatchSaveBinary				//!< Save in place in the binary format
+};
+
+//! One step in a batch script
+typedef struct {
+	FPBatchStepType		type;		//!< The kind of step
+	FPTransformPipeline	pipeline;	//!< Transforms for kBatchTransform
+	ChordIndex			count;		//!< Copies for kBatchClone
+	SInt16				transpose;	//!< Transpose per clone
+	SInt16				harmonize;	//!< Harmonize per clone
+} FPBatchStep;
+
+typedef std::vector<FPBatchStep> FPBatchStepList;
+
+#define kBatchChunkSize		256		//!< Documents in memory at once
+
+//! One document in a batch
+typedef struct {
+	const char			*path;		//!< The path given for the file
+	FPDocument			*doc;		//!< The document while it's processed
+	OSStatus			result;		//!< The result of processing
+} FPBatchJob;
+
+typedef std::vector<FPBatchJob> FPBatchJobList;
+
+#pragma mark -
+//-----------------------------------------------
+//
+// FPBatchProcessor
+//
+class FPBatchProcessor {
+	private:
+		FPBatchStepList		stepList;
+		FPBatchJobList		jobList;
+		UInt32				chunkStart;		//!< The first job of the running chunk
+		bool				format1;		//!< The MIDI format preference, read up front
+
+	public:
+		FPBatchProcessor();
+		~FPBatchProcessor() {}
+
+		bool				ParseScript(const char *script);
+		bool				ParseStep(char *step);
+		OSStatus			Run(int fileCount, char * const filePath[], UInt16 maxThreads=0);
+
+	private:
+		void				AppendTransform(FPTransformType type, SInt16 amount=0);
+		void				Load(FPBatchJob &job);
+		OSStatus			Process(FPDocument *doc) const;
+		OSStatus			WriteExport(FPDocument *doc, Handle data, CFStringRef extension) const;
+		OSStatus			WriteStreamExport(FPDocument *doc, FPBatchStepType type, CFStringRef extension) const;
+
+		static void			ProcessJob(void *context, UInt32 index);
+};
+
+#endif
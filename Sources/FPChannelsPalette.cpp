@@ -228,10 +228,10 @@ bool FPVelocityDragger::MouseWheelMoved(SInt16 delta, SInt16 deltaX) {
 	if (oldVal != Value()) {
 		event = fretpet->StartUndo(UN_VELOCITY, CFSTR("Velocity Change"));
 		event->SetPartAgnostic();
-		event->SaveDataBefore(CFSTR("part"), partIndex);
-		event->SaveDataBefore(CFSTR("velocity"), oldVal);
+		event->SaveDataBefore(kHistoryPart, partIndex);
+		event->SaveDataBefore(kHistoryVelocity, oldVal);
 		event->SetMergeUnderInterim(30);
-		event->SaveDataAfter(CFSTR("velocity"), Value());
+		event->SaveDataAfter(kHistoryVelocity, Value());
 		event->Commit();
 	}
 
@@ -242,14 +242,14 @@ bool FPVelocityDragger::MouseWheelMoved(SInt16 delta, SInt16 deltaX) {
 void FPVelocityDragger::DoMouseDown() {
 	event = fretpet->StartUndo(UN_VELOCITY, CFSTR("Velocity Change"));
 	event->SetPartAgnostic();
-	event->SaveDataBefore(CFSTR("part"), partIndex);
-	event->SaveDataBefore(CFSTR("velocity"), Value());
+	event->SaveDataBefore(kHistoryPart, partIndex);
+	event->SaveDataBefore(kHistoryVelocity, Value());
 }
 
 
 void FPVelocityDragger::DoMouseUp() {
-	if (event->GetDataBefore(CFSTR("velocity")) != Value()) {
-		event->SaveDataAfter(CFSTR("velocity"), Value());
+	if (event->GetDataBefore(kHistoryVelocity) != Value()) {
+		event->SaveDataAfter(kHistoryVelocity, Value());
 		event->Commit();
 	}
 }
@@ -288,10 +288,10 @@ bool FPSustainDragger::MouseWheelMoved(SInt16 delta, SInt16 deltaX) {
 	if (oldVal != Value()) {
 		event = fretpet->StartUndo(UN_SUSTAIN, CFSTR("Sustain Change"));
 		event->SetPartAgnostic();
-		event->SaveDataBefore(CFSTR("part"), partIndex);
-		event->SaveDataBefore(CFSTR("sustain"), oldVal);
+		event->SaveDataBefore(kHistoryPart, partIndex);
+		event->SaveDataBefore(kHistorySustain, oldVal);
 		event->SetMergeUnderInterim(30);
-		event->SaveDataAfter(CFSTR("sustain"), Value());
+		event->SaveDataAfter(kHistorySustain, Value());
 		event->Commit();
 	}
 
@@ -302,14 +302,14 @@ bool FPSustainDragger::MouseWheelMoved(SInt16 delta, SInt16 deltaX) {
 void FPSustainDragger::DoMouseDown() {
 	event = fretpet->StartUndo(UN_SUSTAIN, CFSTR("Sustain Change"));
 	event->SetPartAgnostic();
-	event->SaveDataBefore(CFSTR("part"), partIndex);
-	event->SaveDataBefore(CFSTR("sustain"), Value());
+	event->SaveDataBefore(kHistoryPart, partIndex);
+	event->SaveDataBefore(kHistorySustain, Value());
 }
 
 
 void FPSustainDragger::DoMouseUp() {
-	if (event->GetDataBefore(CFSTR("sustain")) != Value()) {
-		event->SaveDataAfter(CFSTR("sustain"), Value());
+	if (event->GetDataBefore(kHistorySustain) != Value()) {
+		event->SaveDataAfter(kHistorySustain, Value());
 		event->Commit();
 	}
 }
@@ -8,6 +8,8 @@
 
 #include "FPChord.h"
 
+#if !FP_PORTABLE
+
 #include "FPGuitarPalette.h"
 #include "FPScalePalette.h"
 #include "FPApplication.h"
@@ -15,8 +17,18 @@
 
 #include "TFile.h"
 #include "TDictionary.h"
+#include "TPlistStream.h"
 #include "TString.h"
 
+#include <pthread.h>
+
+//
+// ChordName returns a static buffer
+//
+static pthread_mutex_t	chordNameMutex = PTHREAD_MUTEX_INITIALIZER;
+
+#endif
+
 FPChord globalChord;
 
 #define kPrefDefaultSeq		CFSTR("defaultSequence")
@@ -74,6 +86,8 @@ FPChord::FPChord(const OldChordInfo &info) {
 }
 
 
+#if !FP_PORTABLE
+
 FPChord::FPChord(const TDictionary &inDict, UInt16 b, UInt16 r) {
 	key				= inDict.GetInteger(kStoredKey);
 	root			= inDict.GetInteger(kStoredRoot);
@@ -103,23 +117,31 @@ FPChord::FPChord(const TDictionary &inDict, UInt16 b, UInt16 r) {
 		pick[p] = pick32[p];
 }
 
+#endif
 
+
+//
+// Set
+//
+//	Set from a chord record that's already in native
+//	byte order. See FPClassicParser::SwapChords.
+//
 void FPChord::Set(const OldChordInfo &info) {
-	tones		= EndianU16_BtoN(info.tones);
-	key			= EndianU16_BtoN(info.key);
-	root		= EndianU16_BtoN(info.root);
+	tones		= info.tones;
+	key			= info.key;
+	root		= info.root;
 	rootLock	= info.rootLock;
 
 	bracketFlag	= info.bracketFlag;
-	brakLow		= EndianU16_BtoN(info.brakLow);
-	brakHi		= EndianU16_BtoN(info.brakHi);
+	brakLow		= info.brakLow;
+	brakHi		= info.brakHi;
 
-	beats		= EndianU16_BtoN(info.beats);
-	repeat		= EndianU16_BtoN(info.repeat);
+	beats		= info.beats;
+	repeat		= info.repeat;
 
 	for (int s=NUM_STRINGS; s--;) {
-		fretHeld[s] = EndianS16_BtoN(info.fretHeld[s]);
-		pick[s] = EndianU16_BtoN(info.pick[s]);
+		fretHeld[s] = info.fretHeld[s];
+		pick[s] = info.pick[s];
 	}
 
 	ResetStepInfo();
@@ -163,6 +185,61 @@ int FPChord::operator==(const FPChord &inChord) const {
 }
 
 
+//
+// IsIdentical
+//
+// The == operator only compares what's heard and seen in
+// the sequencer. This compares every field, for anything
+// that shares one copy of a chord in place of another.
+//
+bool FPChord::IsIdentical(const FPChord &inChord) const {
+	if (this != &inChord) {
+		if (*this != inChord
+			|| repeat != inChord.repeat
+			|| rootLock != inChord.rootLock
+			|| rootModifier != inChord.rootModifier
+			|| rootScaleStep != inChord.rootScaleStep
+			|| bracketFlag != inChord.bracketFlag
+			|| brakLow != inChord.brakLow
+			|| brakHi != inChord.brakHi)
+			return false;
+	}
+
+	return true;
+}
+
+
+//
+// Hash
+//
+// An FNV-1a hash of every field that IsIdentical compares
+//
+#define FNV_PRIME	16777619U
+#define FNV_MIX(h,v)	h = (h ^ (UInt16)(v)) * FNV_PRIME
+
+UInt32 FPChord::Hash(UInt32 seed) const {
+	UInt32 h = seed;
+
+	FNV_MIX(h, tones);
+	FNV_MIX(h, root);
+	FNV_MIX(h, key);
+	FNV_MIX(h, rootModifier);
+	FNV_MIX(h, rootScaleStep);
+	FNV_MIX(h, brakLow);
+	FNV_MIX(h, brakHi);
+	FNV_MIX(h, (rootLock ? 1 : 0) | (bracketFlag ? 2 : 0));
+	FNV_MIX(h, beats);
+	FNV_MIX(h, repeat);
+
+	for (int s=NUM_STRINGS; s--;) {
+		FNV_MIX(h, fretHeld[s]);
+		FNV_MIX(h, pick[s]);
+	}
+
+	return h;
+}
+
+
 //
 // Init
 //
@@ -189,6 +266,8 @@ void FPChord::Init() {
 }
 
 
+#if !FP_PORTABLE
+
 void FPChord::ChordName(TString &n, TString &e, TString &m, bool bRoman) const {
 	Str31	name, ext, miss;
 	ChordName(Root(), name, ext, miss, bRoman);
@@ -199,6 +278,21 @@ void FPChord::ChordName(TString &n, TString &e, TString &m, bool bRoman) const {
 }
 
 
+/*!
+ * CopyChordName
+ *
+ *	Copy the chord's name into a buffer of your own.
+ *	Exporters call this from several threads at once.
+ */
+void FPChord::CopyChordName(char *outName, UInt16 size, bool bRoman) const {
+	pthread_mutex_lock(&chordNameMutex);
+	strncpy(outName, ChordName(root, bRoman), size - 1);
+	pthread_mutex_unlock(&chordNameMutex);
+
+	outName[size - 1] = '\0';
+}
+
+
 void FPChord::ChordName(UInt16 inRoot, StringPtr outName, StringPtr outExtend, StringPtr outMissing, bool bRoman) const {
 	char		*string1, *string2, *string3;
 
@@ -1002,7 +1096,7 @@ FatChord FPChord::TwoOctaveChord() const {
 		} else if (NOTBITS(B_MAJ3|B_PER5|B_MAJ7|B_PER9) && HASBITS(HAD11_CHORD)) {									// ø11
 			MOVEBITS(B_FLA9|B_PER9|B_DOM11);
 
-#pragma mark 9♯11 CHORDS (6 TONES - 1 3 5 7 9 #11)
+#pragma mark 9#11 CHORDS (6 TONES - 1 3 5 7 9 #11)
 
 		} else if (HASBITS(MAJ9_CHORD|B_SH11)) {																	// ∆9♯11
 			MOVEBITS(B_FLA9|B_PER9|B_AUG9|B_SH11);
@@ -1013,7 +1107,7 @@ FatChord FPChord::TwoOctaveChord() const {
 		} else if (HASBITS(AUGMAJ7_CHORD|B_FLA9|B_SH11)) {															// ∆7♭9♯11+
 			MOVEBITS(B_FLA9|B_PER9|B_AUG9|B_SH11);
 
-#pragma mark MINOR 9♭6 CHORDS (6 TONES - 1 3 5 ♭6 7 9)
+#pragma mark MINOR 9b6 CHORDS (6 TONES - 1 3 5 b6 7 9)
 
 		} else if (!hasMajThird && HASBITS(MIN9_CHORD|B_MIN6)) {													// m9♭6
 			MOVEBITS(B_FLA9|B_PER9);
@@ -1074,7 +1168,7 @@ FatChord FPChord::TwoOctaveChord() const {
 		} else if (NOTBITS(B_PER5|B_PER9) && HASBITS(DIM5_TRIAD|B_MAJ7|B_MAJ6|B_FLA9)) {							// ∆7/6/♭9-
 			MOVEBITS(B_FLA9|B_PER9|B_AUG9|B_DOM11);
 
-#pragma mark 7 FLAT 9 CHORDS (5 TONES - 1 3 5 7 ♭9)
+#pragma mark 7 FLAT 9 CHORDS (5 TONES - 1 3 5 7 b9)
 
 		} else if (NOTBITS(B_PER9) && HASBITS(DOM7_CHORD|B_FLA9)) {													// 7♭9
 			MOVEBITS(B_FLA9|B_PER9|B_AUG9|B_DOM11|B_DOM13);
@@ -1552,18 +1646,29 @@ char* FPChord::ChordToneFunctions() const {
 
 
 void FPChord::UpdateStepInfo() {
+	UpdateStepInfo(scalePalette->CurrentMode());
+}
+
+
+//
+// UpdateStepInfo
+//
+//	Find the root's step in the given scale mode. This only
+//	reads the fixed scale tables, so it's safe on any thread.
+//
+void FPChord::UpdateStepInfo(UInt16 mode) {
 	static FPScalePalette &scale = *scalePalette;
-	SInt16 rs = scale.FunctionOfTone(key, root);
+	SInt16 rs = scale.FunctionOfTone(mode, key, root);
 
 	if (rs >= 0)
 		rootModifier = 0;
 	else {
-		rs = scale.FunctionOfTone(key, root + 1);
+		rs = scale.FunctionOfTone(mode, key, root + 1);
 
 		if (rs >= 0)
 			rootModifier = -1;
 		else {
-			rs = scale.FunctionOfTone(key, root - 1);
+			rs = scale.FunctionOfTone(mode, key, root - 1);
 			rootModifier = 1;
 		}
 	}
@@ -1573,8 +1678,13 @@ void FPChord::UpdateStepInfo() {
 
 
 void FPChord::HarmonizeBy(const SInt16 steps) {
+	HarmonizeBy(steps, scalePalette->CurrentMode());
+}
+
+
+void FPChord::HarmonizeBy(const SInt16 steps, UInt16 mode) {
 	if ( RootNeedsScaleInfo() )
-		UpdateStepInfo();
+		UpdateStepInfo(mode);
 
 	ADD_MOD(rootScaleStep, steps, NUM_STEPS);
 
@@ -1583,7 +1693,7 @@ void FPChord::HarmonizeBy(const SInt16 steps) {
 		rootModifier = 0;
 	}
 
-	UInt16	mask = scalePalette->MaskForKey(key),
+	UInt16	mask = scalePalette->MaskForMode(mode, key),
 			d = (steps < 0) ? OCTAVE-1 : 1,
 			asteps = ABS(steps),
 			j;
@@ -1747,7 +1857,12 @@ bool FPChord::CanReversePattern() const {
 
 
 void FPChord::InvertTones() {
-	tones ^= scalePalette->MaskForKey(key);
+	InvertTones(scalePalette->CurrentMode());
+}
+
+
+void FPChord::InvertTones(UInt16 mode) {
+	tones ^= scalePalette->MaskForMode(mode, key);
 }
 
 
@@ -1827,6 +1942,64 @@ void FPChord::NewFingering() {
 }
 
 
+//
+// NewFingering
+//
+//	Calculate a new fingering for a given tuning and fret
+//	count. Each tone goes on the highest fret it can in the
+//	bracket, or an open string if nothing else has it.
+//
+void FPChord::NewFingering(const SInt32 openTone[NUM_STRINGS], UInt16 frets) {
+	UInt16	fingeredChord = 0;
+	SInt16	fret, string, tone, open, bit;
+	SInt16	bestFret;
+	bool	noTone;
+
+	for (string=0; string<NUM_STRINGS; string++) {
+		if (bracketFlag) {
+			open = NOTEMOD(openTone[string]);
+			tone = NOTEMOD(open + frets);
+
+			noTone = true;
+			bestFret = -1;
+
+			for (fret = frets; fret >= -1 ; fret--) {
+				if (fret >= 0) {
+					bit = BIT(tone);
+
+					if (tones & bit) {
+						if (noTone && fret >= brakLow && fret <= brakHi) {
+							if (fingeredChord & bit)
+								bestFret = fret;
+							else {
+								noTone = false;
+								fingeredChord |= bit;
+								fretHeld[string] = fret;
+							}
+						}
+					}
+
+					DEC_WRAP(tone, OCTAVE);
+				}
+				else if (noTone) {
+					if (bestFret < 0) {
+						bit = BIT(open);
+						if (tones & bit) {
+							fingeredChord |= bit;
+							bestFret = 0;
+						}
+					}
+
+					fretHeld[string] = bestFret;
+				}
+			}
+		}
+		else
+			fretHeld[string] = -1;
+	}
+}
+
+
 OSErr FPChord::Write(TFile* const file) const {
 	return file->Write(this, sizeof(this));
 }
@@ -1891,6 +2064,90 @@ TDictionary* FPChord::GetDictionary() const {
 }
 
 
+//
+// WriteXML
+//
+//	Stream the chord with the same keys as GetDictionary
+//
+void FPChord::WriteXML(TPlistWriter &writer) const {
+	writer.BeginDictionary();
+	writer.SetInteger(kStoredTones, tones);
+	writer.SetInteger(kStoredRoot, root);
+	writer.SetInteger(kStoredKey, key);
+	writer.SetBool(kStoredLock, rootLock);
+	writer.SetBool(kStoredBracketFlag, bracketFlag);
+	writer.SetInteger(kStoredBracketLo, brakLow);
+	writer.SetInteger(kStoredBracketHi, brakHi);
+	writer.SetInteger(kStoredRootStep, rootScaleStep);
+	writer.SetInteger(kStoredRootModifier, rootModifier);
+
+	SInt32 held32[NUM_STRINGS];
+	for (int s=NUM_STRINGS; s--;)
+		held32[s] = fretHeld[s];
+
+	writer.SetIntArray(kStoredFingering, held32, NUM_STRINGS);
+
+	SInt32 pick32[NUM_STRINGS];
+	for (int s=NUM_STRINGS; s--;)
+		pick32[s] = pick[s];
+
+	writer.SetIntArray(kStoredPattern, pick32, NUM_STRINGS);
+	writer.EndDictionary();
+}
+
+
+//
+// ReadXML
+//
+//	Read a chord dictionary whose <dict> was just read,
+//	with the same defaults as the TDictionary constructor.
+//	The caller sets the beats and repeat.
+//
+bool FPChord::ReadXML(TPlistReader &reader) {
+	Init();
+	key = root = tones = brakLow = brakHi = 0;
+	rootScaleStep = rootModifier = kUndefinedRootValue;
+	rootLock = bracketFlag = false;
+
+	while (reader.Next() == kPlistKey) {
+		if (reader.IsKey(kStoredKey))
+			key = reader.NextInteger();
+		else if (reader.IsKey(kStoredRoot))
+			root = reader.NextInteger();
+		else if (reader.IsKey(kStoredRootStep))
+			rootScaleStep = reader.NextInteger(kUndefinedRootValue);
+		else if (reader.IsKey(kStoredRootModifier))
+			rootModifier = reader.NextInteger(kUndefinedRootValue);
+		else if (reader.IsKey(kStoredLock))
+			rootLock = reader.NextBool();
+		else if (reader.IsKey(kStoredTones))
+			tones = reader.NextInteger();
+		else if (reader.IsKey(kStoredBracketFlag))
+			bracketFlag = reader.NextBool();
+		else if (reader.IsKey(kStoredBracketLo))
+			brakLow = reader.NextInteger();
+		else if (reader.IsKey(kStoredBracketHi))
+			brakHi = reader.NextInteger();
+		else if (reader.IsKey(kStoredFingering)) {
+			SInt32 held32[NUM_STRINGS];
+			for (UInt16 s=reader.NextIntArray(held32, NUM_STRINGS); s--;)
+				fretHeld[s] = held32[s];
+		}
+		else if (reader.IsKey(kStoredPattern)) {
+			SInt32 pick32[NUM_STRINGS];
+			for (UInt16 s=reader.NextIntArray(pick32, NUM_STRINGS); s--;)
+				pick[s] = pick32[s];
+		}
+		else
+			(void)reader.SkipNext();
+	}
+
+	return reader.Token() == kPlistDictEnd;
+}
+
+#endif
+
+
 #pragma mark -
 FPChordGroup::FPChordGroup(const FPChord &chord) {
 	for (PartIndex p=DOC_PARTS; p--;)
@@ -1903,6 +2160,8 @@ FPChordGroup::FPChordGroup(const FPChordGroup &group) {
 }
 
 
+#if !FP_PORTABLE
+
 FPChordGroup::FPChordGroup(const TDictionary &inDict) {
 	UInt16 b = inDict.GetInteger(kStoredGroupBeats);
 	UInt16 r = inDict.GetInteger(kStoredGroupRepeat);
@@ -1956,6 +2215,8 @@ void FPChordGroup::StretchPattern(bool latter) {
 		chordList[p].StretchPattern(latter);
 }
 
+#endif
+
 
 int FPChordGroup::operator==(const FPChordGroup &inGroup) const {
 	for (PartIndex p=DOC_PARTS; p--;)
@@ -1966,6 +2227,27 @@ int FPChordGroup::operator==(const FPChordGroup &inGroup) const {
 }
 
 
+bool FPChordGroup::IsIdentical(const FPChordGroup &inGroup) const {
+	for (PartIndex p=DOC_PARTS; p--;)
+		if (!chordList[p].IsIdentical(inGroup[p]))
+			return false;
+
+	return true;
+}
+
+
+UInt32 FPChordGroup::Hash() const {
+	UInt32 h = 2166136261U;		// FNV offset basis
+
+	for (PartIndex p=0; p<DOC_PARTS; p++)
+		h = chordList[p].Hash(h);
+
+	return h;
+}
+
+
+#if !FP_PORTABLE
+
 TDictionary* FPChordGroup::GetDictionary() const {
 	TDictionary		*partDictList[DOC_PARTS];
 	CFDictionaryRef	partDictRef[DOC_PARTS];
@@ -1995,6 +2277,63 @@ TDictionary* FPChordGroup::GetDictionary() const {
 }
 
 
+void FPChordGroup::WriteXML(TPlistWriter &writer) const {
+	writer.BeginDictionary();
+	writer.SetInteger(kStoredGroupBeats, PatternSize());
+	writer.SetInteger(kStoredGroupRepeat, Repeat());
+
+	writer.BeginArray(kStoredGroup);
+	for (PartIndex p=0; p<DOC_PARTS; p++)
+		chordList[p].WriteXML(writer);
+	writer.EndArray();
+
+	writer.EndDictionary();
+}
+
+
+//
+// ReadXML
+//
+//	Read a group dictionary whose <dict> was just read.
+//	The beats and repeat may come after the chords.
+//
+bool FPChordGroup::ReadXML(TPlistReader &reader) {
+	UInt16 b = 0, r = 0;
+
+	while (reader.Next() == kPlistKey) {
+		if (reader.IsKey(kStoredGroupBeats))
+			b = reader.NextInteger();
+		else if (reader.IsKey(kStoredGroupRepeat))
+			r = reader.NextInteger();
+		else if (reader.IsKey(kStoredGroup)) {
+			if (reader.Next() != kPlistArrayBegin) {
+				(void)reader.Skip();
+				continue;
+			}
+
+			for (PartIndex p=0; reader.Next() == kPlistDictBegin; p++) {
+				if (p < DOC_PARTS ? !chordList[p].ReadXML(reader) : !reader.Skip())
+					return false;
+			}
+
+			if (reader.Token() != kPlistArrayEnd)
+				return false;
+		}
+		else
+			(void)reader.SkipNext();
+	}
+
+	if (reader.Token() != kPlistDictEnd)
+		return false;
+
+	SetPatternSize(b);
+	SetRepeat(r);
+	return true;
+}
+
+#endif
+
+
 #pragma mark -
 void FPChordGroupArray::InsertCopyBefore(ChordIndex index, const FPChord &chord) {
 	const FPChordGroup group(chord);
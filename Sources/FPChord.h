@@ -25,6 +25,8 @@
 
 class TFile;
 class TDictionary;
+class TPlistWriter;
+class TPlistReader;
 class FPChord;
 class TString;
 class FPChordGroup;
@@ -34,7 +36,7 @@ class FPChordGroup;
 
 /*!	The struct that represents chords in FretPet Classic.
 	These are still needed to read and write FretPet Classic
-	document files.
+	document files. In files they're big-endian.
 */
 typedef struct {
 	UInt16		tones;				//!< The chord's tones as a bitmask
@@ -98,6 +100,8 @@ class FPChord {
 //		FPChord&		operator=(const FPChord &src);
 		int				operator==(const FPChord &inChord) const;
 		int				operator!=(const FPChord &inChord) const	{ return !(*this == inChord); }
+		bool			IsIdentical(const FPChord &inChord) const;
+		UInt32			Hash(UInt32 seed) const;
 
 		void			Init();
 		inline FPChord* Clone() const						{ return new FPChord(*this); }
@@ -120,9 +124,11 @@ class FPChord {
 		inline SInt16	RootModifier() const				{ return rootModifier; }
 		inline UInt16	RootScaleStep() const				{ return rootScaleStep; }
 		void			UpdateStepInfo();
+		void			UpdateStepInfo(UInt16 mode);
 
 		// Harmonize and Transpose
 		void			HarmonizeBy(const SInt16 steps);
+		void			HarmonizeBy(const SInt16 steps, UInt16 mode);
 		inline void		HarmonizeUp()						{ HarmonizeBy(1); }
 		inline void		HarmonizeDown()						{ HarmonizeBy(-1); }
 
@@ -184,19 +190,24 @@ class FPChord {
 		void			ChordName(TString &n, TString &e, TString &m, bool bRoman=false) const;
 
 		void			ChordName(UInt16 r, StringPtr n, StringPtr e, StringPtr m, bool bRoman=false) const;
+		void			CopyChordName(char *outName, UInt16 size, bool bRoman=false) const;
 		char*			ChordToneFunctions() const;
 		FatChord		TwoOctaveChord() const;
 
 		OSErr			Write(TFile* const file) const;
 		OSErr			WriteOldStyle(TFile* const file) const;
 		TDictionary*	GetDictionary() const;
+		void			WriteXML(TPlistWriter &writer) const;
+		bool			ReadXML(TPlistReader &reader);
 
 		// Selection Operations
 		void			FlipPattern();
 		void			ReversePattern();
 		void			InvertTones();
+		void			InvertTones(UInt16 mode);
 		void			CleanupTones();
 		void			NewFingering();
+		void			NewFingering(const SInt32 openTone[NUM_STRINGS], UInt16 frets);
 
 		bool			CanFlipPattern() const;
 		bool			CanReversePattern() const;
@@ -229,6 +240,8 @@ class FPChordGroup {
 		FPChord&		operator[](unsigned i)				{ return chordList[i]; }
 		int				operator==(const FPChordGroup &inGroup) const;
 		int				operator!=(const FPChordGroup &inGroup) const	{ return !(*this == inGroup); }
+		bool			IsIdentical(const FPChordGroup &inGroup) const;
+		UInt32			Hash() const;
 
 		bool			HasPattern(bool anyChord=false) const;
 		bool			HasFingering() const;
@@ -242,6 +255,8 @@ class FPChordGroup {
 
 		OSErr			Write(UInt16 format);
 		TDictionary*	GetDictionary() const;
+		void			WriteXML(TPlistWriter &writer) const;
+		bool			ReadXML(TPlistReader &reader);
 };
 
 
@@ -0,0 +1,187 @@
+/*
+ *  FPChordDelta.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPChordDelta.h"
+
+
+void FPChordDelta::Clear() {
+	diffList.clear();
+	valueList.clear();
+	rangeSize = 0;
+}
+
+
+/*!
+ * Record
+ *
+ *	Compare a copy of some groups with the same groups
+ *	after an edit, keeping only the fields that changed.
+ *	The edit must not have changed the number of groups.
+ */
+void FPChordDelta::Record(const FPChordGroupArray &before, const FPChordGroupArray &after, ChordIndex afterStart) {
+	Clear();
+	rangeSize = before.size();
+
+	for (ChordIndex i=0; i<rangeSize; i++) {
+		const FPChordGroup	&oldGroup = before[i],
+							&newGroup = after[afterStart + i];
+
+		for (PartIndex p=0; p<DOC_PARTS; p++) {
+			const FPChord	&oldChord = oldGroup[p],
+							&newChord = newGroup[p];
+
+			FPChordDiff diff = { i, p, 0 };
+
+			for (UInt16 f=0; f<kDeltaFieldCount; f++) {
+				SInt16	oldValue = GetField(oldChord, f),
+						newValue = GetField(newChord, f);
+
+				if (oldValue != newValue) {
+					diff.fields |= BIT(f);
+					valueList.push_back(oldValue);
+					valueList.push_back(newValue);
+				}
+			}
+
+			if (diff.fields)
+				diffList.push_back(diff);
+		}
+	}
+}
+
+
+/*!
+ * Apply
+ *
+ *	Restore the old values (backward) or the new values (forward)
+ *	to the groups starting at the given index.
+ *
+ *	Returns false if the groups can't hold the recorded range.
+ */
+bool FPChordDelta::Apply(FPChordGroupArray &groups, ChordIndex start, bool forward) const {
+	if (start < 0 || start + rangeSize > (ChordIndex)groups.size())
+		return false;
+
+	FPDeltaValueList::const_iterator	value = valueList.begin();
+
+	for (FPChordDiffList::const_iterator itr = diffList.begin(); itr != diffList.end(); itr++) {
+		FPChord &chord = groups[start + itr->offset][itr->part];
+
+		for (UInt16 f=0; f<kDeltaFieldCount; f++) {
+			if (itr->fields & BIT(f)) {
+				SetField(chord, f, forward ? value[1] : value[0]);
+				value += 2;
+			}
+		}
+	}
+
+	return true;
+}
+
+
+/*!
+ * ByteSize
+ *
+ *	The approximate memory held by the delta
+ */
+UInt32 FPChordDelta::ByteSize() const {
+	return sizeof(*this)
+		+ diffList.size() * sizeof(FPChordDiff)
+		+ valueList.size() * sizeof(SInt16);
+}
+
+
+/*!
+ * Write
+ *
+ *	Write the delta to a file opened by the caller.
+ *	Only meant to be read back by the same process.
+ */
+bool FPChordDelta::Write(FILE *fp) const {
+	UInt32	header[3] = { rangeSize, diffList.size(), valueList.size() };
+
+	return fwrite(header, sizeof(header), 1, fp) == 1
+		&& (diffList.empty() || fwrite(&diffList[0], sizeof(FPChordDiff), diffList.size(), fp) == diffList.size())
+		&& (valueList.empty() || fwrite(&valueList[0], sizeof(SInt16), valueList.size(), fp) == valueList.size());
+}
+
+
+/*!
+ * Read
+ *
+ *	Read a delta written by Write, replacing this one
+ */
+bool FPChordDelta::Read(FILE *fp) {
+	UInt32	header[3];
+
+	Clear();
+
+	if (fread(header, sizeof(header), 1, fp) != 1)
+		return false;
+
+	diffList.resize(header[1]);
+	valueList.resize(header[2]);
+
+	if ((!diffList.empty() && fread(&diffList[0], sizeof(FPChordDiff), diffList.size(), fp) != diffList.size())
+		|| (!valueList.empty() && fread(&valueList[0], sizeof(SInt16), valueList.size(), fp) != valueList.size())) {
+		Clear();
+		return false;
+	}
+
+	rangeSize = header[0];
+	return true;
+}
+
+
+SInt16 FPChordDelta::GetField(const FPChord &chord, UInt16 field) {
+	if (field >= kDeltaPick && field < kDeltaPick + NUM_STRINGS)
+		return chord.pick[field - kDeltaPick];
+
+	if (field >= kDeltaFretHeld && field < kDeltaFretHeld + NUM_STRINGS)
+		return chord.fretHeld[field - kDeltaFretHeld];
+
+	switch (field) {
+		case kDeltaTones:			return chord.tones;
+		case kDeltaRoot:			return chord.root;
+		case kDeltaKey:				return chord.key;
+		case kDeltaRootLock:		return chord.rootLock;
+		case kDeltaRootModifier:	return chord.rootModifier;
+		case kDeltaRootScaleStep:	return chord.rootScaleStep;
+		case kDeltaBracketFlag:		return chord.bracketFlag;
+		case kDeltaBrakLow:			return chord.brakLow;
+		case kDeltaBrakHi:			return chord.brakHi;
+		case kDeltaBeats:			return chord.beats;
+		case kDeltaRepeat:			return chord.repeat;
+	}
+
+	return 0;
+}
+
+
+void FPChordDelta::SetField(FPChord &chord, UInt16 field, SInt16 value) {
+	if (field >= kDeltaPick && field < kDeltaPick + NUM_STRINGS)
+		chord.pick[field - kDeltaPick] = value;
+
+	else if (field >= kDeltaFretHeld && field < kDeltaFretHeld + NUM_STRINGS)
+		chord.fretHeld[field - kDeltaFretHeld] = value;
+
+	else switch (field) {
+		case kDeltaTones:			chord.tones = value;			break;
+		case kDeltaRoot:			chord.root = value;				break;
+		case kDeltaKey:				chord.key = value;				break;
+		case kDeltaRootLock:		chord.rootLock = (value != 0);	break;
+		case kDeltaRootModifier:	chord.rootModifier = value;		break;
+		case kDeltaRootScaleStep:	chord.rootScaleStep = value;	break;
+		case kDeltaBracketFlag:		chord.bracketFlag = (value != 0);	break;
+		case kDeltaBrakLow:			chord.brakLow = value;			break;
+		case kDeltaBrakHi:			chord.brakHi = value;			break;
+		case kDeltaBeats:			chord.beats = value;			break;
+		case kDeltaRepeat:			chord.repeat = value;			break;
+	}
+}
+
@@ -0,0 +1,86 @@
+/*!
+ *	@file FPChordDelta.h
+ *
+ *	@brief A compact record of the changes made to a range of chords
+ *
+ *	Rather than keeping complete copies of every chord group before
+ *	and after an edit, a delta keeps only the chord fields that
+ *	actually changed, with their old and new values. Applying the
+ *	delta backward restores the old values, and applying it forward
+ *	restores the new ones.
+ *
+ *	A transpose over a selection, for example, only records the
+ *	tones, root, key and fingering of the affected parts.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPCHORDDELTA_H
+#define FPCHORDDELTA_H
+
+#include "FPChord.h"
+#include <stdio.h>
+#include <vector>
+
+//! Chord fields tracked by a delta
+enum {
+	kDeltaTones = 0,
+	kDeltaRoot,
+	kDeltaKey,
+	kDeltaRootLock,
+	kDeltaRootModifier,
+	kDeltaRootScaleStep,
+	kDeltaBracketFlag,
+	kDeltaBrakLow,
+	kDeltaBrakHi,
+	kDeltaFretHeld,
+	kDeltaPick			= kDeltaFretHeld + NUM_STRINGS,
+	kDeltaBeats			= kDeltaPick + NUM_STRINGS,
+	kDeltaRepeat,
+	kDeltaFieldCount
+};
+
+//! The header for one changed chord
+typedef struct {
+	ChordIndex		offset;			//!< The group index relative to the range start
+	PartIndex		part;			//!< The part that changed
+	UInt32			fields;			//!< A mask of the fields that changed
+} FPChordDiff;
+
+typedef std::vector<FPChordDiff>	FPChordDiffList;
+typedef std::vector<SInt16>			FPDeltaValueList;
+
+#pragma mark -
+//-----------------------------------------------
+//
+// FPChordDelta
+//
+class FPChordDelta {
+	private:
+		FPChordDiffList		diffList;		//!< One entry per changed chord
+		FPDeltaValueList	valueList;		//!< Old and new value pairs, in field order
+		ChordIndex			rangeSize;		//!< The number of groups in the range
+
+	public:
+		FPChordDelta() : rangeSize(0) {}
+
+		void				Clear();
+		void				Record(const FPChordGroupArray &before, const FPChordGroupArray &after, ChordIndex afterStart);
+		bool				Apply(FPChordGroupArray &groups, ChordIndex start, bool forward) const;
+
+		inline bool			IsEmpty() const				{ return diffList.empty(); }
+		inline ChordIndex	RangeSize() const			{ return rangeSize; }
+		UInt32				ByteSize() const;
+
+		bool				Write(FILE *fp) const;
+		bool				Read(FILE *fp);
+
+		static SInt16		GetField(const FPChord &chord, UInt16 field);
+		static void			SetField(FPChord &chord, UInt16 field, SInt16 value);
+};
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ *  FPChordGroupStore.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPChordGroupStore.h"
+
+#define kStoreMinSlots	64
+
+
+FPChordGroupStore::FPChordGroupStore(UInt32 expected) {
+	UInt32 slots = kStoreMinSlots;
+
+	// Keep the index at most half full
+	while (slots < expected * 2)
+		slots <<= 1;
+
+	slotList.assign(slots, kNoGroupID);
+	slotMask = slots - 1;
+}
+
+
+/*!
+ * Add
+ *
+ *	Get the ID of a group, adding it if it's new.
+ *	IDs are given out in order from zero.
+ */
+UInt32 FPChordGroupStore::Add(const FPChordGroup &group) {
+	UInt32	hash = group.Hash(),
+			slot = Lookup(group, hash);
+
+	if (slotList[slot] != kNoGroupID)
+		return slotList[slot];
+
+	UInt32 id = groupList.size();
+	groupList.push_back(&group);
+	hashList.push_back(hash);
+	slotList[slot] = id;
+
+	if (groupList.size() * 2 > slotList.size())
+		Grow();
+
+	return id;
+}
+
+
+/*!
+ * Find
+ *
+ *	Get the ID of a group, or kNoGroupID if it isn't in the store
+ */
+UInt32 FPChordGroupStore::Find(const FPChordGroup &group) const {
+	return slotList[Lookup(group, group.Hash())];
+}
+
+
+void FPChordGroupStore::Clear() {
+	groupList.clear();
+	hashList.clear();
+	slotList.assign(kStoreMinSlots, kNoGroupID);
+	slotMask = kStoreMinSlots - 1;
+}
+
+
+//
+// Lookup
+//
+//	Find the slot holding a group, or the empty slot
+//	where it would go. The index is never full, so
+//	the probe always ends.
+//
+UInt32 FPChordGroupStore::Lookup(const FPChordGroup &group, UInt32 hash) const {
+	for (UInt32 slot = hash & slotMask; ; slot = (slot + 1) & slotMask) {
+		UInt32 id = slotList[slot];
+
+		if (id == kNoGroupID || (hashList[id] == hash && groupList[id]->IsIdentical(group)))
+			return slot;
+	}
+}
+
+
+//
+// Grow
+//
+//	Double the index and put every ID back in it
+//
+void FPChordGroupStore::Grow() {
+	UInt32 slots = slotList.size() * 2;
+
+	slotList.assign(slots, kNoGroupID);
+	slotMask = slots - 1;
+
+	for (UInt32 id=0; id<groupList.size(); id++) {
+		UInt32 slot = hashList[id] & slotMask;
+
+		while (slotList[slot] != kNoGroupID)
+			slot = (slot + 1) & slotMask;
+
+		slotList[slot] = id;
+	}
+}
+
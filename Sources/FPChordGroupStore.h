@@ -0,0 +1,71 @@
+/*!
+ *	@file FPChordGroupStore.h
+ *
+ *	@brief An index of chord groups by their content
+ *
+ *	Real documents repeat the same chord group many times, in
+ *	verses, choruses and clones. A store gives each different
+ *	group an ID, the same ID every time it comes up again, so
+ *	anything that keeps or writes groups can do so once each.
+ *
+ *	Groups are found by a hash of every field, and matches are
+ *	confirmed with FPChordGroup::IsIdentical. The store only
+ *	points at the groups it's given, so they must not change
+ *	or go away while it's in use.
+ *
+ *	Binary documents are saved with one table of unique groups
+ *	and a list of IDs, and history snapshots use a store to
+ *	share every repeated group, not just the ones that stayed
+ *	in place. The note list keeps its compiled blocks in a
+ *	store, so the player and the exporters only compile each
+ *	repeated group once. The Sunvox export finds each part's
+ *	repeated patterns with a store of its own.
+ *
+ *	Consolidate doesn't use a store. It only merges neighbouring
+ *	lines, and it compares them with ==, which ignores the repeat
+ *	that IsIdentical includes.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPCHORDGROUPSTORE_H
+#define FPCHORDGROUPSTORE_H
+
+#include "FPChord.h"
+#include <vector>
+
+#define kNoGroupID		0xFFFFFFFFU		//!< An empty slot in the index
+
+#pragma mark -
+//-----------------------------------------------
+//
+// FPChordGroupStore
+//
+class FPChordGroupStore {
+	private:
+		std::vector<const FPChordGroup*>	groupList;	//!< The unique groups, by ID
+		std::vector<UInt32>		hashList;		//!< The hash of each unique group
+		std::vector<UInt32>		slotList;		//!< Open-addressed index of IDs
+		UInt32					slotMask;		//!< The index size minus one
+
+	public:
+		FPChordGroupStore(UInt32 expected=0);
+		~FPChordGroupStore() {}
+
+		UInt32					Add(const FPChordGroup &group);
+		UInt32					Find(const FPChordGroup &group) const;
+		void					Clear();
+
+		inline UInt32			Size() const					{ return groupList.size(); }
+		inline const FPChordGroup&	operator[](UInt32 id) const	{ return *groupList[id]; }
+
+	private:
+		UInt32					Lookup(const FPChordGroup &group, UInt32 hash) const;
+		void					Grow();
+};
+
+#endif
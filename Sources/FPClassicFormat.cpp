@@ -0,0 +1,341 @@
+/*
+ *  FPClassicFormat.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPClassicFormat.h"
+
+
+FPClassicParser::FPClassicParser(const UInt8 *inData, UInt64 inSize) {
+	data	= inData;
+	size	= inSize;
+	table	= NULL;
+	bzero(&header, sizeof(header));
+}
+
+
+/*!
+ * IsClassicType
+ */
+bool FPClassicParser::IsClassicType(UInt32 fileType) {
+	switch (fileType) {
+		case FILE_FORMAT_B3:
+		case FILE_FORMAT_14:
+		case FILE_FORMAT_21:
+		case FILE_FORMAT_X1:
+		case FILE_FORMAT_QQ:
+			return true;
+	}
+	return false;
+}
+
+
+/*!
+ * Parse
+ *
+ *	Check the file type and the size of the whole file
+ *	against the header before reading anything else.
+ *	The size is worked out in 64 bits so a large line
+ *	count can't wrap around.
+ */
+OSStatus FPClassicParser::Parse() {
+	if (size < sizeof(FileHeadCommon))
+		return kFPErrorBadFormat;
+
+	const FileHead	*head = (const FileHead*)data;
+	UInt32			fileType = EndianU32_BtoN(head->common.fileType);
+	UInt32			headSize;
+	PartIndex		partCount = OLD_NUM_PARTS;
+
+	switch (fileType) {
+		case FILE_FORMAT_B3:
+			headSize = sizeof(FileHeadB3);
+			partCount = 1;
+			break;
+		case FILE_FORMAT_14:
+			headSize = sizeof(FileHead14);
+			break;
+		case FILE_FORMAT_21:
+			headSize = sizeof(FileHead21);
+			break;
+		case FILE_FORMAT_X1:
+			headSize = sizeof(FileHeadX1);
+			break;
+		case FILE_FORMAT_QQ:
+			headSize = sizeof(FileHeadQQ);
+			break;
+		default:
+			return kFPErrorBadFormat;
+	}
+
+	UInt64 tableOffset = sizeof(FileHeadCommon) + headSize;
+	ChordIndex len = EndianU16_BtoN(head->common.length);
+
+	if (size < tableOffset
+		|| tableOffset + (UInt64)partCount * len * sizeof(OldChordInfo) != size)
+		return kFPErrorBadFormat;
+
+	header.fileType		= fileType;
+	header.length		= len;
+	header.partCount	= partCount;
+	table = (const OldChordInfo*)(data + tableOffset);
+
+	ReadHeader(head);
+
+	return noErr;
+}
+
+
+/*!
+ * ReadHeader
+ *
+ *	Swap the header fields for the file's format and force
+ *	anything used as an index into range.
+ */
+void FPClassicParser::ReadHeader(const FileHead *head) {
+	header.tempo		= EndianU16_BtoN(head->common.tempo);
+	header.scaleMode	= EndianU16_BtoN(head->common.scaleMode);
+	header.enharmonic	= EndianU16_BtoN(head->common.enharmonic);
+	header.tuning		= EndianU16_BtoN(head->common.tuning);
+	header.topLine		= EndianU16_BtoN(head->common.topLine);
+	header.cursor		= EndianS16_BtoN(head->common.cursor);
+	header.tempoX		= 1;
+	header.hasParts		= true;
+	header.hasTuning	= false;
+
+	// The oldest formats had no output or transform settings
+	for (PartIndex p=OLD_NUM_PARTS; p--;) {
+		FPClassicPart &part = header.part[p];
+		part.outSynth		= true;
+		part.outMIDI		= true;
+		part.outChannel		= p;
+		part.transformFlag	= true;
+	}
+
+	switch (header.fileType) {
+		case FILE_FORMAT_B3: {
+			const FileHeadB3 *data = &head->u.dataB3;
+
+			header.partNum	= 0;
+			header.hasParts	= false;
+			header.part[0].fauxGMNumber = EndianS16_BtoN(data->fauxGMNumber);
+			break;
+		}
+
+		case FILE_FORMAT_14: {
+			const FileHead14 *data = &head->u.data14;
+
+			header.partNum	= EndianS16_BtoN(data->partNum);
+
+			for (PartIndex p=OLD_NUM_PARTS; p--;) {
+				header.part[p].fauxGMNumber	= EndianS16_BtoN(data->fauxGMNumbers[p]);
+				header.part[p].velocity		= EndianU16_BtoN(data->velocity[p]);
+				header.part[p].sustain		= EndianU16_BtoN(data->sustain[p]);
+			}
+			break;
+		}
+
+		case FILE_FORMAT_21: {
+			const FileHead21 *data = &head->u.data21;
+
+			header.partNum	= EndianS16_BtoN(data->partNum);
+			header.tempoX	= EndianU16_BtoN(data->tempoX);
+
+			for (PartIndex p=OLD_NUM_PARTS; p--;) {
+				header.part[p].fauxGMNumber	= EndianS16_BtoN(data->fauxGMNumbers[p]);
+				header.part[p].velocity		= EndianU16_BtoN(data->velocity[p]);
+				header.part[p].sustain		= EndianU16_BtoN(data->sustain[p]);
+			}
+
+			header.hasTuning = true;
+			BlockMoveData(data->tuningName, header.tuningName, sizeof(Str31));
+			for (int s=NUM_STRINGS; s--;)
+				header.lowNote[s] = EndianS16_BtoN(data->lowNote[s]);
+			break;
+		}
+
+		case FILE_FORMAT_QQ: {
+			const FileHeadQQ *data = &head->u.dataQQ;
+
+			header.partNum	= EndianS16_BtoN(data->partNum);
+			header.tempoX	= EndianU16_BtoN(data->tempoX);
+
+			for (PartIndex p=OLD_NUM_PARTS; p--;) {
+				header.part[p].fauxGMNumber	= EndianS16_BtoN(data->part[p].fauxGMNumber);
+				header.part[p].velocity		= EndianU16_BtoN(data->part[p].velocity);
+				header.part[p].sustain		= EndianU16_BtoN(data->part[p].sustain);
+				header.part[p].outSynth		= data->part[p].outQT;
+				header.part[p].outMIDI		= data->part[p].outMIDI;
+				header.part[p].outChannel	= EndianU16_BtoN(data->part[p].outChannel);
+			}
+
+			header.hasTuning = true;
+			BlockMoveData(data->tuningName, header.tuningName, sizeof(Str31));
+			for (int s=NUM_STRINGS; s--;)
+				header.lowNote[s] = EndianS16_BtoN(data->lowNote[s]);
+			break;
+		}
+
+		case FILE_FORMAT_X1: {
+			const FileHeadX1 *data = &head->u.dataX1;
+
+			header.partNum	= EndianS16_BtoN(data->partNum);
+			header.tempoX	= EndianU16_BtoN(data->tempoX);
+
+			for (PartIndex p=OLD_NUM_PARTS; p--;) {
+				header.part[p].fauxGMNumber	= EndianS16_BtoN(data->part[p].fauxGMNumber);
+				header.part[p].velocity		= EndianU16_BtoN(data->part[p].velocity);
+				header.part[p].sustain		= EndianU16_BtoN(data->part[p].sustain);
+				header.part[p].outSynth		= data->part[p].outSynth;
+				header.part[p].outMIDI		= data->part[p].outMIDI;
+				header.part[p].outChannel	= EndianU16_BtoN(data->part[p].outChannel);
+				header.part[p].transformFlag = data->part[p].transformFlag;
+			}
+
+			header.hasTuning = true;
+			BlockMoveData(data->tuningName, header.tuningName, sizeof(Str31));
+			for (int s=NUM_STRINGS; s--;)
+				header.lowNote[s] = EndianS16_BtoN(data->lowNote[s]);
+			break;
+		}
+	}
+
+	//
+	// Nothing in the file is trusted as an index
+	//
+	ChordIndex last = header.length ? header.length - 1 : 0;
+	CONSTRAIN(header.topLine, 0, last);
+	CONSTRAIN(header.cursor, 0, last);
+	CONSTRAIN(header.partNum, 0, DOC_PARTS - 1);
+
+	if (header.tempoX < 1 || header.tempoX > 2)
+		header.tempoX = 1;
+
+	if (header.tuningName[0] > 31)
+		header.tuningName[0] = 31;
+
+	for (PartIndex p=OLD_NUM_PARTS; p--;) {
+		header.part[p].outChannel %= TOTAL_CHANNELS;
+		if (header.part[p].velocity > 127)
+			header.part[p].velocity = 127;
+	}
+}
+
+
+/*!
+ * ReadChords
+ *
+ *	Swap a run of lines from the table into a native buffer
+ *	and force every chord into range. The buffer holds
+ *	partCount records per line.
+ */
+void FPClassicParser::ReadChords(ChordIndex line, ChordIndex lines, OldChordInfo *block) const {
+	const PartIndex	count = header.partCount;
+
+	SwapChords(block, table + line * count, lines * count);
+
+	for (ChordIndex i=lines*count; i--;)
+		CheckChord(block[i]);
+}
+
+
+#if !FP_PORTABLE
+
+/*!
+ * ReadGroups
+ *
+ *	Append every line of the file to a chord group array.
+ *	The table is swapped a block at a time into a native
+ *	buffer, so the file is only read once and never copied
+ *	as a whole. Files with fewer parts than the document
+ *	fill the other parts with the last part's chord.
+ */
+void FPClassicParser::ReadGroups(FPChordGroupArray &groups) const {
+	OldChordInfo	block[kClassicSwapBlock * OLD_NUM_PARTS];
+	FPChordGroup	group;
+	const PartIndex	count = header.partCount;
+
+	for (ChordIndex line=0; line<header.length; line+=kClassicSwapBlock) {
+		ChordIndex lines = MIN(kClassicSwapBlock, header.length - line);
+		ReadChords(line, lines, block);
+
+		OldChordInfo *info = block;
+		for (ChordIndex i=lines; i--;) {
+			for (PartIndex p=0; p<DOC_PARTS; p++) {
+				if (p < count)
+					group[p].Set(*info++);
+				else {
+					group[p] = group[count-1];
+					group[p].ClearPattern();
+				}
+
+				if (p > 0) {
+					group[p].SetRepeat(group.Repeat());
+					group[p].SetPatternSize(group.PatternSize());
+				}
+			}
+
+			groups.append_copy(group);
+		}
+	}
+}
+
+#endif
+
+
+/*!
+ * SwapChords
+ *
+ *	Convert big-endian chord records to native order.
+ *	Every field but the pair of Booleans is a 16-bit word,
+ *	so the whole run is swapped as words in one loop and
+ *	the Booleans are put back afterward.
+ */
+void FPClassicParser::SwapChords(OldChordInfo *dst, const OldChordInfo *src, UInt32 count) {
+#if defined(__BIG_ENDIAN__)
+	BlockMoveData(src, dst, count * sizeof(OldChordInfo));
+#else
+	const UInt32	words = count * (sizeof(OldChordInfo) / sizeof(UInt16));
+	const UInt16	*in = (const UInt16*)src;
+	UInt16			*out = (UInt16*)dst;
+
+	for (UInt32 w=0; w<words; w++)
+		out[w] = Endian16_Swap(in[w]);
+
+	for (UInt32 i=count; i--;) {
+		dst[i].rootLock		= src[i].rootLock;
+		dst[i].bracketFlag	= src[i].bracketFlag;
+	}
+#endif
+}
+
+
+/*!
+ * CheckChord
+ *
+ *	Force a native-order chord record into range. The
+ *	tones, root and key are used to index tables.
+ */
+void FPClassicParser::CheckChord(OldChordInfo &info) {
+	info.tones	&= 0x0FFF;
+	info.root	%= OCTAVE;
+	info.key	%= OCTAVE;
+
+	if (info.brakHi > MAX_FRETS)
+		info.brakHi = MAX_FRETS;
+
+	if (info.brakLow > info.brakHi)
+		info.brakLow = info.brakHi;
+
+	for (int s=NUM_STRINGS; s--;)
+		CONSTRAIN(info.fretHeld[s], -1, MAX_FRETS);
+
+	CONSTRAIN(info.beats, 1, MAX_BEATS);
+
+	if (info.repeat > MAX_REPEAT)
+		info.repeat = MAX_REPEAT;
+}
+
@@ -0,0 +1,233 @@
+/*!
+ *	@file FPClassicFormat.h
+ *
+ *	@brief Reads FretPet Classic document files
+ *
+ *	FretPet Classic saved a flat big-endian file: a common header,
+ *	a header for the format version, and then a table of
+ *	OldChordInfo records, one per part for each line.
+ *
+ *	FPClassicParser reads a whole file from memory, usually a
+ *	mapped file. Every size in the header is checked against the
+ *	data size before anything else is read, and values used as
+ *	indexes are forced into range, so a damaged file can't cause
+ *	a read outside the data. The chord table is never copied.
+ *	It's swapped a block at a time into a small native buffer
+ *	and read from there.
+ *
+ *	The parser knows nothing about documents or the player, so
+ *	it can also be used by tools that convert old archives.
+ *	Only ReadGroups needs FPChord, so the rest of the parser
+ *	also builds without Carbon for the tests in Tests/Makefile.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPCLASSICFORMAT_H
+#define FPCLASSICFORMAT_H
+
+#include "FPChord.h"
+
+#define	FILE_FORMAT_B3			'FPB3'
+#define	FILE_FORMAT_14			'FP14'
+#define	FILE_FORMAT_21			'FP21'
+#define	FILE_FORMAT_X1			'FPX1'
+#define	FILE_FORMAT_QQ			'FPQQ'
+
+#define kClassicSwapBlock		256		//!< Lines swapped at a time
+
+#pragma pack(2)
+
+/*!
+ * Common fields in the header
+ */
+typedef struct {
+	UInt32			fileType;			//  4 start of the writeable file
+	Point			lastPoint;			//  4 the last position of the window
+	UInt16			tempo;				//  2 speed of the tune
+	UInt16			scaleMode;			//  2 current modal scale
+	UInt16			enharmonic;			//  2 current flat-sharp naming
+	UInt16			tuning;				//  2 guitar tuning
+	UInt16			length;				//  2 how many chords?
+	UInt16			topLine;			//  2 first bank chord in window
+	SInt16			cursor;				//  2 cursor position
+} FileHeadCommon;						// 22
+
+/*!
+ * File Format Beta 3
+ */
+typedef struct {
+	SInt16			fauxGMNumber;		//   2 the instrument in FretPet terms
+} FileHeadB3;							//   2
+
+/*!
+ * Format 14 added multiple voices
+ */
+typedef struct {
+	SInt16			partNum;			//   2 current part number in view
+	SInt16			fauxGMNumbers[OLD_NUM_PARTS];	//   8 instruments in FretPet terms
+	SInt16			velocity[OLD_NUM_PARTS];		//   8 velocities
+	SInt16			sustain[OLD_NUM_PARTS];			//   8 note held
+	SInt16			reserved2[OLD_NUM_PARTS];		//   8 the notes of this tuning
+} FileHead14;							//  34
+
+/*!
+ * Format 21 saves more state and remembers custom tunings
+ */
+typedef struct {
+	SInt16		partNum;					//   2
+	SInt16		fauxGMNumbers[OLD_NUM_PARTS];	//   8 four parts in FP 2
+	SInt16		velocity[OLD_NUM_PARTS];	//   8
+	SInt16		sustain[OLD_NUM_PARTS];		//   8
+
+	SInt16		tempoX;					//   2 faster tempo than 600?
+	SInt16		reserved2;				//   2
+	SInt16		reserved3;				//   2
+	SInt16		reserved4;				//   2
+
+	Str31		tuningName;				//  32 Name of a Custom Tuning
+	SInt16		lowNote[6];				//  12 The lowNotes of the tuning
+} FileHead21;							//  78
+
+/*!
+ * The part structure saved in Format X1
+ */
+typedef struct {
+	UInt16		fauxGMNumber;			//  2 The instrument in FretPet terms
+	UInt16		velocity;				//  2 The velocity
+	UInt16		sustain;				//  2 The sustain
+	Boolean		outSynth;				//  1 Synth output?
+	Boolean		outMIDI;				//  1 MIDI output?
+	UInt16		outChannel;				//  2 The MIDI channel to play on
+	Boolean		transformFlag;			//  1 Is this channel transformed in multi-mode
+	Boolean		unused;					//  1 placeholder
+} x1_partInfo;							// 12
+
+/*!
+ * Format X1 was the first Mac OS X header
+ */
+typedef struct {
+	UInt16		tempoX;					//   2 Tempo multipler (1 or 2)
+	SInt16		partNum;				//   2 The current part number of the document
+	x1_partInfo	part[OLD_NUM_PARTS];	//  48
+
+	Boolean		soloSynth;				//	 1 Are we soloing on the Synth?
+	Boolean		soloMIDI;				//	 1 Are we soloing on MIDI?
+	Boolean		soloTransform;			//	 1 Is transform soloing?
+	Boolean		reserved;				//	 1 keep things aligned
+
+	Str31		tuningName;				//  32 Name of a Custom Tuning
+	SInt16		lowNote[6];				//  12 The lowNotes of the tuning
+} FileHeadX1;							// 100
+
+/*!
+ * This part structure was used briefly in Format QQ
+ */
+typedef struct {
+	UInt16		fauxGMNumber;			//  2 The instrument in FretPet terms
+	UInt16		velocity;				//  2 The velocity
+	UInt16		sustain;				//  2 The sustain
+	Boolean		outQT;					//  1 Quicktime output?
+	Boolean		outMIDI;				//  1 MIDI output?
+	UInt16		outChannel;				//  2 The MIDI channel to play on
+} interim_partInfo;						// 10
+
+/*!
+ * Format QQ was barely used
+ */
+typedef struct {
+	UInt16		tempoX;					//  2 Tempo multipler (1 or 2)
+	SInt16		partNum;				//  2 The current part number of the document
+	interim_partInfo part[OLD_NUM_PARTS];	// 40
+	Str31		tuningName;				// 32 Name of a Custom Tuning
+	SInt16		lowNote[6];				// 12 The lowNotes of the tuning
+} FileHeadQQ;							// 88
+
+/*!
+ * This file header was used for flat files on Mac OS 9
+ * and in fact "Format 21" can still be saved.
+ */
+typedef struct {
+	FileHeadCommon	common;				// 22
+	union {
+		FileHeadB3	dataB3;				// 2
+		FileHead14	data14;				// 34
+		FileHead21	data21;				// 78
+		FileHeadQQ	dataQQ;				// 88
+		FileHeadX1	dataX1;				// 100
+	} u;
+} FileHead;
+
+#pragma pack()
+
+/*!
+ * A part's settings in native byte order
+ */
+typedef struct {
+	SInt16		fauxGMNumber;			//!< The instrument in FretPet terms
+	UInt16		velocity;				//!< The velocity
+	UInt16		sustain;				//!< The sustain
+	bool		outSynth;				//!< Synth output?
+	bool		outMIDI;				//!< MIDI output?
+	UInt16		outChannel;				//!< The MIDI channel to play on
+	bool		transformFlag;			//!< Transformed in multi-mode?
+} FPClassicPart;
+
+/*!
+ * The header of a classic file in native byte order
+ */
+typedef struct {
+	UInt32			fileType;			//!< The format ID
+	UInt16			tempo;				//!< Speed of the tune
+	UInt16			tempoX;				//!< Tempo multiplier, 1 or 2
+	UInt16			scaleMode;			//!< Current modal scale
+	UInt16			enharmonic;			//!< Current flat-sharp naming
+	UInt16			tuning;				//!< Index of a built-in tuning
+	ChordIndex		length;				//!< Number of lines
+	ChordIndex		topLine;			//!< First line in the window
+	ChordIndex		cursor;				//!< Cursor position
+	PartIndex		partNum;			//!< The current part
+	PartIndex		partCount;			//!< Records per line in the file
+	bool			hasParts;			//!< False if only the first part was saved
+	bool			hasTuning;			//!< True if the tuning was saved
+	FPClassicPart	part[OLD_NUM_PARTS];	//!< Part settings
+	Str31			tuningName;			//!< Name of a custom tuning
+	SInt16			lowNote[NUM_STRINGS];	//!< Tones of a custom tuning
+} FPClassicHeader;
+
+#pragma mark -
+//-----------------------------------------------
+//
+// FPClassicParser
+//
+class FPClassicParser {
+	private:
+		const UInt8			*data;			//!< The whole file
+		UInt64				size;			//!< The size of the file
+		const OldChordInfo	*table;			//!< The chord records in the file
+		FPClassicHeader		header;			//!< The parsed header
+
+	public:
+		FPClassicParser(const UInt8 *inData, UInt64 inSize);
+		~FPClassicParser() {}
+
+		OSStatus			Parse();
+		inline const FPClassicHeader&	Header() const		{ return header; }
+		void				ReadChords(ChordIndex line, ChordIndex lines, OldChordInfo *block) const;
+#if !FP_PORTABLE
+		void				ReadGroups(FPChordGroupArray &groups) const;
+#endif
+
+		static bool			IsClassicType(UInt32 fileType);
+		static void			SwapChords(OldChordInfo *dst, const OldChordInfo *src, UInt32 count);
+		static void			CheckChord(OldChordInfo &info);
+
+	private:
+		void				ReadHeader(const FileHead *head);
+};
+
+#endif
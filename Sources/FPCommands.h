@@ -23,6 +23,7 @@
 #define kFPCommandPastePattern		'Pseq'
 #define kFPCommandPasteTones		'Pton'
 #define kFPCommandSelectNone		'Sel0'
+#define kFPCommandSwitchBranch		'Brch'
 #define kFPCommandPrefabSubmenu		'SubP'
 
 
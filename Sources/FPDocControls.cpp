@@ -382,9 +382,9 @@ bool FPTempoSlider::MouseWheelMoved(SInt16 delta, SInt16 deltaX) {
 	if (oldVal != Value()) {
 		event = fretpet->StartUndo(UN_TEMPO, CFSTR("Tempo Change"));
 		event->SetPartAgnostic();
-		event->SaveDataBefore(CFSTR("tempo"), oldVal);
+		event->SaveDataBefore(kHistoryTempo, oldVal);
 		event->SetMergeUnderInterim(30);
-		event->SaveDataAfter(CFSTR("tempo"), Value());
+		event->SaveDataAfter(kHistoryTempo, Value());
 		event->Commit();
 	}
 
@@ -400,13 +400,13 @@ void FPTempoSlider::ValueChanged() {
 void FPTempoSlider::DoMouseDown() {
 	event = fretpet->StartUndo(UN_TEMPO, CFSTR("Tempo Change"));
 	event->SetPartAgnostic();
-	event->SaveDataBefore(CFSTR("tempo"), Value());
+	event->SaveDataBefore(kHistoryTempo, Value());
 }
 
 
 void FPTempoSlider::DoMouseUp() {
-	if ( Value() != event->GetDataBefore(CFSTR("tempo")) ) {
-		event->SaveDataAfter(CFSTR("tempo"), Value());
+	if ( Value() != event->GetDataBefore(kHistoryTempo) ) {
+		event->SaveDataAfter(kHistoryTempo, Value());
 		event->Commit();
 	}
 }
@@ -421,10 +421,10 @@ bool FPVelocitySlider::MouseWheelMoved(SInt16 delta, SInt16 deltaX) {
 	if (oldVal != Value()) {
 		event = fretpet->StartUndo(UN_VELOCITY, CFSTR("Velocity Change"));
 		event->SetPartAgnostic();
-		event->SaveDataBefore(CFSTR("part"), player->CurrentPart());
-		event->SaveDataBefore(CFSTR("velocity"), oldVal);
+		event->SaveDataBefore(kHistoryPart, player->CurrentPart());
+		event->SaveDataBefore(kHistoryVelocity, oldVal);
 		event->SetMergeUnderInterim(30);
-		event->SaveDataAfter(CFSTR("velocity"), Value());
+		event->SaveDataAfter(kHistoryVelocity, Value());
 		event->Commit();
 	}
 
@@ -440,14 +440,14 @@ void FPVelocitySlider::ValueChanged() {
 void FPVelocitySlider::DoMouseDown() {
 	event = fretpet->StartUndo(UN_VELOCITY, CFSTR("Velocity Change"));
 	event->SetPartAgnostic();
-	event->SaveDataBefore(CFSTR("part"), player->CurrentPart());
-	event->SaveDataBefore(CFSTR("velocity"), Value());
+	event->SaveDataBefore(kHistoryPart, player->CurrentPart());
+	event->SaveDataBefore(kHistoryVelocity, Value());
 }
 
 
 void FPVelocitySlider::DoMouseUp() {
-	if ( Value() != event->GetDataBefore(CFSTR("velocity")) ) {
-		event->SaveDataAfter(CFSTR("velocity"), Value());
+	if ( Value() != event->GetDataBefore(kHistoryVelocity) ) {
+		event->SaveDataAfter(kHistoryVelocity, Value());
 		event->Commit();
 	}
 }
@@ -462,10 +462,10 @@ bool FPSustainSlider::MouseWheelMoved(SInt16 delta, SInt16 deltaX) {
 	if (oldVal != Value()) {
 		event = fretpet->StartUndo(UN_SUSTAIN, CFSTR("Sustain Change"));
 		event->SetPartAgnostic();
-		event->SaveDataBefore(CFSTR("part"), player->CurrentPart());
-		event->SaveDataBefore(CFSTR("sustain"), oldVal);
+		event->SaveDataBefore(kHistoryPart, player->CurrentPart());
+		event->SaveDataBefore(kHistorySustain, oldVal);
 		event->SetMergeUnderInterim(30);
-		event->SaveDataAfter(CFSTR("sustain"), Value());
+		event->SaveDataAfter(kHistorySustain, Value());
 		event->Commit();
 	}
 
@@ -481,14 +481,14 @@ void FPSustainSlider::ValueChanged() {
 void FPSustainSlider::DoMouseDown() {
 	event = fretpet->StartUndo(UN_SUSTAIN, CFSTR("Sustain Change"));
 	event->SetPartAgnostic();
-	event->SaveDataBefore(CFSTR("part"), player->CurrentPart());
-	event->SaveDataBefore(CFSTR("sustain"), Value());
+	event->SaveDataBefore(kHistoryPart, player->CurrentPart());
+	event->SaveDataBefore(kHistorySustain, Value());
 }
 
 
 void FPSustainSlider::DoMouseUp() {
-	if ( Value() != event->GetDataBefore(CFSTR("sustain")) ) {
-		event->SaveDataAfter(CFSTR("sustain"), Value());
+	if ( Value() != event->GetDataBefore(kHistorySustain) ) {
+		event->SaveDataAfter(kHistorySustain, Value());
 		event->Commit();
 	}
 }
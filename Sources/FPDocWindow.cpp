@@ -496,6 +496,7 @@ void FPDocWindow::NavDidSave() {
 	else {
 		SetModified(false);
 		history->Clear();
+		history->StartJournal(*document);
 		SetTitle(document->DisplayName());
 		document->UpdateProxyIcon();
 		fretpet->AddToRecentItems((TFile&)*document);
@@ -596,7 +597,7 @@ void FPDocWindow::DoPasteTones() {
 		FPHistoryEvent	*event = history->UndoStart(UN_PASTE_TONES, CFSTR("Paste Tones"), kAllChannelsMask);
 		event->SaveSelectionBefore();
 		event->SaveClipboardAfter();
-		event->SaveDataBefore(CFSTR("clipPart"), clipPart);
+		event->SaveDataBefore(kHistoryClipPart, clipPart);
 
 		DoPasteTones(fretpet->clipboard.Contents(), fretpet->clipboard.Part());
 
@@ -675,6 +676,32 @@ void FPDocWindow::ReplaceAll(FPChordGroupArray &src, UInt16 partMask) {
 }
 
 
+//-----------------------------------------------
+//
+// RestoreAll
+//
+//	Replace the whole document with copies of
+//	the source chords, whatever its size
+//
+//	This is ONLY used by Undo/Redo,
+//	so it never dirties the document
+//
+void FPDocWindow::RestoreAll(FPChordGroupArray &src) {
+	FPChordGroupArray &groups = document->ChordGroupArray();
+	groups.clear();
+	groups.append_copies(src);
+
+	ChordIndex size = document->Size();
+	document->SetCursorLine(size ? MIN(GetCursor(), size - 1) : 0);
+	document->SetSelectionRaw(-1);
+
+	UpdateGlobalChord();
+	fretpet->UpdatePlayTools();
+	UpdateScrollState();
+	DrawVisibleLines();
+}
+
+
 //-----------------------------------------------
 //
 // ReplaceRange
@@ -717,7 +744,7 @@ void FPDocWindow::DoPastePattern() {
 		FPHistoryEvent *event = history->UndoStart(UN_PASTE_PATT, CFSTR("Paste Pattern"), kAllChannelsMask);
 		event->SaveSelectionBefore();
 		event->SaveClipboardAfter();
-		event->SaveDataBefore(CFSTR("clipPart"), clipPart);
+		event->SaveDataBefore(kHistoryClipPart, clipPart);
 
 		DoPastePattern(fretpet->clipboard.Contents(), clipPart);
 
@@ -233,6 +233,7 @@ public:
 	void				DoReplace(FPChordGroupArray &groupArray, bool undoable=true, bool replace=false);
 	void				ReplaceSelection(FPChordGroupArray &src, UInt16 partMask=kAllChannelsMask);
 	void				ReplaceRange(FPChordGroupArray &src, ChordIndex start, ChordIndex end, UInt16 partMask=kAllChannelsMask);
+	void				RestoreAll(FPChordGroupArray &src);
 	void				ReplaceAll(FPChordGroupArray &src, UInt16 partMask=kAllChannelsMask);
 
 	void				DoToggleTempoMultiplier(bool undoable=true);
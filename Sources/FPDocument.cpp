@@ -19,10 +19,22 @@
 #include "TString.h"
 #include "TCarbonEvent.h"
 #include "FPHistory.h"
-
-#define DEBUG_MIDI		0
-#define TICKS_PER_16TH	60
-#define TICKS_PER_4TH	(TICKS_PER_16TH * 4)
+#include "FPChordGroupStore.h"
+#include "TByteSink.h"
+#include "FPWaveRenderer.h"
+#include "FPTabWriter.h"
+#include "FPMusicXMLWriter.h"
+#include "FPMidiWriter.h"
+#include "FPTransformPipeline.h"
+#include "TPlistStream.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define kMinTempo		120		// The range of the tempo slider
+#define kMaxTempo		600
 
 //
 // File data keys
@@ -67,114 +79,96 @@
 #pragma pack(2)
 
 /*!
- * Common fields in the header
+ * Part settings in the binary format
  */
 typedef struct {
-	UInt32			fileType;			//  4 start of the writeable file
-	Point			lastPoint;			//  4 the last position of the window
-	UInt16			tempo;				//  2 speed of the tune
-	UInt16			scaleMode;			//  2 current modal scale
-	UInt16			enharmonic;			//  2 current flat-sharp naming
-	UInt16			tuning;				//  2 guitar tuning
-	UInt16			length;				//  2 how many chords?
-	UInt16			topLine;			//  2 first bank chord in window
-	SInt16			cursor;				//  2 cursor position
-} FileHeadCommon;						// 22
+	UInt16		instrument;				//  2 The instrument in terms of the synth
+	UInt16		velocity;				//  2 The velocity
+	UInt16		sustain;				//  2 The sustain
+	UInt16		outChannel;				//  2 The MIDI channel to play on
+	UInt16		flags;					//  2 Synth, MIDI, and transform flags
+	UInt16		reserved;				//  2 keep things aligned
+} BinaryPartInfo;						// 12
 
-/*!
- * File Format Beta 3
- */
-typedef struct {
-	SInt16			fauxGMNumber;		//   2 the instrument in FretPet terms
-} FileHeadB3;							//   2
+enum {
+	kBinaryPartSynth		= BIT(0),
+	kBinaryPartMIDI			= BIT(1),
+	kBinaryPartTransform	= BIT(2)
+};
 
 /*!
- * Format 14 added multiple voices
+ * Format XB is a flat binary header followed by a table of
+ * fixed-size chord groups. Everything but the file ID is
+ * little-endian, so Intel Macs can use the table in place.
+ *
+ * In version 2 the table holds each different group once,
+ * and a list of group IDs, one for each line, follows it.
+ * Version 1 has one group for each line and no list.
+ *
+ * headSize and groupSize let a newer version append fields
+ * to either structure without breaking older readers.
  */
 typedef struct {
+	UInt32			fileType;			//   4 'FPXB', big-endian like the classic IDs
+	UInt16			version;			//   2 FILE_BINARY_VERSION
+	UInt16			headSize;			//   2 offset of the chord table
+	UInt32			length;				//   4 how many chord groups?
+	UInt16			groupSize;			//   2 size of each chord group
+	UInt16			partCount;			//   2 chords in each group
+	UInt16			tempo;				//   2 speed of the tune
+	UInt16			tempoX;				//   2 tempo multiplier (1 or 2)
+	UInt16			scaleMode;			//   2 current modal scale
+	UInt16			enharmonic;			//   2 current flat-sharp naming
+	SInt32			topLine;			//   4 first bank chord in window
+	SInt32			cursor;				//   4 cursor position
+	SInt32			selection;			//   4 selection end, or -1
 	SInt16			partNum;			//   2 current part number in view
-	SInt16			fauxGMNumbers[OLD_NUM_PARTS];	//   8 instruments in FretPet terms
-	SInt16			velocity[OLD_NUM_PARTS];		//   8 velocities
-	SInt16			sustain[OLD_NUM_PARTS];			//   8 note held
-	SInt16			reserved2[OLD_NUM_PARTS];		//   8 the notes of this tuning
-} FileHead14;							//  34
+	UInt16			soloFlags;			//   2 synth, MIDI, and transform solo
+	BinaryPartInfo	part[DOC_PARTS];	//  48
+	SInt16			lowNote[NUM_STRINGS];	//  12 The lowNotes of the tuning
+	UInt16			tuningNameLength;	//   2 bytes used in tuningName
+	char			tuningName[62];		//  62 UTF-8 name of the tuning
+	UInt32			uniqueCount;		//   4 groups in the table (version 2)
+	UInt8			reserved[24];		//  24 room to grow
+} FileHeadBinary;						// 192
 
 /*!
- * Format 21 saves more state and remembers custom tunings
+ * A chord in the binary format
  */
 typedef struct {
-	SInt16		partNum;					//   2
-	SInt16		fauxGMNumbers[OLD_NUM_PARTS];	//   8 four parts in FP 2
-	SInt16		velocity[OLD_NUM_PARTS];	//   8
-	SInt16		sustain[OLD_NUM_PARTS];		//   8
-	
-	SInt16		tempoX;					//   2 faster tempo than 600?
-	SInt16		reserved2;				//   2
-	SInt16		reserved3;				//   2
-	SInt16		reserved4;				//   2
-	
-	Str31		tuningName;				//  32 Name of a Custom Tuning
-	SInt16		lowNote[6];				//  12 The lowNotes of the tuning
-} FileHead21;							//  78
+	UInt16		tones;					//  2 The chord's tones as a bitmask
+	UInt16		root;					//  2 The root tone of the chord
+	UInt16		key;					//  2 The key of the chord
+	SInt16		rootModifier;			//  2 The scale palette offset
+	SInt16		rootScaleStep;			//  2 The scale step offset
+	UInt16		brakLow, brakHi;		//  4 The bracket position
+	UInt16		flags;					//  2 Root lock and bracket flags
+	SInt16		fretHeld[NUM_STRINGS];	// 12 The fretboard fingering
+	UInt16		pick[NUM_STRINGS];		// 12 The picking pattern
+} BinaryChord;							// 40
 
-/*!
- * Format X1 was the first Mac OS X header
- */
-typedef struct {
-	UInt16		tempoX;					//   2 Tempo multipler (1 or 2)
-	SInt16		partNum;				//   2 The current part number of the document
-	partInfo	part[OLD_NUM_PARTS];	//  48
-	
-#if QUICKTIME_SUPPORT
-	Boolean		soloQT;					//	 1 Are we soloing on Quicktime?
-#else
-	Boolean		soloSynth;				//	 1 Are we soloing on the Synth?
-#endif
-	Boolean		soloMIDI;				//	 1 Are we soloing on MIDI?
-	Boolean		soloTransform;			//	 1 Is transform soloing?
-	Boolean		reserved;				//	 1 keep things aligned
-	
-	Str31		tuningName;				//  32 Name of a Custom Tuning
-	SInt16		lowNote[6];				//  12 The lowNotes of the tuning
-} FileHeadX1;							// 100
+enum {
+	kBinaryChordRootLock	= BIT(0),
+	kBinaryChordBracket		= BIT(1)
+};
 
 /*!
- * This part structure was used briefly in Format QQ
+ * A chord group in the binary format
  */
 typedef struct {
-	UInt16		fauxGMNumber;			//  2 The instrument in FretPet terms
-	UInt16		velocity;				//  2 The velocity
-	UInt16		sustain;				//  2 The sustain
-	Boolean		outQT;					//  1 Quicktime output?
-	Boolean		outMIDI;				//  1 MIDI output?
-	UInt16		outChannel;				//  2 The MIDI channel to play on
-} interim_partInfo;						// 12
+	UInt16		beats;					//   2 The length of the sequence
+	UInt16		repeat;					//   2 The number of times to play
+	BinaryChord	chord[DOC_PARTS];		// 160
+} BinaryChordGroup;						// 164
 
 /*!
- * Format QQ was barely used
+ * A line's entry in the list of group IDs
  */
 typedef struct {
-	UInt16		tempoX;					//  2 Tempo multipler (1 or 2)
-	SInt16		partNum;				//  2 The current part number of the document
-	interim_partInfo part[DOC_PARTS];	// 48
-	Str31		tuningName;				// 32 Name of a Custom Tuning
-	SInt16		lowNote[6];				// 12 The lowNotes of the tuning
-} FileHeadQQ;							// 96
+	UInt32		id;						//   4 The index in the group table
+} BinaryGroupRef;						//   4
 
-/*!
- * This file header was used for flat files on Mac OS 9
- * and in fact "Format 21" can still be saved.
- */
-typedef struct {
-	FileHeadCommon	common;				// 22
-	union {
-		FileHeadB3	dataB3;				// 2
-		FileHead14	data14;				// 34
-		FileHead21	data21;				// 78
-		FileHeadQQ	dataQQ;				// 96
-		FileHeadX1	dataX1;				// 100
-	} u;
-} FileHead;
+#define kBinaryGroupsPerWrite	1024
 
 
 #pragma pack()
@@ -222,6 +216,7 @@ FPDocument::FPDocument(FPDocWindow *wind, const FSRef &fsref) : TFile(fsref) {
 }
 
 FPDocument::~FPDocument() {
+	delete loader;
 #if !DEMO_ONLY
 	delete sunvoxExporter;
 	delete movieExporter;
@@ -249,6 +244,8 @@ void FPDocument::Init(FPDocWindow *wind) {
 	soloQT			= false;
 	soloMIDI		= false;
 	soloTransform	= false;
+	binaryFormat	= preferences.GetBoolean(kPrefFormatBinary, FALSE);
+	loader			= NULL;
 	
 	SetTempo(480);					// also initializes "interim"
 	
@@ -283,14 +280,14 @@ void FPDocument::Init(FPDocWindow *wind) {
  */
 void FPDocument::SetWindow(FPDocWindow *wind) {
 	window = wind;
-	SetOwningWindow(wind->Window());
+	SetOwningWindow(wind ? wind->Window() : NULL);
 }
 
 /*!
  * Window
  */
 WindowRef FPDocument::Window() {
-	return window->Window();
+	return window ? window->Window() : NULL;
 }
 
 /*!
@@ -307,6 +304,30 @@ UInt32 FPDocument::TotalBeats() const {
 	return beatCount;
 }
 
+/*!
+ * CopySettings
+ *
+ * Copy everything but the chords from another document.
+ */
+void FPDocument::CopySettings(const FPDocument &src) {
+	tempoX			= src.tempoX;
+	SetTempo(src.tempo);
+	scaleMode		= src.scaleMode;
+	enharmonic		= src.enharmonic;
+	topLine			= src.topLine;
+	cursor			= src.cursor;
+	selectionEnd	= src.selectionEnd;
+	partNum			= src.partNum;
+	soloQT			= src.soloQT;
+	soloMIDI		= src.soloMIDI;
+	soloTransform	= src.soloTransform;
+	tuning			= src.tuning;
+
+	for (PartIndex p=DOC_PARTS; p--;)
+		part[p] = src.part[p];
+}
+
+
 #pragma mark - File Load - XML Format
 /*!
  * InitFromFile
@@ -340,402 +361,680 @@ OSStatus FPDocument::InitFromFile() {
 			case FILE_FORMAT_QQ:
 				err = InitFromClassicFile();
 				break;
+			case FILE_FORMAT_BIN:
+				err = InitFromBinaryFile();
+				break;
+			case FILE_FORMAT_SMF:
+				err = InitFromMidiFile();
+
+				// An imported file is never saved over
+				if (!err)
+					exists = false;
+				break;
 			default:
 				err = InitFromXMLFile();
 				break;
 		}
 	}
 
-	if (err)
-		AlertError(err, CFSTR("This is not a file that FretPet recognizes."));
+	if (err) {
+		if (window)
+			AlertError(err, CFSTR("This is not a file that FretPet recognizes."));
+		else
+			fprintf(stderr, "FretPet: Unrecognized file format (%ld)\n", (long)err);
+	}
+
+	return err;
+}
+
+/*!
+ * InitFromMappedFile
+ *
+ * Map the whole file into memory and hand it to a reader,
+ * which checks it and reads straight out of the mapping.
+ */
+OSStatus FPDocument::InitFromMappedFile(OSStatus (FPDocument::*reader)(const UInt8*, UInt64), UInt64 minSize) {
+	OSStatus	err = noErr;
+	struct stat	info;
+
+	char *path = PosixPath();
+	if (path == NULL) return fnfErr;
+
+	int fd = open(path, O_RDONLY);
+	delete [] path;
+
+	if (fd < 0)
+		return fnfErr;
+
+	if (fstat(fd, &info) != 0)
+		err = ioErr;
+	else if ((UInt64)info.st_size < minSize)
+		err = kFPErrorBadFormat;
+	else {
+		void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (data == MAP_FAILED)
+			err = memFullErr;
+		else {
+			err = (this->*reader)((const UInt8*)data, info.st_size);
+			munmap(data, info.st_size);
+		}
+	}
+
+	close(fd);
 
 	return err;
 }
 
+/*!
+ * InitFromClassicFile
+ */
 OSStatus FPDocument::InitFromClassicFile() {
-	FileHead		*head;
-	FileHeadCommon	hc;
-	FileHeadX1		hd;
-	
-	char			*buffer = new char[400];		// about 4 times larger
-	UInt16			calcLen;
-	OldChordInfo	info;
-	FPChordGroup	group;
+	return InitFromMappedFile(&FPDocument::ReadClassicFormat, sizeof(FileHeadCommon));
+}
 
+/*!
+ * ReadClassicFormat
+ *
+ * Read a FretPet Classic document from memory. Nothing
+ * is changed unless the parser accepts the whole file.
+ */
+OSStatus FPDocument::ReadClassicFormat(const UInt8 *data, UInt64 size) {
+	FPClassicParser parser(data, size);
 
-	UInt32 headSize = 0;
-	PartIndex partCount = OLD_NUM_PARTS;
-	
-	OSStatus err = SetOffset(0);
-	nrequire(err, Bailout);
+	OSStatus err = parser.Parse();
+	if (err != noErr) return err;
 
-	// Read the file ID to start
-	UInt32 fileType;
-	err = Read(&fileType, sizeof(UInt32));
-	nrequire(err, Bailout);
-	fileType = EndianU32_BtoN(fileType);
+	const FPClassicHeader &head = parser.Header();
 
-	switch (fileType) {
-		case FILE_FORMAT_B3:
-			headSize = sizeof(FileHeadB3);
-			partCount = 1;
-			break;
-		case FILE_FORMAT_14:
-			headSize = sizeof(FileHead14);
-			break;
-		case FILE_FORMAT_21:
-			headSize = sizeof(FileHead21);
-			break;
-		case FILE_FORMAT_X1:
-			headSize = sizeof(FileHeadX1);
-			break;
-		case FILE_FORMAT_QQ:
-			headSize = sizeof(FileHeadQQ);
-			break;
-		default:
-			err = kFPErrorBadFormat;
-			break;
-	}
-	nrequire(err, Bailout);
+	tempoX		= head.tempoX;
+	SetTempo(head.tempo);
+	cursor		= head.cursor;
+	scaleMode	= head.scaleMode;
+	enharmonic	= head.enharmonic;
+	topLine		= head.topLine;
+	partNum		= head.partNum;
 
 	//
-	// Read the entire header and swap it if necessary
+	// Copy the part settings. Beta 3 only saved the
+	// first part's instrument.
 	//
-	err = Read(buffer + sizeof(UInt32), headSize + sizeof(FileHeadCommon) - sizeof(UInt32));
-	nrequire(err, Bailout);
-	
+	for (PartIndex p=DOC_PARTS; p--;) {
+		const FPClassicPart &src = head.part[p];
+
+		if (head.hasParts || p == 0)
+			part[p].instrument	= FPMidiHelper::FauxGMToTrueGM(src.fauxGMNumber);
+		else
+			part[p].instrument	= player->GetInstrumentNumber(p);
+
+		part[p].velocity		= head.hasParts ? src.velocity : BASE_VELOCITY;
+		part[p].sustain			= head.hasParts ? src.sustain : BASE_SUSTAIN;
 #if QUICKTIME_SUPPORT
-	hd.soloQT			= false;
+		part[p].outQT			= src.outSynth;
 #else
-	hd.soloSynth		= false;
+		part[p].outSynth		= src.outSynth;
 #endif
-	
-	hd.soloMIDI			= false;
-	hd.soloTransform	= false;
-	
-	head = (FileHead*)buffer;
-	
-	hc.fileType		= fileType;
-	hc.lastPoint.h	= EndianS16_BtoN(head->common.lastPoint.h);
-	hc.lastPoint.v	= EndianS16_BtoN(head->common.lastPoint.v);
-	hc.tempo		= EndianU16_BtoN(head->common.tempo);
-	hc.scaleMode	= EndianU16_BtoN(head->common.scaleMode);
-	hc.enharmonic	= EndianU16_BtoN(head->common.enharmonic);
-	hc.tuning		= EndianU16_BtoN(head->common.tuning);
-	hc.length		= EndianU16_BtoN(head->common.length);
-	hc.topLine		= EndianU16_BtoN(head->common.topLine);
-	hc.cursor		= EndianS16_BtoN(head->common.cursor);
-	
+		part[p].outMIDI			= src.outMIDI;
+		part[p].outChannel		= src.outChannel;
+		part[p].transformFlag	= src.transformFlag;
+	}
+
 	//
-	// Test the size of the file for discrepancies
+	// Translate old tuning info into the new format. Older
+	// files only give the index of a built-in tuning.
 	//
-	calcLen = headSize + sizeof(FileHeadCommon) + partCount * hc.length * sizeof(OldChordInfo);
-	
-	//	fprintf(stderr, "Length Should be %d  -  actual length is %lld\n", calcLen, Length());
-	
-	if (calcLen != Length()) {
-		err = kFPErrorBadFormat;
-		goto Bailout;
+	if (head.hasTuning) {
+		CFStringRef name = CFStringCreateWithPascalString(kCFAllocatorDefault, head.tuningName, kCFStringEncodingMacRoman);
+		if (name) {
+			tuning.SetName(name);
+			CFRELEASE(name);
+		}
+		for (int s=NUM_STRINGS; s--;)
+			tuning.tone[s] = head.lowNote[s];
 	}
-	
-	
-	switch (fileType) {
-		case FILE_FORMAT_B3: {
-			FileHeadB3 *data = &head->u.dataB3;
-			
-			hd.partNum	= 0;
-			hd.tempoX	= 1;
-			hd.tuningName[0] = 0;
-			
-			for (PartIndex p=DOC_PARTS; p--;) {
-				hd.part[p].instrument		= p ? player->GetInstrumentNumber(p) : FPMidiHelper::FauxGMToTrueGM(EndianS16_BtoN(data->fauxGMNumber));
-				hd.part[p].velocity			= BASE_VELOCITY;
-				hd.part[p].sustain			= BASE_SUSTAIN;
-#if QUICKTIME_SUPPORT
-				hd.part[p].outQT			= true;
-#else
-				hd.part[p].outSynth			= true;
-#endif
-				hd.part[p].outMIDI			= true;
-				hd.part[p].outChannel		= p;
-				hd.part[p].transformFlag	= true;
+	else {
+		UInt16 t = head.tuning < kBaseTuningCount ? head.tuning : 0;
+		tuning.SetName(CFSTR(""));
+		for (int s=NUM_STRINGS; s--;)
+			tuning.tone[s] = builtinTuning[t].tone[s];
+	}
+
+	//
+	// Read the chords and insert them
+	//
+	parser.ReadGroups(chordGroupArray);
+
+	return noErr;
+}
+
+
+/*!
+ * InitFromMidiFile
+ */
+OSStatus FPDocument::InitFromMidiFile() {
+	return InitFromMappedFile(&FPDocument::ReadMidiFormat, kMidiMinSize);
+}
+
+/*!
+ * ReadMidiFormat
+ *
+ * Import a Standard MIDI File from memory. Each segment
+ * the parser finds becomes a chord group, fingered with
+ * the current tuning. A group the same as the one before
+ * it just repeats that one. Nothing is changed unless the
+ * parser accepts the file.
+ */
+OSStatus FPDocument::ReadMidiFormat(const UInt8 *data, UInt64 size) {
+	FPMidiParser parser(data, size);
+
+	OSStatus err = parser.Parse();
+	if (err != noErr) return err;
+
+	const FPMidiHeader &head = parser.Header();
+
+	// Tempo is in sixteenths per minute
+	UInt32 sixteenths = (UInt32)(4 * MICROSECOND * 60 / head.usPerQuarter + 0.5);
+	tempoX = (sixteenths > kMaxTempo) ? 2 : 1;
+	sixteenths /= tempoX;
+	CONSTRAIN(sixteenths, kMinTempo, kMaxTempo);
+	SetTempo(sixteenths);
+
+	for (PartIndex p=DOC_PARTS; p--;) {
+		UInt8	channel = head.partChannel[p];
+		UInt16	program = head.program[p] == kMidiNoProgram ? 0 : head.program[p];
+
+		if (channel == kMidiNoChannel)
+			part[p].instrument	= player->GetInstrumentNumber(p);
+		else if (channel == kMidiDrumChannel)
+			part[p].instrument	= FPMidiHelper::DrumkitForProgram(program);
+		else
+			part[p].instrument	= program + 1;
+
+		part[p].velocity		= head.velocity[p] ? head.velocity[p] : BASE_VELOCITY;
+		part[p].sustain			= BASE_SUSTAIN;
+	}
+
+	//
+	// Finger each segment and compact repeats as they come
+	//
+	FPMidiSegment	seg;
+	FPChordGroup	group;
+
+	chordGroupArray.clear();
+
+	while (parser.NextSegment(seg)) {
+		parser.SetTones(seg, group, tuning.tone);
+
+		for (PartIndex p=DOC_PARTS; p--;)
+			group[p].NewFingering(tuning.tone, group[p].brakHi);
+
+		parser.SetPattern(seg, group, tuning.tone);
+
+		// Groups are equal whatever their repeat
+		if (chordGroupArray.size()) {
+			FPChordGroup &last = *chordGroupArray.back();
+			UInt16 repeat = last.Repeat() + group.Repeat();
+
+			if (repeat <= MAX_REPEAT && group == last) {
+				last.SetRepeat(repeat);
+				continue;
 			}
-			
-			for (int s=NUM_STRINGS; s--;)
-				hd.lowNote[s] = builtinTuning[hc.tuning].tone[s];
-			break;
 		}
-			
-		case FILE_FORMAT_14: {
-			FileHead14 *data = &head->u.data14;
-			
-			hd.partNum	= EndianU16_BtoN(data->partNum);
-			hd.tempoX	= 1;
-			hd.tuningName[0] = 0;
-			
-			for (PartIndex p=OLD_NUM_PARTS; p--;) {
-				hd.part[p].instrument	= FPMidiHelper::FauxGMToTrueGM(EndianS16_BtoN(data->fauxGMNumbers[p]));
-				hd.part[p].velocity		= EndianU16_BtoN(data->velocity[p]);
-				hd.part[p].sustain		= EndianU16_BtoN(data->sustain[p]);
-#if QUICKTIME_SUPPORT
-				hd.part[p].outQT		= true;
-#else
-				hd.part[p].outSynth		= true;
-#endif
-				hd.part[p].outMIDI		= true;
-				hd.part[p].outChannel	= p;
-				hd.part[p].transformFlag = true;
-			}
-			
-			for (int s=NUM_STRINGS; s--;)
-				hd.lowNote[s] = builtinTuning[hc.tuning].tone[s];
-			
-			break;
+
+		chordGroupArray.append_copy(group);
+	}
+
+	return noErr;
+}
+
+
+/*!
+ * InitFromXMLFile
+ *
+ * Read the bank as an XML file. The plist is parsed as it's
+ * read and each chord group is built as soon as it's parsed,
+ * so memory use stays flat however large the bank is.
+ */
+OSErr FPDocument::InitFromXMLFile() {
+	OSErr err = SetOffset(0);
+	if (err != noErr) return err;
+
+	TPlistReader	reader(*this);
+	ChordIndex		len = 0, curs = 0, sel = -1;
+	bool			hasGroups = false;
+
+	if (reader.Next() != kPlistDictBegin)
+		return kFPErrorBadFormat;
+
+	while (reader.Next() == kPlistKey) {
+		if (reader.IsKey(kStoredInfo)) {
+			if (reader.Next() != kPlistDictBegin)
+				(void)reader.Skip();
+			else if (!ReadXMLInfo(reader, len, curs, sel))
+				break;
 		}
-			
-		case FILE_FORMAT_21: {
-			FileHead21 *data = &head->u.data21;
-			
-			hd.partNum	= EndianU16_BtoN(data->partNum);
-			hd.tempoX	= EndianU16_BtoN(data->tempoX);
-			pstrcpy(hd.tuningName, data->tuningName);
-			
-			for (PartIndex p=OLD_NUM_PARTS; p--;) {
-				hd.part[p].instrument		= FPMidiHelper::FauxGMToTrueGM(EndianS16_BtoN(data->fauxGMNumbers[p]));
-				hd.part[p].velocity			= EndianU16_BtoN(data->velocity[p]);
-				hd.part[p].sustain			= EndianU16_BtoN(data->sustain[p]);
-#if QUICKTIME_SUPPORT
-				hd.part[p].outQT			= true;
-#else
-				hd.part[p].outSynth			= true;
-#endif
-				hd.part[p].outMIDI			= true;
-				hd.part[p].outChannel		= p;
-				hd.part[p].transformFlag	= true;
+		else if (reader.IsKey(kStoredChordGroups)) {
+			if (reader.Next() != kPlistArrayBegin) {
+				(void)reader.Skip();
+				continue;
 			}
-			for (int s=NUM_STRINGS; s--;)
-				hd.lowNote[s] = EndianS16_BtoN(data->lowNote[s]);
-			
-			break;
+
+			//
+			// Each chord group is a dictionary, and one
+			// member is an array of dictionaries
+			//
+			while (reader.Next() == kPlistDictBegin) {
+				FPChordGroup *group = new FPChordGroup();
+				if (!group->ReadXML(reader)) {
+					delete group;
+					break;
+				}
+				chordGroupArray.push_back(group);
+			}
+
+			if (reader.Token() != kPlistArrayEnd)
+				break;
+
+			hasGroups = true;
 		}
-			
-		case FILE_FORMAT_QQ: {
-			FileHeadQQ  *data = &head->u.dataQQ;
-			
-			hd.partNum	= EndianU16_BtoN(data->partNum);
-			hd.tempoX	= EndianU16_BtoN(data->tempoX);
-			pstrcpy(hd.tuningName, data->tuningName);
-			
-			for (PartIndex p=OLD_NUM_PARTS; p--;) {
-				hd.part[p].instrument		= FPMidiHelper::FauxGMToTrueGM(EndianS16_BtoN(data->part[p].fauxGMNumber));
-				hd.part[p].velocity			= EndianU16_BtoN(data->part[p].velocity);
-				hd.part[p].sustain			= EndianU16_BtoN(data->part[p].sustain);
-#if QUICKTIME_SUPPORT
-				hd.part[p].outQT			= data->part[p].outQT;
-#else
-				hd.part[p].outSynth			= data->part[p].outQT;
-#endif
-				hd.part[p].outMIDI			= data->part[p].outMIDI;
-				hd.part[p].outChannel		= EndianU16_BtoN(data->part[p].outChannel);
-				hd.part[p].transformFlag	= true;
+		else
+			(void)reader.SkipNext();
+	}
+
+	if (reader.Token() != kPlistDictEnd || (hasGroups && Size() != len)) {
+		chordGroupArray.clear();
+		return kFPErrorBadFormat;
+	}
+
+	// Set the tempo interim!
+	UpdateInterim();
+
+	// Sanity-check the cursor position, which was written wrong once
+	CONSTRAIN(curs, 0, len);
+	SetCursorLine(curs);
+
+	// Sanity-check the selection for the heck of it
+	CONSTRAIN(sel, -1, len - 1);
+	SetSelectionRaw(sel);
+
+	return err;
+}
+
+/*!
+ * ReadXMLInfo
+ *
+ * Read the info dictionary whose <dict> was just read.
+ * The cursor and selection are checked by the caller.
+ */
+bool FPDocument::ReadXMLInfo(TPlistReader &reader, ChordIndex &len, ChordIndex &curs, ChordIndex &sel) {
+	while (reader.Next() == kPlistKey) {
+		if (reader.IsKey(kStoredLength))
+			len = reader.NextInteger();
+		else if (reader.IsKey(kStoredTempo))
+			tempo = reader.NextInteger();
+		else if (reader.IsKey(kStoredTempoX))
+			tempoX = reader.NextInteger();
+		else if (reader.IsKey(kStoredScaleMode))
+			scaleMode = reader.NextInteger();
+		else if (reader.IsKey(kStoredEnharmonic))
+			enharmonic = reader.NextInteger();
+		else if (reader.IsKey(kStoredTopLine))
+			topLine = reader.NextInteger();
+		else if (reader.IsKey(kStoredCursor))
+			curs = reader.NextInteger();
+		else if (reader.IsKey(kStoredSelection))
+			sel = reader.NextInteger(-1);
+		else if (reader.IsKey(kStoredCurrentPart))
+			partNum = reader.NextInteger();
+		else if (reader.IsKey(kStoredSoloQT))
+			soloQT = reader.NextBool();
+		else if (reader.IsKey(kStoredSoloMIDI))
+			soloMIDI = reader.NextBool();
+		else if (reader.IsKey(kStoredSoloTrans))
+			soloTransform = reader.NextBool();
+		else if (reader.IsKey(kStoredSoloTuneName)) {
+			CFStringRef name = reader.CopyNextString();
+			if (name) {
+				tuning.SetName(name);
+				CFRELEASE(name);
 			}
-			
-			for (int s=NUM_STRINGS; s--;)
-				hd.lowNote[s] = EndianS16_BtoN(data->lowNote[s]);
-			break;
 		}
-			
-		case FILE_FORMAT_X1: {
-			FileHeadX1  *data = &head->u.dataX1;
-			
-			hd.tempoX	= EndianU16_BtoN(data->tempoX);
-			hd.partNum	= EndianS16_BtoN(data->partNum);
-			
-			for (PartIndex p=DOC_PARTS; p--;) {
-				hd.part[p].instrument		= FPMidiHelper::FauxGMToTrueGM(EndianS16_BtoN(data->part[p].instrument));
-				hd.part[p].velocity			= EndianU16_BtoN(data->part[p].velocity);
-				hd.part[p].sustain			= EndianU16_BtoN(data->part[p].sustain);
+		else if (reader.IsKey(kStoredTuningTones))
+			(void)reader.NextIntArray(tuning.tone, NUM_STRINGS);
+		else if (reader.IsKey(kStoredPartsArray)) {
+			if (reader.Next() != kPlistArrayBegin) {
+				(void)reader.Skip();
+				continue;
+			}
+
+			for (PartIndex p=0; reader.Next() == kPlistDictBegin; p++) {
+				if (p >= DOC_PARTS) {
+					if (!reader.Skip()) return false;
+					continue;
+				}
+
+				partInfo	*pinfo = &part[p];
+				UInt16		gmNum = 0, fauxNum = 0;
+
+				while (reader.Next() == kPlistKey) {
+					if (reader.IsKey(kStored_Instrument))
+						gmNum = reader.NextInteger();
+					else if (reader.IsKey(kStored_GMNumber))
+						fauxNum = reader.NextInteger();
+					else if (reader.IsKey(kStored_Velocity))
+						pinfo->velocity = reader.NextInteger();
+					else if (reader.IsKey(kStored_Sustain))
+						pinfo->sustain = reader.NextInteger();
+					else if (reader.IsKey(kStored_OutChannel))
+						pinfo->outChannel = reader.NextInteger();
 #if QUICKTIME_SUPPORT
-				hd.part[p].outQT			= data->part[p].outQT;
+					else if (reader.IsKey(kStored_OutQT))
+						pinfo->outQT = reader.NextBool();
 #else
-				hd.part[p].outSynth			= data->part[p].outSynth;
+					else if (reader.IsKey(kStored_OutSynth))
+						pinfo->outSynth = reader.NextBool();
 #endif
-				hd.part[p].outMIDI			= data->part[p].outMIDI;
-				hd.part[p].outChannel		= EndianU16_BtoN(data->part[p].outChannel);
-				hd.part[p].transformFlag	= data->part[p].transformFlag;
+					else if (reader.IsKey(kStored_OutMidi))
+						pinfo->outMIDI = reader.NextBool();
+					else if (reader.IsKey(kStored_TransformFlag))
+						pinfo->transformFlag = reader.NextBool();
+					else
+						(void)reader.SkipNext();
+				}
+
+				if (reader.Token() != kPlistDictEnd)
+					return false;
+
+				pinfo->instrument = gmNum ? gmNum : FPMidiHelper::FauxGMToTrueGM(fauxNum);
 			}
-			
-			pstrcpy(hd.tuningName, data->tuningName);
-			
-			for (int s=NUM_STRINGS; s--;)
-				hd.lowNote[s] = EndianS16_BtoN(data->lowNote[s]);
-			
-			break;
+
+			if (reader.Token() != kPlistArrayEnd)
+				return false;
 		}
-			
+		else
+			(void)reader.SkipNext();
 	}
-	
-	//
-	// Sanity check the tempo multiplier
-	//
-	if (hd.tempoX < 1 || hd.tempoX > 2)
-		hd.tempoX = 1;
-	
-	//
-	// Copy old-style file header data to the document object
-	//
-	SetTempo(hc.tempo);
-	cursor		= hc.cursor;
-	scaleMode	= hc.scaleMode;
-	enharmonic	= hc.enharmonic;
-	topLine		= hc.topLine;
-	for (PartIndex p=DOC_PARTS; p--;)
-		part[p] = hd.part[p];
-	
-	//
-	// Translate old tuning info into the new format
-	//
-	tuning.name = CFStringCreateWithPascalString(kCFAllocatorDefault, hd.tuningName, kCFStringEncodingMacRoman);
-	
+
+	return reader.Token() == kPlistDictEnd;
+}
+
+/*!
+ * InitFromBinaryFile
+ *
+ * Map the whole file into memory and read the chord table
+ * straight out of the mapping. A large bank costs one pass
+ * over the table and no property list parsing.
+ */
+OSStatus FPDocument::InitFromBinaryFile() {
+	char *path = PosixPath();
+	if (path == NULL) return fnfErr;
+
+	OSStatus err = InitFromBinaryPath(path);
+	delete [] path;
+
+	if (err == noErr)
+		binaryFormat = true;
+
+	return err;
+}
+
+/*!
+ * InitFromBinaryPath
+ *
+ * Read a binary format file by its path, replacing the
+ * chords. This also reads the history's autosave.
+ */
+OSStatus FPDocument::InitFromBinaryPath(const char *path) {
+	OSStatus	err = noErr;
+	struct stat	info;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return fnfErr;
+
+	if (fstat(fd, &info) != 0)
+		err = ioErr;
+	else if ((UInt64)info.st_size < sizeof(FileHeadBinary))
+		err = kFPErrorBadFormat;
+	else {
+		void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (data == MAP_FAILED)
+			err = memFullErr;
+		else {
+			err = ReadBinaryFormat((const UInt8*)data, info.st_size);
+
+			// A loader keeps the mapping until it's done
+			if (loader == NULL)
+				munmap(data, info.st_size);
+		}
+	}
+
+	close(fd);
+
+	return err;
+}
+
+/*!
+ * ReadBinaryFormat
+ *
+ * Read a binary format document from memory. Every size and
+ * count in the header is checked against the data size before
+ * anything is read, and nothing is changed unless it's valid.
+ * Any chords already in the document are replaced.
+ */
+OSStatus FPDocument::ReadBinaryFormat(const UInt8 *data, UInt64 size) {
+	if (size < sizeof(FileHeadBinary))
+		return kFPErrorBadFormat;
+
+	const FileHeadBinary *head = (const FileHeadBinary*)data;
+
+	UInt16		version		= EndianU16_LtoN(head->version),
+				headSize	= EndianU16_LtoN(head->headSize),
+				groupSize	= EndianU16_LtoN(head->groupSize),
+				partCount	= EndianU16_LtoN(head->partCount),
+				nameLength	= EndianU16_LtoN(head->tuningNameLength);
+	ChordIndex	len			= EndianU32_LtoN(head->length);
+	UInt32		unique		= (version >= 2) ? EndianU32_LtoN(head->uniqueCount) : len;
+	UInt64		refSize		= (version >= 2) ? (UInt64)len * sizeof(BinaryGroupRef) : 0;
+
+	if (EndianU32_BtoN(head->fileType) != FILE_FORMAT_BIN
+		|| version < 1
+		|| headSize < sizeof(FileHeadBinary) || (headSize & 1)
+		|| groupSize < sizeof(BinaryChordGroup) || (groupSize & 1)
+		|| partCount != DOC_PARTS
+		|| nameLength > sizeof(head->tuningName)
+		|| len < 0
+		|| unique > (UInt32)len
+		|| headSize + (UInt64)unique * groupSize + refSize != size)
+		return kFPErrorBadFormat;
+
 	//
-	// Get the tuning's tones
+	// Every line must refer to a group in the table
 	//
+	const UInt8 *table = data + headSize,
+				*refs = (version >= 2) ? table + (UInt64)unique * groupSize : NULL;
+
+	if (refs != NULL) {
+		const BinaryGroupRef *ref = (const BinaryGroupRef*)refs;
+		for (ChordIndex c=0; c<len; c++)
+			if (EndianU32_LtoN(ref[c].id) >= unique)
+				return kFPErrorBadFormat;
+	}
+
+	delete loader;
+	loader = NULL;
+	chordGroupArray.clear();
+
+	tempo			= EndianU16_LtoN(head->tempo);
+	tempoX			= EndianU16_LtoN(head->tempoX);
+	scaleMode		= EndianU16_LtoN(head->scaleMode);
+	enharmonic		= EndianU16_LtoN(head->enharmonic);
+	topLine			= EndianS32_LtoN(head->topLine);
+	partNum			= EndianS16_LtoN(head->partNum);
+
+	// Nothing in the file is trusted as an index
+	CONSTRAIN(topLine, 0, len ? len - 1 : 0);
+	CONSTRAIN(partNum, 0, DOC_PARTS - 1);
+
+	UInt16 solo		= EndianU16_LtoN(head->soloFlags);
+	soloQT			= (solo & kBinaryPartSynth) != 0;
+	soloMIDI		= (solo & kBinaryPartMIDI) != 0;
+	soloTransform	= (solo & kBinaryPartTransform) != 0;
+
+	if (tempoX < 1 || tempoX > 2)
+		tempoX = 1;
+
+	UpdateInterim();
+
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		const BinaryPartInfo	&bpart = head->part[p];
+		partInfo				*pinfo = &part[p];
+		UInt16					flags = EndianU16_LtoN(bpart.flags);
+
+		pinfo->instrument	= EndianU16_LtoN(bpart.instrument);
+		pinfo->velocity		= EndianU16_LtoN(bpart.velocity);
+		pinfo->sustain		= EndianU16_LtoN(bpart.sustain);
+		pinfo->outChannel	= EndianU16_LtoN(bpart.outChannel);
+#if QUICKTIME_SUPPORT
+		pinfo->outQT		= (flags & kBinaryPartSynth) != 0;
+#else
+		pinfo->outSynth		= (flags & kBinaryPartSynth) != 0;
+#endif
+		pinfo->outMIDI		= (flags & kBinaryPartMIDI) != 0;
+		pinfo->transformFlag = (flags & kBinaryPartTransform) != 0;
+	}
+
+	CFStringRef name = CFStringCreateWithBytes(kCFAllocatorDefault, (const UInt8*)head->tuningName, nameLength, kCFStringEncodingUTF8, false);
+	if (name) {
+		tuning.SetName(name);
+		CFRELEASE(name);
+	}
+
 	for (int s=NUM_STRINGS; s--;)
-		tuning.tone[s] = hd.lowNote[s];
-	
+		tuning.tone[s] = EndianS16_LtoN(head->lowNote[s]);
+
 	//
-	// Read the chords and insert them
+	// Build the chord groups from the table. A large bank
+	// being opened in a window only reads the groups that
+	// will be seen first and leaves the rest to a loader.
 	//
-	for (ChordIndex i=0; i<=hc.length - 1; i++) {
-		for (PartIndex p=0; p<DOC_PARTS; p++) {
-			if (p < partCount) {
-				err = Read(&info, sizeof(OldChordInfo));
-				group[p].Set(info);
-			}
-			else {
-				group[p] = group[partCount-1];
-				group[p].ClearPattern();
-			}
-			
-			if (p > 0) {
-				group[p].SetRepeat(group.Repeat());
-				group[p].SetPatternSize(group.PatternSize());
-			}
+	if (window != NULL && len >= kLazyLoadThreshold) {
+		for (ChordIndex c=0; c<len; c++)
+			chordGroupArray.push_back(new FPChordGroup());
+
+		loader = new FPDocumentLoader(this, data, size, table, refs, groupSize, len);
+	}
+	else {
+		for (ChordIndex c=0; c<len; c++) {
+			FPChordGroup *group = new FPChordGroup();
+			ReadBinaryGroup(BinaryGroupRecord(table, refs, groupSize, c), *group);
+			chordGroupArray.push_back(group);
 		}
-		
-		chordGroupArray.append_copy(group);
 	}
 
-Bailout:
-	delete [] buffer;
-	
-	return err;
+	// Sanity-check the cursor and selection as for XML
+	ChordIndex	curs = EndianS32_LtoN(head->cursor);
+	CONSTRAIN(curs, 0, len);
+	SetCursorLine(curs);
+
+	ChordIndex	sel = EndianS32_LtoN(head->selection);
+	CONSTRAIN(sel, -1, len - 1);
+	SetSelectionRaw(sel);
+
+	if (loader != NULL) {
+		loader->Load(topLine - kLoaderMargin, topLine + kLoaderMargin);
+		loader->Load(curs - kLoaderMargin, curs + kLoaderMargin);
+		loader->StartTimer();
+	}
+
+	return noErr;
 }
 
+/*!
+ * BinaryGroupRecord
+ *
+ * Find the record in the chord table for a line. Lines
+ * are looked up in the list of IDs if there is one.
+ */
+const UInt8* FPDocument::BinaryGroupRecord(const UInt8 *table, const UInt8 *refs, UInt16 groupSize, ChordIndex line) {
+	UInt32 id = refs ? EndianU32_LtoN(((const BinaryGroupRef*)refs)[line].id) : line;
+	return table + (UInt64)id * groupSize;
+}
 
 /*!
- * InitFromXMLFile
+ * ReadBinaryGroup
  *
- * Read the bank as an XML file
+ * Fill in a chord group from one record of the chord table.
+ * Fields are forced into range as in the classic parser,
+ * since the tones, root and key are used to index tables.
  */
-OSErr FPDocument::InitFromXMLFile() {
-	OSErr err = SetOffset(0);
-	if (err != noErr) return err;
+void FPDocument::ReadBinaryGroup(const UInt8 *record, FPChordGroup &group) {
+	const BinaryChordGroup	*bgroup = (const BinaryChordGroup*)record;
+	UInt16					beats = EndianU16_LtoN(bgroup->beats),
+							repeat = EndianU16_LtoN(bgroup->repeat);
 
-	TDictionary *fileDict = ReadXMLFile();
-	
-	if ( !fileDict->IsValid() || !fileDict->IsValidPropertyList(kCFPropertyListXMLFormat_v1_0) ) {
-		err = kFPErrorBadFormat;
+	CONSTRAIN(beats, 1, MAX_BEATS);
+
+	if (repeat > MAX_REPEAT)
+		repeat = MAX_REPEAT;
+
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		const BinaryChord	&bchord = bgroup->chord[p];
+		FPChord				&chord = group[p];
+		UInt16				flags = EndianU16_LtoN(bchord.flags);
+
+		chord.tones			= EndianU16_LtoN(bchord.tones) & 0x0FFF;
+		chord.root			= EndianU16_LtoN(bchord.root) % OCTAVE;
+		chord.key			= EndianU16_LtoN(bchord.key) % OCTAVE;
+		chord.rootModifier	= EndianS16_LtoN(bchord.rootModifier);
+		chord.rootScaleStep	= EndianS16_LtoN(bchord.rootScaleStep);
+		chord.brakLow		= EndianU16_LtoN(bchord.brakLow);
+		chord.brakHi		= EndianU16_LtoN(bchord.brakHi);
+		chord.rootLock		= (flags & kBinaryChordRootLock) != 0;
+		chord.bracketFlag	= (flags & kBinaryChordBracket) != 0;
+		chord.beats			= beats;
+		chord.repeat		= repeat;
+
+		if (chord.brakHi > MAX_FRETS)
+			chord.brakHi = MAX_FRETS;
+
+		if (chord.brakLow > chord.brakHi)
+			chord.brakLow = chord.brakHi;
+
+		for (int s=NUM_STRINGS; s--;) {
+			chord.fretHeld[s]	= EndianS16_LtoN(bchord.fretHeld[s]);
+			chord.pick[s]		= EndianU16_LtoN(bchord.pick[s]);
+			CONSTRAIN(chord.fretHeld[s], -1, MAX_FRETS);
+		}
 	}
-	else {
-		TDictionary infoDict( fileDict->GetDictionary(kStoredInfo) );
-		
-		CFStringRef	versString = infoDict.GetString(kStoredVersion);
-		CFRETAIN(versString);
-		// Do nothing for now. Eventually might need to use this info
-		CFRELEASE(versString);
-		
-		ChordIndex len = infoDict.GetInteger(kStoredLength);
-		
-		tempo		= infoDict.GetInteger(kStoredTempo);
-		tempoX		= infoDict.GetInteger(kStoredTempoX);
-		scaleMode	= infoDict.GetInteger(kStoredScaleMode);
-		enharmonic	= infoDict.GetInteger(kStoredEnharmonic);
-		topLine		= infoDict.GetInteger(kStoredTopLine);
-		partNum		= infoDict.GetInteger(kStoredCurrentPart);
-		soloQT		= infoDict.GetBool(kStoredSoloQT);
-		soloMIDI	= infoDict.GetBool(kStoredSoloMIDI);
-		soloTransform = infoDict.GetBool(kStoredSoloTrans);
-		
-		// Set the tempo interim!
-		UpdateInterim();
-		
-		// Sanity-check the cursor position, which was written wrong once
-		ChordIndex	curs = infoDict.GetInteger(kStoredCursor);
-		CONSTRAIN(curs, 0, len);
-		SetCursorLine(curs);
-		
-		// Sanity-check the selection for the heck of it
-		ChordIndex	sel = infoDict.GetInteger(kStoredSelection, -1);
-		CONSTRAIN(sel, -1, len - 1);
-		SetSelectionRaw(sel);
-		
-		tuning.name = infoDict.GetString(kStoredSoloTuneName);
-		CFRETAIN(tuning.name);
-		
-		(void)infoDict.GetIntArray(kStoredTuningTones, tuning.tone, NUM_STRINGS);
-		
-		CFArrayRef partsArray = infoDict.GetArray(kStoredPartsArray);
-		CFRETAIN(partsArray);
-		
-		for (PartIndex p=0; p<DOC_PARTS; p++) {
-			partInfo *pinfo = &part[p];
-			
-			TDictionary partDict( (CFMutableDictionaryRef)CFArrayGetValueAtIndex(partsArray, p) );
+}
 
-			UInt16 gmNum = partDict.GetInteger(kStored_Instrument);
+/*!
+ * LoadRange
+ *
+ * Make sure a range of groups has been read, as before
+ * copying them without going through ChordGroup
+ */
+void FPDocument::LoadRange(ChordIndex start, ChordIndex end) {
+	if (loader != NULL)
+		loader->Load(start, end);
+}
 
-			pinfo->instrument	= gmNum ? gmNum : FPMidiHelper::FauxGMToTrueGM(partDict.GetInteger(kStored_GMNumber));
-			pinfo->velocity		= partDict.GetInteger(kStored_Velocity);
-			pinfo->sustain		= partDict.GetInteger(kStored_Sustain);
-			pinfo->outChannel	= partDict.GetInteger(kStored_OutChannel);
-#if QUICKTIME_SUPPORT
-			pinfo->outQT		= partDict.GetBool(kStored_OutQT);
-#else
-			pinfo->outSynth		= partDict.GetBool(kStored_OutSynth);
-#endif
-			pinfo->outMIDI		= partDict.GetBool(kStored_OutMidi);
-			pinfo->transformFlag = partDict.GetBool(kStored_TransformFlag);
-		}
-		
-		CFRELEASE(partsArray);
-		
-		//
-		// Get the chord groups as an ordered array
-		//
-		//	Each chord group is a dictionary, and one
-		//	member is an array of dictionaries
-		//
-		CFArrayRef docArray = fileDict->GetArray(kStoredChordGroups);
-		if ( docArray ) {
-			if (CFArrayGetCount(docArray) != len)
-				err = kFPErrorBadFormat;
-			else {
-				for (ChordIndex c=0; c<len; c++) {
-					CFDictionaryRef	dictRef = (CFDictionaryRef)CFArrayGetValueAtIndex(docArray, c);
-					TDictionary		groupDict( dictRef );
-					chordGroupArray.push_back( new FPChordGroup(groupDict) );
-				}
-			}
-			
-			CFRELEASE(docArray);
-		}
-		
+/*!
+ * FinishLoading
+ *
+ * Read whatever a loader hasn't read yet and get rid of it.
+ * This is done before anything inserts or deletes groups.
+ */
+void FPDocument::FinishLoading() {
+	if (loader != NULL) {
+		FPDocumentLoader *oldLoader = loader;
+		loader = NULL;
+
+		oldLoader->Load(0, Size() - 1);
+		delete oldLoader;
 	}
-	
-	delete fileDict;
-	
-	return err;
 }
 
 /*!
@@ -763,99 +1062,221 @@ void FPDocument::TerminateNavDialogs() {
 /*!
  * WriteXMLFormat
  *
- * Save as an XML file (about bloody time too)
+ * Save as an XML file (about bloody time too). The plist is
+ * streamed out one chord group at a time instead of being
+ * built in memory first.
  */
 OSErr FPDocument::WriteXMLFormat() {
-	SInt32		err = noErr;
-	ChordIndex	len = Size();
-	
-	TDictionary fileDict;	// Main dictionary
-	TDictionary infoDict;	// Info (header)
-	
+	ChordIndex		len = Size();
+	TPlistWriter	writer(*this);
+
+	writer.BeginDictionary();
+
+	// Info (header)
+	writer.BeginDictionary(kStoredInfo);
+
 	// Version
-	infoDict.SetString(kStoredVersion, FILE_FORMAT_XML_LOOSE);
-	
+	writer.SetString(kStoredVersion, FILE_FORMAT_XML_LOOSE);
+
 	// And more
-	infoDict.SetInteger(kStoredTempo, Tempo());							// Tempo
-	infoDict.SetInteger(kStoredTempoX, TempoMultiplier());				// Tempo X
-	infoDict.SetInteger(kStoredScaleMode, ScaleMode());					// Scale
-	infoDict.SetInteger(kStoredEnharmonic, Enharmonic());				// Enharmonic
-	infoDict.SetInteger(kStoredLength, len);							// Doc Length
-	infoDict.SetInteger(kStoredTopLine, TopLine());						// Top Line
-	infoDict.SetInteger(kStoredCursor, GetCursor());					// Cursor
-	infoDict.SetInteger(kStoredSelection, SelectionEnd());				// The selection end (add 1 for legacy reasons)
-	infoDict.SetInteger(kStoredCurrentPart, CurrentPart());				// Part Number
-	infoDict.SetBool(kStoredSoloQT, soloQT);							// Solo QT			(future)
-	infoDict.SetBool(kStoredSoloMIDI, soloMIDI);						// Solo MIDI		(future)
-	infoDict.SetBool(kStoredSoloTrans, soloTransform);					// Solo Transform	(future)
-	infoDict.SetString(kStoredSoloTuneName, tuning.name);				// Tuning Name
-	infoDict.SetIntArray(kStoredTuningTones, tuning.tone, NUM_STRINGS);	// Tuning Tones
-	
+	writer.SetInteger(kStoredTempo, Tempo());							// Tempo
+	writer.SetInteger(kStoredTempoX, TempoMultiplier());				// Tempo X
+	writer.SetInteger(kStoredScaleMode, ScaleMode());					// Scale
+	writer.SetInteger(kStoredEnharmonic, Enharmonic());				// Enharmonic
+	writer.SetInteger(kStoredLength, len);								// Doc Length
+	writer.SetInteger(kStoredTopLine, TopLine());						// Top Line
+	writer.SetInteger(kStoredCursor, GetCursor());						// Cursor
+	writer.SetInteger(kStoredSelection, SelectionEnd());				// The selection end (add 1 for legacy reasons)
+	writer.SetInteger(kStoredCurrentPart, CurrentPart());				// Part Number
+	writer.SetBool(kStoredSoloQT, soloQT);								// Solo QT			(future)
+	writer.SetBool(kStoredSoloMIDI, soloMIDI);							// Solo MIDI		(future)
+	writer.SetBool(kStoredSoloTrans, soloTransform);					// Solo Transform	(future)
+	writer.SetString(kStoredSoloTuneName, tuning.name);					// Tuning Name
+	writer.SetIntArray(kStoredTuningTones, tuning.tone, NUM_STRINGS);	// Tuning Tones
+
 	// The partInfo array
-	TDictionary				partDictList[DOC_PARTS];
-	CFMutableDictionaryRef	partDictRefs[DOC_PARTS];
-	
+	writer.BeginArray(kStoredPartsArray);
+
 	for (PartIndex p=0; p<DOC_PARTS; p++) {
-		partInfo	&pinfo = part[p];
-		TDictionary	&partDict = partDictList[p];
-		partDictRefs[p] = partDict.GetDictionaryRef();
-		
-		partDict.SetInteger(kStored_Instrument, pinfo.instrument);
-		partDict.SetInteger(kStored_Velocity, pinfo.velocity);
-		partDict.SetInteger(kStored_Sustain, pinfo.sustain);
-		partDict.SetInteger(kStored_OutChannel, pinfo.outChannel);
+		partInfo &pinfo = part[p];
+
+		writer.BeginDictionary();
+		writer.SetInteger(kStored_Instrument, pinfo.instrument);
+		writer.SetInteger(kStored_Velocity, pinfo.velocity);
+		writer.SetInteger(kStored_Sustain, pinfo.sustain);
+		writer.SetInteger(kStored_OutChannel, pinfo.outChannel);
 #if QUICKTIME_SUPPORT
-		partDict.SetBool(kStored_OutQT, pinfo.outQT);
+		writer.SetBool(kStored_OutQT, pinfo.outQT);
 #else
-		partDict.SetBool(kStored_OutSynth, pinfo.outSynth);
+		writer.SetBool(kStored_OutSynth, pinfo.outSynth);
 #endif
-		partDict.SetBool(kStored_OutMidi, pinfo.outMIDI);
-		partDict.SetBool(kStored_TransformFlag, pinfo.transformFlag);
+		writer.SetBool(kStored_OutMidi, pinfo.outMIDI);
+		writer.SetBool(kStored_TransformFlag, pinfo.transformFlag);
+		writer.EndDictionary();
 	}
-	
-	CFArrayRef partsArray = CFArrayCreate(
-										  kCFAllocatorDefault,
-										  (const void **)partDictRefs,
-										  DOC_PARTS,
-										  &kCFTypeArrayCallBacks );
-	
-	infoDict.SetArray(kStoredPartsArray, partsArray);
-	
-	CFRELEASE(partsArray);
-	
-	
-	// Add the parts info array to the file
-	fileDict.SetDictionary(kStoredInfo, infoDict);
-	
-	
+
+	writer.EndArray();
+	writer.EndDictionary();
+
 	//
-	// Build the saveable chord array as an array of dictionaries.
+	// The chord array as an array of dictionaries.
 	//	(Most of the work is done by ChordGroup)
 	//
-	TDictionary		*groupDictList[len];
-	CFDictionaryRef	groupRefList[len];
-	for (ChordIndex c=0; c<len; c++) {
-		TDictionary *dict = chordGroupArray[c].GetDictionary();
-		groupDictList[c] = dict;
-		groupRefList[c] = dict->GetDictionaryRef();
+	writer.BeginArray(kStoredChordGroups);
+
+	for (ChordIndex c=0; c<len && writer.Error() == noErr; c++)
+		chordGroupArray[c].WriteXML(writer);
+
+	writer.EndArray();
+	writer.EndDictionary();
+
+	return writer.Finish();
+}
+
+
+/*!
+ * WriteBinaryFormat
+ *
+ * Save in the binary format. Each different chord group is
+ * written once and every line refers to one by its ID, so
+ * a bank with a lot of repetition makes a small file. The
+ * chord table is converted and written in blocks, so saving
+ * a large bank needs very little memory beyond the document
+ * itself and an ID for each line.
+ */
+OSErr FPDocument::WriteBinaryFormat() {
+	OSErr				err = noErr;
+	ChordIndex			len = Size();
+	FileHeadBinary		head;
+	FPChordGroupStore	store(len);
+	std::vector<UInt32>	idList(len);
+
+	for (ChordIndex c=0; c<len; c++)
+		idList[c] = store.Add(ChordGroup(c));
+
+	UInt32 unique = store.Size();
+
+	bzero(&head, sizeof(head));
+
+	head.fileType		= EndianU32_NtoB(FILE_FORMAT_BIN);
+	head.version		= EndianU16_NtoL(FILE_BINARY_VERSION);
+	head.headSize		= EndianU16_NtoL(sizeof(FileHeadBinary));
+	head.length			= EndianU32_NtoL(len);
+	head.uniqueCount	= EndianU32_NtoL(unique);
+	head.groupSize		= EndianU16_NtoL(sizeof(BinaryChordGroup));
+	head.partCount		= EndianU16_NtoL(DOC_PARTS);
+	head.tempo			= EndianU16_NtoL(Tempo());
+	head.tempoX			= EndianU16_NtoL(TempoMultiplier());
+	head.scaleMode		= EndianU16_NtoL(ScaleMode());
+	head.enharmonic		= EndianU16_NtoL(Enharmonic());
+	head.topLine		= EndianS32_NtoL(TopLine());
+	head.cursor			= EndianS32_NtoL(GetCursor());
+	head.selection		= EndianS32_NtoL(SelectionEnd());
+	head.partNum		= EndianS16_NtoL(CurrentPart());
+	head.soloFlags		= EndianU16_NtoL(
+							(soloQT ? kBinaryPartSynth : 0)
+							| (soloMIDI ? kBinaryPartMIDI : 0)
+							| (soloTransform ? kBinaryPartTransform : 0) );
+
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		const partInfo	&pinfo = part[p];
+		BinaryPartInfo	&bpart = head.part[p];
+
+#if QUICKTIME_SUPPORT
+		bool synth = pinfo.outQT;
+#else
+		bool synth = pinfo.outSynth;
+#endif
+
+		bpart.instrument	= EndianU16_NtoL(pinfo.instrument);
+		bpart.velocity		= EndianU16_NtoL(pinfo.velocity);
+		bpart.sustain		= EndianU16_NtoL(pinfo.sustain);
+		bpart.outChannel	= EndianU16_NtoL(pinfo.outChannel);
+		bpart.flags			= EndianU16_NtoL(
+								(synth ? kBinaryPartSynth : 0)
+								| (pinfo.outMIDI ? kBinaryPartMIDI : 0)
+								| (pinfo.transformFlag ? kBinaryPartTransform : 0) );
 	}
-	
-	CFArrayRef chordsArray = CFArrayCreate(
-										   kCFAllocatorDefault,
-										   (const void **)groupRefList,
-										   len,
-										   &kCFTypeArrayCallBacks );
-	
-	fileDict.SetArray(kStoredChordGroups, chordsArray);
-	
-	for (ChordIndex c=len; c--;)
-		delete groupDictList[c];
-	
-	CFRELEASE(chordsArray);
-	
-	// Write the dictionary out as XML data
-	err = WriteXMLFile(fileDict.GetDictionaryRef());
-	
+
+	for (int s=NUM_STRINGS; s--;)
+		head.lowNote[s] = EndianS16_NtoL(tuning.tone[s]);
+
+	if (tuning.name) {
+		CFIndex used = 0;
+		(void)CFStringGetBytes(
+							   tuning.name,
+							   CFRangeMake(0, CFStringGetLength(tuning.name)),
+							   kCFStringEncodingUTF8, '?', false,
+							   (UInt8*)head.tuningName, sizeof(head.tuningName), &used);
+		head.tuningNameLength = EndianU16_NtoL(used);
+	}
+
+	err = Write(&head, sizeof(head));
+	nrequire(err, BailSave);
+
+	//
+	// Convert and write the chord table a block at a time
+	//
+	{
+		BinaryChordGroup *buffer = new BinaryChordGroup[kBinaryGroupsPerWrite];
+
+		for (UInt32 start=0; err == noErr && start < unique; start += kBinaryGroupsPerWrite) {
+			UInt32 count = MIN(unique - start, kBinaryGroupsPerWrite);
+
+			for (UInt32 i=0; i<count; i++) {
+				const FPChordGroup	&group = store[start + i];
+				BinaryChordGroup	&bgroup = buffer[i];
+
+				bgroup.beats	= EndianU16_NtoL(group.PatternSize());
+				bgroup.repeat	= EndianU16_NtoL(group.Repeat());
+
+				for (PartIndex p=0; p<DOC_PARTS; p++) {
+					const FPChord	&chord = group[p];
+					BinaryChord		&bchord = bgroup.chord[p];
+
+					bchord.tones			= EndianU16_NtoL(chord.tones);
+					bchord.root				= EndianU16_NtoL(chord.root);
+					bchord.key				= EndianU16_NtoL(chord.key);
+					bchord.rootModifier		= EndianS16_NtoL(chord.rootModifier);
+					bchord.rootScaleStep	= EndianS16_NtoL(chord.rootScaleStep);
+					bchord.brakLow			= EndianU16_NtoL(chord.brakLow);
+					bchord.brakHi			= EndianU16_NtoL(chord.brakHi);
+					bchord.flags			= EndianU16_NtoL(
+												(chord.rootLock ? kBinaryChordRootLock : 0)
+												| (chord.bracketFlag ? kBinaryChordBracket : 0) );
+
+					for (int s=NUM_STRINGS; s--;) {
+						bchord.fretHeld[s]	= EndianS16_NtoL(chord.fretHeld[s]);
+						bchord.pick[s]		= EndianU16_NtoL(chord.pick[s]);
+					}
+				}
+			}
+
+			err = Write(buffer, count * sizeof(BinaryChordGroup));
+		}
+
+		delete [] buffer;
+	}
+
+	//
+	// Then the ID of each line's group
+	//
+	{
+		BinaryGroupRef *buffer = new BinaryGroupRef[kBinaryGroupsPerWrite];
+
+		for (ChordIndex start=0; err == noErr && start < len; start += kBinaryGroupsPerWrite) {
+			ChordIndex count = MIN(len - start, kBinaryGroupsPerWrite);
+
+			for (ChordIndex i=0; i<count; i++)
+				buffer[i].id = EndianU32_NtoL(idList[start + i]);
+
+			err = Write(buffer, count * sizeof(BinaryGroupRef));
+		}
+
+		delete [] buffer;
+	}
+
+BailSave:
 	return err;
 }
 
@@ -998,6 +1419,9 @@ OSErr FPDocument::OpenAndSave() {
 		}
 	}
 	
+	// The loader maps the file, which is about to be truncated
+	FinishLoading();
+
 	return TFile::OpenAndSave();
 }
 
@@ -1005,9 +1429,10 @@ OSErr FPDocument::OpenAndSave() {
  *	WriteData
  */
 OSErr FPDocument::WriteData() {
-	return preferences.GetBoolean(kPrefFormat214)
-	? WriteFormat214()
-	: WriteXMLFormat();
+	if (preferences.GetBoolean(kPrefFormat214))
+		return WriteFormat214();
+
+	return binaryFormat ? WriteBinaryFormat() : WriteXMLFormat();
 }
 
 #pragma mark - File Navigator
@@ -1090,104 +1515,47 @@ void FPDocument::NavDidSave() {
 }
 
 #pragma mark - MIDI Export
+
+OSStatus FPDocument::ExportMIDI() {
+	return midiExporter->SaveAs();
+}
+
 /*!
- *	MIDI FILE HELPER MACROS
- *
- *	(c)hannel	(n)ote		(v)alue		(l)ength
+ * CopyInstrumentName
  *
+ *	Get a part's instrument name as UTF-8 for export. The
+ *	name from the player is only used if it was made for
+ *	this part's instrument, so documents exported in a batch
+ *	get their own names and the player is never asked.
  */
+void FPDocument::CopyInstrumentName(PartIndex p, char *name, UInt16 size) const {
+	UInt16 trueGM = GetInstrument(p);
 
-#define midi_Using					int sentOn = 99
-
-#define midi_NoteOn(z,c,n,v,ver)	if (ver || sentOn != (c)) { buff_Byte(z, 0x90|(c)); sentOn = c; } \
-									buff_Byte(z, n); buff_Byte(z, v)
-
-#define midi_NoteOff(z,c,n,ver)		if (ver) buff_Byte(z, 0x80|(c)); \
-									else if (sentOn != (c)) { buff_Byte(z, 0x90|(c)); sentOn = c; } \
-									buff_Byte(z, n); buff_Byte(z, ver ? 0x40 : 0x00)
-
-#define midi_Aftertouch(z,c,n,v)	buff_Byte(z, 0xA0|(c)); buff_Byte(z, n); buff_Byte(z, v)
-#define midi_ControlChange(z,c,k,v)	buff_Byte(z, 0xB0|(c)); buff_Byte(z, k); buff_Byte(z, v)
-#define midi_Program(z,c,p)			buff_Byte(z, 0xC0|(c)); buff_Byte(z, p)
-
-#define midi_AllNotesOff(z,c)		midi_ControlChange(z, c, 123, 0)
-
-#define midi_BankSelect(z,c,n);		midi_ControlChange(z, c, 0x00, (n) >> 8); \
-									midi_NullDelay(z); \
-									midi_ControlChange(z, c, 0x20, (n) & 0xFF)
-
-#define midi_MetaEvent(z,e,l)		buff_Byte(z, 0xFF); buff_Byte(z, e); buff_Byte(z, l)
-
-#define midi_EndMarker(z)			midi_MetaEvent(z, 0x2F, 0); sentOn = 99
-
-#define midi_Tempo(z,t)				midi_MetaEvent(z, 0x51, 3); buff_TrioBE(w, t)
-
-#define midi_SMPTE60(z)				midi_MetaEvent(z, 0x54, 5); \
-									buff_Byte(z, 0x60); \
-									buff_LongBE(z, 0x00000000)
-
-#define midi_TimeSig(z,a,b,t,q)		midi_MetaEvent(z, 0x58, 4); \
-									buff_Byte(z, a); \
-									buff_Byte(z, b); \
-									buff_Byte(z, t); \
-									buff_Byte(z, q)
-
-#define midi_NullDelay(z)			midi_Delay(z, 0)
-
-#define midi_HeadTag(z)				buff_LongBE(z, 'MThd')
-
-#define midi_TrackTag(z)			buff_LongBE(z, 'MTrk')
-
-#define midi_Header(z,f,t,q)		midi_HeadTag(z); \
-									buff_LongBE(z, 6); \
-									buff_WordBE(z, f); \
-									buff_WordBE(z, t); \
-									buff_WordBE(z, q)
-
+	if (namedInstrument[p] == trueGM
+		&& CFStringGetCString(instrumentName[p].GetCFStringRef(), name, size, kCFStringEncodingUTF8) && name[0])
+		return;
 
-/*!
- *	midi_Delay
- */
-void midi_Delay(char*& ptw, long delay);
-void midi_Delay(char*& ptw, long delay) {
-	char	b[4];
-	int i;
-	for (i=4; i--;) {
-		b[i] = (delay & 0x7F) | ((i < 3) ? 0x80 : 0x00);
-		if (!(delay >>= 7)) break;
-	}
-	while (i < 4) buff_Byte(ptw, b[i++]);
+	FPMidiHelper::CopyInstrumentName(trueGM, name, size);
 }
 
 
 /*!
- *	midi_Text
+ * PrepareMidiWriter
+ *
+ *	Give a MIDI writer every part's instrument, name,
+ *	velocity and sustain. A quarter note lasts four
+ *	times Interim(), the time of one sixteenth.
  */
-enum {
-	kMidiTextGeneric = 1,
-	kMidiTextCopyright,
-	kMidiTextTrack,
-	kMidiTextInstrument,
-	kMidiTextLyric,
-	kMidiTextMarker,
-	kMidiTextCue
-};
-void midi_Text(char*& ptw, char event, const char *someText);
-void midi_Text(char*& ptw, char event, const char *someText) {
-	size_t len = strlen(someText);
-
-	buff_Byte(ptw, 0xFF);
-	buff_Byte(ptw, event);
-	buff_Byte(ptw, len);
+void FPDocument::PrepareMidiWriter(FPMidiWriter &writer) const {
+	char name[kMidiNameSize];
 
-	while (len--) buff_Byte(ptw, *someText++);
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		CopyInstrumentName(p, name, sizeof(name));
+		writer.SetPart(p, name, GetInstrument(p), Velocity(p), Sustain(p));
+	}
 }
 
 
-OSStatus FPDocument::ExportMIDI() {
-	return midiExporter->SaveAs();
-}
-
 /*!
  * GetFormat0
  *
@@ -1195,582 +1563,43 @@ OSStatus FPDocument::ExportMIDI() {
  *	channels combined into a single track.
  */
 Handle FPDocument::GetFormat0() {
-	PartIndex p;
-	UInt32 msPer16th = Interim(), msPer4th = Interim() * 4;
-	UInt16 stopNote[DOC_PARTS][100];
-	UInt16 channel[DOC_PARTS], velocity, item, beat, str;
-	bool verbose = preferences.GetBoolean(kPrefVerboseMidi, TRUE);
-
-	midi_Using;
-	//
-	// PlayTempo() is BPM * 4
-	// Interim() is 60 / PlayTempo() * MICROSECOND - the amount of time between individual notes
-	//
-	//    Quarternotes per second:	Tempo / 240 * 4
-	//    Sixteenths per second:	Tempo / 240
-	// Take the reciprocal to get the fractional amount of seconds:
-	//    Seconds per Quarternote:	1 / QPs
-	//    Seconds per Sixteenth:	1 / SPs
-	// Multiply by 1,000,000 to get microseconds:
-	//    MS per QuarterNote:		sPQ * MICROSECOND
-	//    MS per Sixteenth:			sPS * MICROSECOND
-	// Add it all together and you get...
-	//    MS per QuarterNote:		(1.0 / (BPM / 60)) * MICROSECOND
-	//    MS per Sixteenth:			(1.0 / (BPM / (60 * 4))) * MICROSECOND
-	//
-	// Old code was...
-	//    msPer4th = (UInt32)(240.0 * MICROSECOND / (float)PlayTempo());
-	// New code would be...
-	//    msPer4th = (UInt32)(240.0 * MICROSECOND / PlayTempo());
-
-
-	//
-	// Allocate a buffer of a reasonable starting size
-	//
-	Handle midiHandle = NewHandle(BUFFER_CHUNK_SIZE);
-	HLock(midiHandle);
-	char *buffer = *midiHandle, *w = buffer;
-	
-	// Insert the standard MIDI Header
-	midi_Header(w, 0, 1, TICKS_PER_4TH);	// Format 0, 1 Track...		(TODO: Try E728 for millisecond timing)
-	
-	// Begin the single Track
-	midi_TrackTag(w);
-	UInt32 sizeIndex = w - buffer;
-	buff_LongBE(w, 0);
-	UInt32 trackStartIndex = w - buffer;
-	midi_NullDelay(w);
-	
-	// Give credit to FretPet
-	midi_Text(w, kMidiTextCopyright, "Created with FretPet X " FRETPET_VERSION);
-	midi_NullDelay(w);
-	
-	// SMPTE time marker
-	//	midi_SMPTE60(w);
-	//	midi_NullDelay(w);
-
-	//
-	// Set the tempo and Time Signature
-	//
-	midi_Tempo(w, msPer4th);		// Microsecond duration of each Quarter Note
-	midi_NullDelay(w);
-	midi_TimeSig(w, 4, 2, 24, 8);	// 4/2, 24 ticks in metronome, 8 32nd notes per 1/4
-	
-	
-	// Format 0 contains all program changes up front
-	for (p=0; p<DOC_PARTS; p++) {
-		UInt16 trueGM = player->GetInstrumentNumber(p);
-		channel[p] = (trueGM >= kFirstDrumkit && trueGM <= kLastDrumkit) ? 9 : p;
-		midi_NullDelay(w);
-		
-		//		if (select0)
-		//		{
-		UInt16 bank = 0;
-		if (trueGM >= kFirstDrumkit && trueGM <= kLastDrumkit)
-			bank = 1;
-		else if (trueGM >= kFirstGSInstrument-1 && trueGM <= kLastGSInstrument-1)
-			bank = (trueGM >> 7) << 8;
-		
-		midi_BankSelect(w, channel[p], bank);
-		midi_NullDelay(w);
-		//		}
-		
-		midi_Program(w, channel[p], (trueGM - 1) & 0x7F);
-	}
-	
-	
-	// Prepare the note-stops array
-	UInt32 stopTime[DOC_PARTS][NUM_OCTAVES * OCTAVE];
-	bzero(stopTime, sizeof(stopTime));
-	
-	
-	// Loop through the sequence writing out events
-	UInt32 tickCount = 0, lastEvent = 0;
-	for (item=0; item<Size(); item++) {
-		for (int rept=ChordGroup(item).Repeat(); rept--;) {
-			for (beat=0; beat<ChordGroup(item).PatternSize(); beat++) {
-				UInt32 nextTick = tickCount + TICKS_PER_16TH;
-				
-				for (p=0; p<DOC_PARTS; p++) {
-					FPChord &theItem = Chord(item, p);
-					
-					//
-					// Converting jiffies (60ths/sec) into ticks (240ths/beat)
-					//
-					// Quarternotes per second = 1,000,000 / msPer4th (reciprocal of s/q = q/s)
-					// Ticks per second = TICKS_PER_4TH * Quarternotes per second (t/q * q/s = tq/qs = t/s)
-					// Ticks in Jiffies = TPS * Jiffies / 60 (t/s * s = t)
-					//
-					// Sustain in MIDI is expressed in ticks, 240 per second
-					// Sustain in FretPet is expressed as 60ths of a second, or Jiffies
-					//
-
-					UInt32 sustainTicks = (MICROSECOND * Sustain(p) / 60.0) * TICKS_PER_4TH / msPer4th;		// Convert to ticks
-					static int didDebug = 0;
-					velocity = Velocity(p);
-					
-					if (theItem.IsBracketEnabled()) {
-						for (str=0; str<NUM_STRINGS; str++) {
-							SInt16 note = theItem.FretHeld(str);
-							if ((note != -1) && theItem.GetPatternDot(str, beat)) {
-								note += Tuning().tone[str] + LOWEST_C;
-								
-								UInt32 restTime = tickCount - lastEvent;			// number of ticks
-								lastEvent = tickCount;
-								midi_Delay(w, restTime);
-								
-								if (stopTime[p][note]) {							// a note is playing already?
-									midi_NoteOff(w, channel[p], note, verbose);		// then shut it off first
-									midi_NullDelay(w);								// insert a null delay for the next
-								}
-								
-								midi_NoteOn(w, channel[p], note, velocity, verbose);	// Send that note event
-								stopTime[p][note] = tickCount + sustainTicks;			// Set the stop time for the note
-							}
-						}
-					}
-					
-					//
-					// Pre-generate a list of the notes in the current
-					//	part that will end during this beat 
-					//
-					UInt16 stopCount[DOC_PARTS];
-					bzero(stopCount, sizeof(stopCount));
-					for (int note=NUM_OCTAVES * OCTAVE; note--;)
-						if (stopTime[p][note] && (stopTime[p][note] < nextTick))
-							stopNote[p][stopCount[p]++] = note;
-					
-					//
-					// Loop through the time during the beat and
-					//	stop notes that are due to end
-					//
-					UInt16 count = stopCount[p];
-					for (int i=TICKS_PER_16TH; i-- && count;) {
-						for (int j=stopCount[p]; j--;) {
-							UInt16 note = stopNote[p][j];
-							if (note && (stopTime[p][note] <= tickCount)) {
-								UInt32 restTime = tickCount - lastEvent;		// number of ticks
-								lastEvent = tickCount;
-								midi_Delay(w, restTime);						// Insert the delay, whatever it is
-								midi_NoteOff(w, channel[p], note, verbose);	// Turn off that note
-								stopTime[p][note] = 0;						// Flag this note as stopped
-								stopNote[p][j] = 0;							// Ignore this note from now on
-								count--;
-							}
-						}
-						
-						tickCount++;
-						
-					} //ticks within the beat
-					
-				} //part
-				
-				// Check for possible buffer overflow and handle it
-				UInt32 progress = w - buffer;
-				if (ExpandHandleForSize(midiHandle, progress))
-					w = (buffer = *midiHandle) + progress;
-				
-				tickCount = nextTick;
-				
-			} //beat
-			
-		} //repeat
-		
-	} //item
-	
-	{
-		// Get a list of all remaining notes
-		UInt16 stopCount[DOC_PARTS];
-		for (p=DOC_PARTS; p--;) {
-			stopCount[p] = 0;
-			for (int note=NUM_OCTAVES * OCTAVE; note--;)
-				if (stopTime[p][note])
-					stopNote[p][stopCount[p]++] = note;
-		}
-		
-		// Finish all remaining notes
-		UInt32 finalTick = tickCount + TICKS_PER_16TH - 1 + 50;
-		UInt16 count = 0;
-		
-		for (p=DOC_PARTS; p--;)
-			count += stopCount[p];
-		
-		while (count > 0) {
-			for (p=DOC_PARTS; p--;) {
-				for (int j=stopCount[p]; j--;) {
-					UInt16 note = stopNote[p][j];
-					if ( note && (tickCount >= stopTime[p][note] || tickCount >= finalTick) ) {
-						UInt32 restTime = tickCount - lastEvent;
-						lastEvent = tickCount;
-						midi_Delay(w, restTime);
-						midi_NoteOff(w, channel[p], note, verbose);
-						stopNote[p][j] = 0;
-						count--;
-					}
-				}
-			}
-			tickCount++;
-		}
-		
-		// Mark the end of the track
-		midi_Delay(w, finalTick > tickCount ? finalTick - tickCount : 0);
-		midi_EndMarker(w);
-		
-		// Set the track size in its header
-		char *size_long = &buffer[sizeIndex];
-		buff_LongBE(size_long, w - &buffer[trackStartIndex]);
-		
-		UInt32 finalSize = w - buffer;
-		SetHandleSize(midiHandle, finalSize);
-		
-#if DEBUG_MIDI
-		fprintf(stderr, "Format 0 ... Total Beats: %d    Final Buffer Size: %d\n", TotalBeats(), finalSize);
-#endif
-		
-	}
-	
-	return midiHandle;
+	TByteSink sink;
+	return (WriteFormat0(sink) == noErr) ? sink.DetachHandle() : NULL;
 }
 
 /*!
- * GetFormat1
- *
- *	Build a Standard MIDI datastream with a
- *	separate track for each channel.
- */
-Handle FPDocument::GetFormat1() {
-	PartIndex p;
-	UInt32 msPer16th = Interim(), msPer4th = Interim() * 4;
-	UInt32 lastEvent, tickCount;
-	UInt32 stopTime[NUM_OCTAVES * OCTAVE];
-	SInt16 note, stopNote[100];
-	bool verbose = preferences.GetBoolean(kPrefVerboseMidi, TRUE);
-
-#if DEBUG_MIDI
-	fprintf(stderr, "Building Format 1 ... S/Q=%d  Beats=%d\n", msPer4th, TotalBeats());
-#endif
-	
-	midi_Using;
-	
-	// Allocate a buffer
-	Handle midiHandle = NewHandle(BUFFER_CHUNK_SIZE);
-	HLock(midiHandle);
-	
-#if DEBUG_MIDI
-	fprintf(stderr, "Allocated a %d byte handle to start\n", GetHandleSize(midiHandle));
-#endif
-	
-	char	*buffer = *midiHandle, *w = buffer;
-	
-	// Insert the standard MIDI Header
-	midi_Header(w, 1, DOC_PARTS + 1, TICKS_PER_4TH);									// Format 0, 1 Track...
-	
-#if DEBUG_MIDI
-	fprintf(stderr, "Inserted MIDI Header (%d)\n", w - buffer);
-#endif
-	
-	// Insert an Initializer Track
-	midi_TrackTag(w);
-	char *len_long = w;
-	buff_LongBE(w, 0);
-	char *trackStartAddr = w;
-	midi_NullDelay(w);
-	
-#if DEBUG_MIDI
-	fprintf(stderr, "Inserted Track Header (%d)\n", w - buffer);
-#endif
-	
-	// Give FretPet credit
-	midi_Text(w, kMidiTextCopyright, "Created with FretPet X " FRETPET_VERSION);
-	midi_NullDelay(w);
-	
-#if DEBUG_MIDI
-	fprintf(stderr, "Inserted Copyright Message (%d)\n", w - buffer);
-#endif
-	
-	// Tempo Value
-	midi_Tempo(w, msPer4th);
-	midi_NullDelay(w);
-	
-#if DEBUG_MIDI
-	fprintf(stderr, "Inserted Tempo (%d)\n", w - buffer);
-#endif
-	
-	// Time Signature : 4/2, 24 ticks in metronome, 8 32nds per 1/4
-	midi_TimeSig(w, 4, 2, 24, 8);
-	midi_NullDelay(w);
-	
-#if DEBUG_MIDI
-	fprintf(stderr, "Inserted Time Signature (%d)\n", w - buffer);
-#endif
-	
-	// End Marker
-	midi_EndMarker(w);
-	
-#if DEBUG_MIDI
-	fprintf(stderr, "Inserted End Marker (%d)\n", w - buffer);
-#endif
-	
-	// Store the track length
-	buff_LongBE(len_long, w - trackStartAddr);
-	
-#if DEBUG_MIDI
-	fprintf(stderr, "Track Length = %d bytes\n", w - trackStartAddr);
-#endif
-	
-	// Each part gets its own track
-	for (p=0; p<DOC_PARTS; p++) {
-#if DEBUG_MIDI
-		fprintf(stderr, "Starting Track for Part %d\n", part);
-#endif
-		
-		// Prepare the note-stops array
-		bzero(stopTime, sizeof(stopTime));
-		
-		// Uninitialized Track Header
-		midi_TrackTag(w);
-		UInt32 sizeIndex = w - buffer;
-		buff_LongBE(w, 0);
-		UInt32 trackStartIndex = w - buffer;
-		midi_NullDelay(w);
-
-#if DEBUG_MIDI
-		fprintf(stderr, "Inserted Track Header (%d)\n", w - buffer);
-#endif
-		
-		// Instrument Name
-		TString instrumentName(player->GetInstrumentName(p));
-		midi_Text(w, kMidiTextTrack, instrumentName.GetCString());
-		midi_NullDelay(w);
-		
-#if DEBUG_MIDI
-		fprintf(stderr, "Inserted Instrument Name (%d)\n", w - buffer);
-#endif
-		
-		// Instrument Number
-		UInt16	trueGM = player->GetInstrumentNumber(p);
-		UInt16	channel = (trueGM >= kFirstDrumkit && trueGM <= kLastDrumkit) ? 9 : p;
-		
-		//		if (select0)
-		//		{
-		UInt16 bank = 0;
-		if (trueGM >= kFirstDrumkit && trueGM <= kLastDrumkit)
-			bank = 1;
-		else if (trueGM >= kFirstGSInstrument-1 && trueGM <= kLastGSInstrument-1)
-			bank = (trueGM >> 7) << 8;
-		
-		midi_BankSelect(w, channel, bank);
-		midi_NullDelay(w);
-		
-#if DEBUG_MIDI
-		fprintf(stderr, "Inserted Bank Select 0\n", w - buffer);
-#endif
-		//		}
-		
-		midi_Program(w, channel, (trueGM - 1) & 0x7F);
-		
-#if DEBUG_MIDI
-		fprintf(stderr, "Inserted Program Change %d (%d)\n", (inst - 1) & 0x7F, w - buffer);
-#endif
-		
-		// Converting jiffies (60ths/sec) into ticks (240ths/beat)
-		//
-		// Quarternotes per second = 1,000,000 / msPer4th (reciprocal of seconds per quarternote)
-		// Ticks per second = TICKS_PER_4TH * Quarternotes per second (t/q * q/s = t/s)
-		// Ticks in Jiffies = TPS * Jiffies / 60 (t/s * s = t)
+ * WriteFormat0
+ *
+ *	Write a Standard MIDI datastream with all
+ *	channels combined into a single track.
+ */
+OSErr FPDocument::WriteFormat0(TByteSink &w) {
+	FPMidiWriter writer(NoteList(), Interim() * 4, preferences.GetBoolean(kPrefVerboseMidi, TRUE));
+	PrepareMidiWriter(writer);
+	return writer.WriteFormat0(w);
+}
 
-		UInt16	vel = Velocity(p), sus = Sustain(p);
-		UInt32 sustainTicks = (MICROSECOND * sus / 60.0) * TICKS_PER_4TH / msPer4th;
-		tickCount = lastEvent = 0;
-		
-		for (ChordIndex item=0; item<Size(); item++) {
-#if DEBUG_MIDI
-			fprintf(stderr, "Processing Chordgroup %d ...\n", item);
-#endif
-			
-			FPChord theItem = Chord(item, p);
-			for (int rept=theItem.Repeat(); rept--;) {
-#if DEBUG_MIDI
-				fprintf(stderr, "Processing Repeat %d ...\n", rept);
-#endif
-				
-				for (int beat=0; beat<=theItem.PatternSize() - 1; beat++) {
-#if DEBUG_MIDI
-					fprintf(stderr, "Processing Beat %d ...\n", beat);
-#endif
-					
-					if (theItem.IsBracketEnabled()) {
-						for (int str=0; str<NUM_STRINGS; str++) {
-#if DEBUG_MIDI
-							fprintf(stderr, "Processing String %d ...\n", str);
-#endif
-							
-							SInt16 note = theItem.FretHeld(str);
-							if ((note != -1) && theItem.GetPatternDot(str, beat)) {
-								note += Tuning().tone[str] + LOWEST_C;
-								
-								UInt32 restTime = tickCount - lastEvent;		// number of ticks
-								lastEvent = tickCount;
-								midi_Delay(w, restTime);
-								
-#if DEBUG_MIDI
-								fprintf(stderr, "Inserted Rest %d (%d)\n", restTime, w - buffer);
-#endif
-								
-								if (stopTime[note]) {							// a note is playing already?
-									midi_NoteOff(w, channel, note, verbose);	// then shut it off first
-									midi_NullDelay(w);							// insert a null delay for the next
-									
-#if DEBUG_MIDI
-									fprintf(stderr, "Inserted Note Off note=%d (%d)\n", note, w - buffer);
-#endif
-								}
-								
-								midi_NoteOn(w, channel, note, vel, verbose);	// Send that note event
-								stopTime[note] = tickCount + sustainTicks;			// Set the stop time for the note
-								
-#if DEBUG_MIDI
-								fprintf(stderr, "Inserted Note On note=%d  time=%d  endtime=%d (%d) ...\n", note, tickCount, tickCount + sus, w - buffer);
-#endif
-							}
-						}
-					}
-					
-					//
-					// Pre-generate a list of the notes that should
-					//	end during the current beat.
-					//
-					UInt16 stopCount = 0;
-					UInt32 nextTick = tickCount + TICKS_PER_16TH;
-					for (note=NUM_OCTAVES * OCTAVE; note--;)
-						if (stopTime[note] && (stopTime[note] < nextTick))
-							stopNote[stopCount++] = note;
-					
-					//
-					// Loop through the time during the beat and
-					//	stop notes that are due to end
-					//
-					UInt16 count = stopCount;
-					for (int i=TICKS_PER_16TH; i-- && count;) {
-						for (int j=stopCount; j--;) {
-							note = stopNote[j];
-							if (note && (tickCount >= stopTime[note])) {
-								UInt32 restTime = tickCount - lastEvent;		// number of ticks
-								lastEvent = tickCount;
-								midi_Delay(w, restTime);						// Insert the delay, whatever it is
-								
-#if DEBUG_MIDI
-								fprintf(stderr, "Inserted Rest %d (%d)\n", restTime, w - buffer);
-#endif
-								
-								midi_NoteOff(w, channel, note, verbose);		// Turn off that note
-								
-#if DEBUG_MIDI
-								fprintf(stderr, "Inserted Note Off %d (%d)\n", note, w - buffer);
-#endif
-								
-								stopTime[note] = 0;								// Flag this note as stopped
-								stopNote[j] = 0;								// Ignore this note from now on
-							}
-						}
-						tickCount++;
-					}
-					
-					tickCount = nextTick;
-					
-				} // beat
-				
-#if DEBUG_MIDI
-				UInt32 oldSize = GetHandleSize(midiHandle);
-#endif
-				
-				UInt32 progress = w - buffer;
-				
-				if (ExpandHandleForSize(midiHandle, progress))
-					w = (buffer = *midiHandle) + progress;
-				
-#if DEBUG_MIDI
-				UInt32 newSize = GetHandleSize(midiHandle);
-				if (oldSize != newSize)
-					fprintf(stderr, "(Expanding handle to %d bytes)\n", newSize);
-#endif
-				
-				
-			} //repeat
-			
-		} //item
-		
-		//
-		// Pre-generate a list of the notes that
-		//	need to be ended
-		//
-		UInt16 stopCount = 0;
-		for (note=NUM_OCTAVES * OCTAVE; note--;)
-			if (stopTime[note])
-				stopNote[stopCount++] = note;
-		
-#if DEBUG_MIDI
-		fprintf(stderr, "%d Notes still playing at track end\n", stopCount);
-#endif
-		
-		//
-		// Finish all remaining notes
-		//
-		UInt32 finalTick = tickCount + TICKS_PER_16TH - 1 + 50;
-		UInt16 count = stopCount;
-		while (count > 0) {
-			for (int j=stopCount; j--;) {
-				note = stopNote[j];
-				if ( note && (tickCount >= stopTime[note] || tickCount >= finalTick) ) {
-					UInt32 restTime = tickCount - lastEvent;	// number of ticks
-					lastEvent = tickCount;
-					midi_Delay(w, restTime);					// Insert the delay, whatever it is
-					
-#if DEBUG_MIDI
-					fprintf(stderr, "Inserted Rest %d (%d)\n", restTime, w - buffer);
-#endif
-					
-					midi_NoteOff(w, channel, note, verbose);	// Turn off that note
-					
-#if DEBUG_MIDI
-					fprintf(stderr, "Inserted Note Off %d (%d)\n", note, w - buffer);
-#endif
-					
-					stopNote[j] = 0;							// Ignore this note from now on
-					count--;
-				}
-			}
-			tickCount++;
-		}
-		
-		// Mark the end of each track
-		midi_Delay(w, tickCount < finalTick ? finalTick - tickCount : 0);
-		midi_NoteOff(w, channel, LOWEST_C, verbose);
-		midi_NullDelay(w);
-		midi_EndMarker(w);
-		
-#if DEBUG_MIDI
-		fprintf(stderr, "Inserted Track end stuff(%d)\n", w - buffer);
-#endif
-		
-		// Set the track size in its header
-		char *size_long = &buffer[sizeIndex];
-		buff_LongBE(size_long, w - &buffer[trackStartIndex]);
-		
-#if DEBUG_MIDI
-		fprintf(stderr, "Total track size = %d\n", w - &buffer[trackStartIndex]);
-#endif
-		
-	} // part loop
-	
-	UInt32 finalSize = w - buffer;
-	SetHandleSize(midiHandle, finalSize);
-	
-#if DEBUG_MIDI
-	fprintf(stderr, "Format 1 ... Total Beats: %d    Final Buffer Size: %d\n", totalBeats, finalSize);
-#endif
-	
-	return midiHandle;
+/*!
+ * GetFormat1
+ *
+ *	Build a Standard MIDI datastream with a
+ *	separate track for each channel.
+ */
+Handle FPDocument::GetFormat1() {
+	TByteSink sink;
+	return (WriteFormat1(sink) == noErr) ? sink.DetachHandle() : NULL;
+}
+
+/*!
+ * WriteFormat1
+ *
+ *	Write a Standard MIDI datastream with a
+ *	separate track for each channel.
+ */
+OSErr FPDocument::WriteFormat1(TByteSink &w) {
+	FPMidiWriter writer(NoteList(), Interim() * 4, preferences.GetBoolean(kPrefVerboseMidi, TRUE));
+	PrepareMidiWriter(writer);
+	return writer.WriteFormat1(w);
 }
 
 #pragma mark - Movie Export
@@ -1875,13 +1704,9 @@ UInt32** FPDocument::GetTuneSequence(long *duration) {
 	};
 	
 	const int		endingStyle = kEndAtEndPlus;
-	const bool		cutoffNotes = false;
-	const UInt16	cutoffMargin = 1;
 
 	float			beatJiffies = 36000.0f / (float)PlayTempo();			// BPM converted to 600ths per beat
-	ChordIndex		item;
 	PartIndex		p;
-	SInt16			note;
 	UInt32			**h;
 	
 	// fprintf(stderr, "Jiffies Per Beat At Tempo=%d: %.3f\n", PlayTempo(), beatJiffies);
@@ -1916,175 +1741,59 @@ UInt32** FPDocument::GetTuneSequence(long *duration) {
 	//
 	float totalTime = 0.0;
 	
-	// Allocate a decent starting size
-	h = (UInt32**)NewHandle(BUFFER_CHUNK_SIZE * 10);
+	// Sustain is in 60ths, converted to 600ths
+	UInt32 sustainJiffies[DOC_PARTS];
+	for (p=DOC_PARTS; p--;)
+		sustainJiffies[p] = Sustain(p) * 10;
+	
+	const FPNoteList &notes = NoteList();
+	FPTimeline timeline;
+	notes.Timeline(timeline, beatJiffies, sustainJiffies);
+	
+	// Each event needs at most a rest and a note, then a final rest and the end marker
+	h = (UInt32**)NewHandle((timeline.size() * 2 + 2) * sizeof(UInt32));
 	if ( h ) {
 		HLock((Handle)h);
 		
-		float	stopJiffy[DOC_PARTS][NUM_OCTAVES * OCTAVE];
-		for (p=DOC_PARTS; p--;)
-			for (note=NUM_OCTAVES * OCTAVE; note--;)
-				stopJiffy[p][note] = 0.0f;
-		
 		UInt32	*w = *h;
-		UInt16	tonesOn = 0, rept = 0, beat = 0;
-		float	theTime = -1.0f, lastJiffy = 0.0f, nextJiffy = 0.0f;
-		item = 0;
+		UInt32	lastJiffy = 0;
 		
-		while (item < Size()) {
-			theTime += 1.0;
+		for (UInt32 i=0; i<timeline.size(); i++) {
+			const FPTimedEvent &e = timeline[i];
 			
-			// Has time gone past the next jiffy?
-			if (theTime >= nextJiffy) {
-				// fprintf(stderr, "\nItem Number : %d\n", item);
-				// fprintf(stderr, "Jiffy Reached : %.3f >= %.3f     Beat: %d\n", theTime, nextJiffy, beat);
-				
-				UInt16 beats = ChordGroup(item).PatternSize();
-				UInt16 repeat = ChordGroup(item).Repeat();
-				
-				for (p=0; p<DOC_PARTS; p++) {
-					FPChord &chord = Chord(item, p);
-					
-					//					// fprintf(stderr, "Processing Part : %d\n", part);
-					
-					if (chord.IsBracketEnabled()) {
-						long	vel = Velocity(p);
-						float	sus = Sustain(p) * 10;					// Convert 60ths to 600ths
-						
-						//						// fprintf(stderr, "Velocity: %03d     Sustain 600ths: %.2f\n", vel, sus);
-						
-						for (int str=0; str<NUM_STRINGS; str++) {
-							if (chord.GetPatternDot(str, beat)) {
-								// fprintf(stderr, "String: %d   Beat: %d\n", str, beat);
-								
-								note = chord.FretHeld(str);
-								if (note >= 0) {
-									note += OpenTone(str) + LOWEST_C;
-									
-									UInt32	restTime = (UInt32)(theTime - lastJiffy);
-									bool	tonePlaying = (stopJiffy[p][note] != 0.0f);
-									bool	needCutoff = cutoffNotes && tonePlaying;
-									if (restTime > 0) {
-										UInt32 adjustedRest = restTime - (needCutoff ? cutoffMargin : 0);
-										// fprintf(stderr, "Inserting Rest: %d (%.3f)\n", adjustedRest, theTime - lastJiffy);
-										qtma_StuffRestEvent(*w, adjustedRest);
-										w++;
-									}
-									
-									if (tonePlaying) {
-										tonesOn--;
-										if (needCutoff) {
-											qtma_StuffNoteEvent(*w, p + 1, note, 0, 0);
-											w++;
-											// fprintf(stderr, "Cutting Off Note : %d/%d (%d)\n", part, note, tonesOn);
-											qtma_StuffRestEvent(*w, cutoffMargin);
-											w++;
-											// fprintf(stderr, "Inserting Post-Cutoff Rest\n");
-										}
-									}
-									
-									if (endingStyle == 0 && (theTime + sus) > totalBeatTime) {
-										if (totalBeatTime > theTime)
-											sus = totalBeatTime - theTime;
-										else
-											sus = 0.0;
-									}
-									
-									qtma_StuffNoteEvent(*w, p + 1, note, vel, (long)sus);
-									w++;
-									tonesOn++;
-									
-									// fprintf(stderr, "Inserted Note Start: %d/%d %d %.2f (%d)\n", part, note, vel, sus, tonesOn);
-									
-									lastJiffy = theTime;
-									stopJiffy[p][note] = theTime + sus;
-									
-									// fprintf(stderr, "This note ends at: %.3f\n", stopJiffy[part][note]);
-								}
-							}
-						}
-					}
-				}
-				
-				// Insert stop events for any notes that are due to end
-				for (p=0; p<DOC_PARTS; p++) {
-					for (note=0; note<NUM_OCTAVES * OCTAVE; note++) {
-						if (stopJiffy[p][note] > 0.0f && theTime >= stopJiffy[p][note]) {
-							// fprintf(stderr, "Tone %d/%d Ending Normally : ( stopTime=%.3f t=%.3f )\n", part, note, stopJiffy[part][note], theTime);
-							
-							UInt32 restTime = (UInt32)(theTime - lastJiffy);
-							if (restTime > 0) {
-								// fprintf(stderr, "Inserting Rest: %d (%.3f)\n", restTime, theTime - lastJiffy);
-								qtma_StuffRestEvent(*w, restTime);
-								w++;
-							}
-							
-							qtma_StuffNoteEvent(*w, p + 1, note, 0, 0);
-							w++;
-							tonesOn--;
-							
-							//							// fprintf(stderr, "Ending Note : %d/%d (%d)\n", part, note, tonesOn);
-							
-							lastJiffy = theTime;
-							stopJiffy[p][note] = 0.0f;
-						}
-					}
-				}
-				
-				UInt32 progress = (Ptr)w - (Ptr)*h;
-				if (ExpandHandleForSize((Handle)h, progress))
-					w = *h + progress;
+			UInt32 restTime = e.time - lastJiffy;
+			if (restTime > 0) {
+				// fprintf(stderr, "Inserting Rest: %d\n", restTime);
+				qtma_StuffRestEvent(*w, restTime);
+				w++;
+			}
+			
+			if (e.on) {
+				float sus = sustainJiffies[e.part];
 				
-				// prepare for the next beat
-				// fprintf(stderr, "Next Beat...\n");
-				if (++beat >= beats) {
-					// fprintf(stderr, "Next Repeat...\n");
-					beat = 0;
-					if (++rept >= repeat) {
-						// fprintf(stderr, "Next Item...\n");
-						rept = 0;
-						item++;
-					}
+				if (endingStyle == kEndAtBeat && (e.time + sus) > totalBeatTime) {
+					if (totalBeatTime > e.time)
+						sus = totalBeatTime - e.time;
+					else
+						sus = 0.0;
 				}
 				
-				nextJiffy += beatJiffies;
-				// fprintf(stderr, "Next Jiffy : %.3f\n", nextJiffy);
+				qtma_StuffNoteEvent(*w, e.part + 1, e.tone, Velocity(e.part), (long)sus);
+				// fprintf(stderr, "Inserted Note Start: %d/%d %.2f\n", e.part, e.tone, sus);
 			}
-		}
-		
-		// fprintf(stderr, "Reached the end at t=%.3f with %d tones still playing\n", theTime, tonesOn);
-		
-		if (cutoffNotes) {
-			// At the very end silence any continuing notes...
-			while (tonesOn) {
-				theTime += 1.0;
-				
-				for (p=0; p<DOC_PARTS; p++) {
-					for (note=0; note<NUM_OCTAVES * OCTAVE; note++) {
-						if (stopJiffy[p][note] > 0.0f && theTime >= stopJiffy[p][note]) {
-							UInt32 restTime = (UInt32)(theTime - lastJiffy);
-							if (restTime > 0) {
-								// fprintf(stderr, "Inserting Rest: %d (%.3f)\n", restTime, theTime - lastJiffy);
-								qtma_StuffRestEvent(*w, restTime);
-								w++;
-							}
-							
-							qtma_StuffNoteEvent(*w, p + 1, note, 0, 0);
-							w++;
-							tonesOn--;
-							
-							// fprintf(stderr, "Ending Note : %d/%d (%d)\n", part, note, tonesOn);
-							
-							lastJiffy = theTime;
-							stopJiffy[p][note] = 0.0f;
-						}
-					}
-				}
+			else {
+				qtma_StuffNoteEvent(*w, e.part + 1, e.tone, 0, 0);
+				// fprintf(stderr, "Ending Note : %d/%d\n", e.part, e.tone);
 			}
+			w++;
 			
-			// fprintf(stderr, "Final note ending at t=%.3f\n", theTime);
+			lastJiffy = e.time;
 		}
 		
+		float theTime = lastJiffy;
+		
+		// fprintf(stderr, "Reached the end at t=%.3f\n", theTime);
+		
 		//
 		// Add time to the end depending on the style
 		//
@@ -2185,6 +1894,28 @@ UInt32** FPDocument::GetTuneSequence(long *duration) {
 									sunvox_Value(z, 'SPED', spd); \
 									sunvox_Value(z, 'GVOL', vol); }
 
+//
+// SunvoxPatternKey
+//
+//	A group to find a part's pattern by in a store. Only
+//	what changes the pattern is kept, so lines that play
+//	the same chord a different number of times, or name
+//	its root differently, share one pattern. The bracket
+//	flag stays, since a part with its bracket off plays
+//	nothing.
+//
+static FPChordGroup SunvoxPatternKey(const FPChord &chord) {
+	FPChord key(chord);
+	key.repeat			= 1;
+	key.rootLock		= false;
+	key.rootModifier	= 0;
+	key.rootScaleStep	= 0;
+	key.brakLow			= 0;
+	key.brakHi			= 0;
+	return FPChordGroup(key);
+}
+
+
 /*!
  * GetSunvoxFormat
  *
@@ -2205,6 +1936,9 @@ Handle FPDocument::GetSunvoxFormat() {
 	char iconData[32];
 	memset(iconData, 0xFF, sizeof(iconData));
 
+	// The notes come from the same blocks the player hears
+	const FPNoteList &notes = NoteList();
+
 	const UInt32 tpb = 24, tpl = 6;
 	UInt32 bpm = PlayTempo();			// The "real" BPM
 
@@ -2269,6 +2003,13 @@ Handle FPDocument::GetSunvoxFormat() {
 		
 		ChordIndex *chordPDTAIndex = (ChordIndex*)calloc(Size(), sizeof(ChordIndex));
 
+		// The first line of each pattern, found by what it plays.
+		// The store points at the keys, so they're never moved.
+		FPChordGroupStore		patternStore(Size());
+		std::vector<FPChordGroup>	patternKey;
+		std::vector<ChordIndex>	firstChord;
+		patternKey.reserve(Size());
+
 		// Go through all the chords, creating patterns and clones as-needed
 		for (ChordIndex item=0; item<Size(); item++) {
 
@@ -2277,19 +2018,25 @@ Handle FPDocument::GetSunvoxFormat() {
 			// If the chord is exactly like a previous one in the same part
 			// then set it to go ahead and clone the pattern
 			patternToClone = -1;
-			if (item > 0)
-				for (int prev=0;prev<item;prev++) {
-					FPChord prevChord = Chord(prev, p);
-					if (theChord == prevChord) {
-						patternToClone = chordPDTAIndex[prev];
-						break;
-					}
-				}
+			FPChordGroup key(SunvoxPatternKey(theChord));
+			UInt32 id = patternStore.Find(key);
+			if (id != kNoGroupID)
+				patternToClone = chordPDTAIndex[firstChord[id]];
+			else {
+				patternKey.push_back(key);
+				patternStore.Add(patternKey.back());
+				firstChord.push_back(item);
+			}
 
 			// If it is, set a var with the index of the previous chord
 			// Then use that chord's previously-stored PDTA Index as the PDTA index of the clones
 
-			UInt16	activeStringsMask = theChord.StringsUsedInPattern(), activeStringsCount = 0;
+			// Only strings the part plays with the bracket on get tracks
+			const FPNoteBlock &block = notes.LineBlock(item);
+			UInt16	activeStringsMask = 0, activeStringsCount = 0;
+			for (UInt32 n=0; n<block.notes.size(); n++)
+				if (block.notes[n].part == p && !(block.notes[n].flags & kNoteBracketOff))
+					activeStringsMask |= BIT(block.notes[n].string);
 			for (int str=0; str<NUM_STRINGS; str++) if (activeStringsMask & BIT(str)) activeStringsCount++;
 
 			// The chord will be repeated 1-16 times
@@ -2320,6 +2067,15 @@ Handle FPDocument::GetSunvoxFormat() {
 						// Go through all the beats
 						for (int beat = 0; beat < theChord.PatternSize(); beat++) {
 
+							// The tone each string starts on this beat, if any
+							SInt16 beatTone[NUM_STRINGS];
+							for (int str=NUM_STRINGS; str--;) beatTone[str] = -1;
+							for (UInt16 n=block.beatNote[beat]; n<block.beatNote[beat+1]; n++) {
+								const FPBlockNote &note = block.notes[n];
+								if (note.part == p && !(note.flags & kNoteBracketOff))
+									beatTone[note.string] = note.tone - LOWEST_C + LOWEST_SUNVOX_C;
+							}
+
 							// Each beat uses the same number of lines, 24 / lpb
 							for (int line = 0; line < lpb; line++) {
 
@@ -2332,13 +2088,10 @@ Handle FPDocument::GetSunvoxFormat() {
 									Boolean stringHasNote = false;
 
 									// First 'line' has a note on event potentially
-									if (line == 0 && theChord.IsBracketEnabled()) {
-										SInt16 fretHeld = theChord.FretHeld(str);
-										if ((fretHeld != -1) && theChord.GetPatternDot(str, beat)) {
-											sunvox_NoteOn(w, LOWEST_SUNVOX_C + Tuning().tone[str] + fretHeld, vel, moduleIndex);
-											stopLine[str] = patternLine + sustainLines;
-											stringHasNote = true;
-										}
+									if (line == 0 && beatTone[str] >= 0) {
+										sunvox_NoteOn(w, beatTone[str], vel, moduleIndex);
+										stopLine[str] = patternLine + sustainLines;
+										stringHasNote = true;
 									}
 
 									if (!stringHasNote) {
@@ -2478,12 +2231,13 @@ Handle FPDocument::GetSunvoxFormat() {
 	for (p=0; p<DOC_PARTS; p++) {
 		if (!(activePartMask & BIT(p))) continue;
 
-		UInt16	gmNumber = player->GetInstrumentNumber(p);
+		UInt16	gmNumber = GetInstrument(p);
 		Boolean isDrum = (gmNumber >= kFirstDrumkit && gmNumber <= kLastDrumkit);
-		TString instrumentName(player->GetInstrumentName(p));
+		char	name[64];
+		CopyInstrumentName(p, name, sizeof(name));
 
 		sunvox_Value(w, 'SFFF', isDrum ? 0x049 : 0x059);
-		sunvox_TextPad(w, 'SNAM', instrumentName.GetCString(), 32);
+		sunvox_TextPad(w, 'SNAM', name, 32);
 		sunvox_Text(w, 'STYP', (char*)(isDrum ? "DrumSynth" : "Generator"));		// Drum: CcDd BASS, EFf HIHAT, GgAaB SNARE
 		sunvox_Value(w, 'SFIN', 0);
 		sunvox_Value(w, 'SREL', 0);
@@ -2541,6 +2295,97 @@ OSStatus FPDocument::ExportSunvox() {
 	return sunvoxExporter->SaveAs();
 }
 
+#pragma mark - Wave Export
+/*!
+ * WriteWaveFormat
+ *
+ *	Render the document to a WAV file with the built-in
+ *	synth, at the play tempo. Every part is rendered with
+ *	its own velocity and sustain. Drum kits play drums.
+ */
+OSErr FPDocument::WriteWaveFormat(TByteSink &sink, UInt16 maxThreads) {
+	FPWaveRenderer renderer(NoteList(), PlayTempo());
+
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		UInt16 trueGM = GetInstrument(p);
+		renderer.SetPart(p, Velocity(p), Sustain(p), trueGM >= kFirstDrumkit && trueGM <= kLastDrumkit);
+	}
+
+	return renderer.Render(sink, maxThreads);
+}
+
+#pragma mark - Text Export
+/*!
+ * WriteTablature
+ *
+ *	Write the document as text tablature or a chord chart,
+ *	one chord group at a time, titled with the file name.
+ */
+OSErr FPDocument::WriteTablature(TByteSink &sink, UInt16 style) {
+	FPTabWriter	writer(sink, tuning.tone, style);
+	char		title[256];
+
+	if (!CFStringGetCString(BaseName(), title, sizeof(title), kCFStringEncodingUTF8))
+		strcpy(title, "FretPet");
+
+	writer.Begin(title);
+
+	for (ChordIndex i=0; i<Size(); i++)
+		writer.AddGroup(ChordGroup(i));
+
+	return writer.Finish();
+}
+
+/*!
+ * WriteMusicXML
+ *
+ *	Write the document as a MusicXML score, streamed one
+ *	measure at a time. Only parts that play are written.
+ */
+OSErr FPDocument::WriteMusicXML(TByteSink &sink) {
+	const FPNoteList	&notes = NoteList();
+	FPMusicXMLWriter	writer(sink, notes, tuning.tone);
+	PartMask			used = 0;
+	char				title[256], name[64];
+
+	for (UInt32 i=0; i<notes.Size(); i++)
+		if (!(notes[i].flags & kNoteBracketOff))
+			used |= BIT(notes[i].part);
+
+	// A score needs at least one part
+	if (!used)
+		used = BIT(0);
+
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		if (!(used & BIT(p)))
+			continue;
+
+		CopyInstrumentName(p, name, sizeof(name));
+
+		UInt16 trueGM = GetInstrument(p);
+		writer.SetPart(p, name, ((trueGM - 1) & 0x7F) + 1, trueGM >= kFirstDrumkit && trueGM <= kLastDrumkit);
+	}
+
+	if (!CFStringGetCString(BaseName(), title, sizeof(title), kCFStringEncodingUTF8))
+		strcpy(title, "FretPet");
+
+	writer.Begin(title, PlayTempo());
+
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		if (!(used & BIT(p)))
+			continue;
+
+		writer.BeginPart(p);
+
+		for (ChordIndex i=0; i<Size(); i++)
+			writer.AddMeasure(ChordGroup(i));
+
+		writer.EndPart();
+	}
+
+	return writer.Finish();
+}
+
 #endif // !DEMO_ONLY
 
 #pragma mark -
@@ -2573,8 +2418,13 @@ bool FPDocument::Insert(const FPChordGroup *groupPtr, ChordIndex count, bool bRe
 	// Insertion after the cursor, which will work ok even
 	// if the document is empty and the cursor is non-zero.
 	//
-	if (count)
-		chordGroupArray.insert_copy( (Size() ? GetCursor() + 1 : 0), groupPtr );
+	FinishLoading();
+
+	if (count) {
+		ChordIndex at = Size() ? GetCursor() + 1 : 0;
+		chordGroupArray.insert_copy( at, groupPtr );
+		player->InvalidateLines(this, at);
+	}
 	
 	return true;
 }
@@ -2588,9 +2438,14 @@ bool FPDocument::Insert(const FPChordGroupArray &arrayRef) {
 	// Insertion after the cursor, which will work ok even
 	// if the document is empty and the cursor is non-zero.
 	//
+	FinishLoading();
+
 	size_t arraySize = arrayRef.size();
-	if (arraySize > 0)
-		chordGroupArray.insert_copies(arrayRef, 0, (Size() ? GetCursor() + 1 : 0), arraySize);
+	if (arraySize > 0) {
+		ChordIndex at = Size() ? GetCursor() + 1 : 0;
+		chordGroupArray.insert_copies(arrayRef, 0, at, arraySize);
+		player->InvalidateLines(this, at);
+	}
 	
 	return true;
 }
@@ -2615,7 +2470,9 @@ void FPDocument::DeleteSelection() {
 void FPDocument::Delete(ChordIndex startDel, ChordIndex endDel) {
 	ChordIndex	oldLast = Size() - 1;							// the original last item
 	
+	FinishLoading();
 	chordGroupArray.erase(startDel, endDel);
+	player->InvalidateLines(this, startDel);
 	
 	// Empty selection
 	SetSelectionRaw(-1);
@@ -2903,8 +2760,15 @@ bool FPDocument::SelectionCanCleanup(PartMask partMask) const {
 void FPDocument::TransformSelection(MenuCommand cid, MenuItemIndex ind, UInt16 partMask, bool undoable) {
 	ChordIndex		startSel, endSel, i;
 	UInt16			p;
+
 	if (GetSelection(&startSel, &endSel)) {
 		FPHistoryEvent	*event = NULL;
+
+		// Only the filters that add or remove lines need the whole document
+		if (cid == kFPCommandSelCompact || cid == kFPCommandSelSplay || cid == kFPCommandSelDouble)
+			FinishLoading();
+		else
+			LoadRange(startSel, endSel);
 		
 		if (undoable) {
 			UInt16			undoType;
@@ -2912,9 +2776,10 @@ void FPDocument::TransformSelection(MenuCommand cid, MenuItemIndex ind, UInt16 p
 			CFStringRef		undoName;
 			bool			saveIndex = false;
 			bool			saveSel = false;
+			bool			saveDelta = false;
 			switch(cid) {
 				case kFPCommandSelClearPatterns:
-					saveSel = true;
+					saveDelta = true;
 					undoType = UN_S_CLEAR_SEQ;
 					undoName = CFSTR("Pattern:Clear Filter");
 					break;
@@ -2934,14 +2799,14 @@ void FPDocument::TransformSelection(MenuCommand cid, MenuItemIndex ind, UInt16 p
 				case kFPCommandSelRandom1:
 				case kFPCommandSelRandom2: {
 					bool b = (cid == kFPCommandSelRandom1);
-					saveSel = true;
+					saveDelta = true;
 					undoType = b ? UN_S_RANDOM1 : UN_S_RANDOM2;
 					undoName = b ? CFSTR("Pattern:Random 1 Filter") : CFSTR("Pattern:Random 2 Filter");
 					break;
 				}
 					
 				case kFPCommandSelClearTones:
-					saveSel = true;
+					saveDelta = true;
 					undoType = UN_S_CLEAR;
 					undoName = CFSTR("Tones:Clear Filter");
 					break;
@@ -2953,7 +2818,7 @@ void FPDocument::TransformSelection(MenuCommand cid, MenuItemIndex ind, UInt16 p
 					break;
 					
 				case kFPCommandSelCleanupTones:
-					saveSel = true;
+					saveDelta = true;
 					undoType = UN_S_CLEANUP;
 					undoName = CFSTR("Tones:Cleanup Filter");
 					break;
@@ -2971,33 +2836,33 @@ void FPDocument::TransformSelection(MenuCommand cid, MenuItemIndex ind, UInt16 p
 					break;
 					
 				case kFPCommandSelHarmonizeUp:
-					saveSel = true;
+					saveDelta = true;
 					undoType = UN_S_HARMUP;
 					undoName = CFSTR("Harmonize Filter");
 					break;
 					
 				case kFPCommandSelHarmonizeDown:
-					saveSel = true;
+					saveDelta = true;
 					undoType = UN_S_HARMDOWN;
 					undoName = CFSTR("Harmonize Filter");
 					break;
 					
 				case kFPCommandSelHarmonizeBy:
-					saveSel = true;
+					saveDelta = true;
 					saveIndex = true;
 					undoType = UN_S_HARMBY;
 					undoName = CFSTR("Harmonize Filter");
 					break;
 					
 				case kFPCommandSelTransposeBy:
-					saveSel = true;
+					saveDelta = true;
 					saveIndex = true;
 					undoType = UN_S_TRANSBY;
 					undoName = CFSTR("Transpose Filter");
 					break;
 					
 				case kFPCommandSelTransposeTo:
-					saveSel = true;
+					saveDelta = true;
 					saveIndex = true;
 					undoType = UN_S_TRANSTO;
 					undoName = CFSTR("Transpose Filter");
@@ -3016,7 +2881,7 @@ void FPDocument::TransformSelection(MenuCommand cid, MenuItemIndex ind, UInt16 p
 					break;
 					
 				case kFPCommandSelScramble:
-					saveSel = true;
+					saveDelta = true;
 					undoType = UN_S_SCRAMBLE;
 					undoName = CFSTR("Scramble Filter");
 					break;
@@ -3046,16 +2911,18 @@ void FPDocument::TransformSelection(MenuCommand cid, MenuItemIndex ind, UInt16 p
 			}
 			
 			event = window->history->UndoStart(undoType, undoName, partMask);
-			event->SaveDataBefore(CFSTR("redoCommand"), cid);
+			event->SaveDataBefore(kHistoryRedoCommand, cid);
 			
 			if (undoCommand != 0)
-				event->SaveDataBefore(CFSTR("undoCommand"), undoCommand);
+				event->SaveDataBefore(kHistoryUndoCommand, undoCommand);
 			
-			if (saveSel)
+			if (saveDelta)
+				event->SaveDeltaBefore(startSel, endSel);
+			else if (saveSel)
 				event->SaveSelectionBefore();
 			
 			if (saveIndex)
-				event->SaveDataBefore(CFSTR("menuIndex"), ind);
+				event->SaveDataBefore(kHistoryMenuIndex, ind);
 		}
 		
 		switch(cid) {
@@ -3067,17 +2934,11 @@ void FPDocument::TransformSelection(MenuCommand cid, MenuItemIndex ind, UInt16 p
 				break;
 				
 			case kFPCommandSelHFlip:
-				for (p=DOC_PARTS; p--;)
-					if ((partMask & BIT(p)) != 0)
-						for (i=startSel; i<=endSel; i++)
-							Chord(i, p).ReversePattern();
+				FPTransformPipeline(kTransformReversePattern).Commit(chordGroupArray, startSel, endSel, partMask);
 				break;
 				
 			case kFPCommandSelVFlip:
-				for (p=DOC_PARTS; p--;)
-					if ((partMask & BIT(p)) != 0)
-						for (i=startSel; i<=endSel; i++)
-							Chord(i, p).FlipPattern();
+				FPTransformPipeline(kTransformFlipPattern).Commit(chordGroupArray, startSel, endSel, partMask);
 				break;
 				
 			case kFPCommandSelRandom1:
@@ -3098,12 +2959,7 @@ void FPDocument::TransformSelection(MenuCommand cid, MenuItemIndex ind, UInt16 p
 				break;
 				
 			case kFPCommandSelInvertTones:
-				for (p=DOC_PARTS; p--;)
-					if ((partMask & BIT(p)) != 0)
-						for (i=startSel; i<=endSel; i++) {
-							Chord(i, p).InvertTones();
-							Chord(i, p).NewFingering();
-						}
+				FPTransformPipeline(kTransformInvertTones).Commit(chordGroupArray, startSel, endSel, partMask);
 				break;
 				
 			case kFPCommandSelCleanupTones:
@@ -3132,22 +2988,11 @@ void FPDocument::TransformSelection(MenuCommand cid, MenuItemIndex ind, UInt16 p
 				ind = (cid == kFPCommandSelHarmonizeUp) ? 1 : NUM_STEPS-1;
 				
 			case kFPCommandSelHarmonizeBy:
-				for (p=DOC_PARTS; p--;)
-					if ((partMask & BIT(p)) != 0)
-						for (i=startSel; i<=endSel; i++) {
-							Chord(i, p).ResetStepInfo();
-							Chord(i, p).HarmonizeBy(ind);
-							Chord(i, p).NewFingering();
-						}
+				FPTransformPipeline(kTransformHarmonize, ind).Commit(chordGroupArray, startSel, endSel, partMask);
 				break;
 				
 			case kFPCommandSelTransposeBy:
-				for (p=DOC_PARTS; p--;)
-					if ((partMask & BIT(p)) != 0)
-						for (i=startSel; i<=endSel; i++) {
-							Chord(i, p).TransposeBy(ind);
-							Chord(i, p).NewFingering();
-						}
+				FPTransformPipeline(kTransformTranspose, ind).Commit(chordGroupArray, startSel, endSel, partMask);
 				break;
 				
 			case kFPCommandSelTransposeTo:
@@ -3291,9 +3136,14 @@ void FPDocument::TransformSelection(MenuCommand cid, MenuItemIndex ind, UInt16 p
 			}
 		}
 		
+		// Compact, Splay and Double move the lines after the selection
+		bool resized = (cid == kFPCommandSelCompact || cid == kFPCommandSelSplay || cid == kFPCommandSelDouble);
+		player->InvalidateLines(this, startSel, resized ? -1 : endSel);
+		
 		if (undoable) {
-			// Only the scramble filter needs to remember the new chords
-			if (cid == kFPCommandSelScramble || cid == kFPCommandSelRandom1 || cid == kFPCommandSelRandom2 || cid == kFPCommandSelDouble)
+			// Scramble and Random keep their new chords in the delta,
+			// so only the Double filter needs to remember them
+			if (cid == kFPCommandSelDouble)
 				event->SaveSelectionAfter();
 			
 			event->Commit();
@@ -3310,49 +3160,20 @@ void FPDocument::CloneSelection(ChordIndex count, UInt16 clonePartMask, UInt16 c
 	if (count < 2)
 		return;
 	
+	FinishLoading();
+
 	ChordIndex startSel, endSel;
 	if (GetSelection(&startSel, &endSel)) {
 		FPHistoryEvent *event = NULL;
 		if (undoable) {
 			event = window->history->UndoStart(UN_S_CLONE, CFSTR("Clone Filter"), clonePartMask);
-			event->SaveDataBefore(CFSTR("count"), count);
-			event->SaveDataBefore(CFSTR("transpose"), cloneTranspose);
-			event->SaveDataBefore(CFSTR("harmonize"), cloneHarmonize);
+			event->SaveDataBefore(kHistoryCount, count);
+			event->SaveDataBefore(kHistoryTranspose, cloneTranspose);
+			event->SaveDataBefore(kHistoryHarmonize, cloneHarmonize);
 		}
 		
-		ChordIndex size = (endSel-startSel+1);
-		ChordIndex addedSize = (count - 1) * size;
-		
-		chordGroupArray.insert_new(endSel + 1, addedSize);
-		
-		// Copy to the new space, modifying as set
-		ChordIndex dst = startSel + size;
-		for (ChordIndex d=count-1; d--; ) {
-			for (ChordIndex i=size; i--; ) {
-				ChordGroup(dst) = ChordGroup(dst - size);
-				
-				if (clonePartMask != 0) {
-					if (cloneTranspose > 0) {
-						for (PartIndex p=DOC_PARTS; p--;)
-							if ((clonePartMask & BIT(p)) != 0) {
-								Chord(dst, p).TransposeBy(cloneTranspose);
-								Chord(dst, p).NewFingering();
-							}
-					}
-					
-					if (cloneHarmonize > 0) {
-						for (PartIndex p=DOC_PARTS; p--;)
-							if ((clonePartMask & BIT(p)) != 0) {
-								Chord(dst, p).ResetStepInfo();
-								Chord(dst, p).HarmonizeBy(cloneHarmonize);
-								Chord(dst, p).NewFingering();
-							}
-					}
-				}
-				
-				dst++;
-			}
-		}
+		ChordIndex addedSize = CloneGroups(startSel, endSel, count, clonePartMask, cloneTranspose, cloneHarmonize);
+		player->InvalidateLines(this, endSel + 1);
 		
 		SetCursorLine(GetCursor() + addedSize);
 		
@@ -3370,6 +3191,42 @@ void FPDocument::CloneSelection(ChordIndex count, UInt16 clonePartMask, UInt16 c
 	}
 }
 
+/*!
+ * CloneGroups
+ *
+ *	Insert count-1 copies of a range of groups after it,
+ *	each one transposed and harmonized once more than the
+ *	copy before. This only uses the document's own scale
+ *	and tuning, so it's safe on any thread.
+ *
+ *	Returns the number of groups added.
+ */
+ChordIndex FPDocument::CloneGroups(ChordIndex start, ChordIndex end, ChordIndex count, PartMask clonePartMask, UInt16 cloneTranspose, UInt16 cloneHarmonize) {
+	ChordIndex size = (end-start+1);
+	ChordIndex addedSize = (count - 1) * size;
+	
+	chordGroupArray.insert_new(end + 1, addedSize);
+	
+	// Each copy gets the transforms of the previous copy plus one more
+	// step. The pipeline fuses these, so every copy is made from the
+	// original in a single pass.
+	FPTransformPipeline pipeline;
+	pipeline.SetTuning(tuning.tone);
+	pipeline.SetScale(scaleMode);
+	ChordIndex dst = start + size;
+	for (ChordIndex d=count-1; d--; ) {
+		if (clonePartMask != 0) {
+			pipeline.Append(kTransformTranspose, cloneTranspose);
+			pipeline.Append(kTransformHarmonize, cloneHarmonize);
+		}
+
+		pipeline.CommitCopy(chordGroupArray, start, dst, size, clonePartMask);
+		dst += size;
+	}
+	
+	return addedSize;
+}
+
 /*!
  * FixSelectionAfterFilter
  */
@@ -3406,8 +3263,10 @@ bool FPDocument::ReadyToPlay() const {
 void FPDocument::CopySelectionToClipboard() {
 	ChordIndex start, end;
 	
-	if (GetSelection(&start, &end))
+	if (GetSelection(&start, &end)) {
+		LoadRange(start, end);
 		fretpet->clipboard.Copy(chordGroupArray, CurrentPart(), start, end);
+	}
 }
 
 #pragma mark -
@@ -3430,6 +3289,8 @@ void FPDocument::SetCurrentChord(const FPChord &srcChord) {
 				}
 			}
 		}
+		
+		player->InvalidateLines(this, cursor, cursor);
 	}
 }
 
@@ -3468,5 +3329,7 @@ void FPDocument::UpdateFingerings() {
 		for (ChordIndex num=0;num<Size();num++)
 			for (PartIndex part=DOC_PARTS; part--;)
 				guitarPalette->NewFingering(Chord(num, part));
+	
+	player->InvalidateLines(this, 0);
 }
 
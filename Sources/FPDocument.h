@@ -14,13 +14,20 @@
 #define FPDOCUMENT_H
 
 #include "FPChord.h"
+#include "FPNoteList.h"
 #include "TFile.h"
 
 #include "FPMusicPlayer.h"
 #include "FPTuningInfo.h"
+#include "FPDocumentLoader.h"
+#include "FPClassicFormat.h"
+#include "FPMidiFormat.h"
 #include <QuickTime/QuickTime.h>
 
 class	FPDocWindow;
+class	TPlistReader;
+class	TByteSink;
+class	FPMidiWriter;
 
 #if !DEMO_ONLY
 class	FPMovieFile;
@@ -31,11 +38,8 @@ class	FPSunvoxFile;
 //
 //	File Format IDs
 //
-#define	FILE_FORMAT_B3			'FPB3'
-#define	FILE_FORMAT_14			'FP14'
-#define	FILE_FORMAT_21			'FP21'
-#define	FILE_FORMAT_X1			'FPX1'
-#define	FILE_FORMAT_QQ			'FPQQ'
+#define	FILE_FORMAT_BIN			'FPXB'
+#define	FILE_BINARY_VERSION		2
 #define	FILE_FORMAT_XML_COMPACT	CFSTR("Compact")
 #define	FILE_FORMAT_XML_LOOSE	CFSTR("Loose")
 
@@ -79,9 +83,11 @@ typedef struct {
  */
 class FPDocument : public TFile {
 	friend class FPMidiFile;
+	friend class FPDocumentLoader;
 
 	private:
 		FPChordGroupArray	chordGroupArray;	//!< A smart array class to handle our chord data
+		FPNoteList			noteList;			//!< The chords compiled into timed notes
 #if !DEMO_ONLY
 		FPMovieFile			*movieExporter;		//!< Helper to export as a movie
 		FPMidiFile			*midiExporter;		//!< Helper to export as MIDI
@@ -97,6 +103,7 @@ class FPDocument : public TFile {
 		FPTuningInfo		tuning;				//!< The tuning of this document, as last synched
 
 		TString instrumentName[DOC_PARTS];		//!< Instrument names for all parts
+		UInt16				namedInstrument[DOC_PARTS];	//!< The instrument each name was made for
 
 		UInt16				scaleMode;			//!< Scale
 		UInt16				enharmonic;			//!< Enharmonic index
@@ -108,6 +115,9 @@ class FPDocument : public TFile {
 		bool				soloMIDI;			//!< Solo for MIDI (unused)
 		bool				soloTransform;		//!< Solo for Transform (unused)
 
+		bool				binaryFormat;		//!< Save in the binary format
+		FPDocumentLoader	*loader;			//!< Reads the rest of a large document
+
 	public:
 							FPDocument(FPDocWindow *wind);
 							FPDocument(FPDocWindow *wind, const FSSpec &fspec);
@@ -116,26 +126,29 @@ class FPDocument : public TFile {
 
 		void				Init(FPDocWindow *wind);
 		void				SetWindow(FPDocWindow *wind);
+		void				CopySettings(const FPDocument &src);
 		WindowRef			Window();
 		inline FPDocWindow*	DocWindow() const					{ return window; }
 
 		inline ChordIndex	Size() const						{ return chordGroupArray.size(); }
 
-		inline FPChordGroupArray&	ChordGroupArray()			{ return chordGroupArray; }
+		inline FPChordGroupArray&	ChordGroupArray()			{ if (loader) FinishLoading(); return chordGroupArray; }
 
-		inline FPChordGroup&	ChordGroup(ChordIndex index)	{ return chordGroupArray[index]; }
+		inline FPChordGroup&	ChordGroup(ChordIndex index)	{ if (loader) loader->Load(index); return chordGroupArray[index]; }
 		inline FPChordGroup&	ChordGroup()					{ return ChordGroup(cursor); }
 
-		inline FPChord&	Chord(ChordIndex index, PartIndex part)	{ return chordGroupArray[index][part]; }
+		inline FPChord&	Chord(ChordIndex index, PartIndex part)	{ return ChordGroup(index)[part]; }
 		inline FPChord&	Chord(ChordIndex index)					{ return Chord(index, CurrentPart()); }
 		inline FPChord&	CurrentChord()							{ return Chord(cursor); }
 
-		inline const FPChordGroup& ChordGroup(ChordIndex index) const		{ return chordGroupArray[index]; }
+		inline const FPChordGroup& ChordGroup(ChordIndex index) const		{ if (loader) loader->Load(index); return chordGroupArray[index]; }
 		inline const FPChordGroup& ChordGroup() const						{ return ChordGroup(cursor); }
 
-		inline const FPChord& Chord(ChordIndex index, PartIndex part) const	{ return chordGroupArray[index][part]; }
+		inline const FPChord& Chord(ChordIndex index, PartIndex part) const	{ return ChordGroup(index)[part]; }
 		inline const FPChord& Chord(ChordIndex index) const					{ return Chord(index, CurrentPart()); }
-		inline const FPChord& CurrentChord() const							{ return chordGroupArray[cursor][CurrentPart()]; }
+		inline const FPChord& CurrentChord() const							{ return ChordGroup(cursor)[CurrentPart()]; }
+
+		inline const FPNoteList&	NoteList()						{ noteList.Compile(*this); return noteList; }
 
 		inline void		SetTopLine(ChordIndex top)				{ topLine = top; }
 		void			SetCurrentChord(const FPChord &srcChord);
@@ -170,6 +183,7 @@ class FPDocument : public TFile {
 		inline UInt16	GetInstrument(PartIndex p) const					{ return part[p].instrument; }
 		inline UInt16	CurrentInstrument() const							{ return GetInstrument(CurrentPart()); }
 		inline StringPtr CurrentInstrumentName() const						{ return instrumentName[CurrentPart()].GetPascalString(); }
+		void			CopyInstrumentName(PartIndex p, char *name, UInt16 size) const;
 		inline UInt16	ScaleMode() const									{ return scaleMode; }
 		inline UInt16	Enharmonic() const									{ return enharmonic; }
 		inline const	FPTuningInfo& Tuning() const						{ return tuning; }
@@ -195,7 +209,7 @@ class FPDocument : public TFile {
 
 		// Document settings setters
 		inline void		SetInstrument(PartIndex p, UInt16 inInstrument)		{ part[DPART(p)].instrument = inInstrument; }
-		inline void		UpdateInstrumentName(PartIndex p)					{ instrumentName[DPART(p)] = player->GetInstrumentName(DPART(p)); }
+		inline void		UpdateInstrumentName(PartIndex p)					{ instrumentName[DPART(p)] = player->GetInstrumentName(DPART(p)); namedInstrument[DPART(p)] = player->GetInstrumentNumber(DPART(p)); }
 		inline void		UpdateInterim()										{ interim = U64Divide(60 * 1000000, PlayTempo(), NULL); }
 		inline void		SetCurrentPart(PartIndex p)							{ partNum = p; }
 		inline void		SetScale(UInt16 newMode)							{ scaleMode = newMode; }
@@ -211,6 +225,7 @@ class FPDocument : public TFile {
 		void			UpdateFingerings();
 		void			TransformSelection(MenuCommand cid, MenuItemIndex index, PartMask partMask, bool undoable);
 		void			CloneSelection(ChordIndex count, PartMask clonePartMask, UInt16 cloneTranspose, UInt16 cloneHarmonize, bool undoable);
+		ChordIndex		CloneGroups(ChordIndex start, ChordIndex end, ChordIndex count, PartMask clonePartMask, UInt16 cloneTranspose, UInt16 cloneHarmonize);
 		void			FixSelectionAfterFilter(ChordIndex startSel, ChordIndex endSel, ChordIndex addedSize);
 
 		// Sequence methods
@@ -241,10 +256,28 @@ class FPDocument : public TFile {
 		OSStatus		InitFromFile(const FSRef &fsref);
 		OSStatus		InitFromFile();
 		OSErr			InitFromXMLFile();
+		bool			ReadXMLInfo(TPlistReader &reader, ChordIndex &len, ChordIndex &curs, ChordIndex &sel);
+		OSStatus		InitFromMappedFile(OSStatus (FPDocument::*reader)(const UInt8*, UInt64), UInt64 minSize);
 		OSStatus		InitFromClassicFile();
+		OSStatus		ReadClassicFormat(const UInt8 *data, UInt64 size);
+		OSStatus		InitFromMidiFile();
+		OSStatus		ReadMidiFormat(const UInt8 *data, UInt64 size);
+		OSStatus		InitFromBinaryFile();
+		OSStatus		InitFromBinaryPath(const char *path);
+		OSStatus		ReadBinaryFormat(const UInt8 *data, UInt64 size);
+		static const UInt8*	BinaryGroupRecord(const UInt8 *table, const UInt8 *refs, UInt16 groupSize, ChordIndex line);
+		static void		ReadBinaryGroup(const UInt8 *record, FPChordGroup &group);
+
+		inline bool		IsLoading() const					{ return loader != NULL; }
+		void			LoadRange(ChordIndex start, ChordIndex end);
+		void			FinishLoading();
+
+		inline bool		IsBinaryFormat() const				{ return binaryFormat; }
+		inline void		SetBinaryFormat(bool b)				{ binaryFormat = b; }
 
 #if !DEMO_ONLY
 		OSErr			WriteXMLFormat();
+		OSErr			WriteBinaryFormat();
 
 		OSErr			WriteFormat214();
 		OSErr			WriteFormat214Chords();
@@ -252,11 +285,18 @@ class FPDocument : public TFile {
 		// Export Formats
 		Handle		GetFormat0();
 		Handle		GetFormat1();
+		OSErr		WriteFormat0(TByteSink &sink);
+		OSErr		WriteFormat1(TByteSink &sink);
+		void		PrepareMidiWriter(FPMidiWriter &writer) const;
 		OSStatus	ExportMIDI();
 
 		Handle		GetSunvoxFormat();
 		OSStatus	ExportSunvox();
 
+		OSErr		WriteWaveFormat(TByteSink &sink, UInt16 maxThreads=0);
+		OSErr		WriteTablature(TByteSink &sink, UInt16 style);
+		OSErr		WriteMusicXML(TByteSink &sink);
+
 		UInt32*		GetTuneHeader();
 		UInt32**	GetTuneSequence(long *duration);
 		OSStatus	ExportMovie();
@@ -0,0 +1,120 @@
+/*
+ *  FPDocumentLoader.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPDocumentLoader.h"
+#include "FPDocument.h"
+
+#include <sys/mman.h>
+
+
+/*!
+ * FPDocumentLoader
+ *
+ *	Take over a mapped binary document whose header and
+ *	group IDs have already been checked. The document must
+ *	already hold one group for every line.
+ */
+FPDocumentLoader::FPDocumentLoader(FPDocument *doc, const UInt8 *inData, UInt64 inSize, const UInt8 *inTable, const UInt8 *inRefs, UInt16 inGroupSize, ChordIndex len) {
+	document	= doc;
+	data		= inData;
+	size		= inSize;
+	table		= inTable;
+	refs		= inRefs;
+	groupSize	= inGroupSize;
+	length		= len;
+	loadedCount	= 0;
+	sweepIndex	= 0;
+	loaderLoop	= NULL;
+	loaderUPP	= NULL;
+
+	loaded.resize(len, false);
+}
+
+
+FPDocumentLoader::~FPDocumentLoader() {
+	DisposeTimer();
+	munmap((void*)data, size);
+}
+
+
+/*!
+ * Load
+ *
+ *	Read any records in the range that haven't been read yet.
+ *	The range is clipped to the document.
+ */
+void FPDocumentLoader::Load(ChordIndex start, ChordIndex end) {
+	if (start < 0) start = 0;
+	if (end >= length) end = length - 1;
+
+	for (ChordIndex i=start; i<=end; i++) {
+		if (!loaded[i]) {
+			FPDocument::ReadBinaryGroup(FPDocument::BinaryGroupRecord(table, refs, groupSize, i), document->chordGroupArray[i]);
+			loaded[i] = true;
+			loadedCount++;
+		}
+	}
+}
+
+
+/*!
+ * LoadChunk
+ *
+ *	Read the next few unread records.
+ *	Returns true when every record has been read.
+ */
+bool FPDocumentLoader::LoadChunk() {
+	for (ChordIndex count=kLoaderChunkSize; count && sweepIndex < length; sweepIndex++) {
+		if (!loaded[sweepIndex]) {
+			Load(sweepIndex, sweepIndex);
+			count--;
+		}
+	}
+
+	return IsComplete();
+}
+
+
+void FPDocumentLoader::StartTimer() {
+	if (loaderLoop == NULL) {
+		loaderUPP = NewEventLoopTimerUPP(FPDocumentLoader::LoaderTimerProc);
+
+		(void)InstallEventLoopTimer(
+									GetMainEventLoop(),
+									1.0 / 10.0, 1.0 / 100.0,
+									loaderUPP,
+									this,
+									&loaderLoop
+									);
+	}
+}
+
+
+void FPDocumentLoader::DisposeTimer() {
+	if (loaderLoop != NULL) {
+		(void)RemoveEventLoopTimer(loaderLoop);
+		DisposeEventLoopTimerUPP(loaderUPP);
+		loaderLoop = NULL;
+		loaderUPP = NULL;
+	}
+}
+
+
+//
+// LoaderTimerProc
+//
+//	Read a chunk. Once it's all read the document
+//	deletes the loader, so don't touch it after.
+//
+void FPDocumentLoader::LoaderTimerProc(EventLoopTimerRef timer, void *loader) {
+	FPDocumentLoader *self = (FPDocumentLoader*)loader;
+
+	if (self->LoadChunk())
+		self->document->FinishLoading();
+}
+
@@ -0,0 +1,75 @@
+/*!
+ *	@file FPDocumentLoader.h
+ *
+ *	@brief Loads a large binary document a piece at a time
+ *
+ *	The binary format keeps its chord groups in a table of fixed-size
+ *	records, so any group can be found without reading the ones
+ *	before it. When a large binary document is opened in a window,
+ *	the document is filled with empty groups and only the groups
+ *	around the top line and the cursor are read at first. The window
+ *	can be shown right away.
+ *
+ *	A timer then reads the rest in chunks while the app stays
+ *	responsive. Any group that's asked for before then is read on
+ *	the spot, so drawing, playing and exporting all see real data.
+ *
+ *	Until loading finishes the document's indexes still match the
+ *	file. Anything that inserts or deletes groups, or works on the
+ *	whole array, finishes loading first.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPDOCUMENTLOADER_H
+#define FPDOCUMENTLOADER_H
+
+#include <vector>
+
+class FPDocument;
+
+#define kLazyLoadThreshold	8192		//!< Smaller documents are loaded all at once
+#define kLoaderChunkSize	4096		//!< Groups read on each timer tick
+#define kLoaderMargin		256			//!< Groups read around the top line and cursor
+
+#pragma mark -
+//-----------------------------------------------
+//
+// FPDocumentLoader
+//
+class FPDocumentLoader {
+	private:
+		FPDocument			*document;		//!< The document being filled in
+		const UInt8			*data;			//!< The mapped file
+		UInt64				size;			//!< The size of the mapping
+		const UInt8			*table;			//!< The first chord group record
+		const UInt8			*refs;			//!< The group ID of each line, or NULL
+		UInt16				groupSize;		//!< The size of each record
+		ChordIndex			length;			//!< The number of records
+		std::vector<bool>	loaded;			//!< Records already read
+		ChordIndex			loadedCount;	//!< How many records have been read
+		ChordIndex			sweepIndex;		//!< Where the timer will read next
+		EventLoopTimerRef	loaderLoop;		//!< The background timer
+		EventLoopTimerUPP	loaderUPP;		//!< UPP for the timer
+
+	public:
+		FPDocumentLoader(FPDocument *doc, const UInt8 *inData, UInt64 inSize, const UInt8 *inTable, const UInt8 *inRefs, UInt16 inGroupSize, ChordIndex len);
+		~FPDocumentLoader();
+
+		inline void			Load(ChordIndex index)			{ if (!loaded[index]) Load(index, index); }
+		void				Load(ChordIndex start, ChordIndex end);
+		inline bool			IsComplete() const				{ return loadedCount == length; }
+
+		void				StartTimer();
+		void				DisposeTimer();
+
+	private:
+		bool				LoadChunk();
+		static void			LoaderTimerProc(EventLoopTimerRef timer, void *loader);
+};
+
+#endif
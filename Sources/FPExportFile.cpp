@@ -13,6 +13,7 @@
 #include "FPPreferences.h"
 #include "FPDocument.h"
 #include "FPDocWindow.h"
+#include "TByteSink.h"
 
 
 #pragma mark -
@@ -74,18 +75,15 @@ void FPExportFile::NavCancel() {
 #define kMidiCustomHeight	44
 
 OSErr FPMidiFile::WriteData() {
-	OSErr	err = noErr;
-	bool	format1 = preferences.GetBoolean(kPrefFormat1, FALSE);
-	char	**midiHandle = format1 ? document->GetFormat1() : document->GetFormat0();
-	
-	if (midiHandle != NULL) {
-		char	*buffer = *midiHandle;
-		err = Write(buffer, GetHandleSize(midiHandle));
-		DisposeHandle(midiHandle);
-	}
-	else
-		err = memFullErr;
-	
+	bool		format1 = preferences.GetBoolean(kPrefFormat1, FALSE);
+	TByteSink	sink(*this);
+
+	// Stream straight to the file
+	OSErr err = format1 ? document->WriteFormat1(sink) : document->WriteFormat0(sink);
+
+	if (err == noErr)
+		err = sink.Finish();
+
 	return err;
 }
 
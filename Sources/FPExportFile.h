@@ -93,6 +93,7 @@ public:
 #define kPrefFormat1		CFSTR("MidiFormat1")
 #define kPrefMovieSplit		CFSTR("MovieSplit")
 #define kPrefFormat214		CFSTR("Format214")
+#define kPrefFormatBinary	CFSTR("FormatBinary")
 
 
 #endif
@@ -0,0 +1,41 @@
+/*
+ *  FPExportNames.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPExportNames.h"
+#include "FPScalePalette.h"
+
+
+/*!
+ * CopyChordName
+ *
+ *	The chord's name as "Root:extension:(missing)", with
+ *	MacRoman symbols in the extension. Safe on any thread.
+ */
+void FPExportNames::CopyChordName(const FPChord &chord, char *name, UInt16 size) {
+	chord.CopyChordName(name, size);
+}
+
+
+/*!
+ * NameOfNote
+ *
+ *	A tone's name in a key, spelled in the current scale
+ */
+const char* FPExportNames::NameOfNote(UInt16 key, UInt16 tone) {
+	return scalePalette->NameOfNote(key, tone);
+}
+
+
+/*!
+ * NameOfNote
+ *
+ *	A tone's name in the current key and scale
+ */
+const char* FPExportNames::NameOfNote(UInt16 tone) {
+	return scalePalette->NameOfNote(tone);
+}
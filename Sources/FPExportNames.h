@@ -0,0 +1,32 @@
+/*!
+ *	@file FPExportNames.h
+ *
+ *	@brief The note and chord names the text exporters write
+ *
+ *	The tab writer and the MusicXML writer get every name they
+ *	write from here. In the app the names come from the chord
+ *	and the scale palette, as they do on screen. The tests in
+ *	Tests/Makefile build the writers without Carbon, and give
+ *	them fixed names of their own, so the rest of each file can
+ *	be checked against a known good copy.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPEXPORTNAMES_H
+#define FPEXPORTNAMES_H
+
+#include "FPChord.h"
+
+class FPExportNames {
+	public:
+		static void			CopyChordName(const FPChord &chord, char *name, UInt16 size);
+		static const char*	NameOfNote(UInt16 key, UInt16 tone);
+		static const char*	NameOfNote(UInt16 tone);
+};
+
+#endif
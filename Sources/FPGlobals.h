@@ -10,7 +10,9 @@
 #define FPGLOBALS_H
 
 #include "FPMacros.h"
+#if !FP_PORTABLE
 #include <QuickTime/QuickTimeMusic.h>
+#endif
 
 //#define DEBUG_ASSERT_PRODUCTION_CODE 0
 
@@ -1827,63 +1827,7 @@ void FPGuitarPalette::ArrangeDots() {
 //	the current tuning of the palette.
 //
 void FPGuitarPalette::NewFingering(FPChord &pChord) {
-	UInt16	tones = pChord.tones, fingeredChord = 0;
-	SInt16	fret, string, tone, openTone, bestTone, bit;
-	SInt16	hh, bestFret;
-	bool	noTone;
-
-	for (string=0; string<metrics.numberOfStrings; string++) {
-		if (pChord.bracketFlag) {
-			hh = fretpet->IsReverseStrung() ? metrics.numberOfStrings-1 - string : string;
-			openTone = NOTEMOD(OpenTone(string));
-			tone = NOTEMOD(openTone + metrics.numberOfFrets);
-
-			noTone = true;
-			bestFret = -1;
-
-			for (fret = metrics.numberOfFrets; fret >= -1 ; fret--) {
-				if (fret >= 0) {
-					bit = BIT(tone);
-
-					if (tones & bit) {
-						if (noTone && fret >= pChord.brakLow && fret <= pChord.brakHi) {
-							if (fingeredChord & bit) {
-								bestFret = fret;
-								bestTone = tone;
-							}
-							else {
-								noTone = false;
-								fingeredChord |= bit;
-								pChord.fretHeld[string] = fret;
-							}
-						}
-
-					} // tones & bit
-
-					DEC_WRAP(tone, OCTAVE);
-
-				}
-				else if (noTone) {
-					if (bestFret < 0) {
-						bit = BIT(openTone);
-						if (tones & bit) {
-							fingeredChord |= bit;
-							bestFret = 0;
-							bestTone = openTone;
-						}
-					}
-
-					pChord.fretHeld[string] = bestFret;
-
-				} // noTone
-
-			} // fret loop
-		}
-		else {
-			pChord.fretHeld[string] = -1;
-		}
-
-	} // string loop
+	pChord.NewFingering(currentTuning.tone, metrics.numberOfFrets);
 }
 
 
@@ -10,14 +10,63 @@
 #include "FPHistory.h"
 #include "FPDocWindow.h"
 #include "FPDocument.h"
+#include "FPJournalCompactor.h"
+#include "FPPreferences.h"
 
+#include <algorithm>
 
+
+#pragma mark -
+FPHistoryData& FPHistoryData::operator=(const FPHistoryData &src) {
+	if (this != &src) {
+		memcpy(value, src.value, sizeof(value));
+		setMask = src.setMask;
+		objectKey = src.objectKey;
+
+		if (src.object) CFRETAIN(src.object);
+		if (object) CFRELEASE(object);
+		object = src.object;
+	}
+
+	return *this;
+}
+
+
+void FPHistoryData::SetValue(FPHistoryKey key, CFTypeRef val) {
+	if (val) CFRETAIN(val);
+	if (object) CFRELEASE(object);
+
+	object = val;
+	objectKey = val ? key : kHistoryKeyCount;
+}
+
+
+//
+// Returns a retained reference, as CF getters
+// did when this was a dictionary
+//
+CFTypeRef FPHistoryData::GetValue(FPHistoryKey key) const {
+	if (object == NULL || key != objectKey)
+		return NULL;
+
+	CFRETAIN(object);
+	return object;
+}
+
+
+#pragma mark -
 void FPHistoryEvent::Init(FPHistory *hist, UInt16 inAction, CFStringRef opName, PartMask inMask) {
 	history		= hist;
 	docWindow	= history->docWindow;
 	action		= inAction;
 	nameString	= CFCopyLocalizedString(opName, "Undoable event name");
 	eventTime	= TickCount();
+	deltaStart	= 0;
+	deltaPending = false;
+	spillOffset	= -1;
+	spillSize	= 0;
+	snapshot	= NULL;
+	journalEpoch = 0;
 
 	if (docWindow) {
 		partNum			= docWindow->CurrentPart();
@@ -103,6 +152,19 @@ void FPHistoryEvent::SaveSelectionAfter() {
 }
 
 
+//-----------------------------------------------
+//
+// CopyDocumentGroups
+//
+//	Copy a range of groups through ChordGroup, so a
+//	document that's still loading only reads the range
+//
+static void CopyDocumentGroups(FPDocument *doc, FPChordGroupArray &groups, ChordIndex start, ChordIndex end) {
+	for (ChordIndex i=start; i<=end; i++)
+		groups.append_copy(doc->ChordGroup(i));
+}
+
+
 //-----------------------------------------------
 //
 // SaveGroupsBefore / SaveGroupsAfter
@@ -110,7 +172,7 @@ void FPHistoryEvent::SaveSelectionAfter() {
 void FPHistoryEvent::SaveGroupsBefore(ChordIndex start, ChordIndex end) {
 	if (end >= start) {
 		before.groups.clear();
-		before.groups.append_copies(docWindow->document->ChordGroupArray(), start, end);
+		CopyDocumentGroups(docWindow->document, before.groups, start, end);
 	}
 }
 
@@ -121,10 +183,46 @@ void FPHistoryEvent::SaveGroupsBefore(FPChordGroupArray &groupArray) {
 }
 
 
+void FPHistoryEvent::SaveDeltaBefore(ChordIndex start, ChordIndex end) {
+	if (end >= start) {
+		SaveGroupsBefore(start, end);
+		deltaStart = start;
+		deltaPending = true;
+	}
+}
+
+
+//-----------------------------------------------
+//
+// GetDeltaGroups
+//
+//	The document is in the After state when undoing and the
+//	Before state when redoing, so applying the delta to a
+//	copy of the range gives the other state.
+//
+//	Events that couldn't record a delta still have their
+//	groups, so fall back to those.
+//
+bool FPHistoryEvent::GetDeltaGroups(FPChordGroupArray &groups, bool forward) {
+	groups.clear();
+
+	if (delta.RangeSize() == 0) {
+		groups.append_copies(forward ? after.groups : before.groups);
+		return groups.size() > 0;
+	}
+
+	if (deltaStart + delta.RangeSize() > docWindow->document->Size())
+		return false;
+
+	CopyDocumentGroups(docWindow->document, groups, deltaStart, deltaStart + delta.RangeSize() - 1);
+	return delta.Apply(groups, 0, forward);
+}
+
+
 void FPHistoryEvent::SaveGroupsAfter(ChordIndex start, ChordIndex end) {
 	if (end >= start) {
 		after.groups.clear();
-		after.groups.append_copies(docWindow->document->ChordGroupArray(), start, end);
+		CopyDocumentGroups(docWindow->document, after.groups, start, end);
 	}
 }
 
@@ -140,42 +238,42 @@ void FPHistoryEvent::SaveGroupsAfter(FPChordGroupArray &groupArray) {
 // SaveDataBefore / GetDataBefore / GetCFDataBefore
 // SaveDataAfter / GetDataAfter / GetCFDataAfter
 //
-void FPHistoryEvent::SaveDataBefore(CFStringRef key, SInt32 value) {
+void FPHistoryEvent::SaveDataBefore(FPHistoryKey key, SInt32 value) {
 	before.moreData.SetInteger(key, value);
 }
 
 
-SInt32 FPHistoryEvent::GetDataBefore(CFStringRef key) {
+SInt32 FPHistoryEvent::GetDataBefore(FPHistoryKey key) {
 	return before.moreData.GetInteger(key);
 }
 
 
-void FPHistoryEvent::SaveDataAfter(CFStringRef key, SInt32 value) {
+void FPHistoryEvent::SaveDataAfter(FPHistoryKey key, SInt32 value) {
 	after.moreData.SetInteger(key, value);
 }
 
 
-SInt32 FPHistoryEvent::GetDataAfter(CFStringRef key) {
+SInt32 FPHistoryEvent::GetDataAfter(FPHistoryKey key) {
 	return after.moreData.GetInteger(key);
 }
 
 
-void FPHistoryEvent::SaveDataBefore(CFStringRef key, CFTypeRef value) {
+void FPHistoryEvent::SaveDataBefore(FPHistoryKey key, CFTypeRef value) {
 	before.moreData.SetValue(key, value);
 }
 
 
-CFTypeRef FPHistoryEvent::GetCFDataBefore(CFStringRef key) {
+CFTypeRef FPHistoryEvent::GetCFDataBefore(FPHistoryKey key) {
 	return before.moreData.GetValue(key);
 }
 
 
-void FPHistoryEvent::SaveDataAfter(CFStringRef key, CFTypeRef value) {
+void FPHistoryEvent::SaveDataAfter(FPHistoryKey key, CFTypeRef value) {
 	after.moreData.SetValue(key, value);
 }
 
 
-CFTypeRef FPHistoryEvent::GetCFDataAfter(CFStringRef key) {
+CFTypeRef FPHistoryEvent::GetCFDataAfter(FPHistoryKey key) {
 	return after.moreData.GetValue(key);
 }
 
@@ -245,14 +343,10 @@ void FPHistoryEvent::Undo() {
 			break;
 
 		case UN_MODIFY:
-			fretpet->DoSetNoteModifier( GetDataBefore(CFSTR("modifier")), false );
+			fretpet->DoSetNoteModifier( GetDataBefore(kHistoryModifier), false );
 			affectCursor = false;
 			break;
 
-		case UN_CLONE_PART:
-			// TODO: Implement if there's any demand
-			break;
-
 		case UN_CUT:
 		case UN_DELETE: {
 //			if ( after.selEnd == -1 && docWindow->DocumentSize() )
@@ -286,7 +380,7 @@ void FPHistoryEvent::Undo() {
 			break;
 
 		case UN_TEMPO:
-			fretpet->DoSetTempo( GetDataBefore(CFSTR("tempo")), true );
+			fretpet->DoSetTempo( GetDataBefore(kHistoryTempo), true );
 			affectCursor = false;
 			break;
 
@@ -296,28 +390,28 @@ void FPHistoryEvent::Undo() {
 			break;
 
 		case UN_VELOCITY:
-			fretpet->DoSetVelocity( GetDataBefore(CFSTR("velocity")), GetDataBefore(CFSTR("part")), true, true );
+			fretpet->DoSetVelocity( GetDataBefore(kHistoryVelocity), GetDataBefore(kHistoryPart), true, true );
 			affectCursor = false;
 			break;
 
 		case UN_SUSTAIN:
-			fretpet->DoSetSustain( GetDataBefore(CFSTR("sustain")), GetDataBefore(CFSTR("part")), true, true );
+			fretpet->DoSetSustain( GetDataBefore(kHistorySustain), GetDataBefore(kHistoryPart), true, true );
 			affectCursor = false;
 			break;
 
 		case UN_INSTRUMENT:
-			fretpet->DoSetInstrument( GetDataBefore(CFSTR("part")), GetDataBefore(CFSTR("instrument")), false );
+			fretpet->DoSetInstrument( GetDataBefore(kHistoryPart), GetDataBefore(kHistoryInstrument), false );
 			affectCursor = false;
 			break;
 
 		case UN_MIDI_CHANNEL:
-			fretpet->DoSetMidiChannel( GetDataBefore(CFSTR("part")), GetDataBefore(CFSTR("channel")), false );
+			fretpet->DoSetMidiChannel( GetDataBefore(kHistoryPart), GetDataBefore(kHistoryChannel), false );
 			affectCursor = false;
 			break;
 
 		case UN_S_CLONE: {
 			ChordIndex start, end;
-			ChordIndex size = docWindow->GetSelection(&start, &end) * ( GetDataBefore(CFSTR("count")) - 1);
+			ChordIndex size = docWindow->GetSelection(&start, &end) * ( GetDataBefore(kHistoryCount) - 1);
 			docWindow->SetCursorAndSelection( end, end - size + 1 );
 			docWindow->DeleteSelection( false );
 			redraw = true;
@@ -337,7 +431,7 @@ void FPHistoryEvent::Undo() {
 			affectCursor = false;
 
 		// TODO: Only affect the cursor in cases where the size actually changes
-			docWindow->TransformSelection(GetDataBefore(CFSTR("undoCommand")), GetDataBefore(CFSTR("menuIndex")), partMask, false);
+			docWindow->TransformSelection(GetDataBefore(kHistoryUndoCommand), GetDataBefore(kHistoryMenuIndex), partMask, false);
 			break;
 
 		//
@@ -352,6 +446,7 @@ void FPHistoryEvent::Undo() {
 		//
 		// Commands that transform chords in place
 		//
+		case UN_CLONE_PART:
 		case UN_S_SCRAMBLE:
 		case UN_S_CLEAR:
 		case UN_S_CLEANUP:
@@ -362,22 +457,31 @@ void FPHistoryEvent::Undo() {
 		case UN_S_TRANSTO:
 		case UN_S_TRANSBY:
 		case UN_S_RANDOM1:
-		case UN_S_RANDOM2:
+		case UN_S_RANDOM2: {
+			FPChordGroupArray groups;
 			affectCursor = false;
-			docWindow->ReplaceSelection( before.groups );
+			if (GetDeltaGroups(groups, false))
+				docWindow->ReplaceSelection( groups );
 			break;
+		}
 
 		//
 		// Commands that affect every chord
 		//
 		case UN_TUNING_CHANGE: {
-			CFDictionaryRef dict = (CFDictionaryRef)GetCFDataBefore(CFSTR("tuning"));
+			// Get the old chords before the tuning change re-fingers them
+			FPChordGroupArray groups;
+			bool restore = (docWindow != NULL) && GetDeltaGroups(groups, false);
+
+			CFDictionaryRef dict = (CFDictionaryRef)GetCFDataBefore(kHistoryTuning);
 			TDictionary		tdict(dict);
 			FPTuningInfo	tuningInfo(&tdict);
 			fretpet->DoSetGuitarTuning(tuningInfo, false);
 
-			if (docWindow)
-				docWindow->ReplaceAll( before.groups );
+			if (docWindow) {
+				if (restore)
+					docWindow->ReplaceAll( groups );
+			}
 			else
 				fretpet->SetGlobalChord( before.groups[0][partNum] );
 
@@ -404,6 +508,8 @@ void FPHistoryEvent::Undo() {
 //		if (redraw)
 //			docWindow->DrawVisibleLines();
 	}
+
+	InvalidatePlayedLines();
 }
 
 
@@ -445,14 +551,10 @@ void FPHistoryEvent::Redo() {
 			break;
 
 		case UN_MODIFY:
-			fretpet->DoSetNoteModifier( GetDataAfter(CFSTR("modifier")), false );
+			fretpet->DoSetNoteModifier( GetDataAfter(kHistoryModifier), false );
 			affectCursor = false;
 			break;
 
-		case UN_CLONE_PART:
-			// TODO: Implement if there's any demand
-			break;
-
 		case UN_CUT:
 		case UN_DELETE:
 			docWindow->DeleteSelection( false );
@@ -464,12 +566,12 @@ void FPHistoryEvent::Redo() {
 			break;
 
 		case UN_PASTE_PATT:
-			docWindow->DoPastePattern( after.groups, GetDataAfter(CFSTR("clipPart")) );
+			docWindow->DoPastePattern( after.groups, GetDataAfter(kHistoryClipPart) );
 			affectCursor = false;
 			break;
 
 		case UN_PASTE_TONES:
-			docWindow->DoPasteTones( after.groups, GetDataAfter(CFSTR("clipPart")) );
+			docWindow->DoPasteTones( after.groups, GetDataAfter(kHistoryClipPart) );
 			affectCursor = false;
 			break;
 
@@ -478,7 +580,7 @@ void FPHistoryEvent::Redo() {
 			break;
 
 		case UN_TEMPO:
-			fretpet->DoSetTempo( GetDataAfter(CFSTR("tempo")), true );
+			fretpet->DoSetTempo( GetDataAfter(kHistoryTempo), true );
 			break;
 
 		case UN_TEMPO_X:
@@ -486,31 +588,35 @@ void FPHistoryEvent::Redo() {
 			break;
 
 		case UN_VELOCITY:
-			fretpet->DoSetVelocity( GetDataAfter(CFSTR("velocity")), GetDataBefore(CFSTR("part")), true, true );
+			fretpet->DoSetVelocity( GetDataAfter(kHistoryVelocity), GetDataBefore(kHistoryPart), true, true );
 			break;
 
 		case UN_SUSTAIN:
-			fretpet->DoSetSustain( GetDataAfter(CFSTR("sustain")), GetDataBefore(CFSTR("part")), true, true );
+			fretpet->DoSetSustain( GetDataAfter(kHistorySustain), GetDataBefore(kHistoryPart), true, true );
 			break;
 
 		case UN_INSTRUMENT:
-			fretpet->DoSetInstrument( GetDataBefore(CFSTR("part")), GetDataAfter(CFSTR("instrument")), false );
+			fretpet->DoSetInstrument( GetDataBefore(kHistoryPart), GetDataAfter(kHistoryInstrument), false );
 			break;
 
 		case UN_MIDI_CHANNEL:
-			fretpet->DoSetMidiChannel( GetDataBefore(CFSTR("part")), GetDataAfter(CFSTR("channel")), false );
+			fretpet->DoSetMidiChannel( GetDataBefore(kHistoryPart), GetDataAfter(kHistoryChannel), false );
 			break;
 
 		case UN_S_CLONE:
-			docWindow->CloneSelection(GetDataBefore(CFSTR("count")), partMask, GetDataBefore(CFSTR("transpose")), GetDataBefore(CFSTR("harmonize")), false);
+			docWindow->CloneSelection(GetDataBefore(kHistoryCount), partMask, GetDataBefore(kHistoryTranspose), GetDataBefore(kHistoryHarmonize), false);
 			break;
 
+		case UN_CLONE_PART:
 		case UN_S_SCRAMBLE:
 		case UN_S_RANDOM1:
-		case UN_S_RANDOM2:
-			docWindow->ReplaceSelection( after.groups );
+		case UN_S_RANDOM2: {
+			FPChordGroupArray groups;
+			if (GetDeltaGroups(groups, true))
+				docWindow->ReplaceSelection( groups );
 			affectCursor = false;
 			break;
+		}
 
 		// The following commands are redone by doing the same command again.
 		// No data will have been saved during the original operation
@@ -535,11 +641,11 @@ void FPHistoryEvent::Redo() {
 		case UN_S_DOUBLE:
 		case UN_S_LOCK:
 		case UN_S_UNLOCK:
-			docWindow->TransformSelection(GetDataBefore(CFSTR("redoCommand")), GetDataBefore(CFSTR("menuIndex")), partMask, false);
+			docWindow->TransformSelection(GetDataBefore(kHistoryRedoCommand), GetDataBefore(kHistoryMenuIndex), partMask, false);
 			break;
 
 		case UN_TUNING_CHANGE: {
-			CFDictionaryRef dict = (CFDictionaryRef)GetCFDataAfter(CFSTR("tuning"));
+			CFDictionaryRef dict = (CFDictionaryRef)GetCFDataAfter(kHistoryTuning);
 			TDictionary		tdict(dict);
 			FPTuningInfo	tuningInfo(&tdict);
 			fretpet->DoSetGuitarTuning(tuningInfo, false);
@@ -559,6 +665,62 @@ void FPHistoryEvent::Redo() {
 //		if (redraw)
 //			docWindow->DrawVisibleLines();
 	}
+
+	InvalidatePlayedLines();
+}
+
+
+//
+// InvalidatePlayedLines
+//
+//	The lines an edit changes are the ones selected before
+//	or after it. Edits that add or remove lines move every
+//	line after them, and a new tuning fingers every line.
+//	Other settings don't change the lines.
+//
+void FPHistoryEvent::InvalidatePlayedLines() {
+	if (docWindow == NULL)
+		return;
+
+	ChordIndex start = before.cursor, end = before.cursor;
+
+	if (before.selEnd >= 0) {
+		start = MIN(start, before.selEnd);
+		end = MAX(end, before.selEnd);
+	}
+
+	start = MIN(start, after.cursor);
+	end = MAX(end, after.cursor);
+
+	if (after.selEnd >= 0) {
+		start = MIN(start, after.selEnd);
+		end = MAX(end, after.selEnd);
+	}
+
+	switch (action) {
+		case UN_CUT:
+		case UN_PASTE:
+		case UN_INSERT:
+		case UN_DELETE:
+		case UN_S_SPLAY:
+		case UN_S_CONSOLIDATE:
+		case UN_S_DOUBLE:
+		case UN_S_CLONE:
+			end = -1;
+			break;
+
+		case UN_TUNING_CHANGE:
+			start = 0;
+			end = -1;
+			break;
+
+		default:
+			if (FPHistory::IsSettingsAction(action))
+				return;
+			break;
+	}
+
+	player->InvalidateLines(docWindow->document, start, end);
 }
 
 
@@ -567,8 +729,11 @@ void FPHistoryEvent::MergeEvent(FPHistoryEvent *src) {
 	eventTime			= src->eventTime;
 	after.playStart		= src->after.playStart;
 	after.playEnd		= src->after.playEnd;
-	after.groups		= src->after.groups;
 	after.moreData		= src->after.moreData;
+
+	// The source is deleted after merging, so copy its groups
+	after.groups.clear();
+	after.groups.append_copies(src->after.groups);
 }
 
 
@@ -577,12 +742,122 @@ void FPHistoryEvent::Commit() {
 		after.selEnd = docWindow->SelectionEnd();
 		after.cursor = docWindow->GetCursor();
 		player->PlayRange(after.playStart, after.playEnd);
+
+		// Reduce the saved groups to just the changes
+		if (deltaPending) {
+			ChordIndex size = before.groups.size();
+			if (deltaStart + size <= docWindow->document->Size()) {
+				FPChordGroupArray afterGroups;
+				CopyDocumentGroups(docWindow->document, afterGroups, deltaStart, deltaStart + size - 1);
+				delta.Record(before.groups, afterGroups, 0);
+				before.groups.clear();
+			}
+		}
+
+		InvalidatePlayedLines();
 	}
 
+	deltaPending = false;
+
 	history->UndoCommit();
 }
 
 
+//-----------------------------------------------
+//
+// ByteSize
+//
+//	Count the chord groups and the delta, but not the
+//	CF data, which is only ever a few small values.
+//
+UInt32 FPHistoryEvent::ByteSize() const {
+	return sizeof(*this)
+		+ (before.groups.size() + after.groups.size()) * (sizeof(FPChordGroup) + sizeof(FPChordGroup*))
+		+ delta.ByteSize() - sizeof(delta)
+		+ (snapshot ? snapshot->ByteSize() : 0);
+}
+
+
+static bool WriteGroups(FILE *fp, const FPChordGroupArray &groups) {
+	UInt32 count = groups.size();
+	bool good = (fwrite(&count, sizeof(count), 1, fp) == 1);
+
+	for (UInt32 i=0; good && i<count; i++)
+		good = (fwrite(&groups[i], sizeof(FPChordGroup), 1, fp) == 1);
+
+	return good;
+}
+
+
+static bool ReadGroups(FILE *fp, FPChordGroupArray &groups) {
+	UInt32 count;
+	bool good = (fread(&count, sizeof(count), 1, fp) == 1);
+
+	groups.clear();
+	for (UInt32 i=0; good && i<count; i++) {
+		FPChordGroup *group = new FPChordGroup;
+		if ((good = (fread(group, sizeof(FPChordGroup), 1, fp) == 1)))
+			groups.push_back(group);
+		else
+			delete group;
+	}
+
+	return good;
+}
+
+
+//-----------------------------------------------
+//
+// SpillTo
+//
+//	Append the chord data to the spill file and free it.
+//	Chord groups are written as-is, since the file never
+//	outlives the process.
+//
+bool FPHistoryEvent::SpillTo(FILE *fp) {
+	if (IsSpilled() || (before.groups.empty() && after.groups.empty() && delta.RangeSize() == 0))
+		return false;
+
+	if (fseek(fp, 0, SEEK_END) != 0)
+		return false;
+
+	long offset = ftell(fp);
+
+	if (offset < 0 || !WriteGroups(fp, before.groups) || !WriteGroups(fp, after.groups) || !delta.Write(fp)) {
+		fprintf(stderr, "FretPet: Couldn't write the history spill file\n");
+		return false;
+	}
+
+	spillOffset = offset;
+	spillSize = ftell(fp) - offset;
+
+	before.groups.clear();
+	after.groups.clear();
+	delta.Clear();
+
+	return true;
+}
+
+
+bool FPHistoryEvent::PageIn(FILE *fp) {
+	if (!IsSpilled())
+		return true;
+
+	bool good = fseek(fp, spillOffset, SEEK_SET) == 0
+				&& ReadGroups(fp, before.groups)
+				&& ReadGroups(fp, after.groups)
+				&& delta.Read(fp);
+
+	if (!good)
+		fprintf(stderr, "FretPet: Couldn't read the history spill file\n");
+
+	spillOffset = -1;
+	spillSize = 0;
+
+	return good;
+}
+
+
 void FPHistoryEvent::SetMerge() {
 	history->SetUndoMerge();
 }
@@ -597,6 +872,237 @@ void FPHistoryEvent::SetMergeUnderInterim(UInt32 interim) {
 FPHistory::FPHistory(FPDocWindow *wind) {
 	Init();
 	docWindow = wind;
+	memoryBudget = preferences.GetInteger(kPrefHistoryBudget, kDefaultHistoryBudget) * 1024;
+}
+
+
+void FPHistory::Clear() {
+	history.clear();
+	branches.clear();
+	undoPosition = 0;
+
+	delete rootSnapshot;
+	rootSnapshot = NULL;
+	residentBytes = 0;
+
+	if (spillFile != NULL) {
+		fclose(spillFile);
+		spillFile = NULL;
+	}
+
+	spillEnd = spillLive = 0;
+
+	// The document was saved or reverted, so checkpoint
+	CancelCompaction();
+	autosaveBase = false;
+
+	if (journal.IsOpen() && docWindow != NULL)
+		journal.Reset(docWindow->DocumentSize());
+}
+
+
+void FPHistory::StartJournal(const TFile &docFile) {
+	// An imported document has no file of its own yet
+	if (docWindow == NULL || !docFile.Exists() || (journal.IsOpen() && journal.IsFor(docFile)))
+		return;
+
+	CancelCompaction();
+	journal.Close(true);
+
+	if (journal.Open(docFile) == noErr)
+		journal.Reset(docWindow->DocumentSize());
+
+	// Events so far aren't in the new journal
+	if (!history.empty() || !branches.empty())
+		baseEpoch = ++journalEpoch;
+}
+
+
+//-----------------------------------------------
+//
+// RecoverJournal
+//
+//	The document is back where it was last saved, so
+//	committing the journaled events again brings back
+//	the unsaved edits along with the undo history.
+//
+//	A compacted journal follows the autosave instead,
+//	so that replaces the document first. Its history
+//	starts there, and undo can't go back any further.
+//
+//	An undo, redo or merge that refers to an event in
+//	the autosave can't be replayed. It means the app quit
+//	before the autosave could be brought up to date, so
+//	recovery stops there and a new autosave is written.
+//
+UInt32 FPHistory::RecoverJournal(const TFile &docFile) {
+	UInt32			recovered = 0;
+	FPJournalHeader	header;
+	bool			stopped = false;
+
+	if (docWindow == NULL || !docFile.Exists() || journal.Open(docFile) != noErr)
+		return 0;
+
+	bool good = journal.BeginRead(header);
+
+	if (good && (header.flags & kJournalFromAutosave)) {
+		good = (docWindow->document->InitFromBinaryPath(journal.AutosavePath()) == noErr);
+		if (good) {
+			autosaveBase = true;
+			SetDocumentModified(0, true);
+			recovered++;
+		}
+	}
+
+	if (good && header.docSize == docWindow->DocumentSize()) {
+		replaying = true;
+
+		if (rootSnapshot == NULL)
+			TakeRootSnapshot();
+
+		for (bool done = false; !done; ) {
+			FPHistoryEvent	*event = new FPHistoryEvent(this, UN_CANT, CFSTR(""));
+			SInt32			value = 0;
+			UInt32			type = journal.ReadRecord(*event, value);
+
+			switch (type) {
+				case kJournalEvent:
+					event->Redo();
+					SetDocumentModified(event->action, true);
+					RememberEvent(event);
+					event = NULL;
+					break;
+
+				case kJournalMerge:
+					if (undoPosition > 0) {
+						event->Redo();
+						FPHistoryEvent *last = history[undoPosition - 1];
+						PageIn(last);
+						residentBytes -= last->ByteSize();
+						last->MergeEvent(event);
+						residentBytes += last->ByteSize();
+					}
+					else
+						stopped = true;
+					break;
+
+				case kJournalUndo:
+					if (CanUndo())
+						DoUndo();
+					else
+						stopped = true;
+					break;
+
+				case kJournalRedo:
+					if (CanRedo())
+						DoRedo();
+					else
+						stopped = true;
+					break;
+
+				case kJournalBranch:
+					stopped = !SwitchToBranch(value);
+					break;
+
+				default:
+					done = true;
+					break;
+			}
+
+			delete event;
+
+			if (stopped)
+				done = true;
+			else if (!done)
+				recovered++;
+		}
+
+		replaying = false;
+
+		// The records left over would be replayed again
+		if (stopped)
+			StartCompaction();
+	}
+	else {
+		journal.Reset(docWindow->DocumentSize());
+
+		// Nothing on the disk matches the document now
+		if (autosaveBase)
+			StartCompaction();
+	}
+
+	return recovered;
+}
+
+
+//-----------------------------------------------
+//
+// CheckJournal
+//
+//	Compacting writes the whole document, but on another
+//	thread and only once the journal has grown large, so
+//	the cost of each edit stays the cost of its record.
+//
+void FPHistory::CheckJournal(bool stale) {
+	if (!journal.IsOpen() || replaying)
+		return;
+
+	if (stale) {
+		if (compactor != NULL)
+			compactAgain = true;
+		else
+			StartCompaction();
+	}
+	else if (compactor == NULL && journal.Size() > kJournalCompactSize)
+		StartCompaction();
+}
+
+
+void FPHistory::StartCompaction() {
+	if (docWindow == NULL || !journal.IsOpen() || compactor != NULL || docWindow->document->IsLoading())
+		return;
+
+	UInt16				index;
+	FPDocument			*doc = docWindow->document;
+	FPHistorySnapshot	*snap = new FPHistorySnapshot(doc->ChordGroupArray(), sharedBytes, NearestSnapshot(undoPosition, index));
+
+	compactAgain = false;
+	compactor = new FPJournalCompactor(this, *doc, snap, journal.NextAutosavePath(), journal.Size(), ++journalEpoch);
+
+	if (compactor->Start() != noErr) {
+		fprintf(stderr, "FretPet: Couldn't start compacting the history journal\n");
+		CancelCompaction();
+	}
+}
+
+
+void FPHistory::FinishCompaction(FPJournalCompactor *done) {
+	if (done != compactor)
+		return;
+
+	if (compactor->Result() == noErr && journal.Rebase(compactor->DocSize(), compactor->JournalOffset()) == noErr)
+		baseEpoch = compactor->Epoch();
+	else
+		fprintf(stderr, "FretPet: Couldn't compact the history journal\n");
+
+	delete compactor;
+	compactor = NULL;
+
+	if (compactAgain)
+		StartCompaction();
+}
+
+
+void FPHistory::CancelCompaction() {
+	delete compactor;
+	compactor = NULL;
+	compactAgain = false;
+}
+
+
+void FPHistory::SetMemoryBudget(UInt32 bytes) {
+	memoryBudget = bytes;
+	TrimToBudget();
 }
 
 
@@ -607,15 +1113,389 @@ FPHistory::FPHistory(FPDocWindow *wind) {
 //	Undo sets the history back one item and
 //	preserves all items in the history.
 //
-//	Adding a new action to the history drops
-//	all (redo) items after the current undo index.
+//	Adding a new action to the history moves
+//	all (redo) items after the current undo index
+//	into a new branch.
+//
+//	Every few events the whole document is
+//	snapshotted, sharing the unchanged groups
+//	of the snapshot before. A document that's
+//	still loading isn't snapshotted, since that
+//	would read the whole file. Branch switches
+//	just undo and redo until a snapshot exists.
 //
 void FPHistory::RememberEvent(FPHistoryEvent *event) {
-	if (CanRedo())
-		history.resize(undoPosition);
+	if (CanRedo()) {
+		FPHistoryBranch *branch = new FPHistoryBranch(undoPosition ? history[undoPosition - 1] : NULL);
+
+		while (history.size() > undoPosition) {
+			branch->events.push_front(history.back());
+			history.pop_back();
+		}
+
+		branches.push_back(branch);
+	}
 
 	history.push_back( event );
 	undoPosition = history.size();
+
+	if (docWindow != NULL && undoPosition % kHistorySnapshotInterval == 0 && !docWindow->document->IsLoading()) {
+		UInt16 index;
+		event->snapshot = new FPHistorySnapshot(docWindow->document->ChordGroupArray(), sharedBytes, NearestSnapshot(undoPosition - 1, index));
+	}
+
+	event->journalEpoch = journalEpoch;
+
+	if (journal.IsOpen() && !replaying) {
+		journal.AppendEvent(*event);
+		CheckJournal();
+	}
+
+	residentBytes += event->ByteSize();
+	TrimToBudget();
+}
+
+
+//-----------------------------------------------
+//
+// TrimToBudget
+//
+//	Spill inactive branches first, then the oldest
+//	events, but always keep the events on either
+//	side of the undo position.
+//
+//	Snapshots can't be spilled, since they share
+//	groups, so if that isn't enough they're dropped
+//	the same way. A large document's snapshots can
+//	be most of the history.
+//
+void FPHistory::TrimToBudget() {
+	for (UInt16 b=0; ResidentBytes() > memoryBudget && b<branches.size(); b++) {
+		FPHistoryArray &events = branches[b]->events;
+		for (UInt16 i=0; ResidentBytes() > memoryBudget && i<events.size(); i++)
+			SpillEvent(events[i]);
+	}
+
+	for (ChordIndex i=0; ResidentBytes() > memoryBudget && i<(ChordIndex)history.size(); i++) {
+		if (i + 1 == undoPosition || i == undoPosition)
+			continue;
+
+		SpillEvent(history[i]);
+	}
+
+	for (UInt16 b=0; ResidentBytes() > memoryBudget && b<branches.size(); b++) {
+		FPHistoryArray &events = branches[b]->events;
+		for (UInt16 i=0; ResidentBytes() > memoryBudget && i<events.size(); i++)
+			DropSnapshot(events[i]->snapshot);
+	}
+
+	if (ResidentBytes() > memoryBudget)
+		DropSnapshot(rootSnapshot);
+
+	for (ChordIndex i=0; ResidentBytes() > memoryBudget && i<(ChordIndex)history.size(); i++)
+		DropSnapshot(history[i]->snapshot);
+}
+
+
+void FPHistory::SpillEvent(FPHistoryEvent *event) {
+	if (event->IsSpilled())
+		return;
+
+	if (spillFile == NULL && (spillFile = tmpfile()) == NULL)
+		return;
+
+	UInt32 oldSize = event->ByteSize();
+	if (event->SpillTo(spillFile)) {
+		residentBytes -= oldSize - event->ByteSize();
+		spillLive += event->spillSize;
+		spillEnd = event->spillOffset + event->spillSize;
+	}
+}
+
+
+//-----------------------------------------------
+//
+// PageIn
+//
+//	Read an event back in. Its record in the spill file
+//	is dead after that, so once no event is left in the
+//	file it's closed, and once most of a large file is
+//	dead the live records are copied to a new one.
+//
+void FPHistory::PageIn(FPHistoryEvent *event) {
+	if (event->IsSpilled() && spillFile != NULL) {
+		UInt32 oldSize = event->ByteSize(), recordSize = event->spillSize;
+		(void)event->PageIn(spillFile);
+		residentBytes += event->ByteSize() - oldSize;
+		spillLive -= recordSize;
+
+		if (spillLive == 0) {
+			fclose(spillFile);
+			spillFile = NULL;
+			spillEnd = 0;
+		}
+		else if (spillEnd >= kSpillCompactMinimum && spillLive < spillEnd / 2)
+			CompactSpillFile();
+	}
+}
+
+
+//-----------------------------------------------
+//
+// CompactSpillFile
+//
+//	Copy the records of every spilled event, on the
+//	active path and in branches, to a new spill file.
+//	The offsets only change once every record has been
+//	copied, so if anything fails the old file is kept.
+//
+void FPHistory::CompactSpillFile() {
+	std::vector<FPHistoryEvent*> spilled;
+
+	for (ChordIndex i=0; i<(ChordIndex)history.size(); i++)
+		if (history[i]->IsSpilled())
+			spilled.push_back(history[i]);
+
+	for (UInt16 b=0; b<branches.size(); b++) {
+		FPHistoryArray &events = branches[b]->events;
+		for (UInt16 i=0; i<events.size(); i++)
+			if (events[i]->IsSpilled())
+				spilled.push_back(events[i]);
+	}
+
+	FILE *newFile = tmpfile();
+	if (newFile == NULL)
+		return;
+
+	std::vector<long>	newOffset(spilled.size());
+	char				buffer[4096];
+	long				offset = 0;
+	bool				good = true;
+
+	for (UInt32 i=0; good && i<spilled.size(); i++) {
+		FPHistoryEvent *event = spilled[i];
+
+		newOffset[i] = offset;
+		good = (fseek(spillFile, event->spillOffset, SEEK_SET) == 0);
+
+		for (UInt32 left = event->spillSize; good && left; ) {
+			size_t size = MIN(left, sizeof(buffer));
+			good = (fread(buffer, 1, size, spillFile) == size && fwrite(buffer, 1, size, newFile) == size);
+			left -= size;
+		}
+
+		offset += event->spillSize;
+	}
+
+	if (!good || fflush(newFile) != 0) {
+		fprintf(stderr, "FretPet: Couldn't compact the history spill file\n");
+		fclose(newFile);
+		return;
+	}
+
+	for (UInt32 i=0; i<spilled.size(); i++)
+		spilled[i]->spillOffset = newOffset[i];
+
+	fclose(spillFile);
+	spillFile = newFile;
+	spillEnd = spillLive = offset;
+}
+
+
+void FPHistory::TakeRootSnapshot() {
+	if (docWindow != NULL && !docWindow->document->IsLoading()) {
+		rootSnapshot = new FPHistorySnapshot(docWindow->document->ChordGroupArray(), sharedBytes);
+		residentBytes += rootSnapshot->ByteSize();
+	}
+}
+
+
+void FPHistory::DropSnapshot(FPHistorySnapshot *&snapshot) {
+	if (snapshot != NULL) {
+		residentBytes -= snapshot->ByteSize();
+		delete snapshot;
+		snapshot = NULL;
+	}
+}
+
+
+FPHistorySnapshot* FPHistory::NearestSnapshot(UInt16 position, UInt16 &index) {
+	for (index = position; index > 0; index--)
+		if (history[index - 1]->snapshot != NULL)
+			return history[index - 1]->snapshot;
+
+	return rootSnapshot;
+}
+
+
+//-----------------------------------------------
+//
+// SwitchToBranch
+//
+//	Jump from the current state to the newest
+//	state of a branch, however far apart they are.
+//
+bool FPHistory::SwitchToBranch(UInt16 index) {
+	if (docWindow == NULL || index >= branches.size())
+		return false;
+
+	std::vector<FPHistoryEvent*> oldPath(history.begin(), history.end());
+	UInt16 oldPosition = undoPosition;
+
+	ActivateBranch(branches[index]);
+
+	UInt16 common = 0;
+	while (common < oldPosition && common < history.size() && oldPath[common] == history[common])
+		common++;
+
+	undoPosition = history.size();
+	MoveState(oldPath, oldPosition, common, undoPosition);
+	SetDocumentModified(0, true);
+	TrimToBudget();
+
+	// Branches can hold events from before any autosave
+	if (journal.IsOpen() && !replaying) {
+		journal.AppendMarker(kJournalBranch, index);
+		CheckJournal(journalEpoch > 0);
+	}
+
+	return true;
+}
+
+
+//-----------------------------------------------
+//
+// ActivateBranch
+//
+//	The branch's fork has to be on the active path,
+//	so activate the branch holding it first. Then the
+//	events after the fork move into a new branch and
+//	the branch's events take their place.
+//
+void FPHistory::ActivateBranch(FPHistoryBranch *branch) {
+	ChordIndex forkIndex = -1;
+
+	if (branch->fork != NULL) {
+		for (;;) {
+			FPHistoryArray::iterator itr = find(history.begin(), history.end(), branch->fork);
+			if (itr != history.end()) {
+				forkIndex = itr - history.begin();
+				break;
+			}
+
+			FPHistoryBranch *outer = NULL;
+			for (FPHistoryBranchArray::iterator b = branches.begin(); outer == NULL && b != branches.end(); b++)
+				if (find((*b)->events.begin(), (*b)->events.end(), branch->fork) != (*b)->events.end())
+					outer = *b;
+
+			if (outer == NULL)
+				return;
+
+			ActivateBranch(outer);
+		}
+	}
+
+	UInt16 keep = forkIndex + 1;
+	if (history.size() > keep) {
+		FPHistoryBranch *tail = new FPHistoryBranch(branch->fork);
+
+		while (history.size() > keep) {
+			tail->events.push_front(history.back());
+			history.pop_back();
+		}
+
+		branches.push_back(tail);
+	}
+
+	while (!branch->events.empty()) {
+		history.push_back(branch->events.front());
+		branch->events.pop_front();
+	}
+
+	branches.erase(find(branches.begin(), branches.end(), branch));
+}
+
+
+//-----------------------------------------------
+//
+// MoveState
+//
+//	Either undo back to where the paths meet and redo
+//	forward, or restore the nearest snapshot and redo
+//	the few events after it, whichever is fewer steps.
+//
+//	Snapshots only hold chords, so the settings events
+//	along the way are still undone and redone first.
+//	They only set values, so this is quick.
+//
+void FPHistory::MoveState(const std::vector<FPHistoryEvent*> &oldPath, UInt16 from, UInt16 common, UInt16 to) {
+	UInt16				snapIndex;
+	FPHistorySnapshot	*snap = NearestSnapshot(to, snapIndex);
+	bool				useSnapshot = snap != NULL && (to - snapIndex) < (from - common) + (to - common);
+	UInt16				i;
+
+	if (!useSnapshot) {
+		for (i = from; i-- > common;) {
+			PageIn(oldPath[i]);
+			oldPath[i]->Undo();
+		}
+
+		for (i = common; i < to; i++) {
+			PageIn(history[i]);
+			history[i]->Redo();
+		}
+
+		return;
+	}
+
+	for (i = from; i-- > common;)
+		if (IsSettingsAction(oldPath[i]->action)) {
+			PageIn(oldPath[i]);
+			oldPath[i]->Undo();
+		}
+
+	if (snapIndex > common) {
+		for (i = common; i < snapIndex; i++)
+			if (IsSettingsAction(history[i]->action)) {
+				PageIn(history[i]);
+				history[i]->Redo();
+			}
+	}
+	else {
+		for (i = common; i-- > snapIndex;)
+			if (IsSettingsAction(history[i]->action)) {
+				PageIn(history[i]);
+				history[i]->Undo();
+			}
+	}
+
+	FPChordGroupArray groups;
+	snap->Restore(groups);
+	docWindow->RestoreAll(groups);
+
+	for (i = snapIndex; i < to; i++) {
+		PageIn(history[i]);
+		history[i]->Redo();
+	}
+
+	if (snapIndex == to && to > 0)
+		docWindow->SetCursorAndSelection(history[to - 1]->after.cursor, history[to - 1]->after.selEnd);
+}
+
+
+bool FPHistory::IsSettingsAction(UInt16 action) {
+	switch (action) {
+		case UN_TEMPO:
+		case UN_TEMPO_X:
+		case UN_VELOCITY:
+		case UN_SUSTAIN:
+		case UN_INSTRUMENT:
+		case UN_MIDI_CHANNEL:
+		case UN_TUNING_CHANGE:
+			return true;
+	}
+
+	return false;
 }
 
 
@@ -624,6 +1504,7 @@ FPChord* FPHistory::PreviousChord() {
 	ChordIndex	i = history.size();
 
 	while (i--) {
+		PageIn(history[i]);
 		if ((chord = history[i]->PrimaryChord()))
 			break;
  	}
@@ -636,8 +1517,18 @@ void FPHistory::UndoCommit() {
 	if (tempUndoEvent != NULL) {
 		SetDocumentModified(tempUndoEvent->action, true);
 		if (mergeFlag) {
-			if (undoPosition > 0)
-				history[undoPosition - 1]->MergeEvent(tempUndoEvent);
+			if (undoPosition > 0) {
+				FPHistoryEvent *event = history[undoPosition - 1];
+				PageIn(event);
+				residentBytes -= event->ByteSize();
+				event->MergeEvent(tempUndoEvent);
+				residentBytes += event->ByteSize();
+
+				if (journal.IsOpen()) {
+					journal.AppendEvent(*tempUndoEvent, true);
+					CheckJournal(IsCompacted(event));
+				}
+			}
 
 			delete tempUndoEvent;
 		}
@@ -652,9 +1543,18 @@ void FPHistory::UndoCommit() {
 
 void FPHistory::DoUndo() {
 	if (undoPosition > 0) {
-		history[--undoPosition]->Undo();
+		FPHistoryEvent *event = history[--undoPosition];
+		PageIn(event);
+		event->Undo();
+		TrimToBudget();
+
+		if (journal.IsOpen() && !replaying) {
+			journal.AppendMarker(kJournalUndo);
+			CheckJournal(IsCompacted(event));
+		}
 
-		if (undoPosition == 0)
+		// An autosave isn't the saved document
+		if (undoPosition == 0 && !autosaveBase)
 			SetDocumentModified(0, false);
 	}
 }
@@ -663,12 +1563,33 @@ void FPHistory::DoUndo() {
 void FPHistory::DoRedo() {
 	if (undoPosition < history.size()) {
 		FPHistoryEvent *hist = history[undoPosition++];
+		PageIn(hist);
 		SetDocumentModified(hist->action, true);
 		hist->Redo();
+		TrimToBudget();
+
+		if (journal.IsOpen() && !replaying) {
+			journal.AppendMarker(kJournalRedo);
+			CheckJournal(IsCompacted(hist));
+		}
 	}
 }
 
 
+void FPHistory::DoSwitchBranch() {
+	if (!branches.empty() && SwitchToBranch(0))
+		docWindow->UpdateScrollState();
+}
+
+
+CFStringRef FPHistory::BranchName() const {
+	if (branches.empty() || branches[0]->events.empty())
+		return NULL;
+
+	return branches[0]->events.back()->ActionName();
+}
+
+
 void FPHistory::SetDocumentModified(UInt16 action, bool modified) {
 	if (docWindow != NULL) {
 		bool always = true;
@@ -22,12 +22,28 @@
 #define FPHISTORY_H
 
 #include "FPChord.h"
+#include "FPChordDelta.h"
+#include "FPHistoryJournal.h"
+#include "FPHistorySnapshot.h"
 #include "TDictionary.h"
 #include "TString.h"
 #include "TObjectDeque.h"
 
 class FPDocWindow;
 class FPHistory;
+class FPJournalCompactor;
+
+//! The default history memory budget, in KB
+#define kDefaultHistoryBudget	(8 * 1024)
+
+//! Events between snapshots of the whole document
+#define kHistorySnapshotInterval	16
+
+//! Spill file size below which it's never rewritten
+#define kSpillCompactMinimum	(256 * 1024)
+
+//! Journal size that starts a compaction
+#define kJournalCompactSize		(4 * 1024 * 1024)
 
 
 //
@@ -86,6 +102,64 @@ enum {
 	UN_S_HARMBY
 };
 
+//
+// HISTORY DATA KEYS
+//
+enum FPHistoryKey {
+	kHistoryPart = 0,		// The part that was changed
+	kHistoryTempo,			// Tempo
+	kHistoryVelocity,		// Velocity of a part
+	kHistorySustain,		// Sustain of a part
+	kHistoryInstrument,		// Instrument of a part
+	kHistoryChannel,		// MIDI channel of a part
+	kHistoryModifier,		// Note modifier
+	kHistoryClipPart,		// The clipboard part that was pasted
+	kHistoryRedoCommand,	// The filter command to redo
+	kHistoryUndoCommand,	// The filter command that undoes
+	kHistoryMenuIndex,		// The filter's menu item
+	kHistoryCount,			// Number of clones
+	kHistoryTranspose,		// Transpose per clone
+	kHistoryHarmonize,		// Harmonize per clone
+	kHistoryTuning,			// The guitar tuning, as a dictionary
+
+	kHistoryKeyCount
+};
+
+
+/*!	@class FPHistoryData
+
+	@brief	Extra values saved with a history state
+
+	Values are kept in a fixed array indexed by key,
+	so saving one never allocates. Up to one value per
+	state can be a CF object, which is retained.
+*/
+class FPHistoryData {
+private:
+	SInt32				value[kHistoryKeyCount];	//!< the integer values
+	UInt32				setMask;				//!< which keys have a value
+	CFTypeRef			object;					//!< the object value, if any
+	FPHistoryKey		objectKey;				//!< the key for the object value
+
+public:
+	FPHistoryData() : setMask(0), object(NULL), objectKey(kHistoryKeyCount) {}
+	FPHistoryData(const FPHistoryData &src) : object(NULL) { *this = src; }
+	~FPHistoryData() { if (object) CFRELEASE(object); }
+
+	FPHistoryData&		operator=(const FPHistoryData &src);
+
+	inline bool			IsSet(FPHistoryKey key) const			{ return (setMask & BIT(key)) != 0; }
+	inline UInt32		SetMask() const							{ return setMask; }
+
+	inline void			SetInteger(FPHistoryKey key, SInt32 val)	{ value[key] = val; setMask |= BIT(key); }
+	inline SInt32		GetInteger(FPHistoryKey key, SInt32 defaultVal=0) const { return IsSet(key) ? value[key] : defaultVal; }
+
+	void				SetValue(FPHistoryKey key, CFTypeRef val);
+	inline FPHistoryKey	ObjectKey() const						{ return objectKey; }
+	CFTypeRef			GetValue(FPHistoryKey key) const;
+};
+
+
 /*! The state of the document at some point.
 	That's why they call it a brief description.
 */
@@ -94,7 +168,7 @@ typedef struct {
 	ChordIndex			selEnd;					//!< the selection ending
 	ChordIndex			playStart;				//!< the playback range start
 	ChordIndex			playEnd;				//!< the playback range end
-	TDictionary			moreData;				//!< other data related to the state
+	FPHistoryData		moreData;				//!< other data related to the state
 	FPChordGroupArray	groups;					//!< chords that were deleted (for example)
 } HistoryState;
 
@@ -110,6 +184,7 @@ typedef struct {
 */
 class FPHistoryEvent {
 friend class FPHistory;
+friend class FPHistoryJournal;
 
 private:
 	FPHistory			*history;				//!< the history manager this belongs to
@@ -120,7 +195,14 @@ private:
 	TString				nameString;				//!< string for the undo/redo menu items
 	HistoryState		before,					//!< the state before committing
 						after;					//!< the state after committing
+	FPChordDelta		delta;					//!< changed fields, for edits that keep the size
+	ChordIndex			deltaStart;				//!< the first group covered by the delta
+	bool				deltaPending;			//!< the delta gets recorded on commit
+	long				spillOffset;			//!< where the groups are in the spill file, or -1
+	UInt32				spillSize;				//!< the bytes used in the spill file
+	FPHistorySnapshot	*snapshot;				//!< the document after this event, if taken
 	UInt32				eventTime;				//!< TickCount at the time of this event
+	UInt32				journalEpoch;			//!< the journal epoch when it was recorded
 
 public:
 
@@ -141,7 +223,7 @@ public:
 	FPHistoryEvent(FPHistory *hist, UInt16 act, CFStringRef opName, PartMask pm=kCurrentChannelMask)
 	{ Init(hist, act, opName, pm); }
 
-	virtual ~FPHistoryEvent() {}
+	virtual ~FPHistoryEvent() { delete snapshot; }
 
 	/*!	The instance Init method
 		@param hist the history that owns this event
@@ -197,6 +279,25 @@ public:
 	void SaveGroupsBefore(FPChordGroupArray &groupArray);
 
 
+	/*!	Prepare to store only the changes to a range of chord groups.
+		The groups are copied for now, then reduced to a delta
+		when the event is committed. The edit must not change the
+		number of groups in the range.
+		@param start the range start
+		@param end the range end
+	*/
+	void SaveDeltaBefore(ChordIndex start, ChordIndex end);
+
+
+	/*!	Rebuild the Before or After groups covered by the delta
+		from the current document.
+		@param groups the array to fill
+		@param forward TRUE for the After state
+		@result TRUE if any groups were produced
+	*/
+	bool GetDeltaGroups(FPChordGroupArray &groups, bool forward);
+
+
 	/*!	Store a selection of chord groups in the After state.
 		@param start the selection start
 		@param end the selection end
@@ -214,52 +315,52 @@ public:
 		@param key the storage key
 		@param value the data to store
 	*/
-	void SaveDataBefore(CFStringRef key, SInt32 value);
+	void SaveDataBefore(FPHistoryKey key, SInt32 value);
 
 
 	/*!	Get a Before data value.
 		@result the Before data
 	*/
-	SInt32 GetDataBefore(CFStringRef key);
+	SInt32 GetDataBefore(FPHistoryKey key);
 
 
 	/*!	Save a piece of After data.
 		@param key the storage key
 		@param value the data to store
 	*/
-	void SaveDataAfter(CFStringRef key, SInt32 value);
+	void SaveDataAfter(FPHistoryKey key, SInt32 value);
 
 
 	/*!	Get an After data value.
 		@result the After data
 	*/
-	SInt32 GetDataAfter(CFStringRef key);
+	SInt32 GetDataAfter(FPHistoryKey key);
 
 
 	/*!	Save a piece of Before data.
 		@param key the storage key
 		@param value the data to store
 	*/
-	void SaveDataBefore(CFStringRef key, CFTypeRef value);
+	void SaveDataBefore(FPHistoryKey key, CFTypeRef value);
 
 
 	/*!	Save a piece of After data.
 		@param key the storage key
 		@param value the data to store
 	*/
-	void SaveDataAfter(CFStringRef key, CFTypeRef value);
+	void SaveDataAfter(FPHistoryKey key, CFTypeRef value);
 
 
 	/*!	Get a piece of Before data as a CFTypeRef.
 		@result the Before data
 	*/
-	CFTypeRef GetCFDataBefore(CFStringRef key);
+	CFTypeRef GetCFDataBefore(FPHistoryKey key);
 
 
 	/*!	Get a piece of After data as a CFTypeRef.
 		@result the After data
 	*/
-	CFTypeRef GetCFDataAfter(CFStringRef key);
+	CFTypeRef GetCFDataAfter(FPHistoryKey key);
 
 
 	/*!	The chord that was highlighted after this event.
@@ -310,10 +411,41 @@ public:
 	virtual void Redo();
 
 
+	//! @brief Tell the player which lines this event changed.
+	void InvalidatePlayedLines();
+
+
 	/*!	Get the name of the action
 		@result the name of the action
 	*/
 	inline CFStringRef ActionName() const { return nameString.GetCFStringRef(); }
+
+private:
+
+	/*!	The approximate memory held by the event
+		@result the size in bytes
+	*/
+	UInt32 ByteSize() const;
+
+
+	/*!	Whether the groups of this event are in the spill file
+		@result TRUE if the event is spilled
+	*/
+	inline bool IsSpilled() const { return spillOffset >= 0; }
+
+
+	/*!	Move the groups and delta to the end of a spill file.
+		@param fp the spill file
+		@result TRUE if anything was written
+	*/
+	bool SpillTo(FILE *fp);
+
+
+	/*!	Read the groups and delta back from the spill file.
+		@param fp the spill file
+		@result TRUE if the data was read in full
+	*/
+	bool PageIn(FILE *fp);
 };
 
 
@@ -323,6 +455,27 @@ public:
 typedef TObjectDeque<FPHistoryEvent> FPHistoryArray;
 
 
+/*!	@class FPHistoryBranch
+
+	@brief	Events that were undone before a different edit
+
+	Instead of throwing away the events that could be
+	redone, a new edit moves them into a branch. The
+	branch remembers the event it follows, so it can be
+	made the active path again later.
+*/
+class FPHistoryBranch {
+public:
+	FPHistoryEvent		*fork;					//!< the event the branch follows, or NULL
+	FPHistoryArray		events;					//!< the events in the branch
+
+	FPHistoryBranch(FPHistoryEvent *inFork=NULL) : fork(inFork) {}
+};
+
+//! A place to store inactive branches
+typedef TObjectDeque<FPHistoryBranch> FPHistoryBranchArray;
+
+
 #pragma mark -
 /*! A manager for history events related to a document
  *
@@ -330,6 +483,10 @@ typedef TObjectDeque<FPHistoryEvent> FPHistoryArray;
  *	growing list of chord and document events.
  *	It always associates the event with a document window
  *	and its document.
+ *
+ *	The history is a tree. The list of events is the active
+ *	path from the start to the newest event, and any events
+ *	that were undone and then replaced are kept as branches.
  */
 class FPHistory {
 friend class FPHistoryEvent;
@@ -338,8 +495,23 @@ private:
 	FPDocWindow		*docWindow;				//!< the window of each undo item created
 	UInt16			undoPosition;			//!< position in history for undo/redo
 	FPHistoryArray	history;				//!< A growing array of history events
+	FPHistoryBranchArray branches;			//!< Inactive branches of the history
+	FPHistorySnapshot *rootSnapshot;		//!< The document before the first event
 	FPHistoryEvent	*tempUndoEvent;			//!< A temporary event for use in undo creation
 	bool			mergeFlag;				//!< Set if the next event should merge
+	UInt32			memoryBudget;			//!< Bytes to keep in memory before spilling
+	UInt32			residentBytes;			//!< Bytes held by events and snapshot lists in memory
+	UInt32			sharedBytes;			//!< Bytes held by the groups snapshots share
+	FILE			*spillFile;				//!< Temporary file for older events
+	UInt32			spillEnd;				//!< Bytes written to the spill file
+	UInt32			spillLive;				//!< Bytes of the spill file still holding events
+	FPHistoryJournal journal;				//!< The journal, for documents with a file
+	bool			replaying;				//!< Set while recovering from the journal
+	FPJournalCompactor *compactor;			//!< Writes the autosave, while it's running
+	UInt32			journalEpoch;			//!< Counts compactions started
+	UInt32			baseEpoch;				//!< The epoch of the autosave the journal follows
+	bool			compactAgain;			//!< Compact again when the running one is done
+	bool			autosaveBase;			//!< The history starts from an autosave
 
 public:
 
@@ -351,6 +523,18 @@ public:
 		// needed because not every event is committed
 		if (tempUndoEvent != NULL)
 			delete tempUndoEvent;
+
+		if (spillFile != NULL)
+			fclose(spillFile);
+
+		// Snapshot groups count themselves out as they go
+		history.clear();
+		branches.clear();
+		delete rootSnapshot;
+
+		// A journal left behind means a crash
+		CancelCompaction();
+		journal.Close(true);
 	}
 
 
@@ -360,6 +544,19 @@ public:
 		undoPosition	= 0;
 		docWindow		= NULL;
 		tempUndoEvent	= NULL;
+		memoryBudget	= kDefaultHistoryBudget * 1024;
+		residentBytes	= 0;
+		sharedBytes		= 0;
+		spillFile		= NULL;
+		spillEnd		= 0;
+		spillLive		= 0;
+		replaying		= false;
+		rootSnapshot	= NULL;
+		compactor		= NULL;
+		journalEpoch	= 0;
+		baseEpoch		= 0;
+		compactAgain	= false;
+		autosaveBase	= false;
 	}
 
 
@@ -367,8 +564,59 @@ public:
 	inline ChordIndex Size() { return history.size(); }
 
 
+	//! @brief The number of inactive branches
+	inline UInt16 BranchCount() const { return branches.size(); }
+
+
+	/*!	Make a branch the active path and bring the
+		document to the newest state in the branch.
+		The path it replaces becomes a branch itself,
+		so switching back and forth compares them.
+		@param index the branch index
+		@result TRUE if the branch was switched to
+	*/
+	bool SwitchToBranch(UInt16 index);
+
+
 	//! @brief Clear the history
-	inline void Clear() { history.clear(); undoPosition = 0; }
+	void Clear();
+
+
+	/*!	Set the memory budget. Older events beyond the
+		budget have their chords moved to a spill file,
+		then snapshots are dropped if that isn't enough.
+		@param bytes the budget in bytes
+	*/
+	void SetMemoryBudget(UInt32 bytes);
+
+
+	//! @brief Bytes held by events and snapshots in memory
+	inline UInt32 ResidentBytes() const { return residentBytes + sharedBytes; }
+
+
+	/*!	Start journaling to the document's file, replacing
+		any journal for an older file, as after Save As.
+		Nothing is journaled until the document has a
+		saved file of its own, so an imported file never
+		gets a journal beside it.
+		@param docFile the document file
+	*/
+	void StartJournal(const TFile &docFile);
+
+
+	/*!	Open the document's journal and replay any records
+		left behind by a crash, then keep journaling.
+		@param docFile the document file
+		@result the number of records recovered
+	*/
+	UInt32 RecoverJournal(const TFile &docFile);
+
+
+	/*!	Rebase the journal on the autosave a compactor
+		wrote, then delete the compactor.
+		@param done the compactor that finished
+	*/
+	void FinishCompaction(FPJournalCompactor *done);
 
 
 	/*!	@brief The last chord that was stored in the history
@@ -418,6 +666,10 @@ public:
 		if (tempUndoEvent != NULL)
 			delete tempUndoEvent;
 
+		// Keep the state before the first event
+		if (rootSnapshot == NULL && history.empty() && branches.empty())
+			TakeRootSnapshot();
+
 		tempUndoEvent = new FPHistoryEvent(this, act, opName, partMask );
 
 		return tempUndoEvent;
@@ -449,6 +701,22 @@ public:
 	void DoRedo();
 
 
+	/*!	Switch to the oldest branch. The path that was
+		active becomes the newest branch, so doing it
+		again steps through every branch in turn and
+		then back to where it started.
+	*/
+	void DoSwitchBranch();
+
+
+	/*!	The name of the newest event in the branch
+		that DoSwitchBranch will switch to.
+
+		@result the name of the event
+	*/
+	CFStringRef BranchName() const;
+
+
 	/*!	The name of the current Redo event.
 
 		@result the name of the event
@@ -493,6 +761,94 @@ private:
 	*/
 	void SetDocumentModified(UInt16 action, bool modified);
 
+
+	//! @brief Spill the oldest events, then drop snapshots, until the budget is met
+	void TrimToBudget();
+
+
+	/*!	Bring a spilled event back into memory
+		@param event the event to page in
+	*/
+	void PageIn(FPHistoryEvent *event);
+
+
+	/*!	Move an event's groups to the spill file
+		@param event the event to spill
+	*/
+	void SpillEvent(FPHistoryEvent *event);
+
+
+	//! @brief Copy the spilled events to a new spill file, dropping paged-in records
+	void CompactSpillFile();
+
+
+	//! @brief Snapshot the document before the first event
+	void TakeRootSnapshot();
+
+
+	/*!	Free a snapshot. Moving through the history can
+		always redo events instead, so it only costs time.
+		@param snapshot the snapshot to free, set to NULL
+	*/
+	void DropSnapshot(FPHistorySnapshot *&snapshot);
+
+
+	/*!	Start a compaction after a journal record if the
+		journal is large, or if the record refers to an
+		event that's only in the autosave.
+		@param stale TRUE if the record refers to such an event
+	*/
+	void CheckJournal(bool stale=false);
+
+
+	/*!	Whether an event's journal record has been, or is
+		being, compacted into the autosave
+		@param event the event
+		@result TRUE if replay wouldn't find the event
+	*/
+	inline bool IsCompacted(const FPHistoryEvent *event) const {
+		return event->journalEpoch < (compactor != NULL ? journalEpoch : baseEpoch);
+	}
+
+
+	//! @brief Copy the document to the autosave on another thread
+	void StartCompaction();
+
+
+	//! @brief Stop and discard a running compaction
+	void CancelCompaction();
+
+
+	/*!	The newest snapshot on the active path
+		@param position the number of events to consider
+		@param index receives the number of events it follows
+		@result the snapshot, or NULL
+	*/
+	FPHistorySnapshot* NearestSnapshot(UInt16 position, UInt16 &index);
+
+
+	/*!	Rearrange the tree so a branch is on the active path
+		@param branch the branch to activate
+	*/
+	void ActivateBranch(FPHistoryBranch *branch);
+
+
+	/*!	Bring the document from a position on an old path
+		to a position on the active path
+		@param oldPath the previous active path
+		@param from the position on the old path
+		@param common the length of the shared start
+		@param to the position on the active path
+	*/
+	void MoveState(const std::vector<FPHistoryEvent*> &oldPath, UInt16 from, UInt16 common, UInt16 to);
+
+
+	/*!	Whether an action only changes document settings
+		@param action the action identifier
+		@result TRUE if the action leaves the chords alone
+	*/
+	static bool IsSettingsAction(UInt16 action);
+
 };
 
 #endif
@@ -0,0 +1,617 @@
+/*
+ *  FPHistoryJournal.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPHistoryJournal.h"
+#include "FPHistory.h"
+#include "TFile.h"
+
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define kJournalMagic		'FPJn'
+#define kJournalVersion		3
+#define kJournalTrailer		'FPJe'
+#define kJournalExtension	".fpjournal"
+#define kAutosaveExtensionA	".fpautosave"
+#define kAutosaveExtensionB	".fpautosave2"
+#define kRebaseExtension	".new"
+#define kRebaseBufferSize	0x8000
+#define kJournalSyncCount	16			// records between syncs
+#define kJournalSyncTicks	120			// or two seconds
+
+
+#pragma mark -
+//-----------------------------------------------
+//
+// Low-level readers and writers
+//
+static inline bool Put(FILE *fp, const void *data, size_t size) {
+	return size == 0 || fwrite(data, size, 1, fp) == 1;
+}
+
+static inline bool Get(FILE *fp, void *data, size_t size) {
+	return size == 0 || fread(data, size, 1, fp) == 1;
+}
+
+static inline bool PutLong(FILE *fp, SInt32 value) { return Put(fp, &value, sizeof(value)); }
+
+static inline bool GetLong(FILE *fp, SInt32 &value) { return Get(fp, &value, sizeof(value)); }
+
+
+//
+// CF data is stored as a length and the bytes
+//
+static bool PutData(FILE *fp, CFDataRef data) {
+	SInt32 length = data ? CFDataGetLength(data) : 0;
+	return PutLong(fp, length) && (length == 0 || Put(fp, CFDataGetBytePtr(data), length));
+}
+
+static CFDataRef GetData(FILE *fp, bool &good) {
+	SInt32		length;
+	CFDataRef	data = NULL;
+
+	good = GetLong(fp, length) && length >= 0;
+
+	if (good && length > 0) {
+		UInt8 *bytes = new UInt8[length];
+		if ((good = Get(fp, bytes, length)))
+			data = CFDataCreate(kCFAllocatorDefault, bytes, length);
+		delete [] bytes;
+	}
+
+	return data;
+}
+
+
+static bool PutString(FILE *fp, CFStringRef string) {
+	CFDataRef data = CFStringCreateExternalRepresentation(kCFAllocatorDefault, string, kCFStringEncodingUTF8, '?');
+	bool good = PutData(fp, data);
+	if (data) CFRELEASE(data);
+	return good;
+}
+
+static bool GetString(FILE *fp, TString &string) {
+	bool		good;
+	CFDataRef	data = GetData(fp, good);
+
+	if (data) {
+		CFStringRef cfstring = CFStringCreateFromExternalRepresentation(kCFAllocatorDefault, data, kCFStringEncodingUTF8);
+		if (cfstring) {
+			string = cfstring;
+			CFRELEASE(cfstring);
+		}
+		CFRELEASE(data);
+	}
+
+	return good;
+}
+
+
+//
+// The extra state data is stored as a mask and the integers
+// that are set, then the object value as an XML property list
+//
+static bool PutHistoryData(FILE *fp, const FPHistoryData &moreData) {
+	bool good = PutLong(fp, moreData.SetMask());
+
+	for (int k=0; good && k<kHistoryKeyCount; k++)
+		if (moreData.IsSet((FPHistoryKey)k))
+			good = PutLong(fp, moreData.GetInteger((FPHistoryKey)k));
+
+	FPHistoryKey	key = moreData.ObjectKey();
+	CFTypeRef		object = moreData.GetValue(key);
+	CFDataRef		data = object ? CFPropertyListCreateXMLData(kCFAllocatorDefault, object) : NULL;
+
+	good = good && PutLong(fp, key) && PutData(fp, data);
+
+	if (data) CFRELEASE(data);
+	if (object) CFRELEASE(object);
+	return good;
+}
+
+static bool GetHistoryData(FILE *fp, FPHistoryData &moreData) {
+	SInt32	mask, value, key;
+	bool	good = GetLong(fp, mask);
+
+	moreData = FPHistoryData();
+
+	for (int k=0; good && k<kHistoryKeyCount; k++)
+		if ((mask & BIT(k)) && (good = GetLong(fp, value)))
+			moreData.SetInteger((FPHistoryKey)k, value);
+
+	if (!(good && GetLong(fp, key)))
+		return false;
+
+	CFDataRef data = GetData(fp, good);
+
+	if (data) {
+		CFPropertyListRef plist = CFPropertyListCreateFromXMLData(kCFAllocatorDefault, data, kCFPropertyListImmutable, NULL);
+
+		if (plist && key >= 0 && key < kHistoryKeyCount)
+			moreData.SetValue((FPHistoryKey)key, plist);
+		else
+			good = false;
+
+		if (plist) CFRELEASE(plist);
+		CFRELEASE(data);
+	}
+
+	return good;
+}
+
+
+//
+// Chords are stored field by field, the same way as deltas
+//
+static bool PutGroups(FILE *fp, const FPChordGroupArray &groups) {
+	bool good = PutLong(fp, groups.size());
+
+	for (UInt32 i=0; good && i<groups.size(); i++)
+		for (PartIndex p=0; good && p<DOC_PARTS; p++)
+			for (UInt16 f=0; good && f<kDeltaFieldCount; f++) {
+				SInt16 value = FPChordDelta::GetField(groups[i][p], f);
+				good = Put(fp, &value, sizeof(value));
+			}
+
+	return good;
+}
+
+static bool GetGroups(FILE *fp, FPChordGroupArray &groups) {
+	SInt32	count;
+	bool	good = GetLong(fp, count) && count >= 0;
+
+	groups.clear();
+
+	for (SInt32 i=0; good && i<count; i++) {
+		FPChordGroup *group = new FPChordGroup;
+
+		for (PartIndex p=0; good && p<DOC_PARTS; p++)
+			for (UInt16 f=0; good && f<kDeltaFieldCount; f++) {
+				SInt16 value;
+				if ((good = Get(fp, &value, sizeof(value))))
+					FPChordDelta::SetField((*group)[p], f, value);
+			}
+
+		if (good)
+			groups.push_back(group);
+		else
+			delete group;
+	}
+
+	return good;
+}
+
+
+static bool PutState(FILE *fp, const HistoryState &state) {
+	return PutLong(fp, state.cursor)
+		&& PutLong(fp, state.selEnd)
+		&& PutLong(fp, state.playStart)
+		&& PutLong(fp, state.playEnd)
+		&& PutHistoryData(fp, state.moreData)
+		&& PutGroups(fp, state.groups);
+}
+
+static bool GetState(FILE *fp, HistoryState &state) {
+	SInt32 cursor, selEnd, playStart, playEnd;
+
+	if (!(GetLong(fp, cursor) && GetLong(fp, selEnd) && GetLong(fp, playStart) && GetLong(fp, playEnd)))
+		return false;
+
+	state.cursor	= cursor;
+	state.selEnd	= selEnd;
+	state.playStart	= playStart;
+	state.playEnd	= playEnd;
+
+	return GetHistoryData(fp, state.moreData) && GetGroups(fp, state.groups);
+}
+
+
+#pragma mark -
+FPHistoryJournal::FPHistoryJournal() {
+	fp			= NULL;
+	path		= NULL;
+	flags		= 0;
+	unsynced	= 0;
+	autosavePath[0] = autosavePath[1] = NULL;
+	syncTime	= 0;
+}
+
+
+FPHistoryJournal::~FPHistoryJournal() {
+	Close();
+}
+
+
+/*!
+ * SidecarPath
+ *
+ *	The journal and autosave are hidden files in the
+ *	document's folder
+ */
+char* FPHistoryJournal::SidecarPath(const TFile &docFile, const char *extension) {
+	char *docPath = docFile.PosixPath();
+	if (docPath == NULL)
+		return NULL;
+
+	char	*slash = strrchr(docPath, '/'),
+			*name = slash ? slash + 1 : docPath,
+			*outPath = new char[strlen(docPath) + strlen(extension) + 2];
+
+	sprintf(outPath, "%.*s.%s%s", (int)(name - docPath), docPath, name, extension);
+	delete [] docPath;
+
+	return outPath;
+}
+
+
+bool FPHistoryJournal::IsFor(const TFile &docFile) const {
+	char *otherPath = SidecarPath(docFile, kJournalExtension);
+	bool same = (path != NULL && otherPath != NULL && !strcmp(path, otherPath));
+	delete [] otherPath;
+	return same;
+}
+
+
+/*!
+ * Open
+ *
+ *	Open the document's journal, creating it if needed.
+ *	Call BeginRead to check for records to recover,
+ *	or Reset to start over.
+ */
+OSStatus FPHistoryJournal::Open(const TFile &docFile) {
+	Close(false);
+
+	if ((path = SidecarPath(docFile, kJournalExtension)) == NULL)
+		return fnfErr;
+
+	autosavePath[0] = SidecarPath(docFile, kAutosaveExtensionA);
+	autosavePath[1] = SidecarPath(docFile, kAutosaveExtensionB);
+	flags = 0;
+
+	if ((fp = fopen(path, "r+b")) == NULL)
+		fp = fopen(path, "w+b");
+
+	if (fp == NULL) {
+		Close(false);
+		return ioErr;
+	}
+
+	unsynced = 0;
+	syncTime = TickCount();
+
+	return noErr;
+}
+
+
+/*!
+ * Close
+ *
+ *	Close the journal, by default deleting it and
+ *	the autosave too
+ */
+void FPHistoryJournal::Close(bool discard) {
+	if (fp != NULL) {
+		if (!discard)
+			Sync(true);
+
+		fclose(fp);
+		fp = NULL;
+
+		if (discard) {
+			unlink(path);
+			RemoveAutosaves();
+		}
+	}
+
+	delete [] path;
+	delete [] autosavePath[0];
+	delete [] autosavePath[1];
+	path = NULL;
+	autosavePath[0] = autosavePath[1] = NULL;
+	flags = 0;
+}
+
+
+void FPHistoryJournal::RemoveAutosaves() {
+	for (int i=2; i--;)
+		if (autosavePath[i] != NULL)
+			unlink(autosavePath[i]);
+}
+
+
+/*!
+ * BeginRead
+ *
+ *	Read and check the header. The caller makes sure the
+ *	document matches it, reading the autosave if the flags
+ *	call for it. Then the records can be read.
+ */
+bool FPHistoryJournal::BeginRead(FPJournalHeader &header) {
+	rewind(fp);
+
+	if (!Get(fp, &header, sizeof(header))
+		|| header.magic != kJournalMagic
+		|| header.version != kJournalVersion)
+		return false;
+
+	flags = header.flags;
+	return true;
+}
+
+
+/*!
+ * ReadRecord
+ *
+ *	Read the next record, filling in the event if it has one,
+ *	or the value for a marker.
+ *
+ *	A record cut short by a crash ends the journal. It gets
+ *	trimmed off so new records can follow the good ones.
+ */
+UInt32 FPHistoryJournal::ReadRecord(FPHistoryEvent &event, SInt32 &value) {
+	long			start = ftell(fp);
+	FPJournalRecord	record;
+	SInt32			trailer;
+	bool			good = Get(fp, &record, sizeof(record)) && record.length > 0;
+
+	if (good) {
+		long end = start + sizeof(record) + record.length;
+
+		switch (record.type) {
+			case kJournalEvent:
+			case kJournalMerge:
+				good = ReadEvent(event) && ftell(fp) == end;
+				break;
+
+			case kJournalUndo:
+			case kJournalRedo:
+			case kJournalBranch:
+				good = GetLong(fp, value) && ftell(fp) == end;
+				break;
+
+			default:
+				good = false;
+				break;
+		}
+
+		good = good && GetLong(fp, trailer) && (UInt32)trailer == (kJournalTrailer ^ record.length);
+	}
+
+	if (!good) {
+		fflush(fp);
+		(void)ftruncate(fileno(fp), start);
+		fseek(fp, start, SEEK_SET);
+		return kJournalEnd;
+	}
+
+	return record.type;
+}
+
+
+/*!
+ * Reset
+ *
+ *	Cut the journal back to just its header. This is done
+ *	whenever the document is saved or reverted, so the
+ *	autosave is no longer needed either.
+ */
+void FPHistoryJournal::Reset(ChordIndex docSize) {
+	if (fp == NULL)
+		return;
+
+	RemoveAutosaves();
+	flags = 0;
+
+	FPJournalHeader header = { kJournalMagic, kJournalVersion, docSize, 0 };
+
+	fflush(fp);
+	(void)ftruncate(fileno(fp), 0);
+	rewind(fp);
+
+	if (Put(fp, &header, sizeof(header)))
+		Sync(true);
+}
+
+
+/*!
+ * Rebase
+ *
+ *	Once the next autosave slot holds the document as it was
+ *	when the journal was at the given offset, only the records
+ *	after that are needed. They're copied to a new journal whose
+ *	header points at that slot, and the new journal is renamed
+ *	over the old one. A crash at any point leaves one journal
+ *	or the other, each with its own autosave, so either one can
+ *	be replayed.
+ */
+OSStatus FPHistoryJournal::Rebase(ChordIndex docSize, long offset) {
+	if (fp == NULL)
+		return fnfErr;
+
+	char *newPath = new char[strlen(path) + strlen(kRebaseExtension) + 1];
+	sprintf(newPath, "%s%s", path, kRebaseExtension);
+
+	FILE			*newFile = fopen(newPath, "w+b");
+	UInt32			newFlags = kJournalFromAutosave | ((flags & kJournalAutosaveB) ? 0 : kJournalAutosaveB);
+	FPJournalHeader	header = { kJournalMagic, kJournalVersion, docSize, newFlags };
+	bool			good = newFile != NULL && Put(newFile, &header, sizeof(header));
+
+	fflush(fp);
+
+	if (good && fseek(fp, offset, SEEK_SET) == 0) {
+		char	*buffer = new char[kRebaseBufferSize];
+		size_t	count;
+
+		while (good && (count = fread(buffer, 1, kRebaseBufferSize, fp)) > 0)
+			good = Put(newFile, buffer, count);
+
+		good = good && !ferror(fp);
+		delete [] buffer;
+	}
+	else
+		good = false;
+
+	if (newFile != NULL) {
+		good = good && fflush(newFile) == 0 && fsync(fileno(newFile)) == 0;
+
+		if (good && rename(newPath, path) == 0) {
+			fclose(fp);
+			fp = newFile;
+
+			// The old slot is free once nothing names it
+			if (flags & kJournalFromAutosave)
+				unlink(AutosavePath());
+
+			flags = newFlags;
+		}
+		else {
+			good = false;
+			fclose(newFile);
+			unlink(newPath);
+		}
+	}
+
+	delete [] newPath;
+
+	(void)fseek(fp, 0, SEEK_END);
+	unsynced = 0;
+	syncTime = TickCount();
+
+	return good ? noErr : ioErr;
+}
+
+
+/*!
+ * Size
+ *
+ *	The size of the journal, including any unflushed records
+ */
+long FPHistoryJournal::Size() const {
+	struct stat info;
+
+	if (fp == NULL)
+		return 0;
+
+	fflush(fp);
+	return (fstat(fileno(fp), &info) == 0) ? (long)info.st_size : 0;
+}
+
+
+/*!
+ * AppendEvent
+ */
+void FPHistoryJournal::AppendEvent(const FPHistoryEvent &event, bool merge) {
+	long start;
+
+	if (BeginRecord(merge ? kJournalMerge : kJournalEvent, start)) {
+		if (WriteEvent(event))
+			EndRecord(start);
+		else
+			fprintf(stderr, "FretPet: Couldn't write the history journal\n");
+	}
+}
+
+
+/*!
+ * AppendMarker
+ *
+ *	Append an undo, redo or branch record
+ */
+void FPHistoryJournal::AppendMarker(UInt32 type, SInt32 value) {
+	long start;
+
+	if (BeginRecord(type, start) && PutLong(fp, value))
+		EndRecord(start);
+}
+
+
+/*!
+ * Sync
+ *
+ *	Records are always flushed so they survive a crash of
+ *	the app, but syncing to the disk waits for a batch.
+ */
+void FPHistoryJournal::Sync(bool force) {
+	if (fp == NULL)
+		return;
+
+	fflush(fp);
+
+	if (force || unsynced >= kJournalSyncCount || TickCount() - syncTime >= kJournalSyncTicks) {
+		(void)fsync(fileno(fp));
+		unsynced = 0;
+		syncTime = TickCount();
+	}
+}
+
+
+/*!
+ * BeginRecord
+ *
+ *	Write a record header with no length. The length is
+ *	filled in by EndRecord once the payload is written.
+ */
+bool FPHistoryJournal::BeginRecord(UInt32 type, long &start) {
+	if (fp == NULL || fseek(fp, 0, SEEK_END) != 0 || (start = ftell(fp)) < 0)
+		return false;
+
+	FPJournalRecord record = { type, 0 };
+	return Put(fp, &record, sizeof(record));
+}
+
+
+void FPHistoryJournal::EndRecord(long start) {
+	long	end = ftell(fp);
+	UInt32	length = end - start - sizeof(FPJournalRecord);
+	SInt32	trailer = kJournalTrailer ^ length;
+
+	if (PutLong(fp, trailer)
+		&& fseek(fp, start + offsetof(FPJournalRecord, length), SEEK_SET) == 0
+		&& Put(fp, &length, sizeof(length))
+		&& fseek(fp, 0, SEEK_END) == 0) {
+			unsynced++;
+			Sync();
+	}
+}
+
+
+bool FPHistoryJournal::WriteEvent(const FPHistoryEvent &event) {
+	UInt16 info[3] = { event.action, event.partNum, event.partMask };
+
+	return Put(fp, info, sizeof(info))
+		&& PutLong(fp, event.eventTime)
+		&& PutString(fp, event.nameString.GetCFStringRef())
+		&& PutState(fp, event.before)
+		&& PutState(fp, event.after)
+		&& PutLong(fp, event.deltaStart)
+		&& event.delta.Write(fp);
+}
+
+
+bool FPHistoryJournal::ReadEvent(FPHistoryEvent &event) {
+	UInt16	info[3];
+	SInt32	eventTime, deltaStart;
+
+	if (!(Get(fp, info, sizeof(info)) && GetLong(fp, eventTime) && GetString(fp, event.nameString)))
+		return false;
+
+	event.action	= info[0];
+	event.partNum	= (SInt16)info[1];
+	event.partMask	= info[2];
+	event.eventTime	= eventTime;
+
+	if (!(GetState(fp, event.before) && GetState(fp, event.after) && GetLong(fp, deltaStart)))
+		return false;
+
+	event.deltaStart = deltaStart;
+
+	return event.delta.Read(fp);
+}
+
@@ -0,0 +1,128 @@
+/*!
+ *	@file FPHistoryJournal.h
+ *
+ *	@brief An append-only record of committed history events
+ *
+ *	While a document with a file is open its history is also
+ *	written to a hidden journal next to the document. Each
+ *	committed event, merge, undo, redo and branch switch is
+ *	appended as one record. Records are flushed as they are
+ *	written, but only synced to disk in batches.
+ *
+ *	Saving or reverting the document is a checkpoint. The
+ *	history is cleared at that point, so the journal is cut
+ *	back to its header, which notes the size of the document
+ *	as saved. Only the records since the last save ever need
+ *	to be replayed.
+ *
+ *	A journal that grows large is compacted. A full copy of the
+ *	document is written to a hidden autosave file on another
+ *	thread, then the journal is rebuilt with only the records
+ *	written since the copy was taken. The header then notes that
+ *	the records follow the autosave instead of the saved file.
+ *	There are two autosave slots, and a new autosave always goes
+ *	in the one the journal isn't using, so the journal and the
+ *	autosave it names always agree. See FPJournalCompactor.
+ *
+ *	The journal is removed when the document closes normally.
+ *	If it's still there when the document is opened, the app
+ *	must have quit unexpectedly. The records are then replayed
+ *	to recover the unsaved edits and the undo history, starting
+ *	from the autosave if the journal was compacted.
+ *
+ *	The journal is written in native byte order and is only
+ *	meant to be read back on the same machine.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPHISTORYJOURNAL_H
+#define FPHISTORYJOURNAL_H
+
+#include <stdio.h>
+
+class TFile;
+class FPHistoryEvent;
+
+//! Journal record types
+enum {
+	kJournalEnd = 0,				//!< No more records
+	kJournalEvent,					//!< A committed event
+	kJournalMerge,					//!< An event merged with the last one
+	kJournalUndo,					//!< The last event was undone
+	kJournalRedo,					//!< The next event was redone
+	kJournalBranch					//!< Switched to another branch
+};
+
+//! Journal header flags
+enum {
+	kJournalFromAutosave = BIT(0),	//!< The records follow the autosave, not the saved file
+	kJournalAutosaveB = BIT(1)		//!< The autosave is in the second slot
+};
+
+//! The header at the start of every journal
+typedef struct {
+	UInt32			magic;			//!< Identifies a journal file
+	UInt32			version;		//!< The journal format version
+	SInt32			docSize;		//!< The number of chords in the saved document or autosave
+	UInt32			flags;			//!< Journal header flags
+} FPJournalHeader;
+
+//! The header for each record
+typedef struct {
+	UInt32			type;			//!< The record type
+	UInt32			length;			//!< The payload length
+} FPJournalRecord;
+
+#pragma mark -
+//-----------------------------------------------
+//
+// FPHistoryJournal
+//
+class FPHistoryJournal {
+	private:
+		FILE			*fp;			//!< The open journal
+		char			*path;			//!< The journal path
+		char			*autosavePath[2];	//!< The paths of the autosave slots
+		UInt32			flags;			//!< The flags in the current header
+		UInt16			unsynced;		//!< Records written since the last sync
+		UInt32			syncTime;		//!< TickCount at the last sync
+
+	public:
+		FPHistoryJournal();
+		~FPHistoryJournal();
+
+		OSStatus		Open(const TFile &docFile);
+		void			Close(bool discard=true);
+		inline bool		IsOpen() const					{ return fp != NULL; }
+		bool			IsFor(const TFile &docFile) const;
+
+		bool			BeginRead(FPJournalHeader &header);
+		UInt32			ReadRecord(FPHistoryEvent &event, SInt32 &value);
+		void			Reset(ChordIndex docSize);
+		OSStatus		Rebase(ChordIndex docSize, long offset);
+
+		long			Size() const;
+		inline const char*	AutosavePath() const			{ return autosavePath[(flags & kJournalAutosaveB) ? 1 : 0]; }
+		inline const char*	NextAutosavePath() const		{ return autosavePath[(flags & kJournalAutosaveB) ? 0 : 1]; }
+
+		void			AppendEvent(const FPHistoryEvent &event, bool merge=false);
+		void			AppendMarker(UInt32 type, SInt32 value=0);
+		void			Sync(bool force=false);
+
+	private:
+		bool			BeginRecord(UInt32 type, long &start);
+		void			EndRecord(long start);
+		bool			WriteEvent(const FPHistoryEvent &event);
+		bool			ReadEvent(FPHistoryEvent &event);
+
+		void			RemoveAutosaves();
+
+		static char*	SidecarPath(const TFile &docFile, const char *extension);
+};
+
+#endif
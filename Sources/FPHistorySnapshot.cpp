@@ -0,0 +1,78 @@
+/*
+ *  FPHistorySnapshot.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPHistorySnapshot.h"
+#include "FPChordGroupStore.h"
+
+
+/*!
+ * FPHistorySnapshot
+ *
+ *	Copy the groups, sharing any with the same content as
+ *	a group in the previous snapshot or earlier in this one.
+ *	The group at the same index is checked first, since
+ *	most groups stay put, and the rest are looked up in a
+ *	store holding every group shared so far. New groups
+ *	are added to the owner's count of shared bytes.
+ */
+FPHistorySnapshot::FPHistorySnapshot(const FPChordGroupArray &groups, UInt32 &sharedBytes, const FPHistorySnapshot *previous) {
+	ChordIndex			size = groups.size(),
+						prevSize = previous ? previous->Size() : 0;
+	FPChordGroupStore	store(prevSize + size);
+	FPSharedGroupList	storeList;
+
+	groupList.reserve(size);
+
+	for (ChordIndex i=0; i<prevSize; i++) {
+		FPSharedGroup *prev = previous->groupList[i];
+		if (store.Add(prev->group) == storeList.size())
+			storeList.push_back(prev);
+	}
+
+	for (ChordIndex i=0; i<size; i++) {
+		const FPChordGroup	&group = groups[i];
+		FPSharedGroup		*shared;
+
+		if (i < prevSize && previous->groupList[i]->group.IsIdentical(group))
+			shared = previous->groupList[i];
+		else {
+			UInt32 id = store.Find(group);
+			shared = (id != kNoGroupID) ? storeList[id] : NULL;
+		}
+
+		if (shared != NULL)
+			shared->Retain();
+		else {
+			shared = new FPSharedGroup(group, &sharedBytes);
+			(void)store.Add(shared->group);
+			storeList.push_back(shared);
+		}
+
+		groupList.push_back(shared);
+	}
+}
+
+
+FPHistorySnapshot::~FPHistorySnapshot() {
+	for (FPSharedGroupList::iterator itr = groupList.begin(); itr != groupList.end(); itr++)
+		(*itr)->Release();
+}
+
+
+/*!
+ * Restore
+ *
+ *	Fill an array with copies of the snapshot's groups
+ */
+void FPHistorySnapshot::Restore(FPChordGroupArray &groups) const {
+	groups.clear();
+
+	for (FPSharedGroupList::const_iterator itr = groupList.begin(); itr != groupList.end(); itr++)
+		groups.push_back(new FPChordGroup((*itr)->group));
+}
+
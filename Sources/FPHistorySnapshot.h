@@ -0,0 +1,69 @@
+/*!
+ *	@file FPHistorySnapshot.h
+ *
+ *	@brief A full copy of a document's chords at some point in its history
+ *
+ *	Snapshots are taken every few events so that jumping to a
+ *	distant state, such as another branch of the undo tree, only
+ *	needs one snapshot restore followed by a few redos.
+ *
+ *	Most chords don't change between one snapshot and the next,
+ *	and many repeat within a document, so a new snapshot shares
+ *	every group with the same content as one in the previous
+ *	snapshot or earlier in itself. Shared groups are reference
+ *	counted and never modified, so every snapshot sees its own
+ *	complete copy.
+ *
+ *	A shared group can outlive the snapshot that made it, so
+ *	groups are counted in their owner's byte count as they're
+ *	made and freed, and a snapshot's own size is just its list.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPHISTORYSNAPSHOT_H
+#define FPHISTORYSNAPSHOT_H
+
+#include "FPChord.h"
+#include <vector>
+
+//! A chord group shared between snapshots
+class FPSharedGroup {
+	public:
+		FPChordGroup		group;			//!< The chords, never modified
+		UInt32				refCount;		//!< The number of snapshots using it
+		UInt32				*byteCount;		//!< The owner's count of bytes in shared groups
+
+		FPSharedGroup(const FPChordGroup &src, UInt32 *counter) : group(src), refCount(1), byteCount(counter) { *byteCount += sizeof(*this); }
+		~FPSharedGroup()							{ *byteCount -= sizeof(*this); }
+
+		inline void			Retain()				{ refCount++; }
+		inline void			Release()				{ if (--refCount == 0) delete this; }
+};
+
+typedef std::vector<FPSharedGroup*> FPSharedGroupList;
+
+#pragma mark -
+//-----------------------------------------------
+//
+// FPHistorySnapshot
+//
+class FPHistorySnapshot {
+	private:
+		FPSharedGroupList	groupList;		//!< The chord groups, in order
+
+	public:
+		FPHistorySnapshot(const FPChordGroupArray &groups, UInt32 &sharedBytes, const FPHistorySnapshot *previous=NULL);
+		~FPHistorySnapshot();
+
+		void				Restore(FPChordGroupArray &groups) const;
+
+		inline ChordIndex	Size() const			{ return groupList.size(); }
+		inline UInt32		ByteSize() const		{ return sizeof(*this) + groupList.size() * sizeof(FPSharedGroup*); }
+};
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ *  FPJournalCompactor.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPJournalCompactor.h"
+#include "FPHistory.h"
+#include "FPDocument.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+
+/*!
+ * FPJournalCompactor
+ *
+ *	Take a copy of the document's settings and the snapshot
+ *	of its chords. This runs on the main thread, which owns
+ *	the snapshot's shared groups.
+ */
+FPJournalCompactor::FPJournalCompactor(FPHistory *hist, const FPDocument &doc, FPHistorySnapshot *snap, const char *autosavePath, long offset, UInt32 inEpoch) {
+	history			= hist;
+	snapshot		= snap;
+	docSize			= snap->Size();
+	journalOffset	= offset;
+	epoch			= inEpoch;
+	running			= false;
+	done			= false;
+	result			= noErr;
+	pollLoop		= NULL;
+	pollUPP			= NULL;
+
+	path = new char[strlen(autosavePath) + 1];
+	strcpy(path, autosavePath);
+
+	copy = new FPDocument(NULL);
+	copy->CopySettings(doc);
+}
+
+
+/*!
+ * ~FPJournalCompactor
+ *
+ *	A compactor can be deleted while it's still writing,
+ *	as when the document is saved. The thread is waited
+ *	for and the partial autosave is simply never used.
+ */
+FPJournalCompactor::~FPJournalCompactor() {
+	DisposeTimer();
+	Join();
+
+	delete copy;
+	delete snapshot;
+	delete [] path;
+}
+
+
+/*!
+ * Start
+ *
+ *	Start writing the autosave on its own thread
+ */
+OSStatus FPJournalCompactor::Start() {
+	if (running)
+		return noErr;
+
+	if (pthread_create(&thread, NULL, ThreadEntry, this) != 0)
+		return memFullErr;
+
+	running = true;
+	StartTimer();
+
+	return noErr;
+}
+
+
+/*!
+ * Write
+ *
+ *	Fill in the copy's chords and write it to the autosave
+ *	slot. The file is synced so the journal never names an
+ *	autosave that isn't on the disk yet.
+ */
+void FPJournalCompactor::Write() {
+	snapshot->Restore(copy->ChordGroupArray());
+
+	// TFile can only specify a file that exists
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		result = ioErr;
+		return;
+	}
+	close(fd);
+
+	copy->Specify(path);
+	result = copy->OpenWrite();
+
+	if (result == noErr)
+		result = copy->WriteBinaryFormat();
+
+	copy->Close();
+
+	if (result == noErr) {
+		if ((fd = open(path, O_RDONLY)) >= 0) {
+			if (fsync(fd) != 0)
+				result = ioErr;
+			close(fd);
+		}
+		else
+			result = ioErr;
+	}
+}
+
+
+void FPJournalCompactor::Join() {
+	if (running) {
+		pthread_join(thread, NULL);
+		running = false;
+	}
+}
+
+
+void* FPJournalCompactor::ThreadEntry(void *compactor) {
+	FPJournalCompactor *self = (FPJournalCompactor*)compactor;
+
+	self->Write();
+	self->done = true;
+
+	return NULL;
+}
+
+
+void FPJournalCompactor::StartTimer() {
+	if (pollLoop == NULL) {
+		pollUPP = NewEventLoopTimerUPP(FPJournalCompactor::PollTimerProc);
+
+		(void)InstallEventLoopTimer(
+									GetMainEventLoop(),
+									1.0 / 4.0, 1.0 / 4.0,
+									pollUPP,
+									this,
+									&pollLoop
+									);
+	}
+}
+
+
+void FPJournalCompactor::DisposeTimer() {
+	if (pollLoop != NULL) {
+		(void)RemoveEventLoopTimer(pollLoop);
+		DisposeEventLoopTimerUPP(pollUPP);
+		pollLoop = NULL;
+		pollUPP = NULL;
+	}
+}
+
+
+//
+// PollTimerProc
+//
+//	Once the thread is done the history rebases the
+//	journal and deletes the compactor, so don't touch
+//	it after.
+//
+void FPJournalCompactor::PollTimerProc(EventLoopTimerRef timer, void *compactor) {
+	FPJournalCompactor *self = (FPJournalCompactor*)compactor;
+
+	if (self->done) {
+		self->Join();
+		self->history->FinishCompaction(self);
+	}
+}
+
@@ -0,0 +1,79 @@
+/*!
+ *	@file FPJournalCompactor.h
+ *
+ *	@brief Writes a document's autosave on another thread
+ *
+ *	A history journal grows with every edit, so a long session
+ *	would make recovery after a crash slower and slower. When the
+ *	journal gets large the history starts a compactor.
+ *
+ *	On the main thread the compactor takes a copy of the document
+ *	settings and a history snapshot of the chords. A snapshot is
+ *	cheap because it shares every group that hasn't changed since
+ *	the last one. The copy is then written in the binary format to
+ *	the journal's next autosave slot on a thread of its own, so
+ *	editing carries on and autosave never costs more than the edit.
+ *
+ *	A timer watches for the thread to finish, then hands the
+ *	compactor back to the history, which cuts the journal down
+ *	to the records written since the copy was taken.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPJOURNALCOMPACTOR_H
+#define FPJOURNALCOMPACTOR_H
+
+#include <pthread.h>
+
+class FPDocument;
+class FPHistory;
+class FPHistorySnapshot;
+
+#pragma mark -
+//-----------------------------------------------
+//
+// FPJournalCompactor
+//
+class FPJournalCompactor {
+	private:
+		FPHistory			*history;		//!< The history to notify
+		FPDocument			*copy;			//!< The document settings, and chords once restored
+		FPHistorySnapshot	*snapshot;		//!< The chords when the copy was taken
+		char				*path;			//!< The autosave slot to write
+		ChordIndex			docSize;		//!< The number of chords written
+		long				journalOffset;	//!< The journal size when the copy was taken
+		UInt32				epoch;			//!< The history's journal epoch for this copy
+		pthread_t			thread;			//!< The writer thread
+		bool				running;		//!< The thread was started and not joined
+		volatile bool		done;			//!< Set by the thread when it's finished
+		OSStatus			result;			//!< The result of the write
+		EventLoopTimerRef	pollLoop;		//!< The timer that watches the thread
+		EventLoopTimerUPP	pollUPP;		//!< UPP for the timer
+
+	public:
+		FPJournalCompactor(FPHistory *hist, const FPDocument &doc, FPHistorySnapshot *snap, const char *autosavePath, long offset, UInt32 inEpoch);
+		~FPJournalCompactor();
+
+		OSStatus			Start();
+
+		inline OSStatus		Result() const				{ return result; }
+		inline ChordIndex	DocSize() const				{ return docSize; }
+		inline long			JournalOffset() const		{ return journalOffset; }
+		inline UInt32		Epoch() const				{ return epoch; }
+
+	private:
+		void				Write();
+		void				Join();
+		void				StartTimer();
+		void				DisposeTimer();
+
+		static void*		ThreadEntry(void *compactor);
+		static void			PollTimerProc(EventLoopTimerRef timer, void *compactor);
+};
+
+#endif
@@ -0,0 +1,441 @@
+/*
+ *  FPMidiFormat.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPMidiFormat.h"
+
+#include <algorithm>
+
+#define kMidiTrackID			'MTrk'
+#define kMidiHeadSize			6			//!< The smallest MThd chunk
+#define kMidiChunkHead			8			//!< Chunk ID and length
+
+struct FPMidiNoteOrder {
+	bool operator()(const FPMidiNote &a, const FPMidiNote &b) const {
+		if (a.step != b.step) return a.step < b.step;
+		if (a.part != b.part) return a.part < b.part;
+		return a.tone < b.tone;
+	}
+};
+
+static inline UInt16 ReadWord(const UInt8 *p) { return (p[0] << 8) | p[1]; }
+static inline UInt32 ReadLong(const UInt8 *p) { return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+
+//
+// ReadVarLen
+//
+//	Read a variable-length number. Fails if it runs
+//	past the end or is longer than four bytes.
+//
+static bool ReadVarLen(const UInt8 *&p, const UInt8 *end, UInt32 &value) {
+	value = 0;
+
+	for (int i=0; i<4; i++) {
+		if (p >= end)
+			return false;
+
+		UInt8 b = *p++;
+		value = (value << 7) | (b & 0x7F);
+
+		if (!(b & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
+
+FPMidiParser::FPMidiParser(const UInt8 *inData, UInt64 inSize) {
+	data		= inData;
+	size		= inSize;
+	nextNote	= 0;
+	nextStep	= 0;
+	bzero(&header, sizeof(header));
+}
+
+
+/*!
+ * IsMidiType
+ */
+bool FPMidiParser::IsMidiType(UInt32 fileType) {
+	return fileType == FILE_FORMAT_SMF;
+}
+
+
+/*!
+ * Parse
+ *
+ *	Check the header and read every track. A chunk that
+ *	claims to run past the end is read up to the end.
+ *	Chunks that aren't tracks are skipped.
+ */
+OSStatus FPMidiParser::Parse() {
+	if (size < kMidiMinSize || ReadLong(data) != FILE_FORMAT_SMF)
+		return kFPErrorBadFormat;
+
+	UInt32 headLen = ReadLong(data + 4);
+	if (headLen < kMidiHeadSize || kMidiChunkHead + (UInt64)headLen > size)
+		return kFPErrorBadFormat;
+
+	header.format		= ReadWord(data + 8);
+	header.trackCount	= ReadWord(data + 10);
+	header.division		= ReadWord(data + 12);
+
+	// SMPTE timing has no beats to quantize to
+	if (header.format > 1 || header.division == 0 || (header.division & 0x8000))
+		return kFPErrorBadFormat;
+
+	for (int c=TOTAL_CHANNELS; c--;)
+		channelProgram[c] = kMidiNoProgram;
+
+	noteList.clear();
+	noteList.reserve(size / 8);
+
+	const UInt8	*p = data + kMidiChunkHead + headLen,
+				*end = data + size;
+	UInt16		tracks = 0;
+
+	while (end - p >= kMidiChunkHead && tracks < header.trackCount) {
+		UInt32 chunkID = ReadLong(p), len = ReadLong(p + 4);
+		p += kMidiChunkHead;
+
+		if (len > (UInt64)(end - p))
+			len = end - p;
+
+		if (chunkID == kMidiTrackID) {
+			ReadTrack(p, p + len);
+			tracks++;
+		}
+
+		p += len;
+	}
+
+	if (tracks == 0)
+		return kFPErrorBadFormat;
+
+	if (header.usPerQuarter == 0)
+		header.usPerQuarter = kMidiDefaultTempo;
+
+	AssignParts();
+
+	nextNote = 0;
+	nextStep = 0;
+
+	return noErr;
+}
+
+
+/*!
+ * NextSegment
+ *
+ *	Get the next run of steps to make into a chord group.
+ *	Returns false when there are no more notes.
+ */
+bool FPMidiParser::NextSegment(FPMidiSegment &seg) {
+	if (nextNote >= noteList.size())
+		return false;
+
+	seg.step	= nextStep;
+	seg.first	= nextNote;
+
+	// Empty bars before the next note become one repeated rest
+	UInt32 emptyBars = (nextStep % MAX_BEATS) ? 0 : (noteList[nextNote].step - nextStep) / MAX_BEATS;
+	if (emptyBars) {
+		seg.beats	= MAX_BEATS;
+		seg.repeat	= MIN(emptyBars, MAX_REPEAT);
+		seg.end		= nextNote;
+		nextStep	+= MAX_BEATS * seg.repeat;
+		return true;
+	}
+
+	// Stay in step with the bars, then halve until
+	// every part can be fingered
+	UInt16 beats = MAX_BEATS;
+	while (nextStep % beats)
+		beats /= 2;
+
+	while (beats > kMidiMinBeats && TooManyTones(nextNote, NoteEnd(nextNote, nextStep + beats)))
+		beats /= 2;
+
+	seg.beats	= beats;
+	seg.repeat	= 1;
+	seg.end		= NoteEnd(nextNote, nextStep + beats);
+
+	nextNote	= seg.end;
+	nextStep	+= beats;
+
+	return true;
+}
+
+
+#if !FP_PORTABLE
+
+/*!
+ * SetTones
+ *
+ *	Start each chord of a group with the tones its part
+ *	plays in a segment. The lowest note names the chord
+ *	and puts the bracket where it can be fingered.
+ */
+void FPMidiParser::SetTones(const FPMidiSegment &seg, FPChordGroup &group, const SInt32 tone[NUM_STRINGS]) const {
+	UInt16	mask[DOC_PARTS];
+	UInt8	lowest[DOC_PARTS];
+
+	bzero(mask, sizeof(mask));
+	memset(lowest, 0xFF, sizeof(lowest));
+
+	for (UInt32 n=seg.first; n<seg.end; n++) {
+		const FPMidiNote &note = noteList[n];
+		mask[note.part] |= BIT(NOTEMOD(note.tone));
+		lowest[note.part] = MIN(lowest[note.part], note.tone);
+	}
+
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		FPChord &chord = group[p];
+
+		chord.Init();
+		chord.SetPatternSize(seg.beats);
+		chord.SetRepeat(seg.repeat);
+
+		if (mask[p]) {
+			UInt16 root = NOTEMOD(lowest[p]);
+			chord.Set(mask[p], root, root);
+			chord.ResetStepInfo();
+
+			SInt32 fret = lowest[p] - LOWEST_C - tone[0];
+			while (fret < 0) fret += OCTAVE;
+			while (fret > MAX_FRETS - 4) fret -= OCTAVE;
+			chord.SetBracket(fret, fret + 4);
+		}
+	}
+}
+
+
+/*!
+ * SetPattern
+ *
+ *	Put every note of a segment on a fingered string that
+ *	plays the same tone, the one closest in pitch, and
+ *	preferably one not already picked on that beat. A note
+ *	the fingering missed is left out.
+ */
+void FPMidiParser::SetPattern(const FPMidiSegment &seg, FPChordGroup &group, const SInt32 tone[NUM_STRINGS]) const {
+	for (UInt32 n=seg.first; n<seg.end; n++) {
+		const FPMidiNote	&note = noteList[n];
+		FPChord				&chord = group[note.part];
+		UInt16				beat = note.step - seg.step;
+		SInt16				best = -1;
+		SInt32				bestScore = 0;
+
+		for (UInt16 s=0; s<NUM_STRINGS; s++) {
+			SInt16 fret = chord.FretHeld(s);
+			if (fret < 0)
+				continue;
+
+			SInt32 pitch = fret + tone[s] + LOWEST_C;
+			if (NOTEMOD(pitch) != NOTEMOD(note.tone))
+				continue;
+
+			SInt32 score = abs(pitch - note.tone);
+			if (chord.GetPatternDot(s, beat))
+				score += NUM_OCTAVES * OCTAVE;
+
+			if (best < 0 || score < bestScore) {
+				best = s;
+				bestScore = score;
+			}
+		}
+
+		if (best >= 0)
+			chord.SetPatternDot(best, beat);
+	}
+}
+
+#endif
+
+
+//
+// ReadTrack
+//
+//	Read the note starts, programs and first tempo of
+//	one track. Meta events and sysex cancel running
+//	status. Reading stops at the end of the track or at
+//	the first thing that doesn't make sense.
+//
+void FPMidiParser::ReadTrack(const UInt8 *p, const UInt8 *end) {
+	UInt32	tick = 0, delta, len;
+	UInt8	status = 0;
+
+	while (p < end) {
+		if (!ReadVarLen(p, end, delta) || p >= end)
+			break;
+
+		tick += delta;
+
+		UInt8 b = *p;
+		if (b & 0x80) {
+			p++;
+			if (b < 0xF0) status = b;
+		}
+		else if (status)
+			b = status;
+		else
+			break;
+
+		if (b == 0xFF) {
+			if (p >= end) break;
+			UInt8 type = *p++;
+
+			if (!ReadVarLen(p, end, len) || len > (UInt32)(end - p))
+				break;
+
+			if (type == 0x2F)
+				break;
+
+			if (type == 0x51 && len == 3 && header.usPerQuarter == 0)
+				header.usPerQuarter = (p[0] << 16) | (p[1] << 8) | p[2];
+
+			p += len;
+			status = 0;
+		}
+		else if (b == 0xF0 || b == 0xF7) {
+			if (!ReadVarLen(p, end, len) || len > (UInt32)(end - p))
+				break;
+
+			p += len;
+			status = 0;
+		}
+		else if (b >= 0xF0)
+			break;
+		else {
+			UInt16 count = ((b & 0xE0) == 0xC0) ? 1 : 2;
+			if (end - p < count)
+				break;
+
+			UInt8	channel = b & 0x0F,
+					data1 = p[0] & 0x7F,
+					data2 = (count > 1) ? (p[1] & 0x7F) : 0;
+
+			p += count;
+
+			switch (b & 0xF0) {
+				case 0x90:
+					if (data2) {
+						UInt32 step = (UInt32)(((UInt64)tick * 4 + header.division / 2) / header.division);
+						if (step <= kMidiMaxStep) {
+							FPMidiNote note = { step, channel, data1, data2, 0 };
+							noteList.push_back(note);
+						}
+					}
+					break;
+
+				case 0xC0:
+					if (channelProgram[channel] == kMidiNoProgram)
+						channelProgram[channel] = data1;
+					break;
+			}
+		}
+	}
+}
+
+
+//
+// AssignParts
+//
+//	Give parts to the lowest channels with notes, drop
+//	the notes of other channels, and sort what's left
+//	by step, part and tone with no doubles.
+//
+void FPMidiParser::AssignParts() {
+	UInt32	channelNotes[TOTAL_CHANNELS];
+	UInt8	channelPart[TOTAL_CHANNELS];
+	UInt32	n, kept = 0;
+
+	bzero(channelNotes, sizeof(channelNotes));
+	memset(channelPart, kMidiNoChannel, sizeof(channelPart));
+
+	for (n=0; n<noteList.size(); n++)
+		channelNotes[noteList[n].part]++;
+
+	PartIndex parts = 0;
+	for (int c=0; c<TOTAL_CHANNELS; c++)
+		if (channelNotes[c] && parts < DOC_PARTS) {
+			channelPart[c] = parts;
+			header.partChannel[parts] = c;
+			header.program[parts] = channelProgram[c];
+			parts++;
+		}
+
+	for (PartIndex p=parts; p<DOC_PARTS; p++) {
+		header.partChannel[p] = kMidiNoChannel;
+		header.program[p] = kMidiNoProgram;
+	}
+
+	for (n=0; n<noteList.size(); n++) {
+		FPMidiNote note = noteList[n];
+		UInt8 part = channelPart[note.part];
+
+		if (part != kMidiNoChannel) {
+			note.part = part;
+			header.velocity[part] = MAX(header.velocity[part], note.velocity);
+			noteList[kept++] = note;
+		}
+	}
+
+	noteList.resize(kept);
+	std::sort(noteList.begin(), noteList.end(), FPMidiNoteOrder());
+
+	// Keep one of each tone played at once in a part
+	kept = 0;
+	for (n=0; n<noteList.size(); n++)
+		if (kept == 0 || FPMidiNoteOrder()(noteList[kept - 1], noteList[n]))
+			noteList[kept++] = noteList[n];
+
+	noteList.resize(kept);
+	header.noteCount = kept;
+}
+
+
+//
+// NoteEnd
+//
+//	Get the first note at or after a step
+//
+UInt32 FPMidiParser::NoteEnd(UInt32 first, UInt32 step) const {
+	UInt32 n = first;
+	while (n < noteList.size() && noteList[n].step < step)
+		n++;
+	return n;
+}
+
+
+//
+// TooManyTones
+//
+//	Check if some part plays more tones in a run of
+//	notes than it has strings to finger
+//
+bool FPMidiParser::TooManyTones(UInt32 first, UInt32 end) const {
+	UInt16 mask[DOC_PARTS];
+	bzero(mask, sizeof(mask));
+
+	for (UInt32 n=first; n<end; n++)
+		mask[noteList[n].part] |= BIT(NOTEMOD(noteList[n].tone));
+
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		UInt16 count = 0;
+		for (UInt16 m=mask[p]; m; m &= m - 1)
+			count++;
+
+		if (count > NUM_STRINGS)
+			return true;
+	}
+
+	return false;
+}
+
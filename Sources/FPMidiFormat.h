@@ -0,0 +1,128 @@
+/*!
+ *	@file FPMidiFormat.h
+ *
+ *	@brief Reads Standard MIDI Files into chord groups
+ *
+ *	FPMidiParser reads a format 0 or 1 MIDI file from memory,
+ *	usually a mapped file, in one pass. Every track is decoded
+ *	straight from the data. Only note starts are kept, each one
+ *	rounded to the nearest sixteenth, which is the step of a
+ *	FretPet pattern. Note lengths are set by each part's sustain,
+ *	so note-offs aren't needed. Every read is checked against the
+ *	end of its chunk, so a damaged file just ends early.
+ *
+ *	The lowest channels with any notes become the parts, up to
+ *	DOC_PARTS of them. Notes on other channels are dropped.
+ *	Only the first tempo is kept, as a document has one tempo.
+ *
+ *	The notes are then cut into segments, one chord group each.
+ *	A segment is a bar of MAX_BEATS steps, halved until no part
+ *	has more tones than there are strings. A run of empty bars
+ *	is one segment, repeated. For each segment the
+ *	caller gets the tones of each part with SetTones, fingers
+ *	the chords, and then SetPattern puts every note on the
+ *	fingered string closest to its pitch.
+ *
+ *	The parser knows nothing about documents or the player, so
+ *	the fingering is left to the caller. Without Carbon only the
+ *	parsing and segments are built, for the tests.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPMIDIFORMAT_H
+#define FPMIDIFORMAT_H
+
+#include "FPChord.h"
+#include <vector>
+
+#define	FILE_FORMAT_SMF			'MThd'
+
+#define kMidiNoChannel			0xFF		//!< A part with no channel
+#define kMidiNoProgram			0xFFFF		//!< A channel with no program change
+#define kMidiDrumChannel		9			//!< General MIDI percussion
+#define kMidiDefaultTempo		500000		//!< Microseconds per quarter note at 120 BPM
+#define kMidiMinSize			14			//!< The smallest MThd chunk
+#define kMidiMinBeats			4			//!< The shortest segment
+#define kMidiMaxStep			0x00FFFFFF	//!< Later notes are dropped
+
+/*!
+ * A note start, quantized
+ */
+typedef struct {
+	UInt32		step;				//!< 4 Sixteenths from the start
+	UInt8		part;				//!< 1 The part, or the channel while parsing
+	UInt8		tone;				//!< 1 The MIDI note number
+	UInt8		velocity;			//!< 1 The note velocity
+	UInt8		unused;				//!< 1 placeholder
+} FPMidiNote;						//   8 bytes total
+
+/*!
+ * What the file says besides the notes
+ */
+typedef struct {
+	UInt16		format;						//!< 0 or 1
+	UInt16		trackCount;					//!< Tracks named in the header
+	UInt16		division;					//!< Ticks per quarter note
+	UInt32		usPerQuarter;				//!< The first tempo
+	UInt8		partChannel[DOC_PARTS];		//!< The channel of each part
+	UInt16		program[DOC_PARTS];			//!< The first program of each part
+	UInt8		velocity[DOC_PARTS];		//!< The loudest note of each part
+	UInt32		noteCount;					//!< Notes kept
+} FPMidiHeader;
+
+/*!
+ * A run of steps that becomes one chord group
+ */
+typedef struct {
+	UInt32		step;				//!< The first step
+	UInt16		beats;				//!< The number of steps
+	UInt16		repeat;				//!< Times played, for empty bars
+	UInt32		first;				//!< The first note in it
+	UInt32		end;				//!< The note after the last
+} FPMidiSegment;
+
+#pragma mark -
+//-----------------------------------------------
+//
+// FPMidiParser
+//
+class FPMidiParser {
+	private:
+		const UInt8					*data;			//!< The whole file
+		UInt64						size;			//!< The size of the file
+		FPMidiHeader				header;			//!< The parsed header
+		std::vector<FPMidiNote>		noteList;		//!< Note starts by step, part and tone
+		UInt16						channelProgram[TOTAL_CHANNELS];	//!< First program per channel
+		UInt32						nextNote;		//!< Where the next segment starts
+		UInt32						nextStep;		//!< The step of the next segment
+
+	public:
+		FPMidiParser(const UInt8 *inData, UInt64 inSize);
+		~FPMidiParser() {}
+
+		OSStatus			Parse();
+		inline const FPMidiHeader&	Header() const		{ return header; }
+
+		inline const FPMidiNote&	operator[](UInt32 n) const	{ return noteList[n]; }
+
+		bool				NextSegment(FPMidiSegment &seg);
+#if !FP_PORTABLE
+		void				SetTones(const FPMidiSegment &seg, FPChordGroup &group, const SInt32 tone[NUM_STRINGS]) const;
+		void				SetPattern(const FPMidiSegment &seg, FPChordGroup &group, const SInt32 tone[NUM_STRINGS]) const;
+#endif
+
+		static bool			IsMidiType(UInt32 fileType);
+
+	private:
+		void				ReadTrack(const UInt8 *p, const UInt8 *end);
+		void				AssignParts();
+		UInt32				NoteEnd(UInt32 first, UInt32 step) const;
+		bool				TooManyTones(UInt32 first, UInt32 end) const;
+};
+
+#endif
@@ -52,3 +52,49 @@ void FPMidiHelper::GroupAndIndexForInstrument(UInt16 inInst, UInt16 &outGroup, U
 	outGroup = ((fauxGM <= kLastFauxGM) ? fauxGM - 1 : (fauxGM <= kLastFauxDrum) ? kFirstFauxDrum - 1 : kFirstFauxGS - 1) / 8 + 1;
 	outIndex = fauxGM - ((fauxGM <= kLastFauxGM) ? kFirstFauxGM : (fauxGM <= kLastFauxDrum) ? kFirstFauxDrum : kFirstFauxGS) + 1;
 }
+
+/*!
+ * CopyInstrumentName
+ *
+ *	The General MIDI or GS name of an instrument. Only
+ *	constant tables are used, so any thread can call it.
+ */
+void FPMidiHelper::CopyInstrumentName(UInt16 trueGM, char *name, UInt16 size) {
+	UInt16 fauxGM = TrueGMToFauxGM(trueGM);
+
+	if (fauxGM >= kFirstFauxGM && fauxGM <= kLastFauxGM) {
+		static const char *names[] = {"Acoustic Grand Piano", "Bright Acoustic Piano", "Electric Grand Piano", "Honkytonk Piano", "Electric Piano", "Chorused Piano", "Harpsichord", "Clavi", "Celesta", "Glockenspiel", "Music Box", "Vibraphone", "Marimba", "Xylophone", "Tubular bells", "Dulcimer", "Drawbar Organ", "Percussive Organ", "Rock Organ", "Church Organ", "Reed Organ", "Accordion", "Harmonica", "Tango Accordion", "Acoustic Nylon Guitar", "Acoustic Steel Guitar", "Electric Jazz Guitar", "Electric Clean Guitar", "Electric Guitar Muted", "Overdriven Guitar", "Distortion Guitar", "Guitar Harmonics", "Acoustic Fretless Bass", "Electric Bass Fingered", "Electric Bass Picked", "Fretless Bass", "Slap Bass 1", "Slap Bass 2", "Synth Bass 1", "Synth Bass 2", "Violin", "Viola", "Cello", "Contrabass", "Tremolo Strings", "Pizzicato Strings", "Orchestral Harp", "Timpani", "Acoustic String Ensemble", "Acoustic String Ensemble 2 ", "SynthStrings 1", "SynthStrings 2", "Aah Choir", "Ooh Choir", "SynthVox", "Orchestra Hit", "Trumpet", "Trombone", "Tuba", "Muted Trumpet", "French Horn", "Brass Section", "Synth Brass 1", "Synth Brass 2", "Soprano Sax", "Alto Sax", "Tenor Sax", "Baritone Sax", "Oboe", "English Horn", "Bassoon", "Clarinet", "Piccolo", "Flute", "Recorder", "Pan Flute", "Bottle Blow", "Shakuhachi", "Whistle", "Ocarina", "Square Wave", "Saw Wave", "Calliope", "Chiffer", "Charang", "Solo Vox", "5th Saw Wave", "Bass & Lead", "Fantasy", "Warm", "Polysynth", "Choir", "Bowed", "Metal", "Halo", "Sweep", "Ice Rain", "Sound Tracks", "Crystal", "Atmosphere", "Brightness", "Goblins", "Echoes", "Space", "Sitar", "Banjo", "Shamisen", "Koto", "Kalimba", "Bag Pipe", "Fiddle", "Shannai", "Tinkle Bell", "Agogo", "Steel Drums", "Woodblock", "Taiko Drum", "Melodic Tom", "Synth Drum", "Reverse Cymbal", "Guitar Fret Noise", "Breath Noise", "Seashore", "Bird Tweet", "Telephone Ring", "Helicopter", "Applause", "Gunshot"};
+		strlcpy(name, names[fauxGM - kFirstFauxGM], size);
+	}
+	else if (fauxGM >= kFirstFauxDrum && fauxGM <= kLastFauxDrum) {
+		static const char *drum_names[] = {"Standard Kit", "Room Kit", "Power Kit", "Electronic Kit", "Analog Kit", "Jazz Kit", "Brush Kit", "Orchestra Kit", "SFX Kit"};
+		strlcpy(name, drum_names[fauxGM - kFirstFauxDrum], size);
+	}
+	else if (fauxGM >= kFirstFauxGS && fauxGM <= kLastFauxGS) {
+		static const char *gs_backup[] = {"GS SynthBass101", "GS Trombone 2", "GS Fr.Horn 2", "GS Square", "GS Saw", "GS Syn Mallet", "GS Echo Bell", "GS Sitar 2", "GS Gt.Cut Noise", "GS Fl.Key Click", "GS Rain", "GS Dog", "GS Telephone 2", "GS Car-Engine", "GS Laughing", "GS Machine Gun", "GS Echo Pan", "GS String Slap", "GS Thunder", "GS Horse-Gallop", "GS DoorCreaking", "GS Car-Stop", "GS Screaming", "GS Lasergun", "GS Wind", "GS Bird 2", "GS Door", "GS Car-Pass", "GS Punch", "GS Explosion", "GS Stream", "GS Scratch", "GS Car-Crash", "GS Heart Beat", "GS Bubble", "GS Wind Chimes", "GS Siren", "GS Footsteps", "GS Train", "GS Jetplane", "GS Piano 1", "GS Piano 2", "GS Piano 3", "GS Honky-tonk", "GS Detuned EP 1", "GS Detuned EP 2", "GS Coupled Hps.", "GS Vibraphone", "GS Marimba", "GS Church Bell", "GS Detuned Or.1", "GS Detuned Or.2", "GS Church Org.2", "GS Accordion It", "GS Ukulele", "GS 12-str.Gt", "GS Hawaiian Gt.", "GS Chorus Gt.", "GS Funk Gt.", "GS Feedback Gt.", "GS Gt. Feedback", "GS Synth Bass 3", "GS Synth Bass 4", "GS Slow Violin", "GS Orchestra", "GS Syn.Strings3", "GS Brass 2", "GS Synth Brass3", "GS Synth Brass4", "GS Sine Wave", "GS Doctor Solo", "GS Taisho Koto", "GS Castanets", "GS Concert BD", "GS Melo. Tom 2", "GS 808 Tom", "GS Starship", "GS Carillon", "GS Elec Perc.", "GS Burst Noise", "GS Piano 1d", "GS E.Piano 1v", "GS E.Piano 2v", "GS Harpsichord", "GS 60's Organ 1", "GS Church Org.3", "GS Nylon Gt.o", "GS Mandolin", "GS Funk Gt.2", "GS Rubber Bass", "GS AnalogBrass1", "GS AnalogBrass2", "GS 60's E.Piano", "GS Harpsi.o", "GS Organ 4", "GS Organ 5", "GS Nylon Gt.2", "GS Choir Aahs 2"};
+		strlcpy(name, gs_backup[fauxGM - kFirstFauxGS], size);
+	}
+	else
+		snprintf(name, size, "GS %d", trueGM);
+}
+
+
+/*!
+ * DrumkitForProgram
+ *
+ *	The drum kit a program change on channel 10 selects. The
+ *	MIDI export sends each kit as its number minus one, in the
+ *	low seven bits, so this finds the kit that gives the same
+ *	program. Any other program gets the kit it's a variation
+ *	of, the closest one below it, as a GS module would play.
+ */
+UInt16 FPMidiHelper::DrumkitForProgram(UInt16 program) {
+	UInt16 kit = gs_instruments[0];
+
+	for (int i=0; i<kDefinedDrums; i++) {
+		if (((gs_instruments[i] - 1) & 0x7F) <= (program & 0x7F))
+			kit = gs_instruments[i];
+	}
+
+	return kit;
+}
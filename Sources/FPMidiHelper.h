@@ -21,4 +21,12 @@ public:
 	 */
 	static UInt16 TrueGMToFauxGM(UInt16 trueGM);
 	static void	GroupAndIndexForInstrument(UInt16 inInst, UInt16 &outGroup, UInt16 &outIndex);
+
+	/*! The standard name of an instrument, safe on any thread
+	 */
+	static void	CopyInstrumentName(UInt16 trueGM, char *name, UInt16 size);
+
+	/*! The drum kit a channel 10 program selects
+	 */
+	static UInt16 DrumkitForProgram(UInt16 program);
 };
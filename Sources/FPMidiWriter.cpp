@@ -0,0 +1,354 @@
+/*
+ *  FPMidiWriter.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPMidiWriter.h"
+#include "TByteSink.h"
+#include "TWorkGroup.h"
+
+/*!
+ *	MIDI FILE HELPER MACROS
+ *
+ *	(c)hannel	(n)ote		(v)alue		(l)ength
+ *
+ */
+
+#define midi_Using					int sentOn = 99
+
+#define midi_NoteOn(z,c,n,v,ver)	if (ver || sentOn != (c)) { z.Byte(0x90|(c)); sentOn = c; } \
+									z.Byte(n); z.Byte(v)
+
+#define midi_NoteOff(z,c,n,ver)		if (ver) z.Byte(0x80|(c)); \
+									else if (sentOn != (c)) { z.Byte(0x90|(c)); sentOn = c; } \
+									z.Byte(n); z.Byte(ver ? 0x40 : 0x00)
+
+#define midi_Aftertouch(z,c,n,v)	z.Byte(0xA0|(c)); z.Byte(n); z.Byte(v)
+#define midi_ControlChange(z,c,k,v)	z.Byte(0xB0|(c)); z.Byte(k); z.Byte(v)
+#define midi_Program(z,c,p)			z.Byte(0xC0|(c)); z.Byte(p)
+
+#define midi_AllNotesOff(z,c)		midi_ControlChange(z, c, 123, 0)
+
+#define midi_BankSelect(z,c,n);		midi_ControlChange(z, c, 0x00, (n) >> 8); \
+									midi_NullDelay(z); \
+									midi_ControlChange(z, c, 0x20, (n) & 0xFF)
+
+#define midi_MetaEvent(z,e,l)		z.Byte(0xFF); z.Byte(e); z.Byte(l)
+
+#define midi_EndMarker(z)			midi_MetaEvent(z, 0x2F, 0); sentOn = 99
+
+#define midi_Tempo(z,t)				midi_MetaEvent(z, 0x51, 3); z.TrioBE(t)
+
+#define midi_SMPTE60(z)				midi_MetaEvent(z, 0x54, 5); \
+									z.Byte(0x60); \
+									z.LongBE(0x00000000)
+
+#define midi_TimeSig(z,a,b,t,q)		midi_MetaEvent(z, 0x58, 4); \
+									z.Byte(a); \
+									z.Byte(b); \
+									z.Byte(t); \
+									z.Byte(q)
+
+#define midi_NullDelay(z)			midi_Delay(z, 0)
+
+#define midi_HeadTag(z)				z.LongBE('MThd')
+
+#define midi_TrackTag(z)			z.LongBE('MTrk')
+
+#define midi_Header(z,f,t,q)		midi_HeadTag(z); \
+									z.LongBE(6); \
+									z.WordBE(f); \
+									z.WordBE(t); \
+									z.WordBE(q)
+
+
+/*!
+ *	midi_Delay
+ */
+static void midi_Delay(TByteSink &sink, long delay) {
+	char	b[4];
+	int i;
+	for (i=4; i--;) {
+		b[i] = (delay & 0x7F) | ((i < 3) ? 0x80 : 0x00);
+		if (!(delay >>= 7)) break;
+	}
+	while (i < 4) sink.Byte(b[i++]);
+}
+
+
+/*!
+ *	midi_Text
+ */
+enum {
+	kMidiTextGeneric = 1,
+	kMidiTextCopyright,
+	kMidiTextTrack,
+	kMidiTextInstrument,
+	kMidiTextLyric,
+	kMidiTextMarker,
+	kMidiTextCue
+};
+static void midi_Text(TByteSink &sink, char event, const char *someText) {
+	size_t len = MIN(strlen(someText), 127);
+
+	sink.Byte(0xFF);
+	sink.Byte(event);
+	sink.Byte(len);
+	sink.Bytes(someText, len);
+}
+
+
+FPMidiWriter::FPMidiWriter(const FPNoteData &inNotes, UInt32 inMsPer4th, bool inVerbose) : notes(inNotes) {
+	msPer4th	= inMsPer4th;
+	verbose		= inVerbose;
+	trackSink	= NULL;
+
+	// Notes still sounding after the last beat are cut off here
+	finalTick	= notes.TotalSteps() * TICKS_PER_16TH + TICKS_PER_16TH - 1 + 50;
+
+	for (PartIndex p=DOC_PARTS; p--;)
+		SetPart(p, "", kFirstGMInstrument, 0, 0);
+}
+
+
+/*!
+ * SetPart
+ *
+ *	Give a part its name, instrument, velocity and sustain.
+ *	The instrument is a QuickTime instrument number, and the
+ *	sustain is in sixtieths of a second, like the document's.
+ *	Drum kits go on channel 10.
+ */
+void FPMidiWriter::SetPart(PartIndex p, const char *name, UInt16 trueGM, UInt16 velocity, UInt16 sustainJiffies) {
+	FPMidiPart &mp = part[p];
+
+	strncpy(mp.name, name, kMidiNameSize - 1);
+	mp.name[kMidiNameSize - 1] = '\0';
+
+	bool drum = (trueGM >= kFirstDrumkit && trueGM <= kLastDrumkit);
+	mp.channel = drum ? 9 : p;
+	mp.program = (trueGM - 1) & 0x7F;
+
+	mp.bank = 0;
+	if (drum)
+		mp.bank = 1;
+	else if (trueGM >= kFirstGSInstrument-1 && trueGM <= kLastGSInstrument-1)
+		mp.bank = (trueGM >> 7) << 8;
+
+	mp.velocity = velocity;
+
+	//
+	// Converting jiffies (60ths/sec) into ticks (240ths/beat)
+	//
+	// Quarternotes per second = 1,000,000 / msPer4th (reciprocal of s/q = q/s)
+	// Ticks per second = TICKS_PER_4TH * Quarternotes per second (t/q * q/s = tq/qs = t/s)
+	// Ticks in Jiffies = TPS * Jiffies / 60 (t/s * s = t)
+	//
+	mp.sustainTicks = (MICROSECOND * sustainJiffies / 60.0) * TICKS_PER_4TH / msPer4th;
+}
+
+
+/*!
+ * WriteFormat0
+ *
+ *	Write a Standard MIDI datastream with all
+ *	channels combined into a single track.
+ */
+OSErr FPMidiWriter::WriteFormat0(TByteSink &w) {
+	PartIndex p;
+
+	midi_Using;
+
+	// Insert the standard MIDI Header
+	midi_Header(w, 0, 1, TICKS_PER_4TH);	// Format 0, 1 Track...		(TODO: Try E728 for millisecond timing)
+
+	// Begin the single Track
+	midi_TrackTag(w);
+	UInt32 sizeIndex = w.Position();
+	w.LongBE(0);
+	UInt32 trackStartIndex = w.Position();
+	midi_NullDelay(w);
+
+	// Give credit to FretPet
+	midi_Text(w, kMidiTextCopyright, "Created with FretPet X " FRETPET_VERSION);
+	midi_NullDelay(w);
+
+	//
+	// Set the tempo and Time Signature
+	//
+	midi_Tempo(w, msPer4th);		// Microsecond duration of each Quarter Note
+	midi_NullDelay(w);
+	midi_TimeSig(w, 4, 2, 24, 8);	// 4/2, 24 ticks in metronome, 8 32nd notes per 1/4
+
+	// Format 0 contains all program changes up front
+	for (p=0; p<DOC_PARTS; p++) {
+		midi_NullDelay(w);
+		midi_BankSelect(w, part[p].channel, part[p].bank);
+		midi_NullDelay(w);
+		midi_Program(w, part[p].channel, part[p].program);
+	}
+
+	UInt32 sustainTicks[DOC_PARTS];
+	for (p=0; p<DOC_PARTS; p++)
+		sustainTicks[p] = part[p].sustainTicks;
+
+	FPTimeline timeline;
+	notes.Timeline(timeline, TICKS_PER_16TH, sustainTicks);
+
+	// Write out the events of all parts in order
+	UInt32 lastEvent = 0;
+	for (UInt32 i=0; i<timeline.size(); i++) {
+		const FPTimedEvent &e = timeline[i];
+		UInt32 tick = MIN(e.time, finalTick);
+
+		midi_Delay(w, tick - lastEvent);
+		lastEvent = tick;
+
+		if (e.on) {
+			midi_NoteOn(w, part[e.part].channel, e.tone, part[e.part].velocity, verbose);
+		}
+		else {
+			midi_NoteOff(w, part[e.part].channel, e.tone, verbose);
+		}
+	}
+
+	// Mark the end of the track
+	midi_Delay(w, finalTick - lastEvent);
+	midi_EndMarker(w);
+
+	// Set the track size in its header
+	w.PatchLongBE(sizeIndex, w.Position() - trackStartIndex);
+
+	return w.Error();
+}
+
+
+/*!
+ * WriteFormat1
+ *
+ *	Write a Standard MIDI datastream with a
+ *	separate track for each channel.
+ */
+OSErr FPMidiWriter::WriteFormat1(TByteSink &w, UInt16 maxThreads) {
+	midi_Using;
+
+	// Insert the standard MIDI Header
+	midi_Header(w, 1, DOC_PARTS + 1, TICKS_PER_4TH);
+
+	// Insert an Initializer Track
+	midi_TrackTag(w);
+	UInt32 lenIndex = w.Position();
+	w.LongBE(0);
+	UInt32 trackStartAddr = w.Position();
+	midi_NullDelay(w);
+
+	// Give FretPet credit
+	midi_Text(w, kMidiTextCopyright, "Created with FretPet X " FRETPET_VERSION);
+	midi_NullDelay(w);
+
+	// Tempo Value
+	midi_Tempo(w, msPer4th);
+	midi_NullDelay(w);
+
+	// Time Signature : 4/2, 24 ticks in metronome, 8 32nds per 1/4
+	midi_TimeSig(w, 4, 2, 24, 8);
+	midi_NullDelay(w);
+
+	// End Marker
+	midi_EndMarker(w);
+
+	// Store the track length
+	w.PatchLongBE(lenIndex, w.Position() - trackStartAddr);
+
+	// Each part gets its own track, all written at once
+	TByteSink sink[DOC_PARTS];
+	trackSink = sink;
+
+	TWorkGroup group(TrackJob, this);
+	group.Run(DOC_PARTS, maxThreads);
+
+	trackSink = NULL;
+
+	// The tracks follow in part order
+	for (PartIndex p=0; p<DOC_PARTS; p++)
+		w.Append(sink[p]);
+
+	return w.Error();
+}
+
+
+//
+// TrackJob
+//
+//	Worker entry point for one part's track
+//
+void FPMidiWriter::TrackJob(void *context, UInt32 index) {
+	FPMidiWriter *self = (FPMidiWriter*)context;
+	self->WriteTrack(index, self->trackSink[index]);
+}
+
+
+//
+// WriteTrack
+//
+//	Write one part's complete track chunk into its own
+//	buffer. A job only reads the notes and its own part,
+//	so all the parts can be written at once.
+//
+void FPMidiWriter::WriteTrack(PartIndex p, TByteSink &w) const {
+	const FPMidiPart &mp = part[p];
+
+	midi_Using;
+
+	// Uninitialized Track Header
+	midi_TrackTag(w);
+	UInt32 sizeIndex = w.Position();
+	w.LongBE(0);
+	UInt32 trackStartIndex = w.Position();
+	midi_NullDelay(w);
+
+	// Instrument Name
+	midi_Text(w, kMidiTextTrack, mp.name);
+	midi_NullDelay(w);
+
+	// Instrument Number
+	midi_BankSelect(w, mp.channel, mp.bank);
+	midi_NullDelay(w);
+	midi_Program(w, mp.channel, mp.program);
+
+	// Sustain for this part only
+	UInt32 sustainTicks[DOC_PARTS];
+	bzero(sustainTicks, sizeof(sustainTicks));
+	sustainTicks[p] = mp.sustainTicks;
+
+	FPTimeline timeline;
+	notes.Timeline(timeline, TICKS_PER_16TH, sustainTicks, BIT(p));
+
+	UInt32 lastEvent = 0;
+	for (UInt32 i=0; i<timeline.size(); i++) {
+		const FPTimedEvent &e = timeline[i];
+		UInt32 tick = MIN(e.time, finalTick);
+
+		midi_Delay(w, tick - lastEvent);
+		lastEvent = tick;
+
+		if (e.on) {
+			midi_NoteOn(w, mp.channel, e.tone, mp.velocity, verbose);
+		}
+		else {
+			midi_NoteOff(w, mp.channel, e.tone, verbose);
+		}
+	}
+
+	// Mark the end of each track
+	midi_Delay(w, finalTick - lastEvent);
+	midi_NoteOff(w, mp.channel, LOWEST_C, verbose);
+	midi_NullDelay(w);
+	midi_EndMarker(w);
+
+	// Set the track size in its header
+	w.PatchLongBE(sizeIndex, w.Position() - trackStartIndex);
+}
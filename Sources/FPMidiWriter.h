@@ -0,0 +1,76 @@
+/*!
+ *	@file FPMidiWriter.h
+ *
+ *	@brief Writes compiled notes as a Standard MIDI File
+ *
+ *	The MIDI writer turns note data into a Format 0 file, with
+ *	every part in one track, or a Format 1 file, with a track
+ *	for each part after a track for the tempo. The tracks of a
+ *	Format 1 file are written at once on a work group, each
+ *	into its own sink, and then appended in part order.
+ *
+ *	The writer only knows the notes and what the caller tells
+ *	it about each part, so it builds without Carbon. The tests
+ *	in Tests/Makefile write long documents with it.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPMIDIWRITER_H
+#define FPMIDIWRITER_H
+
+#include "FPNoteData.h"
+
+class TByteSink;
+
+#define TICKS_PER_16TH		60
+#define TICKS_PER_4TH		(TICKS_PER_16TH * 4)
+
+#define kMidiNameSize		128			//!< The longest track name kept
+
+/*!
+ *	What the file says about each part
+ */
+typedef struct {
+	char		name[kMidiNameSize];		//!< The instrument name
+	UInt16		channel;					//!< The MIDI channel
+	UInt16		bank;						//!< The bank to select
+	UInt16		program;					//!< The program number
+	UInt16		velocity;					//!< The part's velocity
+	UInt32		sustainTicks;				//!< Note length in ticks
+} FPMidiPart;
+
+
+#pragma mark -
+//-----------------------------------------------
+//
+// FPMidiWriter
+//
+class FPMidiWriter {
+	private:
+		const FPNoteData	&notes;					//!< The notes to write
+		UInt32				msPer4th;				//!< Microseconds per quarter note
+		UInt32				finalTick;				//!< Where all tracks end
+		bool				verbose;				//!< No running status
+		FPMidiPart			part[DOC_PARTS];		//!< The parts
+		TByteSink			*trackSink;				//!< Each part's track while writing Format 1
+
+	public:
+		FPMidiWriter(const FPNoteData &inNotes, UInt32 inMsPer4th, bool inVerbose);
+		~FPMidiWriter() {}
+
+		void				SetPart(PartIndex p, const char *name, UInt16 trueGM, UInt16 velocity, UInt16 sustainJiffies);
+		OSErr				WriteFormat0(TByteSink &w);
+		OSErr				WriteFormat1(TByteSink &w, UInt16 maxThreads=0);
+
+	private:
+		void				WriteTrack(PartIndex p, TByteSink &w) const;
+
+		static void			TrackJob(void *context, UInt32 index);
+};
+
+#endif
@@ -55,6 +55,8 @@
 #include "TMidiOutput.h"
 #include "TError.h"
 
+#include <algorithm>
+
 
 #define	LOWEST_C		36
 #define SUSTAIN_FACTOR	(MICROSECOND/60)
@@ -66,6 +68,17 @@
 
 #define kPrefSplitOutputs	CFSTR("splitOutputs")
 
+//
+// ToneIsLater
+//
+//	Orders the tone queue so the heap's top is the
+//	earliest tone, and the first added of equal tones
+//
+static bool ToneIsLater(const QueueTone &a, const QueueTone &b) {
+	int compare = U64Compare(a.when, b.when);
+	return compare ? compare > 0 : (SInt32)(a.order - b.order) > 0;
+}
+
 /*!
  *  FPMusicPlayer				* CONSTRUCTOR *
  */
@@ -87,10 +100,20 @@ FPMusicPlayer::FPMusicPlayer() {
 	playFlag		= false;
 	playFirst		= 0;
 	playLast		= -1;
-	stringToPlay	= 0;
 	beatToPlay		= 0;
 	chordToPlay		= 0;
 	repeatToPlay	= 0;
+	scheduleHead	= 0;
+	scheduleCount	= 0;
+	noteToPlay		= 0;
+	beatStarted		= false;
+	editPending		= false;
+	editFirst		= 0;
+	editLast		= -1;
+	toneOrder		= 0;
+	
+	pthread_mutex_init(&toneMutex, NULL);
+	pthread_mutex_init(&scheduleMutex, NULL);
 	
 	prevBeat		= 0;
 	abortPlay		= false;
@@ -145,6 +168,8 @@ FPMusicPlayer::~FPMusicPlayer() {
 	DisposeAUSynth();
 #endif
 	
+	pthread_mutex_destroy(&toneMutex);
+	pthread_mutex_destroy(&scheduleMutex);
 }
 
 /*!
@@ -526,24 +551,31 @@ void FPMusicPlayer::PlayerTimerCallback(CFRunLoopTimerRef timer, void *info) {
  */
 void FPMusicPlayer::DoPlayerTimer() {
 	UInt64			playTime = Micro64();
-	QueueTone		tone;
+	QueueTone		due[kToneBatch];
+	UInt16			dueCount = 0;
 	
 	FinishSustainingNotes();
 	
-	if (ToneQueue.size()) {
-		for (ToneIterator itr = ToneQueue.begin(); itr != ToneQueue.end();) {
-			tone = (*itr);
-			if (U64Compare(tone.when, playTime) <= 0) {
-				PlayNote(tone.part, tone.note);
-				
-				if (tone.string < 100)
-					guitarPalette->TwinkleTone(tone.string, tone.fret);
-				
-				itr = ToneQueue.erase(itr);
-			}
-			else
-				itr++;
+	//
+	// Take the tones that are due off the top of the heap.
+	// Tones are queued from the main thread, so if it has
+	// the lock just try again next tick.
+	//
+	if (pthread_mutex_trylock(&toneMutex) == 0) {
+		while (dueCount < kToneBatch && !ToneQueue.empty() && U64Compare(ToneQueue.front().when, playTime) <= 0) {
+			due[dueCount++] = ToneQueue.front();
+			std::pop_heap(ToneQueue.begin(), ToneQueue.end(), ToneIsLater);
+			ToneQueue.pop_back();
 		}
+		pthread_mutex_unlock(&toneMutex);
+	}
+	
+	for (UInt16 i=0; i<dueCount; i++) {
+		QueueTone &tone = due[i];
+		PlayNote(tone.part, tone.note);
+		
+		if (tone.string < 100)
+			guitarPalette->TwinkleTone(tone.string, tone.fret);
 	}
 	
 	
@@ -553,98 +585,295 @@ void FPMusicPlayer::DoPlayerTimer() {
 	if (abortPlay || !playFlag /*|| playDoc == NULL*/)
 		return;
 	
-	bool bPlayedOne = false;
-	
-	ChordIndex total = playDoc->Size();
-	if (total == 0) {
+	if (playDoc->Size() == 0) {
 		abortPlay = true;
 		return;
 	}
 	
-	SInt16		fret, i, last;
-	UInt16		beats;
-	
 	//
-	// Sanity check the chord number
-	//	to prevent memory faults
+	// Start the next beat when it's due, then play the
+	//	notes that are due. Between beats this is all
+	//	the player does.
 	//
-	if (chordToPlay >= total)
-		chordToPlay = playFirst;
+	if (U64Compare(beatStarted ? U64Add(playingBeat.when, playingBeat.interim) : lastTime, playTime) <= 0) {
+		StartNextBeat(playTime);
+		
+		if (abortPlay)
+			return;
+	}
 	
-	//
-	// If beats changed prior to the player
-	//	wrap it around
-	FPChordGroup	&group = playDoc->ChordGroup(chordToPlay);
-	beats = group.PatternSize();
-	if (beatToPlay >= beats) {
-		beatToPlay %= 4;
-		if (beatToPlay >= beats)
-			beatToPlay = 0;
+	while (noteToPlay < playingBeat.noteCount && U64Compare(U64Add(playingBeat.when, U64SetU(playingBeat.note[noteToPlay].offset)), playTime) <= 0)
+		PlayScheduledNote(playingBeat.note[noteToPlay++]);
+}
+
+
+/*!
+ * StartNextBeat
+ *
+ *	Make the next beat in the schedule the one being
+ *	heard, then compile one more beat ahead to replace it.
+ *	Beats that edits or moves have made stale are dropped
+ *	first and compiled again.
+ *
+ *	Beats are timed from the one before, so they stay on
+ *	the beat. If a whole beat was missed, as when the
+ *	timer stalls, the beat starts now instead, and the
+ *	schedule moves with it. The beats that were missed
+ *	are skipped, not played all at once.
+ */
+void FPMusicPlayer::StartNextBeat(UInt64 playTime) {
+	// The rest of the beat being heard is due by now
+	while (noteToPlay < playingBeat.noteCount)
+		PlayScheduledNote(playingBeat.note[noteToPlay++]);
+	
+	CheckSchedule();
+	
+	if (scheduleCount == 0)
+		FillSchedule();
+	
+	playingBeat		= schedule[scheduleHead];
+	scheduleHead	= (scheduleHead + 1) % kScheduleBeats;
+	scheduleCount--;
+	
+	beatStarted	= true;
+	noteToPlay	= 0;
+	
+	if (playingBeat.end) {
+		abortPlay = true;
+		return;
 	}
 	
-	//
-	// Play either one or all available notes
-	//
-	while (!bPlayedOne && stringToPlay <= 5) {
-		i = stringToPlay++;
+	if (U64Compare(U64Add(playingBeat.when, playingBeat.interim), playTime) <= 0) {
+		UInt64 late = U64Subtract(playTime, playingBeat.when);
 		
-		for (PartIndex p=0; p<DOC_PARTS; p++) {
-			FPChord &chord = group[p];
-			
-			if (!fretpet->IsSoloModeEnabled() || p == recentPart) {
-				if (chord.GetPatternDot(i, beatToPlay)) {
-					if ((fret = chord.fretHeld[i]) >= 0) {
-						if (p == recentPart)
-							guitarPalette->TwinkleTone(i, fret);
-						
-						PlayNote(p, guitarPalette->Tone(i, fret));
-						if (playDoc->TempoMultiplier() == 1)
-							bPlayedOne = true;
-					}
-				}
-			}
+		playingBeat.when = playTime;
+		for (UInt16 i=0; i<scheduleCount; i++) {
+			ScheduledBeat &b = schedule[(scheduleHead + i) % kScheduleBeats];
+			b.when = U64Add(b.when, late);
 		}
 	}
 	
-	//
-	// If enough time has elapsed then set up for the next note
-	//
+	chordToPlay		= playingBeat.chord;
+	beatToPlay		= playingBeat.beat;
+	repeatToPlay	= playingBeat.repeat;
+	lastTime		= playingBeat.when;
+	playInterim		= playingBeat.interim;
 	
-	if (U64Compare(playTime, U64Add(lastTime, playInterim)) >= 0) {		// if ((pt - lt) >= pi)...  if (pt >= pi + lt)))
-		lastTime = U64Add(lastTime, playInterim);
+	FillSchedule();
+}
+
+
+#define edited(c)	((c) >= first && (last < 0 || (c) <= last))
+
+/*!
+ * CheckSchedule
+ *
+ *	Drop the beats compiled ahead that no longer match
+ *	the document. Edited lines drop the schedule from the
+ *	first beat they play, since the beats after it follow
+ *	from it. A move of the beat being heard, or a change
+ *	to the tempo, play range, solo part or the length of
+ *	the document, drops all of it.
+ *
+ *	Lines are edited on the main thread. If it has the
+ *	lock, the edit can't be read, so the whole schedule
+ *	is dropped to be safe.
+ */
+void FPMusicPlayer::CheckSchedule() {
+	ScheduleKey key;
+	GetScheduleKey(key);
+	
+	if (memcmp(&key, &scheduleKey, sizeof(key)) != 0) {
+		memcpy(&scheduleKey, &key, sizeof(key));		// with its padding
+		scheduleCount = 0;
+	}
+	
+	if (beatStarted && (chordToPlay != playingBeat.chord || beatToPlay != playingBeat.beat || repeatToPlay != playingBeat.repeat)) {
+		playingBeat.chord	= chordToPlay;
+		playingBeat.beat	= beatToPlay;
+		playingBeat.repeat	= repeatToPlay;
+		scheduleCount = 0;
+	}
+	
+	ChordIndex first = 0, last = -1;
+	bool pending = true;
+	
+	if (pthread_mutex_trylock(&scheduleMutex) == 0) {
+		pending		= editPending;
+		first		= editFirst;
+		last		= editLast;
+		editPending	= false;
+		pthread_mutex_unlock(&scheduleMutex);
+	}
+	
+	if (!pending)
+		return;
+	
+	// The beats after the one being heard follow from its line
+	if (beatStarted && edited(playingBeat.chord)) {
+		scheduleCount = 0;
+		return;
+	}
+	
+	for (UInt16 i=0; i<scheduleCount; i++)
+		if (edited(schedule[(scheduleHead + i) % kScheduleBeats].chord)) {
+			scheduleCount = i;
+			break;
+		}
+}
+
+
+/*!
+ * FillSchedule
+ *
+ *	Compile beats ahead until the schedule is full
+ *	or playing stops
+ */
+void FPMusicPlayer::FillSchedule() {
+	if (scheduleCount == 0)
+		GetScheduleKey(scheduleKey);
+	
+	while (scheduleCount < kScheduleBeats) {
+		const ScheduledBeat *prev = NULL;
 		
-		stringToPlay = 0;
+		if (scheduleCount)
+			prev = &schedule[(scheduleHead + scheduleCount - 1) % kScheduleBeats];
+		else if (beatStarted)
+			prev = &playingBeat;
 		
-		if (++beatToPlay >= group.PatternSize()) {
-			beatToPlay = 0;
-			if (playDoc->Interim() != playInterim)
-				playInterim = playDoc->Interim();
+		if (prev && prev->end)
+			break;
+		
+		CompileBeat(prev, schedule[(scheduleHead + scheduleCount) % kScheduleBeats]);
+		scheduleCount++;
+	}
+}
+
+
+/*!
+ * GetScheduleKey
+ *
+ *	Get the settings that beats are compiled with
+ */
+void FPMusicPlayer::GetScheduleKey(ScheduleKey &key) {
+	bzero(&key, sizeof(key));
+	
+	key.doc		= playDoc;
+	key.size	= playDoc->Size();
+	key.interim	= playDoc->Interim();
+	key.tempoX	= playDoc->TempoMultiplier();
+	key.first	= playFirst;
+	key.last	= playLast;
+	key.loop	= fretpet->IsLoopingEnabled();
+	key.hear	= justHearFlag;
+	key.solo	= fretpet->IsSoloModeEnabled() ? recentPart : -1;
+}
+
+
+/*!
+ * CompileBeat
+ *
+ *	Compile the beat that follows another, or the first
+ *	beat to play. A new pass through a line picks up the
+ *	tempo. The notes of each string come a little after
+ *	the string before, unless the tempo is doubled.
+ *
+ *	The notes come from the group's block in the player's
+ *	own note list, the same notes the exporters play. The
+ *	player also sounds the notes flagged with the bracket
+ *	off. Its list is kept apart from the document's, since
+ *	it's compiled one group at a time on the timer thread.
+ */
+void FPMusicPlayer::CompileBeat(const ScheduledBeat *prev, ScheduledBeat &b) {
+	ChordIndex total = playDoc->Size();
+	
+	b.end		= false;
+	b.noteCount	= 0;
+	
+	if (prev == NULL || prev->chord >= total) {
+		b.when		= prev ? U64Add(prev->when, prev->interim) : lastTime;
+		b.interim	= playDoc->Interim();
+		b.chord		= playFirst;
+		b.beat		= 0;
+		b.repeat	= 1;
+	}
+	else {
+		b.when		= U64Add(prev->when, prev->interim);
+		b.interim	= prev->interim;
+		b.chord		= prev->chord;
+		b.beat		= prev->beat + 1;
+		b.repeat	= prev->repeat;
+		
+		const FPChordGroup &group = playDoc->ChordGroup(b.chord);
+		
+		if (b.beat >= group.PatternSize()) {
+			b.beat = 0;
+			b.interim = playDoc->Interim();
 			
 			if (justHearFlag) {
-				abortPlay = true;
+				b.end = true;
 				return;
 			}
 			
-			if (++repeatToPlay > group.Repeat()) {
-				repeatToPlay = 1;
+			if (++b.repeat > group.Repeat()) {
+				b.repeat = 1;
 				
-				last = playLast;					// when last<0 it means play to the end
+				ChordIndex last = playLast;			// when last<0 it means play to the end
 				if (last < 0 || last >= total)
 					last = total - 1;
 				
-				UInt16 ch = chordToPlay + 1;
+				ChordIndex ch = b.chord + 1;
 				if (ch >= total || ch > last || ch < playFirst) {
 					ch = playFirst;
 					if (!fretpet->IsLoopingEnabled() || ch >= total) {
-						abortPlay = true;
+						b.end = true;
 						return;
 					}
 				}
 				
-				chordToPlay = ch;
+				b.chord = ch;
 			}
 		}
 	}
+	
+	if (b.chord >= total) {
+		b.end = true;
+		return;
+	}
+	
+	const FPNoteBlock	&block = playNotes.Block(playDoc->ChordGroup(b.chord), playDoc->Tuning().tone);
+	UInt16				first = block.beatNote[b.beat], last = block.beatNote[b.beat + 1];
+	bool				arpeggiate = (playDoc->TempoMultiplier() == 1);
+	UInt32				offset = 0;
+	
+	// The block lists a beat's notes by part, but they're heard by string
+	for (UInt16 i=0; i<NUM_STRINGS; i++) {
+		bool played = false;
+		
+		for (UInt16 n=first; n<last; n++) {
+			const FPBlockNote &bn = block.notes[n];
+			
+			if (bn.string == i && (!fretpet->IsSoloModeEnabled() || bn.part == recentPart)) {
+				ScheduledNote note = { offset, bn.part, bn.string, bn.fret, bn.tone };
+				b.note[b.noteCount++] = note;
+				played = true;
+			}
+		}
+		
+		if (played && arpeggiate)
+			offset += TIMER_DELAY * 1000;
+	}
+}
+
+
+/*!
+ * PlayScheduledNote
+ */
+void FPMusicPlayer::PlayScheduledNote(const ScheduledNote &note) {
+	if (note.part == recentPart)
+		guitarPalette->TwinkleTone(note.string, note.fret);
+	
+	PlayNote(note.part, note.tone - LOWEST_C);
 }
 
 #pragma mark -
@@ -707,8 +936,13 @@ void FPMusicPlayer::DoAnimationTimer() {
  *	AddNoteToQueue
  */
 void FPMusicPlayer::AddNoteToQueue(UInt16 tone, UInt64 when, UInt16 string, UInt16 fret) {
-	QueueTone newTone = { when, recentPart, tone, string, fret };
+	pthread_mutex_lock(&toneMutex);
+	
+	QueueTone newTone = { when, toneOrder++, recentPart, tone, string, fret };
 	ToneQueue.push_back(newTone);
+	std::push_heap(ToneQueue.begin(), ToneQueue.end(), ToneIsLater);
+	
+	pthread_mutex_unlock(&toneMutex);
 }
 
 
@@ -836,34 +1070,14 @@ void FPMusicPlayer::PlayNote(PartIndex part, UInt16 tone, bool novisual) {
  *	FinishSustainingNotes
  */
 void FPMusicPlayer::FinishSustainingNotes() {
-	static int		part, channel;
-	static Byte stoplist[NUM_OCTAVES * OCTAVE];
-	
-	// Do a single part each pass instead of all 4
-	// This means a 1/250th second delay will occur
-	// between supposedly synched-up cutoffs. I hope
-	// no one notices.
-	part = ((part + 1) % TOTAL_PARTS);
-	channel = ((channel + 1) % TOTAL_CHANNELS);
-	
-	// A list to keep track of stopped notes
-	bzero(stoplist, sizeof(stoplist));
+	Byte	stopped[kStopBatch];
 	
-	// Stop notes in MIDI world
-	MidiOutForPart(part)->StopExpiredNotes(stoplist);
-	
-#if QUICKTIME_SUPPORT
-	// Stop QuickTime notes
-	CH[part].quickTimeOutput->StopExpiredNotes(stoplist);
-#else
-	// Stop Audio Device notes
-	CH[part].synthOutput->StopExpiredNotes(stoplist);
-#endif
+	// Every output shares one heap of note ends, so all
+	// parts stop together and only due notes are touched
+	UInt16	count = TMusicOutput::StopExpiredNotes(stopped, kStopBatch);
 	
-	for (int tone = 0; tone < NUM_OCTAVES * OCTAVE; tone++) {
-		if (stoplist[tone])
-			fretpet->SetPianoKeyPlaying(tone-LOWEST_C, false);
-	}
+	for (UInt16 i=0; i<count; i++)
+		fretpet->SetPianoKeyPlaying(stopped[i]-LOWEST_C, false);
 	
 }
 
@@ -985,9 +1199,21 @@ void FPMusicPlayer::PlayDocument() {
 	repeatToPlay	= 1;
 	beatToPlay		= 0;
 	prevBeat		= -1;
-	stringToPlay	= 0;
 	abortPlay		= false;
 	
+	scheduleHead	= 0;
+	scheduleCount	= 0;
+	playingBeat.noteCount = 0;
+	noteToPlay		= 0;
+	beatStarted		= false;
+	
+	pthread_mutex_lock(&scheduleMutex);
+	editPending		= false;
+	pthread_mutex_unlock(&scheduleMutex);
+	
+	// Blocks of groups heard before are stale by now
+	playNotes.Invalidate();
+	
 	lastTime = Micro64();
 	
 	//
@@ -1001,6 +1227,37 @@ void FPMusicPlayer::PlayDocument() {
 }
 
 
+/*!
+ *	InvalidateLines
+ *
+ *	Tell the player that lines of a document were edited,
+ *	from start to end, or to the end of the document if
+ *	end is negative. If the document is playing, the beats
+ *	compiled ahead from those lines are dropped before the
+ *	next beat, and compiled again.
+ */
+void FPMusicPlayer::InvalidateLines(FPDocument *doc, ChordIndex start, ChordIndex end) {
+	if (!playFlag || doc != playDoc)
+		return;
+	
+	if (start < 0)
+		start = 0;
+	
+	pthread_mutex_lock(&scheduleMutex);
+	
+	if (editPending) {
+		end = (end < 0 || editLast < 0) ? -1 : MAX(end, editLast);
+		start = MIN(start, editFirst);
+	}
+	
+	editFirst	= start;
+	editLast	= end;
+	editPending	= true;
+	
+	pthread_mutex_unlock(&scheduleMutex);
+}
+
+
 /*!
  *	GetRangeToPlay
  */
@@ -1044,7 +1301,9 @@ void FPMusicPlayer::SetPlayRangeFromSelection() {
  *	Stop
  */
 void FPMusicPlayer::Stop() {
+	pthread_mutex_lock(&toneMutex);
 	ToneQueue.clear();
+	pthread_mutex_unlock(&toneMutex);
 	
 	playFlag		= false;
 	justHearFlag	= false;
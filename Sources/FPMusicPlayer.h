@@ -19,6 +19,7 @@
 #include <QuickTime/QuickTimeMusic.h>
 
 #include "FPChord.h"
+#include "FPNoteList.h"
 #include "FPApplication.h"
 
 #include "TQTOutput.h"
@@ -33,18 +34,73 @@ class FPDocWindow;
 
 //
 // QueueTone
+//	A tone waiting in the tone queue. The queue is a heap
+//	ordered by time, and tones added for the same time
+//	play in the order they were added.
 //
 typedef struct {
 	UInt64			when;
+	UInt32			order;						// Tiebreak for tones at the same time
 	PartIndex		part;
 	UInt16			note;
 	UInt16			string;
 	UInt16			fret;
 } QueueTone;
 
-#include <deque>
-typedef std::deque<QueueTone>	ToneList;
-typedef ToneList::iterator		ToneIterator;
+#include <vector>
+#include <pthread.h>
+typedef std::vector<QueueTone>	ToneList;
+
+#define kToneBatch		32						// The most queued tones played in one tick
+#define kStopBatch		64						// The most notes stopped in one tick
+
+
+#define kScheduleBeats	16						// Beats compiled ahead of the player
+#define kScheduleNotes	(DOC_PARTS * NUM_STRINGS)	// The most notes in a beat
+
+//
+// ScheduledNote
+//	A note in a compiled beat
+//
+typedef struct {
+	UInt32			offset;						// Microseconds after the beat starts
+	UInt8			part;
+	UInt8			string;
+	SInt8			fret;
+	UInt8			tone;						// The MIDI note number
+} ScheduledNote;
+
+//
+// ScheduledBeat
+//	One beat of the document, compiled ahead
+//	of time with the notes it plays
+//
+typedef struct {
+	UInt64			when;						// When the beat starts
+	UInt64			interim;					// Time until the next beat
+	ChordIndex		chord;						// The line
+	UInt16			beat;						// The step in its pattern
+	UInt16			repeat;						// The pass through the line
+	bool			end;						// Playing stops here instead
+	UInt16			noteCount;					// Notes in the beat
+	ScheduledNote	note[kScheduleNotes];		// The notes, in time order
+} ScheduledBeat;
+
+//
+// ScheduleKey
+//	The settings the beats were compiled with,
+//	besides the lines. Any change drops them all.
+//
+typedef struct {
+	FPDocument		*doc;						// The document
+	ChordIndex		size;						// Its length
+	UInt64			interim;					// Its tempo
+	UInt16			tempoX;						// Its tempo multiplier
+	ChordIndex		first, last;				// The play range
+	bool			loop;						// Looping
+	bool			hear;						// Just hearing one line
+	PartIndex		solo;						// The part heard alone, or -1
+} ScheduleKey;
 
 
 //
@@ -87,7 +143,9 @@ typedef struct	{
 #pragma mark -
 class FPMusicPlayer {
 private:
-	ToneList		ToneQueue;				//!< Tone Queue - notes played outside a document
+	ToneList		ToneQueue;				//!< Tone Queue - notes played outside a document, as a heap
+	pthread_mutex_t	toneMutex;				//!< Guards the tone queue between threads
+	UInt32			toneOrder;				//!< Order stamp for the next queued tone
 
 #ifdef USE_DEPRECATED_TIMER
 	FPPlayerExtTask		playerTask;			//!< Time Manager Task for the player
@@ -126,7 +184,6 @@ private:
 	bool			playFlag;				//!< playing the sequence?
 	ChordIndex		playFirst;				//!< first chord in to play
 	ChordIndex		playLast;				//!< last chord to play
-	UInt16			stringToPlay;			//!< tones are subtly arpeggiated
 	UInt16			beatToPlay;				//!< the beat to play
 	ChordIndex		chordToPlay;			//!< the chord we hear
 	UInt16			repeatToPlay;			//!< the count of repeats
@@ -139,6 +196,21 @@ private:
 	UInt64			lastTime;				//!< document player timing
 	UInt64			playInterim;			//!< interim
 
+	//
+	// Play Schedule
+	//
+	ScheduledBeat	schedule[kScheduleBeats];	//!< The beats after this one, compiled ahead
+	UInt16			scheduleHead;			//!< the next beat in the ring
+	UInt16			scheduleCount;			//!< beats compiled ahead
+	ScheduleKey		scheduleKey;			//!< the settings they were compiled with
+	pthread_mutex_t	scheduleMutex;			//!< Guards the edited lines between threads
+	bool			editPending;			//!< lines were edited since the last beat
+	ChordIndex		editFirst, editLast;	//!< the lines edited, or to the end if last < 0
+	ScheduledBeat	playingBeat;			//!< the beat being heard
+	FPNoteList		playNotes;				//!< the notes of each group heard, compiled on the timer thread
+	UInt16			noteToPlay;				//!< its next note, since tones are subtly arpeggiated
+	bool			beatStarted;			//!< a beat has been heard
+
 public:
 	FPMusicPlayer();
 	~FPMusicPlayer();
@@ -294,9 +366,16 @@ public:
 	static void		PlayerTimerCallback(CFRunLoopTimerRef timer, void *info);
 #endif
 	void			DoPlayerTimer();
+	void			StartNextBeat(UInt64 playTime);
+	void			CheckSchedule();
+	void			FillSchedule();
+	void			GetScheduleKey(ScheduleKey &key);
+	void			CompileBeat(const ScheduledBeat *prev, ScheduledBeat &b);
+	void			PlayScheduledNote(const ScheduledNote &note);
 	void			StartPlaybackTimer();
 	void			DisposePlaybackTimer();
 
+	void			InvalidateLines(FPDocument *doc, ChordIndex start, ChordIndex end=-1);
 	void			GetRangeToPlay(ChordIndex &start, ChordIndex &end);
 	void			PlayDocument();
 	void			Stop();
@@ -0,0 +1,621 @@
+/*
+ *  FPMusicXMLWriter.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPMusicXMLWriter.h"
+#include "FPExportNames.h"
+#include "TByteSink.h"
+
+#include <stdarg.h>
+
+#define kXMLLineSize		512			//!< The longest line written
+
+//
+// Note types by length in steps, longest first
+//
+typedef struct {
+	UInt16		duration;
+	const char	*type;
+	bool		dot;
+} FPXMLNoteType;
+
+static const FPXMLNoteType noteTypes[] = {
+	{ 16, "whole", false },
+	{ 12, "half", true },
+	{ 8, "half", false },
+	{ 6, "quarter", true },
+	{ 4, "quarter", false },
+	{ 3, "eighth", true },
+	{ 2, "eighth", false },
+	{ 1, "16th", false }
+};
+
+//
+// MusicXML kinds for the extensions FretPet gives the
+// common chords. The rest are "other" with FretPet's text.
+//
+static const char *chordKinds[][2] = {
+	{ "", "major" },
+	{ "m", "minor" },
+	{ "+", "augmented" },
+	{ "o", "diminished" },
+	{ "7", "dominant" },
+	{ "\3067", "major-seventh" },
+	{ "m7", "minor-seventh" },
+	{ "o7", "diminished-seventh" },
+	{ "\2777", "half-diminished" },
+	{ "7+", "augmented-seventh" },
+	{ "m\3067", "major-minor" },
+	{ "6", "major-sixth" },
+	{ "m6", "minor-sixth" },
+	{ "9", "dominant-ninth" },
+	{ "\3069", "major-ninth" },
+	{ "m9", "minor-ninth" },
+	{ "11", "dominant-11th" },
+	{ "\30611", "major-11th" },
+	{ "m11", "minor-11th" },
+	{ "13", "dominant-13th" },
+	{ "\30613", "major-13th" },
+	{ "m13", "minor-13th" },
+	{ "sus", "suspended-fourth" },
+	{ "sus2", "suspended-second" },
+	{ "5", "power" }
+};
+
+//
+// The tone of each letter's natural
+//
+static const UInt16 naturalTone[] = { 9, 11, 0, 2, 4, 5, 7 };		// A B C D E F G
+
+
+FPMusicXMLWriter::FPMusicXMLWriter(TByteSink &inSink, const FPNoteData &inNotes, const SInt32 inTone[NUM_STRINGS]) : sink(inSink), notes(inNotes) {
+	for (int s=NUM_STRINGS; s--;)
+		tone[s] = inTone[s];
+
+	for (PartIndex p=DOC_PARTS; p--;)
+		part[p].enabled = false;
+
+	// Spell every tone the way the scale palette does
+	for (UInt16 key=0; key<OCTAVE; key++) {
+		for (UInt16 t=0; t<OCTAVE; t++) {
+			const char		*name = FPExportNames::NameOfNote(key, t);
+			FPXMLSpelling	&sp = spelling[key][t];
+
+			sp.step = name[0];
+			sp.alter = 0;
+
+			for (int i=1; name[i]; i++) {
+				if (name[i] == '#')			sp.alter++;
+				else if (name[i] == 'b')	sp.alter--;
+			}
+		}
+	}
+
+	bzero(harmonyCache, sizeof(harmonyCache));
+
+	quarterTempo	= 0;
+	currPart		= 0;
+	measure			= 0;
+	lastKey			= -1;
+	lastBeats		= 0;
+	lastTag			= 0;
+}
+
+
+/*!
+ * SetPart
+ *
+ *	Add a part to the score. The program is the General
+ *	MIDI program from 1 to 128.
+ */
+void FPMusicXMLWriter::SetPart(PartIndex p, const char *name, UInt16 program, bool drum) {
+	CopyEscaped(part[p].name, name, kXMLNameSize);
+	part[p].program	= program;
+	part[p].drum	= drum;
+	part[p].enabled	= true;
+}
+
+
+/*!
+ * Begin
+ *
+ *	Write the score header and the list of parts. The
+ *	tempo is in sixteenths per minute, like PlayTempo().
+ */
+void FPMusicXMLWriter::Begin(const char *title, UInt16 tempo) {
+	char escaped[kXMLLineSize / 2];
+
+	quarterTempo = MAX((tempo + 2) / 4, 1);
+
+	Text("<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\n");
+	Text("<!DOCTYPE score-partwise PUBLIC \"-//Recordare//DTD MusicXML 3.0 Partwise//EN\" \"http://www.musicxml.org/dtds/partwise.dtd\">\n");
+	Text("<score-partwise version=\"3.0\">\n");
+
+	CopyEscaped(escaped, title, sizeof(escaped));
+	Line("  <work>");
+	Line("    <work-title>%s</work-title>", escaped);
+	Line("  </work>");
+	Line("  <identification>");
+	Line("    <encoding>");
+	Line("      <software>FretPet X " FRETPET_VERSION "</software>");
+	Line("    </encoding>");
+	Line("  </identification>");
+
+	Line("  <part-list>");
+
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		const FPXMLPart &xp = part[p];
+		if (!xp.enabled)
+			continue;
+
+		Line("    <score-part id=\"P%d\">", p + 1);
+		Line("      <part-name>%s</part-name>", xp.name);
+		Line("      <score-instrument id=\"P%d-I1\">", p + 1);
+		Line("        <instrument-name>%s</instrument-name>", xp.name);
+		Line("      </score-instrument>");
+		Line("      <midi-instrument id=\"P%d-I1\">", p + 1);
+		Line("        <midi-channel>%d</midi-channel>", xp.drum ? 10 : p + 1);
+		Line("        <midi-program>%d</midi-program>", xp.program);
+		Line("      </midi-instrument>");
+		Line("    </score-part>");
+	}
+
+	Line("  </part-list>");
+}
+
+
+/*!
+ * BeginPart
+ *
+ *	Start a part. Its measures follow, one per line
+ *	of the document, then EndPart.
+ */
+void FPMusicXMLWriter::BeginPart(PartIndex p) {
+	Line("  <part id=\"P%d\">", p + 1);
+
+	currPart	= p;
+	measure		= 0;
+	lastKey		= -1;
+	lastBeats	= 0;
+	lastTag		= 0;
+}
+
+
+/*!
+ * AddMeasure
+ *
+ *	Write the next line of the document as a measure of
+ *	the current part. The notes come from the line's first
+ *	pass in the note list. Later passes are repeat bars.
+ */
+void FPMusicXMLWriter::AddMeasure(const FPChordGroup &group) {
+	const FPChord	&chord = group[currPart];
+	UInt16			beats = group.PatternSize(),
+					repeat = group.Repeat();
+	SInt16			key = NOTEMOD(chord.key);
+	UInt32			start = notes.LineStep(measure),
+					first = notes.FirstEventAtStep(start);
+
+	Line("    <measure number=\"%d\">", measure + 1);
+
+	if (measure == 0 || beats != lastBeats || key != lastKey)
+		WriteAttributes(beats, key, measure == 0);
+
+	if (measure == 0) {
+		Line("      <direction placement=\"above\">");
+		Line("        <direction-type>");
+		Line("          <metronome><beat-unit>quarter</beat-unit><per-minute>%d</per-minute></metronome>", quarterTempo);
+		Line("        </direction-type>");
+		Line("        <staff>1</staff>");
+		Line("        <sound tempo=\"%d\"/>", quarterTempo);
+		Line("      </direction>");
+	}
+
+	if (repeat > 1) {
+		Line("      <barline location=\"left\">");
+		Line("        <bar-style>heavy-light</bar-style>");
+		Line("        <repeat direction=\"forward\"/>");
+		Line("      </barline>");
+	}
+
+	WriteHarmony(chord);
+
+	WriteStaff(1, first, start, beats, key);
+
+	Line("      <backup><duration>%d</duration></backup>", beats);
+
+	WriteStaff(2, first, start, beats, key);
+
+	if (repeat > 1) {
+		Line("      <barline location=\"right\">");
+		Line("        <bar-style>light-heavy</bar-style>");
+		Line("        <repeat direction=\"backward\" times=\"%d\"/>", repeat);
+		Line("      </barline>");
+	}
+
+	Line("    </measure>");
+
+	measure++;
+}
+
+
+/*!
+ * EndPart
+ */
+void FPMusicXMLWriter::EndPart() {
+	Line("  </part>");
+}
+
+
+/*!
+ * Finish
+ *
+ *	End the score
+ *
+ *	@result the sink's first error, if any
+ */
+OSErr FPMusicXMLWriter::Finish() {
+	Line("</score-partwise>");
+	return sink.Error();
+}
+
+
+//
+// WriteAttributes
+//
+//	Write the key and time when they change. The first
+//	measure also sets up the guitar and tablature staves.
+//
+void FPMusicXMLWriter::WriteAttributes(UInt16 beats, SInt16 key, bool first) {
+	Line("      <attributes>");
+
+	if (first)
+		Line("        <divisions>%d</divisions>", kXMLDivisions);
+
+	if (key != lastKey) {
+		Line("        <key><fifths>%d</fifths></key>", Fifths(key));
+		lastKey = key;
+	}
+
+	if (beats != lastBeats) {
+		UInt16 beatType = 16, count = beats;
+		while (beatType > 4 && !(count & 1)) {
+			count >>= 1;
+			beatType >>= 1;
+		}
+
+		Line("        <time><beats>%d</beats><beat-type>%d</beat-type></time>", count, beatType);
+		lastBeats = beats;
+	}
+
+	if (first) {
+		Line("        <staves>2</staves>");
+		Line("        <clef number=\"1\"><sign>G</sign><line>2</line><clef-octave-change>-1</clef-octave-change></clef>");
+		Line("        <clef number=\"2\"><sign>TAB</sign><line>5</line></clef>");
+		Line("        <staff-details number=\"2\">");
+		Line("          <staff-lines>%d</staff-lines>", NUM_STRINGS);
+
+		// The lowest string is the bottom line
+		for (UInt16 s=0; s<NUM_STRINGS; s++) {
+			UInt16				midi = tone[s] + LOWEST_C;
+			const FPXMLSpelling	&sp = spelling[0][midi % OCTAVE];
+			UInt16				octave = (midi - sp.alter - naturalTone[sp.step - 'A']) / OCTAVE - 1;
+
+			if (sp.alter)
+				Line("          <staff-tuning line=\"%d\"><tuning-step>%c</tuning-step><tuning-alter>%d</tuning-alter><tuning-octave>%d</tuning-octave></staff-tuning>", s + 1, sp.step, sp.alter, octave);
+			else
+				Line("          <staff-tuning line=\"%d\"><tuning-step>%c</tuning-step><tuning-octave>%d</tuning-octave></staff-tuning>", s + 1, sp.step, octave);
+		}
+
+		Line("        </staff-details>");
+	}
+
+	Line("      </attributes>");
+}
+
+
+//
+// WriteHarmony
+//
+//	Write a chord symbol if the chord differs from the
+//	last one written in the part
+//
+void FPMusicXMLWriter::WriteHarmony(const FPChord &chord) {
+	if (!chord.HasTones()) {
+		lastTag = 0;
+		return;
+	}
+
+	const FPXMLHarmony &harmony = HarmonyOfChord(chord);
+	if (harmony.tag == lastTag)
+		return;
+
+	lastTag = harmony.tag;
+
+	const FPXMLSpelling &root = spelling[NOTEMOD(chord.key)][NOTEMOD(chord.root)];
+
+	Line("      <harmony>");
+
+	if (root.alter)
+		Line("        <root><root-step>%c</root-step><root-alter>%d</root-alter></root>", root.step, root.alter);
+	else
+		Line("        <root><root-step>%c</root-step></root>", root.step);
+
+	Line("        <kind text=\"%s\">%s</kind>", harmony.text, harmony.kind);
+
+	if (harmony.noThird)
+		Line("        <degree><degree-value>3</degree-value><degree-alter>0</degree-alter><degree-type>subtract</degree-type></degree>");
+
+	if (harmony.noFifth)
+		Line("        <degree><degree-value>5</degree-value><degree-alter>0</degree-alter><degree-type>subtract</degree-type></degree>");
+
+	Line("        <staff>1</staff>");
+	Line("      </harmony>");
+}
+
+
+//
+// WriteStaff
+//
+//	Write the current part's notes in the first pass of
+//	a line on one staff. Each note lasts until the part
+//	plays again, and gaps are rests. Notes with the
+//	bracket off are rests too.
+//
+void FPMusicXMLWriter::WriteStaff(UInt16 staff, UInt32 firstEvent, UInt32 start, UInt16 beats, SInt16 key) {
+	UInt32	end = start + beats, step = start, size = notes.Size(), i = firstEvent;
+
+	while (step < end) {
+		// Find the part's next notes in the measure
+		while (i < size && notes[i].step < end && !Heard(notes[i]))
+			i++;
+
+		UInt32 onset = (i < size && notes[i].step < end) ? notes[i].step : end;
+
+		if (onset > step) {
+			WriteNotes(staff, 0, 0, onset - step, key, true);
+			step = onset;
+			continue;
+		}
+
+		// A part's notes on one step are together in the list
+		UInt32 last = i;
+		while (last < size && notes[last].step == onset && Heard(notes[last]))
+			last++;
+
+		UInt32 next = last;
+		while (next < size && notes[next].step < end && !Heard(notes[next]))
+			next++;
+
+		step = (next < size && notes[next].step < end) ? notes[next].step : end;
+
+		WriteNotes(staff, i, last, step - onset, key, false);
+		i = next;
+	}
+}
+
+
+//
+// WriteNotes
+//
+//	Write a rest or a chord of notes, tied across as many
+//	note types as it takes to fill the duration. Notes on
+//	the tablature staff get their string and fret.
+//
+void FPMusicXMLWriter::WriteNotes(UInt16 staff, UInt32 firstEvent, UInt32 lastEvent, UInt16 duration, SInt16 key, bool rest) {
+	UInt16	remaining = duration, t = 0;
+	bool	tied = false;
+
+	while (remaining) {
+		while (noteTypes[t].duration > remaining)
+			t++;
+
+		const FPXMLNoteType &nt = noteTypes[t];
+		remaining -= nt.duration;
+
+		bool	tieStart = !rest && remaining > 0;
+		UInt32	count = rest ? 1 : lastEvent - firstEvent;
+
+		for (UInt32 n=0; n<count; n++) {
+			Line("      <note>");
+
+			if (rest)
+				Line("        <rest/>");
+			else {
+				const FPNoteEvent	&e = notes[firstEvent + n];
+				const FPXMLSpelling	&sp = spelling[key][e.tone % OCTAVE];
+				UInt16				octave = (e.tone - sp.alter - naturalTone[sp.step - 'A']) / OCTAVE - 1;
+
+				if (n > 0)
+					Line("        <chord/>");
+
+				if (sp.alter)
+					Line("        <pitch><step>%c</step><alter>%d</alter><octave>%d</octave></pitch>", sp.step, sp.alter, octave);
+				else
+					Line("        <pitch><step>%c</step><octave>%d</octave></pitch>", sp.step, octave);
+			}
+
+			Line("        <duration>%d</duration>", nt.duration);
+
+			if (tied)		Line("        <tie type=\"stop\"/>");
+			if (tieStart)	Line("        <tie type=\"start\"/>");
+
+			Line("        <voice>%d</voice>", staff);
+			Line("        <type>%s</type>", nt.type);
+
+			if (nt.dot)
+				Line("        <dot/>");
+
+			Line("        <staff>%d</staff>", staff);
+
+			if (!rest && (tied || tieStart || staff == 2)) {
+				const FPNoteEvent &e = notes[firstEvent + n];
+
+				Line("        <notations>");
+				if (tied)		Line("          <tied type=\"stop\"/>");
+				if (tieStart)	Line("          <tied type=\"start\"/>");
+				if (staff == 2)
+					Line("          <technical><string>%d</string><fret>%d</fret></technical>", NUM_STRINGS - e.string, e.tone - tone[e.string] - LOWEST_C);
+				Line("        </notations>");
+			}
+
+			Line("      </note>");
+		}
+
+		tied = tieStart;
+	}
+}
+
+
+//
+// HarmonyOfChord
+//
+//	Get a chord's symbol, from the cache if it's been
+//	seen before. FretPet's name gives the extension and
+//	the tones it assumed.
+//
+const FPXMLHarmony& FPMusicXMLWriter::HarmonyOfChord(const FPChord &chord) {
+	UInt32			tag = ((chord.tones & 0xFFF) | (NOTEMOD(chord.root) << 12) | (NOTEMOD(chord.key) << 16)) + 1;
+	FPXMLHarmony	&entry = harmonyCache[(tag * 2654435761U >> 20) & (kXMLHarmonyCacheSize - 1)];
+
+	if (entry.tag == tag)
+		return entry;
+
+	// "Root:extension:(missing)"
+	char raw[64];
+	FPExportNames::CopyChordName(chord, raw, sizeof(raw));
+
+	char *ext = strchr(raw, ':');
+	ext = ext ? ext + 1 : raw + strlen(raw);
+
+	char *missing = strchr(ext, ':');
+	if (missing)
+		*missing++ = '\0';
+	else
+		missing = ext + strlen(ext);
+
+	entry.kind = "other";
+	for (UInt16 k=0; k<sizeof(chordKinds)/sizeof(chordKinds[0]); k++)
+		if (!strcmp(ext, chordKinds[k][0])) {
+			entry.kind = chordKinds[k][1];
+			break;
+		}
+
+	// MacRoman symbols in the extension
+	char *dst = entry.text, *end = entry.text + kXMLKindSize - 4;
+	for (const char *src = ext; *src && dst < end; src++) {
+		switch ((UInt8)*src) {
+			case 0xC6:			// Delta
+				*dst++ = 0xE2; *dst++ = 0x88; *dst++ = 0x86;
+				break;
+
+			case 0xBF:			// o-slash
+				*dst++ = 0xC3; *dst++ = 0xB8;
+				break;
+
+			default:
+				*dst++ = *src;
+				break;
+		}
+	}
+	*dst = '\0';
+
+	entry.noThird	= (strchr(missing, '3') != NULL);
+	entry.noFifth	= (strchr(missing, '5') != NULL);
+	entry.tag		= tag;
+
+	return entry;
+}
+
+
+//
+// Fifths
+//
+//	The key signature of a major key, counting flats
+//	as negative, with the spelling the palette uses
+//
+SInt16 FPMusicXMLWriter::Fifths(SInt16 key) const {
+	SInt16 fifths = FIFTHS_POSITION(key);
+	return (spelling[key][key].alter < 0 || fifths == 11) ? fifths - 12 : fifths;
+}
+
+
+//
+// Text
+//
+//	Write text as it is
+//
+void FPMusicXMLWriter::Text(const char *text) {
+	sink.Bytes(text, strlen(text));
+}
+
+
+//
+// Line
+//
+//	Write a formatted line. Most lines have nothing to
+//	format, so they skip the formatter.
+//
+void FPMusicXMLWriter::Line(const char *format, ...) {
+	if (!strchr(format, '%')) {
+		Text(format);
+		sink.Byte('\n');
+		return;
+	}
+
+	char	line[kXMLLineSize];
+	va_list	args;
+
+	va_start(args, format);
+	int length = vsnprintf(line, sizeof(line) - 1, format, args);
+	va_end(args);
+
+	if (length < 0)
+		length = 0;
+	else if (length > (int)sizeof(line) - 2)
+		length = sizeof(line) - 2;
+
+	line[length] = '\n';
+	sink.Bytes(line, length + 1);
+}
+
+
+//
+// CopyEscaped
+//
+//	Copy text with the XML special characters escaped,
+//	leaving out any character that won't fit
+//
+UInt16 FPMusicXMLWriter::CopyEscaped(char *dst, const char *src, UInt16 size) {
+	UInt16 length = 0;
+
+	for (; *src; src++) {
+		const char *entity = NULL;
+
+		switch (*src) {
+			case '&':	entity = "&amp;";	break;
+			case '<':	entity = "&lt;";	break;
+			case '>':	entity = "&gt;";	break;
+			case '"':	entity = "&quot;";	break;
+		}
+
+		UInt16 need = entity ? strlen(entity) : 1;
+		if (length + need >= size)
+			break;
+
+		if (entity)
+			memcpy(dst + length, entity, need);
+		else
+			dst[length] = *src;
+
+		length += need;
+	}
+
+	dst[length] = '\0';
+	return length;
+}
+
@@ -0,0 +1,116 @@
+/*!
+ *	@file FPMusicXMLWriter.h
+ *
+ *	@brief Writes a compiled document as MusicXML
+ *
+ *	The MusicXML writer turns the notes of a compiled
+ *	document into a partwise score that notation programs can
+ *	open. Each part gets a guitar staff and a tablature staff
+ *	tuned like the document, and each chord gets a chord
+ *	symbol with the name FretPet gives it.
+ *
+ *	The score is streamed to a byte sink one measure at a
+ *	time, so no document tree is ever built. A measure is one
+ *	chord group. A repeated group is written once between
+ *	repeat bars. A note lasts until the part plays again or
+ *	the measure ends, with ties where one note type won't do.
+ *
+ *	Chord symbols are kept in a small cache by tones, root
+ *	and key, like the tab writer's chord names.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPMUSICXMLWRITER_H
+#define FPMUSICXMLWRITER_H
+
+#include "FPChord.h"
+#include "FPNoteData.h"
+
+class TByteSink;
+
+#define kXMLDivisions		4			//!< Divisions of a quarter note, so one step is one
+#define kXMLNameSize		32			//!< The longest part name kept
+#define kXMLKindSize		24			//!< The longest chord extension kept
+#define kXMLHarmonyCacheSize 512		//!< Chord symbols remembered
+
+/*!
+ *	A note spelled for the staff
+ */
+typedef struct {
+	char		step;					//!< The letter
+	SInt8		alter;					//!< Sharps, or flats if negative
+} FPXMLSpelling;
+
+/*!
+ *	A chord symbol in the cache
+ */
+typedef struct {
+	UInt32		tag;					//!< Tones, root and key, plus one
+	const char	*kind;					//!< The MusicXML kind of chord
+	char		text[kXMLKindSize];		//!< The extension as FretPet shows it, in UTF-8
+	bool		noThird;				//!< Named with a third it doesn't have
+	bool		noFifth;				//!< Named with a fifth it doesn't have
+} FPXMLHarmony;
+
+/*!
+ *	What the score says about each part
+ */
+typedef struct {
+	char		name[kXMLNameSize];		//!< The part name, escaped
+	UInt16		program;				//!< The General MIDI program, or 0
+	bool		drum;					//!< Plays on the drum channel
+	bool		enabled;				//!< Written at all
+} FPXMLPart;
+
+
+#pragma mark -
+//-----------------------------------------------
+//
+// FPMusicXMLWriter
+//
+class FPMusicXMLWriter {
+	private:
+		TByteSink			&sink;								//!< Where the score goes
+		const FPNoteData	&notes;								//!< The compiled document
+		SInt32				tone[NUM_STRINGS];					//!< The open string tones
+		FPXMLPart			part[DOC_PARTS];					//!< The parts to write
+		FPXMLSpelling		spelling[OCTAVE][OCTAVE];			//!< Each tone spelled in each key
+		FPXMLHarmony		harmonyCache[kXMLHarmonyCacheSize];	//!< Chord symbols by content
+		UInt16				quarterTempo;						//!< Quarter notes per minute
+		PartIndex			currPart;							//!< The part being written
+		ChordIndex			measure;							//!< The next measure of the part
+		SInt16				lastKey;							//!< The key signature in effect
+		UInt16				lastBeats;							//!< The measure length in effect
+		UInt32				lastTag;							//!< The last chord symbol written
+
+	public:
+		FPMusicXMLWriter(TByteSink &inSink, const FPNoteData &inNotes, const SInt32 inTone[NUM_STRINGS]);
+		~FPMusicXMLWriter() {}
+
+		void				SetPart(PartIndex p, const char *name, UInt16 program, bool drum);
+		void				Begin(const char *title, UInt16 tempo);
+		void				BeginPart(PartIndex p);
+		void				AddMeasure(const FPChordGroup &group);
+		void				EndPart();
+		OSErr				Finish();
+
+	private:
+		void				WriteAttributes(UInt16 beats, SInt16 key, bool first);
+		void				WriteHarmony(const FPChord &chord);
+		void				WriteStaff(UInt16 staff, UInt32 firstEvent, UInt32 start, UInt16 beats, SInt16 key);
+		void				WriteNotes(UInt16 staff, UInt32 firstEvent, UInt32 lastEvent, UInt16 duration, SInt16 key, bool rest);
+		inline bool			Heard(const FPNoteEvent &e) const		{ return e.part == currPart && !(e.flags & kNoteBracketOff); }
+		const FPXMLHarmony&	HarmonyOfChord(const FPChord &chord);
+		SInt16				Fifths(SInt16 key) const;
+		void				Text(const char *text);
+		void				Line(const char *format, ...);
+
+		static UInt16		CopyEscaped(char *dst, const char *src, UInt16 size);
+};
+
+#endif
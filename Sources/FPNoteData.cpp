@@ -0,0 +1,199 @@
+/*
+ *  FPNoteData.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPNoteData.h"
+
+#include <algorithm>
+#include <queue>
+
+//
+// A note waiting to be stopped on a timeline
+//
+typedef struct {
+	UInt32		time;			//!< When it stops
+	UInt32		order;			//!< Which start it belongs to
+	UInt8		part;
+	UInt8		tone;
+} FPPendingStop;
+
+struct FPLaterStop {
+	bool operator()(const FPPendingStop &a, const FPPendingStop &b) const {
+		return (a.time != b.time) ? (a.time > b.time) : (a.order > b.order);
+	}
+};
+
+typedef std::priority_queue<FPPendingStop, std::vector<FPPendingStop>, FPLaterStop> FPStopQueue;
+
+struct FPEarlierStep {
+	bool operator()(const FPNoteEvent &e, UInt32 step) const { return e.step < step; }
+};
+
+
+FPNoteData::FPNoteData() {
+	lineStep.assign(1, 0);
+}
+
+
+/*!
+ * Clear
+ *
+ *	Remove every line.
+ */
+void FPNoteData::Clear() {
+	lineStep.assign(1, 0);
+	eventList.clear();
+}
+
+
+/*!
+ * Reserve
+ *
+ *	Make room for the lines and note starts
+ *	about to be added.
+ */
+void FPNoteData::Reserve(ChordIndex lines, UInt32 events) {
+	lineStep.reserve(lineStep.size() + lines);
+	eventList.reserve(eventList.size() + events);
+}
+
+
+/*!
+ * AddLine
+ *
+ *	Add a line to the end of the song, with every
+ *	repeat of its block.
+ */
+void FPNoteData::AddLine(const FPNoteBlock &block) {
+	ChordIndex	line = lineStep.size() - 1;
+	UInt32		step = lineStep.back();
+
+	for (UInt16 rept=block.repeat; rept--;) {
+		for (UInt32 n=0; n<block.notes.size(); n++) {
+			const FPBlockNote &note = block.notes[n];
+			FPNoteEvent e = { step + note.beat, line, note.part, note.string, note.tone, note.flags };
+			eventList.push_back(e);
+		}
+		step += block.beats;
+	}
+
+	lineStep.push_back(step);
+}
+
+
+/*!
+ * FirstEventAtStep
+ *
+ *	Get the index of the first note starting at or after
+ *	a step, or Size() if there are none.
+ */
+UInt32 FPNoteData::FirstEventAtStep(UInt32 step) const {
+	return std::lower_bound(eventList.begin(), eventList.end(), step, FPEarlierStep()) - eventList.begin();
+}
+
+
+//
+// StopNote
+//
+//	Add the stop for a pending note, unless the note
+//	was already cut off by the same tone again.
+//
+static void StopNote(FPTimeline &timeline, UInt32 sounding[][NUM_OCTAVES * OCTAVE], const FPPendingStop &stop, UInt32 time) {
+	if (sounding[stop.part][stop.tone] == stop.order) {
+		FPTimedEvent off = { time, stop.part, 0, stop.tone, false };
+		timeline.push_back(off);
+		sounding[stop.part][stop.tone] = 0;
+	}
+}
+
+
+/*!
+ * Timeline
+ *
+ *	Get every note start and stop for some parts, in time
+ *	order. A step lasts unitsPerStep, and each note lasts
+ *	its part's sustain in the same units. A tone played
+ *	again while it's sounding is stopped first. Stops come
+ *	before starts at the same time. Notes with any of the
+ *	skipFlags are left out, which by default are the ones
+ *	with the bracket off.
+ */
+void FPNoteData::Timeline(FPTimeline &timeline, double unitsPerStep, const UInt32 sustain[DOC_PARTS], PartMask partMask, UInt8 skipFlags) const {
+	UInt32		sounding[DOC_PARTS][NUM_OCTAVES * OCTAVE];
+	UInt32		order = 0;
+	FPStopQueue	pending;
+
+	bzero(sounding, sizeof(sounding));
+
+	timeline.clear();
+	timeline.reserve(eventList.size() * 2);
+
+	for (UInt32 i=0; i<eventList.size(); i++) {
+		const FPNoteEvent &e = eventList[i];
+		if (!(partMask & BIT(e.part)) || (e.flags & skipFlags))
+			continue;
+
+		UInt32 time = (UInt32)(e.step * unitsPerStep + 0.5);
+
+		// Stop notes that end by now
+		while (!pending.empty() && pending.top().time <= time) {
+			StopNote(timeline, sounding, pending.top(), pending.top().time);
+			pending.pop();
+		}
+
+		// Cut off the same tone if it's still sounding
+		if (sounding[e.part][e.tone]) {
+			FPTimedEvent off = { time, e.part, 0, e.tone, false };
+			timeline.push_back(off);
+		}
+
+		FPTimedEvent on = { time, e.part, e.string, e.tone, true };
+		timeline.push_back(on);
+
+		FPPendingStop stop = { time + sustain[e.part], ++order, e.part, e.tone };
+		pending.push(stop);
+		sounding[e.part][e.tone] = order;
+	}
+
+	while (!pending.empty()) {
+		StopNote(timeline, sounding, pending.top(), pending.top().time);
+		pending.pop();
+	}
+}
+
+
+/*!
+ * CompileBlock
+ *
+ *	List the notes played in one pass of a group, in
+ *	a tuning, flagging the ones with the bracket off.
+ */
+void FPNoteData::CompileBlock(FPNoteBlock &block, const FPNoteGroup &group, const SInt32 tone[NUM_STRINGS]) {
+	block.beats		= group.beats;
+	block.repeat	= group.repeat;
+	block.notes.clear();
+	block.beatNote.resize(group.beats + 1);
+
+	for (UInt16 beat=0; beat<group.beats; beat++) {
+		block.beatNote[beat] = block.notes.size();
+
+		for (PartIndex p=0; p<DOC_PARTS; p++) {
+			const FPNotePart &part = group.part[p];
+			UInt8 flags = part.bracket ? 0 : kNoteBracketOff;
+
+			for (UInt16 str=0; str<NUM_STRINGS; str++) {
+				SInt16 fret = part.fretHeld[str];
+				if (fret != -1 && (part.pick[str] & BIT(beat))) {
+					FPBlockNote note = { (UInt8)beat, (UInt8)p, (UInt8)str, (UInt8)(fret + tone[str] + LOWEST_C), (SInt8)fret, flags };
+					block.notes.push_back(note);
+				}
+			}
+		}
+	}
+
+	block.beatNote[group.beats] = block.notes.size();
+}
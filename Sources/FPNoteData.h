@@ -0,0 +1,133 @@
+/*!
+ *	@file FPNoteData.h
+ *
+ *	@brief Compiled notes with no document behind them
+ *
+ *	Note data is the part of a note list that the exporters
+ *	and the player read: blocks of notes for each group, the
+ *	note starts of the whole song in order, and the timeline
+ *	made from them. It only uses plain types, so it builds
+ *	without Carbon, as the wave renderer's tool in
+ *	Tests/Makefile does.
+ *
+ *	A block is compiled from an FPNoteGroup, which holds just
+ *	the fingering, pattern and bracket of each part. FPNoteList
+ *	fills it from a document's chord groups. A tool can fill it
+ *	from anything else, such as a classic file's records.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPNOTEDATA_H
+#define FPNOTEDATA_H
+
+#include <vector>
+
+/*!
+ *	Note flags
+ */
+enum {
+	kNoteBracketOff		= 0x01		//!< The part's bracket is off, so only the player sounds it
+};
+
+/*!
+ *	A note played in a chord group, relative to the group
+ */
+typedef struct {
+	UInt8		beat;				//!< 1 The beat in the pattern
+	UInt8		part;				//!< 1 The part playing it
+	UInt8		string;				//!< 1 The string plucked
+	UInt8		tone;				//!< 1 The MIDI note number
+	SInt8		fret;				//!< 1 The fret held
+	UInt8		flags;				//!< 1 Note flags
+} FPBlockNote;						//   6 bytes total
+
+/*!
+ *	A note start in the compiled document
+ */
+typedef struct {
+	UInt32		step;				//!< 4 Sixteenths from the start
+	ChordIndex	line;				//!< 4 The line it comes from
+	UInt8		part;				//!< 1 The part playing it
+	UInt8		string;				//!< 1 The string plucked
+	UInt8		tone;				//!< 1 The MIDI note number
+	UInt8		flags;				//!< 1 Note flags
+} FPNoteEvent;						//  12 bytes total
+
+/*!
+ *	A note start or stop on a timeline
+ */
+typedef struct {
+	UInt32		time;				//!< 4 The time in the caller's units
+	UInt8		part;				//!< 1 The part
+	UInt8		string;				//!< 1 The string, for starts
+	UInt8		tone;				//!< 1 The MIDI note number
+	bool		on;					//!< 1 A start, or a stop
+} FPTimedEvent;						//   8 bytes total
+
+typedef std::vector<FPTimedEvent> FPTimeline;
+
+/*!
+ *	What a block needs to know about one part of a group
+ */
+typedef struct {
+	bool			bracket;					//!< The bracket is on
+	SInt16			fretHeld[NUM_STRINGS];		//!< The fingering, -1 for none
+	PatternMask		pick[NUM_STRINGS];			//!< The picking pattern
+} FPNotePart;
+
+/*!
+ *	What a block needs to know about a group
+ */
+typedef struct {
+	UInt16			beats;						//!< The length of the pattern
+	UInt16			repeat;						//!< Passes through the pattern
+	FPNotePart		part[DOC_PARTS];			//!< Each part
+} FPNoteGroup;
+
+/*!
+ *	The compiled notes of one chord group
+ */
+typedef struct {
+	UInt16						beats;		//!< The length of the pattern
+	UInt16						repeat;		//!< Passes through the pattern
+	std::vector<FPBlockNote>	notes;		//!< Notes by beat, part and string
+	std::vector<UInt16>			beatNote;	//!< The first note of each beat, plus the end
+} FPNoteBlock;
+
+
+#pragma mark -
+//-----------------------------------------------
+//
+// FPNoteData
+//
+class FPNoteData {
+	protected:
+		std::vector<UInt32>			lineStep;		//!< The first step of each line, plus the end
+		std::vector<FPNoteEvent>	eventList;		//!< All note starts in order
+
+	public:
+		FPNoteData();
+		~FPNoteData() {}
+
+		void				Clear();
+		void				Reserve(ChordIndex lines, UInt32 events);
+		void				AddLine(const FPNoteBlock &block);
+
+		inline UInt32		Size() const							{ return eventList.size(); }
+		inline const FPNoteEvent&	operator[](UInt32 i) const		{ return eventList[i]; }
+
+		inline UInt32		TotalSteps() const						{ return lineStep.back(); }
+		inline UInt32		LineStep(ChordIndex line) const			{ return lineStep[line]; }
+		UInt32				FirstEventAtStep(UInt32 step) const;
+
+		void				Timeline(FPTimeline &timeline, double unitsPerStep, const UInt32 sustain[DOC_PARTS], PartMask partMask=kAllChannelsMask, UInt8 skipFlags=kNoteBracketOff) const;
+
+		static void			CompileBlock(FPNoteBlock &block, const FPNoteGroup &group, const SInt32 tone[NUM_STRINGS]);
+};
+
+#endif
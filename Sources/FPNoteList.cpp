@@ -0,0 +1,213 @@
+/*
+ *  FPNoteList.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPNoteList.h"
+#include "FPDocument.h"
+
+#define kNoteListSpareBlocks	64
+
+
+FPNoteList::FPNoteList() {
+	memset(tone, 0xFF, sizeof(tone));
+	compiled = false;
+}
+
+
+FPNoteList::~FPNoteList() {
+	for (UInt32 id=0; id<blockList.size(); id++)
+		delete blockList[id];
+}
+
+
+/*!
+ * Compile
+ *
+ *	Bring the list up to date with the document. Only groups
+ *	not seen before are compiled, and the list is only laid
+ *	out again if some line now has a different block.
+ */
+void FPNoteList::Compile(const FPDocument &doc) {
+	SetTuning(doc.Tuning().tone);
+
+	ChordIndex lines = doc.Size();
+	if (Lines() != lines) {
+		lineBlock.assign(lines, kNoGroupID);
+		compiled = false;
+	}
+
+	for (ChordIndex line=0; line<lines; line++) {
+		UInt32 id = BlockForGroup(doc.ChordGroup(line));
+		if (lineBlock[line] != id) {
+			lineBlock[line] = id;
+			compiled = false;
+		}
+	}
+
+	if (!compiled) {
+		Prune();
+		Layout();
+		compiled = true;
+	}
+}
+
+
+/*!
+ * Invalidate
+ *
+ *	Throw away all the blocks, so the next compile
+ *	starts from nothing.
+ */
+void FPNoteList::Invalidate() {
+	for (UInt32 id=0; id<blockList.size(); id++)
+		delete blockList[id];
+
+	blockList.clear();
+	blockStore.Clear();
+	lineBlock.clear();
+	Clear();
+	memset(tone, 0xFF, sizeof(tone));
+	compiled = false;
+}
+
+
+/*!
+ * Block
+ *
+ *	Get the compiled notes of a group by itself, as the
+ *	player does one beat at a time. The block stays good
+ *	until the tuning changes or the list is invalidated.
+ */
+const FPNoteBlock& FPNoteList::Block(const FPChordGroup &group, const SInt32 inTone[NUM_STRINGS]) {
+	SetTuning(inTone);
+	return blockList[BlockForGroup(group)]->block;
+}
+
+
+//
+// SetTuning
+//
+//	Every block depends on the tuning, so a new
+//	tuning throws them all away
+//
+void FPNoteList::SetTuning(const SInt32 inTone[NUM_STRINGS]) {
+	if (memcmp(tone, inTone, sizeof(tone)) != 0) {
+		Invalidate();
+		memcpy(tone, inTone, sizeof(tone));
+	}
+}
+
+
+//
+// BlockForGroup
+//
+//	Get the ID of the block for a group's content,
+//	compiling a new one if there isn't one yet
+//
+UInt32 FPNoteList::BlockForGroup(const FPChordGroup &group) {
+	UInt32 id = blockStore.Find(group);
+
+	if (id == kNoGroupID) {
+		FPCompiledGroup *entry = new FPCompiledGroup;
+		entry->group = group;
+		CompileBlock(*entry);
+
+		// The store keeps the entry's own copy of the group
+		id = blockStore.Add(entry->group);
+		blockList.push_back(entry);
+	}
+
+	return id;
+}
+
+
+//
+// CompileBlock
+//
+//	Hand a group's fingerings and patterns to
+//	FPNoteData to compile
+//
+void FPNoteList::CompileBlock(FPCompiledGroup &entry) {
+	const FPChordGroup	&group = entry.group;
+	FPNoteGroup			notes;
+
+	notes.beats		= group.PatternSize();
+	notes.repeat	= group.Repeat();
+
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		const FPChord	&chord = group[p];
+		FPNotePart		&part = notes.part[p];
+
+		part.bracket = chord.IsBracketEnabled();
+		memcpy(part.fretHeld, chord.fretHeld, sizeof(part.fretHeld));
+		memcpy(part.pick, chord.pick, sizeof(part.pick));
+	}
+
+	FPNoteData::CompileBlock(entry.block, notes, tone);
+}
+
+
+//
+// Layout
+//
+//	Lay the blocks of all lines end to end, with every
+//	repeat, as one list of note starts
+//
+void FPNoteList::Layout() {
+	ChordIndex	lines = Lines();
+	UInt32		count = 0;
+
+	for (ChordIndex line=0; line<lines; line++) {
+		const FPNoteBlock &block = LineBlock(line);
+		count += block.notes.size() * block.repeat;
+	}
+
+	Clear();
+	Reserve(lines, count);
+
+	for (ChordIndex line=0; line<lines; line++)
+		AddLine(LineBlock(line));
+}
+
+
+//
+// Prune
+//
+//	Blocks for content that's gone stay around, so undo
+//	and redo can find them again. Once they outnumber the
+//	ones in use the old ones are thrown away.
+//
+void FPNoteList::Prune() {
+	ChordIndex			lines = Lines();
+	std::vector<UInt32>	newID(blockList.size(), kNoGroupID);
+	UInt32				used = 0;
+
+	for (ChordIndex line=0; line<lines; line++)
+		if (newID[lineBlock[line]] == kNoGroupID)
+			newID[lineBlock[line]] = used++;
+
+	if (blockList.size() <= used * 2 + kNoteListSpareBlocks)
+		return;
+
+	std::vector<FPCompiledGroup*> oldList;
+	oldList.swap(blockList);
+	blockStore.Clear();
+
+	// Add the blocks back in the order of their new IDs
+	for (ChordIndex line=0; line<lines; line++) {
+		UInt32 id = lineBlock[line];
+		if (newID[id] == blockList.size()) {
+			blockList.push_back(oldList[id]);
+			blockStore.Add(oldList[id]->group);
+		}
+		lineBlock[line] = newID[id];
+	}
+
+	for (UInt32 id=0; id<oldList.size(); id++)
+		if (newID[id] == kNoGroupID)
+			delete oldList[id];
+}
@@ -0,0 +1,93 @@
+/*!
+ *	@file FPNoteList.h
+ *
+ *	@brief A document compiled into a list of timed notes
+ *
+ *	Every exporter used to walk the document chord by chord,
+ *	repeat by repeat, beat by beat, part by part and string by
+ *	string, and each kept its own table of sounding notes to
+ *	know when to stop them. A note list does that walk once.
+ *
+ *	Each chord group is compiled into a block of the notes it
+ *	plays on each beat. Blocks are kept by content, in a chord
+ *	group store, so repeated groups share one block and a later
+ *	compile only has to build blocks for groups that changed.
+ *	The blocks are then laid end to end into one list of note
+ *	starts, sorted by step, part and string.
+ *
+ *	A timeline adds the note stops. Given the length of a step
+ *	and each part's sustain in the caller's own units, it gives
+ *	every start and stop in time order, cutting a note short
+ *	when the same tone is played again in the same part.
+ *
+ *	Chords with the bracket off are compiled too, with their
+ *	notes flagged. The player sounds them, but a timeline and
+ *	the exporters leave them out. Block notes keep their frets
+ *	for the guitar palette.
+ *
+ *	The blocks, the note starts and the timeline are all in
+ *	FPNoteData, which doesn't need the document or Carbon.
+ *	The note list adds the block cache and reading the
+ *	document.
+ *
+ *	The player and the MIDI, wave, MusicXML and Sunvox
+ *	exporters all use a note list. The player keeps its own,
+ *	since it compiles one block at a time on the timer thread.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPNOTELIST_H
+#define FPNOTELIST_H
+
+#include "FPNoteData.h"
+#include "FPChordGroupStore.h"
+
+class FPDocument;
+
+/*!
+ *	A block with the group it was compiled from
+ */
+typedef struct {
+	FPChordGroup				group;		//!< The group it was compiled from
+	FPNoteBlock					block;		//!< Its notes
+} FPCompiledGroup;
+
+
+#pragma mark -
+//-----------------------------------------------
+//
+// FPNoteList
+//
+class FPNoteList : public FPNoteData {
+	private:
+		std::vector<FPCompiledGroup*>	blockList;	//!< Compiled groups, by store ID
+		FPChordGroupStore			blockStore;		//!< Index of the blocks by content
+		std::vector<UInt32>			lineBlock;		//!< The block of each line
+		SInt32						tone[NUM_STRINGS];	//!< The tuning the blocks were built for
+		bool						compiled;		//!< The list matches lineBlock
+
+	public:
+		FPNoteList();
+		~FPNoteList();
+
+		void				Compile(const FPDocument &doc);
+		void				Invalidate();
+		const FPNoteBlock&	Block(const FPChordGroup &group, const SInt32 inTone[NUM_STRINGS]);
+
+		inline ChordIndex	Lines() const							{ return lineBlock.size(); }
+		inline const FPNoteBlock&	LineBlock(ChordIndex line) const	{ return blockList[lineBlock[line]]->block; }
+
+	private:
+		void				SetTuning(const SInt32 inTone[NUM_STRINGS]);
+		UInt32				BlockForGroup(const FPChordGroup &group);
+		void				CompileBlock(FPCompiledGroup &entry);
+		void				Layout();
+		void				Prune();
+};
+
+#endif
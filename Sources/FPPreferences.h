@@ -74,6 +74,7 @@ extern FPPreferences preferences;
 #define kPrefRecentItems	CFSTR("recentItems")
 
 #define kPrefKeyboardSize	CFSTR("keyboardSize")
+#define kPrefHistoryBudget	CFSTR("historyBudget")
 
 #define kCommandPrefTab				'Ptab'
 #define kCommandPrefFingerWarning	'Pfin'
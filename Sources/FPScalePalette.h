@@ -198,6 +198,7 @@ class FPScalePalette : public FPPalette {
 		// Convert Tones to Scale Functions
 		inline SInt16	FunctionOfTone(SInt16 tone)						{ int step = NUM_STEPS; while (step-- && ScaleTone(step) != NOTEMOD(tone)); return step; }
 		inline SInt16	FunctionOfTone(UInt16 key, SInt16 tone)			{ int step = NUM_STEPS; while (step-- && ScaleTone(key, step) != NOTEMOD(tone)); return step; }
+		inline SInt16	FunctionOfTone(UInt16 mode, UInt16 key, SInt16 tone)	{ return info.FunctionOfTone(mode, key, tone); }
 
 		// Tone Name Accessors
 		inline const char*	NameOfNote(UInt16 mode, UInt16 key, UInt16 tone){ return info.NameOfNote(mode, key, tone); }
@@ -0,0 +1,202 @@
+/*
+ *  FPSelfTest.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPSelfTest.h"
+
+#if !DEMO_ONLY
+
+#include "FPApplication.h"
+#include "FPDocWindow.h"
+#include "FPDocument.h"
+#include "FPHistory.h"
+#include "TFile.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+
+FPSelfTest::FPSelfTest(const char *source) {
+	sourcePath	= source;
+	failures	= 0;
+}
+
+
+/*!
+ * Run
+ *
+ *	Run a test by name and report whether every check passed
+ */
+bool FPSelfTest::Run(const char *testName) {
+	if (!strcasecmp(testName, "journal"))
+		(void)TestJournalReplay();
+	else {
+		fprintf(stderr, "FretPet: Unknown test \"%s\"\n", testName);
+		return false;
+	}
+
+	return failures == 0;
+}
+
+
+/*!
+ * TestJournalReplay
+ *
+ *	Clone part 1 over part 2 in a few lines, as option-dragging
+ *	a part would, and leave the window open as if the app had
+ *	crashed. A second window on the same file must replay the
+ *	journal to the same chords, then undo and redo the clone.
+ */
+bool FPSelfTest::TestJournalReplay() {
+	std::string path = sourcePath + ".fret";
+
+	if (WriteBinaryCopy(path) != noErr) {
+		Check(false, "journal test document was written");
+		return false;
+	}
+
+	FPDocWindow *crashed = OpenWindow(path);
+	if (crashed == NULL || crashed->DocumentSize() < 6) {
+		Check(false, "journal test document has 6 lines");
+		return false;
+	}
+
+	FPDocument		*doc = crashed->document;
+	FPHistory		*history = crashed->history;
+	FPChordGroupArray original, expected;
+
+	for (ChordIndex i=0; i<doc->Size(); i++)
+		original.append_copy(doc->ChordGroup(i));
+
+	fretpet->DoWindowActivated(crashed);
+	history->StartJournal(*doc);
+
+	crashed->SetCursorAndSelection(5, 2);
+	FPHistoryEvent *event = history->UndoStart(UN_CLONE_PART, CFSTR("Clone Part"), BIT(1));
+	event->SaveDeltaBefore(2, 5);
+	for (ChordIndex i=2; i<=5; i++)
+		doc->Chord(i, 1) = doc->Chord(i, 0);
+	event->Commit();
+
+	for (ChordIndex i=0; i<doc->Size(); i++)
+		expected.append_copy(doc->ChordGroup(i));
+
+	FPDocWindow *recovered = OpenWindow(path);
+	if (recovered == NULL) {
+		Check(false, "journal test document opened again");
+		return false;
+	}
+
+	fretpet->DoWindowActivated(recovered);
+	history = recovered->history;
+
+	Check(SameGroups(recovered, original), "document opens as it was saved");
+	Check(history->RecoverJournal(*recovered->document) == 1, "one journal record was replayed");
+	Check(SameGroups(recovered, expected), "replayed clone part matches the edit");
+
+	Check(history->CanUndo(), "replayed clone part can be undone");
+	history->DoUndo();
+	Check(SameGroups(recovered, original), "undo restores the cloned lines");
+
+	Check(history->CanRedo(), "undone clone part can be redone");
+	history->DoRedo();
+	Check(SameGroups(recovered, expected), "redo clones the lines again");
+
+	return failures == 0;
+}
+
+
+/*!
+ * OpenWindow
+ *
+ *	Open a document in a window that's never shown
+ */
+FPDocWindow* FPSelfTest::OpenWindow(const std::string &path) {
+	TFile			file(path.c_str());
+	FPDocWindow		*wind = NULL;
+
+	if (file.Exists()) {
+		wind = new FPDocWindow(CFSTR("loading..."));
+		if (wind->InitFromFile(file.FileRef()) != noErr) {
+			delete wind;
+			wind = NULL;
+		}
+	}
+
+	return wind;
+}
+
+
+/*!
+ * WriteBinaryCopy
+ *
+ *	Save the source document in the binary format, which
+ *	is the only kind of file that gets a journal
+ */
+OSStatus FPSelfTest::WriteBinaryCopy(const std::string &path) {
+	FPDocument	*doc = new FPDocument(NULL);
+
+	doc->Specify(sourcePath.c_str());
+
+	OSStatus err = doc->Exists() ? doc->InitFromFile() : fnfErr;
+	doc->Close();
+
+	// TFile can only specify a file that exists
+	if (err == noErr) {
+		int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			err = ioErr;
+		else
+			close(fd);
+	}
+
+	if (err == noErr) {
+		doc->Specify(path.c_str());
+		doc->SetBinaryFormat(true);
+		err = doc->OpenWrite();
+	}
+
+	if (err == noErr)
+		err = doc->WriteBinaryFormat();
+
+	doc->Close();
+	delete doc;
+
+	return err;
+}
+
+
+/*!
+ * SameGroups
+ *
+ *	Compare a window's document to a copy of its chords
+ */
+bool FPSelfTest::SameGroups(FPDocWindow *wind, const FPChordGroupArray &groups) {
+	FPDocument *doc = wind->document;
+
+	if (doc->Size() != (ChordIndex)groups.size())
+		return false;
+
+	for (ChordIndex i=0; i<doc->Size(); i++)
+		if (!(doc->ChordGroup(i) == groups[i]))
+			return false;
+
+	return true;
+}
+
+
+/*!
+ * Check
+ *
+ *	Report one check
+ */
+void FPSelfTest::Check(bool good, const char *what) {
+	printf("%s: %s\n", good ? "PASS" : "FAIL", what);
+	if (!good) failures++;
+}
+
+#endif
@@ -0,0 +1,49 @@
+/*!
+ *	@file FPSelfTest.h
+ *
+ *	@brief Tests that need the app's windows and history
+ *
+ *	Most of the file readers and exporters can be tested on their
+ *	own, but undo, redo and the journal work through a document
+ *	window. The self test runs inside the app, before the event
+ *	loop, on a document given on the command line:
+ *
+ *		FretPet -test journal file.fp
+ *
+ *	Each test prints PASS or FAIL with what it checked.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPSELFTEST_H
+#define FPSELFTEST_H
+
+#include <string>
+
+class FPDocWindow;
+class FPChordGroupArray;
+
+class FPSelfTest {
+	private:
+		std::string		sourcePath;		//!< The document to test with
+		UInt16			failures;		//!< Checks that failed so far
+
+	public:
+		FPSelfTest(const char *source);
+		~FPSelfTest() {}
+
+		bool			Run(const char *testName);
+
+	private:
+		bool			TestJournalReplay();
+		FPDocWindow*	OpenWindow(const std::string &path);
+		OSStatus		WriteBinaryCopy(const std::string &path);
+		bool			SameGroups(FPDocWindow *wind, const FPChordGroupArray &groups);
+		void			Check(bool good, const char *what);
+};
+
+#endif
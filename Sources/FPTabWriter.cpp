@@ -0,0 +1,329 @@
+/*
+ *  FPTabWriter.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPTabWriter.h"
+#include "FPExportNames.h"
+#include "TByteSink.h"
+
+
+FPTabWriter::FPTabWriter(TByteSink &inSink, const SInt32 inTone[NUM_STRINGS], UInt16 inStyle, PartMask parts) : sink(inSink) {
+	for (int s=NUM_STRINGS; s--;)
+		tone[s] = inTone[s];
+
+	style		= inStyle;
+	partMask	= parts;
+	barCount	= 0;
+
+	bzero(nameCache, sizeof(nameCache));
+	StartSystem();
+}
+
+
+/*!
+ * Begin
+ *
+ *	Write the title and, for tablature, the tuning
+ */
+void FPTabWriter::Begin(const char *title) {
+	sink.Bytes(title, strlen(title));
+	sink.Byte('\n');
+
+	if (style == kTabStyleTablature) {
+		const char *label = "Tuning:";
+		sink.Bytes(label, strlen(label));
+
+		for (int s=0; s<NUM_STRINGS; s++) {
+			char name[8];
+			UInt16 length = CopyName(name, FPExportNames::NameOfNote(NOTEMOD(tone[s])), sizeof(name));
+			sink.Byte(' ');
+			sink.Bytes(name, length);
+		}
+
+		sink.Byte('\n');
+	}
+
+	sink.Byte('\n');
+}
+
+
+/*!
+ * AddGroup
+ *
+ *	Add a group as the next bar, writing out the system
+ *	first if the bar won't fit on the line. A repeated
+ *	group is one bar marked with its repeat count.
+ */
+void FPTabWriter::AddGroup(const FPChordGroup &group) {
+	UInt16		beats = group.PatternSize(),
+				repeat = group.Repeat();
+	char		label[DOC_PARTS][kTabNameSize + 8];
+	UInt16		labelLength[DOC_PARTS], labelWidth[DOC_PARTS];
+	UInt16		width = (style == kTabStyleTablature) ? beats * kTabBeatWidth + 1 : 0;
+	bool		full = false;
+
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		labelLength[p] = labelWidth[p] = 0;
+
+		if (!(partMask & BIT(p)))
+			continue;
+
+		const FPChord &chord = group[p];
+		labelLength[p] = chord.HasTones()
+			? CopyName(label[p], NameOfChord(chord), kTabNameSize)
+			: CopyName(label[p], "N.C.", kTabNameSize);
+
+		if (repeat > 1)
+			labelLength[p] += snprintf(label[p] + labelLength[p], 8, " x%d", repeat);
+
+		labelWidth[p] = TextWidth(label[p], labelLength[p]);
+		width = MAX(width, labelWidth[p] + 2);
+	}
+
+	// Names can take more bytes than columns
+	for (PartIndex p=0; p<DOC_PARTS; p++)
+		if (nameUsed[p] + width + labelLength[p] - labelWidth[p] > kTabLineSize)
+			full = true;
+
+	if ((column + width > kTabLineWidth || full) && column > kTabMargin)
+		FlushSystem();
+
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		if (!(partMask & BIT(p)))
+			continue;
+
+		const FPChord &chord = group[p];
+		if (chord.HasTones())
+			partsUsed |= BIT(p);
+
+		// The name sits over the start of the bar
+		char	*name = &nameLine[p][nameUsed[p]];
+		UInt16	length = width + labelLength[p] - labelWidth[p];
+
+		memset(name, ' ', length);
+		memcpy(name + 1, label[p], labelLength[p]);
+		nameUsed[p] += length;
+
+		if (style != kTabStyleTablature) {
+			name[length - 1] = '|';
+			continue;
+		}
+
+		for (UInt16 s=0; s<NUM_STRINGS; s++) {
+			char	*line = &stringLine[p][s][column];
+			SInt16	fret = chord.IsBracketEnabled() ? chord.FretHeld(s) : -1;
+
+			memset(line, '-', width - 1);
+			line[width - 1] = '|';
+
+			if (fret < 0)
+				continue;
+
+			for (UInt16 beat=0; beat<beats; beat++)
+				if (chord.GetPatternDot(s, beat)) {
+					char *cell = line + beat * kTabBeatWidth + 1;
+					if (fret >= 10) {
+						cell[0] = '0' + fret / 10;
+						cell[1] = '0' + fret % 10;
+					}
+					else
+						cell[1] = '0' + fret;
+				}
+		}
+	}
+
+	column += width;
+	barCount++;
+}
+
+
+/*!
+ * AddGroups
+ */
+void FPTabWriter::AddGroups(const FPChordGroupArray &groups) {
+	for (ChordIndex i=0; i<groups.size(); i++)
+		AddGroup(groups[i]);
+}
+
+
+/*!
+ * Finish
+ *
+ *	Write out the last system
+ *
+ *	@result the sink's first error, if any
+ */
+OSErr FPTabWriter::Finish() {
+	if (column > kTabMargin)
+		FlushSystem();
+
+	return sink.Error();
+}
+
+
+//
+// NameOfChord
+//
+//	Get a chord's name as UTF-8, from the cache if it's
+//	been seen before. The name only depends on the tones,
+//	the root and the key.
+//
+const char* FPTabWriter::NameOfChord(const FPChord &chord) {
+	UInt32		tag = ((chord.tones & 0xFFF) | (NOTEMOD(chord.root) << 12) | (NOTEMOD(chord.key) << 16)) + 1;
+	FPTabName	&entry = nameCache[(tag * 2654435761U >> 20) & (kTabNameCacheSize - 1)];
+
+	if (entry.tag == tag)
+		return entry.name;
+
+	char raw[64];
+	FPExportNames::CopyChordName(chord, raw, sizeof(raw));
+
+	// "Root:extension:missing" with the root padded and
+	// MacRoman symbols in the extension
+	char	*dst = entry.name, *end = entry.name + kTabNameSize - 4;
+	UInt16	field = 0;
+
+	for (const char *src = raw; *src && dst < end; src++) {
+		switch ((UInt8)*src) {
+			case ' ':
+				if (field == 0) break;
+				*dst++ = ' ';
+				break;
+
+			case ':':
+				if (field++ == 1 && src[1])
+					*dst++ = ' ';
+				break;
+
+			case 0xC6:			// Delta
+				*dst++ = 0xE2; *dst++ = 0x88; *dst++ = 0x86;
+				break;
+
+			case 0xBF:			// o-slash
+				*dst++ = 0xC3; *dst++ = 0xB8;
+				break;
+
+			default:
+				*dst++ = *src;
+				break;
+		}
+	}
+
+	*dst = '\0';
+	entry.tag = tag;
+
+	return entry.name;
+}
+
+
+//
+// FlushSystem
+//
+//	Write every part that played in the system, then
+//	start a new one
+//
+void FPTabWriter::FlushSystem() {
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		if (!(partsUsed & BIT(p)))
+			continue;
+
+		WriteLine(nameLine[p], nameUsed[p]);
+
+		if (style == kTabStyleTablature) {
+			// The highest string is on top
+			for (int s=NUM_STRINGS; s--;)
+				WriteLine(stringLine[p][s], column);
+		}
+	}
+
+	if (partsUsed)
+		sink.Byte('\n');
+
+	StartSystem();
+}
+
+
+//
+// StartSystem
+//
+//	Put the part number and string names in the margin
+//
+void FPTabWriter::StartSystem() {
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		memset(nameLine[p], ' ', kTabMargin);
+		nameLine[p][0] = '1' + p;
+		nameUsed[p] = kTabMargin;
+
+		if (style != kTabStyleTablature) {
+			nameLine[p][kTabMargin - 1] = '|';
+			continue;
+		}
+
+		for (UInt16 s=0; s<NUM_STRINGS; s++) {
+			char *line = stringLine[p][s];
+			memset(line, ' ', kTabMargin);
+			CopyName(line, FPExportNames::NameOfNote(NOTEMOD(tone[s])), kTabMargin);
+			line[strlen(line)] = ' ';
+			line[kTabMargin - 1] = '|';
+		}
+	}
+
+	column		= kTabMargin;
+	partsUsed	= 0;
+}
+
+
+//
+// WriteLine
+//
+//	Write a line without its trailing spaces
+//
+void FPTabWriter::WriteLine(const char *line, UInt16 length) {
+	while (length && line[length - 1] == ' ')
+		length--;
+
+	sink.Bytes(line, length);
+	sink.Byte('\n');
+}
+
+
+//
+// CopyName
+//
+//	Copy a name without its padding, returning its length
+//
+UInt16 FPTabWriter::CopyName(char *dst, const char *src, UInt16 size) {
+	UInt16 length = 0;
+
+	while (src[length] && length < size - 1) {
+		dst[length] = src[length];
+		length++;
+	}
+
+	while (length && dst[length - 1] == ' ')
+		length--;
+
+	dst[length] = '\0';
+	return length;
+}
+
+
+//
+// TextWidth
+//
+//	The number of columns in some UTF-8 text
+//
+UInt16 FPTabWriter::TextWidth(const char *text, UInt16 length) {
+	UInt16 width = 0;
+
+	for (UInt16 i=0; i<length; i++)
+		if (((UInt8)text[i] & 0xC0) != 0x80)
+			width++;
+
+	return width;
+}
+
@@ -0,0 +1,94 @@
+/*!
+ *	@file FPTabWriter.h
+ *
+ *	@brief Writes chord groups as text tablature or a chord chart
+ *
+ *	A tab writer takes chord groups one at a time and streams
+ *	plain text to a byte sink, so a document of any length is
+ *	written in a single pass.
+ *
+ *	Each group is one bar. Bars are set side by side in a
+ *	system until the next one won't fit in the line, then the
+ *	system is written out. In a system, each part that plays
+ *	gets a line of chord names and, for tablature, a line per
+ *	string with the fret picked on each beat. A chord chart
+ *	only has the names.
+ *
+ *	A system is built in fixed line buffers, and chord names
+ *	are kept in a small cache by tones, root and key, so no
+ *	memory is allocated per chord.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPTABWRITER_H
+#define FPTABWRITER_H
+
+#include "FPChord.h"
+
+class TByteSink;
+
+#define kTabLineWidth		104			//!< Bars are wrapped to this width
+#define kTabLineSize		176			//!< Room for one line and the widest bar
+#define kTabMargin			4			//!< Room for the string names
+#define kTabBeatWidth		3			//!< Columns for each beat
+#define kTabNameSize		40			//!< The longest chord name kept
+#define kTabNameCacheSize	1024		//!< Chord names remembered
+
+//! What the writer writes
+enum {
+	kTabStyleTablature,				//!< Chord names and strings
+	kTabStyleChart					//!< Chord names only
+};
+
+/*!
+ *	A chord name in the cache
+ */
+typedef struct {
+	UInt32		tag;					//!< Tones, root and key, plus one
+	char		name[kTabNameSize];		//!< The name as UTF-8
+} FPTabName;
+
+
+#pragma mark -
+//-----------------------------------------------
+//
+// FPTabWriter
+//
+class FPTabWriter {
+	private:
+		TByteSink		&sink;										//!< Where the text goes
+		SInt32			tone[NUM_STRINGS];							//!< The open string tones
+		UInt16			style;										//!< Tablature or chart
+		PartMask		partMask;									//!< Parts to write
+		char			nameLine[DOC_PARTS][kTabLineSize];			//!< Chord names for each part
+		char			stringLine[DOC_PARTS][NUM_STRINGS][kTabLineSize];	//!< Frets for each string
+		UInt16			column;										//!< The width of the system so far
+		UInt16			nameUsed[DOC_PARTS];						//!< Bytes in each name line
+		PartMask		partsUsed;									//!< Parts with chords in the system
+		UInt32			barCount;									//!< Bars written
+		FPTabName		nameCache[kTabNameCacheSize];				//!< Chord names by content
+
+	public:
+		FPTabWriter(TByteSink &inSink, const SInt32 inTone[NUM_STRINGS], UInt16 inStyle=kTabStyleTablature, PartMask parts=kAllChannelsMask);
+		~FPTabWriter() {}
+
+		void			Begin(const char *title);
+		void			AddGroup(const FPChordGroup &group);
+		void			AddGroups(const FPChordGroupArray &groups);
+		OSErr			Finish();
+
+	private:
+		const char*		NameOfChord(const FPChord &chord);
+		void			FlushSystem();
+		void			StartSystem();
+		void			WriteLine(const char *line, UInt16 length);
+		static UInt16	CopyName(char *dst, const char *src, UInt16 size);
+		static UInt16	TextWidth(const char *text, UInt16 length);
+};
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ *  FPTransformPipeline.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPTransformPipeline.h"
+#include "FPScalePalette.h"
+
+
+/*!
+ * Append
+ *
+ *	Add a transform to the end of the pipeline, fusing it with an
+ *	earlier transform of the same kind if nothing in between gets
+ *	in the way. Identity transforms are simply dropped.
+ */
+void FPTransformPipeline::Append(FPTransformType type, SInt16 amount) {
+	switch (type) {
+		case kTransformTranspose:
+			amount = NOTEMOD(amount);
+			if (amount == 0) return;
+			break;
+
+		// Callers pass "down" either as a negative count or as
+		// NUM_STEPS-1, so bring the count into -3...3 before
+		// fusing, and a step down always sums with a step down.
+		case kTransformHarmonize:
+			amount %= NUM_STEPS;
+			if (amount > NUM_STEPS / 2)
+				amount -= NUM_STEPS;
+			else if (amount < -(NUM_STEPS / 2))
+				amount += NUM_STEPS;
+			if (amount == 0) return;
+			break;
+
+		default:
+			amount = 0;
+			break;
+	}
+
+	for (int i=opList.size(); i--;) {
+		FPTransformOp &op = opList[i];
+
+		if (op.type == type) {
+			switch (type) {
+				case kTransformTranspose:
+					op.amount = NOTEMOD(op.amount + amount);
+					if (op.amount == 0)
+						opList.erase(opList.begin() + i);
+					return;
+
+				// Harmonizing only sums in one direction. Up then down
+				// doesn't restore tones that were outside the scale.
+				// After the first step every tone is in the scale, so
+				// whole octaves of steps past the first can be dropped.
+				case kTransformHarmonize:
+					if ((op.amount < 0) == (amount < 0)) {
+						SInt16 sum = ABS(op.amount + amount);
+						sum = (sum - 1) % NUM_STEPS + 1;
+						op.amount = (amount < 0) ? -sum : sum;
+						return;
+					}
+					break;
+
+				// These undo themselves
+				case kTransformInvertTones:
+				case kTransformFlipPattern:
+					opList.erase(opList.begin() + i);
+					return;
+
+				// Reversing drops steps past the end of the pattern
+				case kTransformReversePattern:
+					break;
+			}
+			break;
+		}
+
+		if (!Commutes(op.type, type))
+			break;
+	}
+
+	FPTransformOp newOp = { type, amount };
+	opList.push_back(newOp);
+}
+
+
+/*!
+ * Append
+ *
+ *	Add all the transforms from another pipeline
+ */
+void FPTransformPipeline::Append(const FPTransformPipeline &pipe) {
+	for (FPTransformList::const_iterator itr = pipe.opList.begin(); itr != pipe.opList.end(); itr++)
+		Append(itr->type, itr->amount);
+}
+
+
+/*!
+ * Commutes
+ *
+ *	Pattern transforms never interact with tone transforms.
+ *	Transposing commutes with the other tone transforms because
+ *	the scale mask simply rotates with the key.
+ */
+bool FPTransformPipeline::Commutes(FPTransformType a, FPTransformType b) {
+	bool	aPattern = (a == kTransformReversePattern || a == kTransformFlipPattern),
+			bPattern = (b == kTransformReversePattern || b == kTransformFlipPattern);
+
+	if (aPattern || bPattern)
+		return true;
+
+	return (a == kTransformTranspose || b == kTransformTranspose);
+}
+
+
+/*!
+ * ChangesTones
+ *
+ *	Whether the chords will need to be re-fingered
+ */
+bool FPTransformPipeline::ChangesTones() const {
+	for (FPTransformList::const_iterator itr = opList.begin(); itr != opList.end(); itr++)
+		if (itr->type != kTransformReversePattern && itr->type != kTransformFlipPattern)
+			return true;
+
+	return false;
+}
+
+
+/*!
+ * Apply
+ *
+ *	Materialize all the transforms on a single chord
+ */
+void FPTransformPipeline::Apply(FPChord &chord) const {
+	UInt16 mode = (scaleMode >= 0) ? scaleMode : scalePalette->CurrentMode();
+
+	for (FPTransformList::const_iterator itr = opList.begin(); itr != opList.end(); itr++) {
+		switch (itr->type) {
+			case kTransformTranspose:
+				chord.TransposeBy(itr->amount);
+				break;
+
+			case kTransformHarmonize:
+				chord.ResetStepInfo();
+				chord.HarmonizeBy(itr->amount, mode);
+				break;
+
+			case kTransformInvertTones:
+				chord.InvertTones(mode);
+				break;
+
+			case kTransformReversePattern:
+				chord.ReversePattern();
+				break;
+
+			case kTransformFlipPattern:
+				chord.FlipPattern();
+				break;
+		}
+	}
+
+	// Frets above the bracket are never used, so
+	// the bracket is as far as the search goes
+	if (ChangesTones()) {
+		if (fingerTone)
+			chord.NewFingering(fingerTone, chord.brakHi);
+		else
+			chord.NewFingering();
+	}
+}
+
+
+/*!
+ * Apply
+ *
+ *	Materialize the transforms on the masked parts of a group
+ */
+void FPTransformPipeline::Apply(FPChordGroup &group, PartMask partMask) const {
+	if (IsEmpty())
+		return;
+
+	for (PartIndex p=DOC_PARTS; p--;)
+		if ((partMask & BIT(p)) != 0)
+			Apply(group[p]);
+}
+
+
+/*!
+ * Preview
+ *
+ *	Get a transformed copy of a chord without changing it
+ */
+FPChord FPTransformPipeline::Preview(const FPChord &chord) const {
+	FPChord result(chord);
+	Apply(result);
+	return result;
+}
+
+
+/*!
+ * Commit
+ *
+ *	Transform a range of groups in place
+ */
+void FPTransformPipeline::Commit(FPChordGroupArray &groups, ChordIndex start, ChordIndex end, PartMask partMask) const {
+	if (IsEmpty() || partMask == 0)
+		return;
+
+	for (ChordIndex i=start; i<=end; i++)
+		Apply(groups[i], partMask);
+}
+
+
+/*!
+ * CommitCopy
+ *
+ *	Copy a run of groups to another place in the array,
+ *	transforming them on the way. The destination must
+ *	already exist and shouldn't overlap the source.
+ */
+void FPTransformPipeline::CommitCopy(FPChordGroupArray &groups, ChordIndex srcStart, ChordIndex dstStart, ChordIndex count, PartMask partMask) const {
+	for (ChordIndex i=0; i<count; i++) {
+		FPChordGroup &dst = groups[dstStart + i];
+		dst = groups[srcStart + i];
+		Apply(dst, partMask);
+	}
+}
+
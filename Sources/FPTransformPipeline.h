@@ -0,0 +1,88 @@
+/*!
+ *	@file FPTransformPipeline.h
+ *
+ *	@brief A lazy chain of chord transforms over a range of chord groups
+ *
+ *	A pipeline collects transforms without touching the document.
+ *	Adjacent transforms of the same kind are fused as they are added,
+ *	so transpose+transpose becomes a single transpose, two flips
+ *	cancel out, and so on. Transforms that don't interact (for example
+ *	pattern flips and tone transposition) are allowed to pass one
+ *	another so more of them can be fused.
+ *
+ *	Nothing is changed until the pipeline is applied to a chord or
+ *	committed to a range, and fingering is only recalculated once per
+ *	chord at that time.
+ *
+ *	By default the pipeline harmonizes and inverts in the scale palette's
+ *	current mode and fingers for the guitar palette's tuning. Those are
+ *	main thread state, so a pipeline only runs safely on another thread
+ *	once it has been given both a scale with SetScale and a tuning with
+ *	SetTuning.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPTRANSFORMPIPELINE_H
+#define FPTRANSFORMPIPELINE_H
+
+#include "FPChord.h"
+#include <vector>
+
+//! The transforms a pipeline knows how to perform
+enum FPTransformType {
+	kTransformTranspose,			//!< Transpose by a number of half-steps
+	kTransformHarmonize,			//!< Harmonize by a number of scale steps
+	kTransformInvertTones,			//!< Invert the tones within the scale
+	kTransformReversePattern,		//!< Reverse the pattern (horizontal flip)
+	kTransformFlipPattern			//!< Flip the pattern strings (vertical flip)
+};
+
+//! A single transform with its parameter
+typedef struct {
+	FPTransformType	type;			//!< The kind of transform
+	SInt16			amount;			//!< Interval or step count, if any
+} FPTransformOp;
+
+typedef std::vector<FPTransformOp> FPTransformList;
+
+#pragma mark -
+//-----------------------------------------------
+//
+// FPTransformPipeline
+//
+class FPTransformPipeline {
+	private:
+		FPTransformList	opList;
+		const SInt32	*fingerTone;		//!< The tuning to finger for, or NULL for the palette's
+		SInt16			scaleMode;			//!< The scale mode to harmonize in, or -1 for the palette's
+
+	public:
+		FPTransformPipeline() : fingerTone(NULL), scaleMode(-1) {}
+		FPTransformPipeline(FPTransformType type, SInt16 amount=0) : fingerTone(NULL), scaleMode(-1)	{ Append(type, amount); }
+
+		void				Append(FPTransformType type, SInt16 amount=0);
+		void				Append(const FPTransformPipeline &pipe);
+		inline void			Clear()									{ opList.clear(); }
+		inline bool			IsEmpty() const							{ return opList.empty(); }
+		inline UInt16		Size() const							{ return opList.size(); }
+		bool				ChangesTones() const;
+		inline void			SetTuning(const SInt32 tone[NUM_STRINGS])	{ fingerTone = tone; }
+		inline void			SetScale(UInt16 mode)					{ scaleMode = mode; }
+
+		void				Apply(FPChord &chord) const;
+		void				Apply(FPChordGroup &group, PartMask partMask) const;
+		FPChord				Preview(const FPChord &chord) const;
+
+		void				Commit(FPChordGroupArray &groups, ChordIndex start, ChordIndex end, PartMask partMask) const;
+		void				CommitCopy(FPChordGroupArray &groups, ChordIndex srcStart, ChordIndex dstStart, ChordIndex count, PartMask partMask) const;
+
+	private:
+		static bool			Commutes(FPTransformType a, FPTransformType b);
+};
+
+#endif
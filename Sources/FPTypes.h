@@ -9,8 +9,95 @@
 #ifndef FPTYPES_H
 #define FPTYPES_H
 
+#if FP_PORTABLE
+
+//
+// The tests and command line tools build without Carbon,
+// so they get the few Mac types the portable sources use
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+typedef uint8_t			UInt8;
+typedef int8_t			SInt8;
+typedef uint16_t		UInt16;
+typedef int16_t			SInt16;
+typedef uint32_t		UInt32;
+typedef int32_t			SInt32;
+typedef uint64_t		UInt64;
+typedef int64_t			SInt64;
+typedef unsigned char	Boolean;
+typedef SInt16			OSErr;
+typedef SInt32			OSStatus;
+typedef unsigned char	Str31[32];
+typedef unsigned char	*StringPtr;
+typedef struct { SInt16 v, h; } Point;
+typedef struct { UInt16 red, green, blue; } RGBColor;
+typedef const struct __CFArray *CFArrayRef;
+
+enum {
+	noErr				= 0,
+	ioErr				= -36,
+	eofErr				= -39,
+	fnfErr				= -43,
+	paramErr			= -50,
+	memFullErr			= -108
+};
+
+// QuickTime's instrument numbers
+enum {
+	kFirstGMInstrument	= 0x0001,
+	kLastGMInstrument	= 0x0080,
+	kFirstGSInstrument	= 0x0081,
+	kLastGSInstrument	= 0x3FFF,
+	kFirstDrumkit		= 0x4000,
+	kLastDrumkit		= 0x4080
+};
+
+#define Endian16_Swap(x)		__builtin_bswap16(x)
+#define Endian32_Swap(x)		__builtin_bswap32(x)
+
+#if defined(__BIG_ENDIAN__)
+	#define EndianU16_BtoN(x)	((UInt16)(x))
+	#define EndianU32_BtoN(x)	((UInt32)(x))
+	#define EndianU16_LtoN(x)	((UInt16)Endian16_Swap(x))
+	#define EndianU32_LtoN(x)	((UInt32)Endian32_Swap(x))
+#else
+	#define EndianU16_BtoN(x)	((UInt16)Endian16_Swap(x))
+	#define EndianU32_BtoN(x)	((UInt32)Endian32_Swap(x))
+	#define EndianU16_LtoN(x)	((UInt16)(x))
+	#define EndianU32_LtoN(x)	((UInt32)(x))
+#endif
+
+#define EndianS16_BtoN(x)		((SInt16)EndianU16_BtoN(x))
+#define EndianS32_BtoN(x)		((SInt32)EndianU32_BtoN(x))
+#define EndianS16_LtoN(x)		((SInt16)EndianU16_LtoN(x))
+#define EndianS32_LtoN(x)		((SInt32)EndianU32_LtoN(x))
+
+#define BlockMoveData(src, dst, size)	memmove(dst, src, size)
+
+// Older C libraries on Linux don't have strlcpy
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+inline size_t strlcpy(char *dst, const char *src, size_t size) {
+	size_t len = strlen(src);
+	if (size) {
+		size_t n = (len < size) ? len : size - 1;
+		memcpy(dst, src, n);
+		dst[n] = '\0';
+	}
+	return len;
+}
+#endif
+
+#else
+
 #include <Carbon/Carbon.h>
 
+#endif
+
 typedef UInt16	Tone;
 typedef SInt16	PartIndex;
 typedef UInt16	PartMask;
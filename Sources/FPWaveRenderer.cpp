@@ -0,0 +1,311 @@
+/*
+ *  FPWaveRenderer.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPWaveRenderer.h"
+#include "TByteSink.h"
+#include "TWorkGroup.h"
+
+#include <math.h>
+
+#define kWaveHeadSize		44			//!< RIFF, fmt and data headers
+#define kWaveMinAllpass		0.1			//!< Keeps the tuning filter stable
+
+//
+// NextNoise
+//
+//	A small random number generator, so every render
+//	of the same document comes out the same
+//
+static inline UInt32 NextNoise(UInt32 &seed) {
+	seed = seed * 1664525 + 1013904223;
+	return seed;
+}
+
+
+FPWaveRenderer::FPWaveRenderer(const FPNoteData &inNotes, UInt16 tempo, UInt32 rate) : notes(inNotes) {
+	sampleRate		= rate;
+	samplesPerStep	= rate * 60.0 / MAX(tempo, 1);
+	blockStart		= 0;
+	blockLength		= 0;
+
+	for (PartIndex p=DOC_PARTS; p--;) {
+		sustain[p]		= 0;
+		part[p].next	= 0;
+		part[p].gain	= 0;
+		part[p].seed	= p + 1;
+		part[p].drum	= false;
+		part[p].enabled	= false;
+	}
+}
+
+
+/*!
+ * SetPart
+ *
+ *	Turn on a part. Sustain is in sixtieths of a second,
+ *	the same as the document's.
+ */
+void FPWaveRenderer::SetPart(PartIndex p, UInt16 velocity, UInt16 sustainJiffies, bool drum) {
+	sustain[p]		= (UInt32)((double)sampleRate * sustainJiffies / 60.0);
+	part[p].gain	= kWaveVoiceGain * MIN(velocity, 127) / 127.0f;
+	part[p].drum	= drum;
+	part[p].enabled	= true;
+}
+
+
+/*!
+ * Render
+ *
+ *	Write the whole song to a sink as a WAV file. The sink
+ *	can be a file sink, so only one block is ever held.
+ */
+OSErr FPWaveRenderer::Render(TByteSink &sink, UInt16 maxThreads) {
+	UInt32 length = Prepare();
+	UInt32 dataSize = length * 2;
+
+	sink.LongBE('RIFF');
+	sink.LongLE(kWaveHeadSize - 8 + dataSize);
+	sink.LongBE('WAVE');
+
+	sink.LongBE('fmt ');
+	sink.LongLE(16);
+	sink.WordLE(1);						// PCM
+	sink.WordLE(1);						// Mono
+	sink.LongLE(sampleRate);
+	sink.LongLE(sampleRate * 2);		// Bytes per second
+	sink.WordLE(2);						// Bytes per frame
+	sink.WordLE(16);					// Bits per sample
+
+	sink.LongBE('data');
+	sink.LongLE(dataSize);
+
+	TWorkGroup group(RenderJob, this);
+
+	for (blockStart=0; blockStart<length && sink.Error() == noErr; blockStart += blockLength) {
+		blockLength = MIN(length - blockStart, kWaveBlockSize);
+
+		group.Run(DOC_PARTS, maxThreads);
+
+		// Mix the parts in order so the sum is always the same
+		for (UInt32 i=0; i<blockLength; i++) {
+			float mix = 0;
+			for (PartIndex p=0; p<DOC_PARTS; p++)
+				if (part[p].enabled)
+					mix += part[p].buffer[i];
+
+			CONSTRAIN(mix, -1.0f, 1.0f);
+			sink.WordLE((UInt16)(SInt16)lrintf(mix * 32767.0f));
+		}
+	}
+
+	return sink.Error();
+}
+
+
+//
+// Prepare
+//
+//	Build each part's timeline in samples and set up its
+//	voices. Returns the length of the song in samples.
+//
+UInt32 FPWaveRenderer::Prepare() {
+	UInt32 length = 0;
+
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		FPWavePart &wp = part[p];
+
+		wp.next = 0;
+		wp.timeline.clear();
+
+		if (!wp.enabled)
+			continue;
+
+		notes.Timeline(wp.timeline, samplesPerStep, sustain, BIT(p));
+
+		if (wp.timeline.size())
+			length = MAX(length, wp.timeline.back().time + kWaveRelease);
+
+		wp.voice.resize(kWavePolyphony);
+		for (UInt16 v=0; v<kWavePolyphony; v++)
+			wp.voice[v].active = false;
+
+		wp.buffer.resize(kWaveBlockSize);
+	}
+
+	return length;
+}
+
+
+//
+// RenderJob
+//
+//	Worker entry point for one part
+//
+void FPWaveRenderer::RenderJob(void *context, UInt32 index) {
+	FPWaveRenderer *self = (FPWaveRenderer*)context;
+
+	if (self->part[index].enabled)
+		self->RenderPart(index);
+}
+
+
+//
+// RenderPart
+//
+//	Render one part's share of the block, starting and
+//	stopping notes at the exact sample they fall on
+//
+void FPWaveRenderer::RenderPart(PartIndex p) {
+	FPWavePart	&wp = part[p];
+	UInt32		t = blockStart, end = blockStart + blockLength;
+
+	bzero(&wp.buffer[0], blockLength * sizeof(float));
+
+	while (t < end) {
+		while (wp.next < wp.timeline.size() && wp.timeline[wp.next].time <= t) {
+			const FPTimedEvent &e = wp.timeline[wp.next++];
+			if (e.on)
+				Pluck(wp, e);
+			else
+				Release(wp, e);
+		}
+
+		UInt32 until = end;
+		if (wp.next < wp.timeline.size())
+			until = MIN(until, wp.timeline[wp.next].time);
+
+		RenderVoices(wp, &wp.buffer[t - blockStart], until - t);
+		t = until;
+	}
+}
+
+
+//
+// RenderVoices
+//
+//	Add every sounding voice to the output. Each pass
+//	through the loop averages two samples, which is what
+//	makes the string decay, then an allpass filter adds
+//	the fraction of a sample the pitch needs.
+//
+void FPWaveRenderer::RenderVoices(FPWavePart &wp, float *out, UInt32 count) {
+	for (UInt16 v=0; v<kWavePolyphony; v++) {
+		FPWaveVoice &voice = wp.voice[v];
+		if (!voice.active)
+			continue;
+
+		float	*delay = voice.delay;
+		UInt16	pos = voice.pos, length = voice.length;
+		float	coef = voice.coef, apIn = voice.apIn, apOut = voice.apOut;
+		float	gain = voice.gain, fade = voice.released ? voice.fade : 0;
+
+		for (UInt32 i=0; i<count; i++) {
+			UInt16	nextPos = (pos + 1 == length) ? 0 : pos + 1;
+			float	s = delay[pos],
+					avg = kWaveDecay * 0.5f * (s + delay[nextPos]);
+
+			if (wp.drum && (NextNoise(wp.seed) & 0x10000))
+				avg = -avg;
+
+			apOut = coef * (avg - apOut) + apIn;
+			apIn = avg;
+			delay[pos] = apOut;
+			pos = nextPos;
+
+			out[i] += s * gain;
+
+			if (fade) {
+				gain -= fade;
+				if (gain <= 0) {
+					voice.active = false;
+					break;
+				}
+			}
+		}
+
+		voice.pos	= pos;
+		voice.apIn	= apIn;
+		voice.apOut	= apOut;
+		voice.gain	= gain;
+	}
+}
+
+
+//
+// Pluck
+//
+//	Start a note on a free voice, or on the oldest one.
+//	The loop is filled with noise at the part's level.
+//
+void FPWaveRenderer::Pluck(FPWavePart &wp, const FPTimedEvent &e) {
+	FPWaveVoice *voice = NULL;
+
+	for (UInt16 v=0; v<kWavePolyphony; v++) {
+		FPWaveVoice &candidate = wp.voice[v];
+		if (!candidate.active) {
+			voice = &candidate;
+			break;
+		}
+		if (voice == NULL || candidate.start < voice->start)
+			voice = &candidate;
+	}
+
+	// Averaging each sample with the next one to come takes
+	// half a sample off the loop, so it's half a sample longer
+	// than the period. High octaves stand in for notes too low
+	// for the longest loop.
+	double period = sampleRate / (440.0 * pow(2.0, (e.tone - 69) / 12.0));
+	while (period > kWaveMaxDelay - 2)
+		period /= 2;
+
+	double	loop = MAX(period + 0.5, 2.0 + kWaveMinAllpass);
+	UInt16	length = (UInt16)(loop - kWaveMinAllpass);
+	double	frac = loop - length;
+
+	voice->length	= length;
+	voice->pos		= 0;
+	voice->coef		= (float)((1.0 - frac) / (1.0 + frac));
+	voice->apIn		= 0;
+	voice->apOut	= 0;
+	voice->gain		= wp.gain;
+	voice->fade		= 0;
+	voice->start	= e.time;
+	voice->tone		= e.tone;
+	voice->active	= true;
+	voice->released	= false;
+
+	float sum = 0;
+	for (UInt16 i=0; i<length; i++) {
+		voice->delay[i] = (NextNoise(wp.seed) >> 8) * (2.0f / 0x1000000) - 1.0f;
+		sum += voice->delay[i];
+	}
+
+	// No offset, so the string comes to rest at zero
+	float mean = sum / length;
+	for (UInt16 i=0; i<length; i++)
+		voice->delay[i] -= mean;
+}
+
+
+//
+// Release
+//
+//	Fade out the voice playing a stopped note
+//
+void FPWaveRenderer::Release(FPWavePart &wp, const FPTimedEvent &e) {
+	for (UInt16 v=0; v<kWavePolyphony; v++) {
+		FPWaveVoice &voice = wp.voice[v];
+
+		if (voice.active && !voice.released && voice.tone == e.tone) {
+			voice.released	= true;
+			voice.fade		= voice.gain / kWaveRelease;
+			break;
+		}
+	}
+}
+
@@ -0,0 +1,110 @@
+/*!
+ *	@file FPWaveRenderer.h
+ *
+ *	@brief Renders a note list to a WAV file offline
+ *
+ *	Live playback can only sound as fast as the clock. The wave
+ *	renderer plays a compiled note list through a small plucked
+ *	string synth instead, as fast as it can, and streams the
+ *	result to a byte sink as a 16-bit mono WAV file.
+ *
+ *	Each note is a Karplus-Strong string: a loop of noise that
+ *	is smoothed on every pass, so it rings at the loop's pitch
+ *	and dies away like a plucked string. Drum parts flip the
+ *	sign at random, which turns the string into a drum.
+ *
+ *	The song is rendered a block at a time. Each part renders
+ *	its block on its own thread, then the parts are mixed and
+ *	written. Voices are made once, so memory doesn't grow with
+ *	the length of the song. Nothing here needs an audio device
+ *	or Carbon. It plays FPNoteData, not the document, and a byte
+ *	sink can write to a stdio stream, so Tests/Makefile also
+ *	builds it into a command line tool.
+ *
+ *	@section COPYRIGHT
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#ifndef FPWAVERENDERER_H
+#define FPWAVERENDERER_H
+
+#include "FPNoteData.h"
+
+class TByteSink;
+
+#define kWaveSampleRate		44100		//!< Samples per second
+#define kWaveBlockSize		0x10000		//!< Samples rendered at a time
+#define kWaveMaxDelay		2048		//!< The longest string loop
+#define kWavePolyphony		12			//!< Voices per part
+#define kWaveRelease		441			//!< Samples to fade a stopped note
+#define kWaveDecay			0.996f		//!< Loss on each pass of the loop
+#define kWaveVoiceGain		0.1f		//!< The level of one voice at full velocity
+
+/*!
+ *	A plucked string
+ */
+typedef struct {
+	float		delay[kWaveMaxDelay];	//!< The string
+	UInt16		length;					//!< Samples in the loop
+	UInt16		pos;					//!< The next sample
+	float		coef;					//!< Allpass coefficient for the fine tuning
+	float		apIn, apOut;			//!< The last allpass input and output
+	float		gain;					//!< The current level
+	float		fade;					//!< Level lost per sample once released
+	UInt32		start;					//!< When it was plucked
+	UInt8		tone;					//!< The MIDI note number
+	bool		active;					//!< Sounding now
+	bool		released;				//!< Fading out
+} FPWaveVoice;
+
+/*!
+ *	Everything one part needs to render
+ */
+typedef struct {
+	FPTimeline					timeline;	//!< Starts and stops in samples
+	UInt32						next;		//!< The next event
+	std::vector<FPWaveVoice>	voice;		//!< The voices
+	std::vector<float>			buffer;		//!< The current block
+	float						gain;		//!< Level at the part's velocity
+	UInt32						seed;		//!< Noise state
+	bool						drum;		//!< A drum part
+	bool						enabled;	//!< Rendered at all
+} FPWavePart;
+
+
+#pragma mark -
+//-----------------------------------------------
+//
+// FPWaveRenderer
+//
+class FPWaveRenderer {
+	private:
+		const FPNoteData	&notes;					//!< The notes to play
+		UInt32				sampleRate;				//!< Samples per second
+		double				samplesPerStep;			//!< Samples per sixteenth
+		UInt32				sustain[DOC_PARTS];		//!< Note length of each part in samples
+		FPWavePart			part[DOC_PARTS];		//!< The parts
+		UInt32				blockStart;				//!< The first sample of the block
+		UInt32				blockLength;			//!< Samples in the block
+
+	public:
+		FPWaveRenderer(const FPNoteData &inNotes, UInt16 tempo, UInt32 rate=kWaveSampleRate);
+		~FPWaveRenderer() {}
+
+		void				SetPart(PartIndex p, UInt16 velocity, UInt16 sustainJiffies, bool drum);
+		OSErr				Render(TByteSink &sink, UInt16 maxThreads=0);
+
+	private:
+		UInt32				Prepare();
+		void				RenderPart(PartIndex p);
+		void				RenderVoices(FPWavePart &wp, float *out, UInt32 count);
+		void				Pluck(FPWavePart &wp, const FPTimedEvent &e);
+		void				Release(FPWavePart &wp, const FPTimedEvent &e);
+
+		static void			RenderJob(void *context, UInt32 index);
+};
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ *  FretPet_Portable_Prefix.h
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ *	The prefix for the tests and command line tools in
+ *	Tests/Makefile. They only use sources that don't need
+ *	Carbon, so they also build on Linux.
+ *
+ */
+
+#define SPARKLE_SUPPORT		0
+#define KAGI_SUPPORT		0
+#define DEMO_ONLY			0
+#define APPSTORE_SUPPORT	0
+#define QUICKTIME_SUPPORT	0
+#define DEBUG_REFCOUNTS		0
+#define FP_PORTABLE			1
+
+#include "FPTypes.h"
+#include "FPMacros.h"
+#include "FPGlobals.h"
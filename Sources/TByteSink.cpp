@@ -0,0 +1,232 @@
+/*
+ *  TByteSink.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "TByteSink.h"
+#if !FP_PORTABLE
+#include "TFile.h"
+#endif
+
+
+TByteSink::TByteSink(UInt32 initialSize) {
+	file		= NULL;
+	stream		= NULL;
+	capacity	= initialSize ? initialSize : kByteSinkChunkSize;
+	buffer		= (UInt8*)malloc(capacity);
+	used		= 0;
+	flushed		= 0;
+	err			= buffer ? noErr : memFullErr;
+}
+
+
+TByteSink::TByteSink(TFile &inFile) {
+	file		= &inFile;
+	stream		= NULL;
+	capacity	= kByteSinkFileBuffer;
+	buffer		= (UInt8*)malloc(capacity);
+	used		= 0;
+	flushed		= 0;
+	err			= buffer ? noErr : memFullErr;
+}
+
+
+TByteSink::TByteSink(FILE *inStream) {
+	file		= NULL;
+	stream		= inStream;
+	capacity	= kByteSinkFileBuffer;
+	buffer		= (UInt8*)malloc(capacity);
+	used		= 0;
+	flushed		= 0;
+	err			= buffer ? noErr : memFullErr;
+}
+
+
+TByteSink::~TByteSink() {
+	free(buffer);
+}
+
+
+void TByteSink::Bytes(const void *data, UInt32 length) {
+	const UInt8 *src = (const UInt8*)data;
+
+	while (length && err == noErr) {
+		if (used == capacity && !MakeRoom(length))
+			break;
+
+		UInt32 count = MIN(length, capacity - used);
+		memcpy(buffer + used, src, count);
+		used += count;
+		src += count;
+		length -= count;
+	}
+}
+
+
+/*!
+ * Patch
+ *
+ *	Bytes still in the buffer are replaced there.
+ *	Bytes already flushed are written to the file or
+ *	stream in place, and then writing carries on at
+ *	the end.
+ */
+void TByteSink::Patch(UInt32 position, const void *data, UInt32 length) {
+	if (err != noErr)
+		return;
+
+	if (position + length > Position()) {
+		err = paramErr;
+		return;
+	}
+
+	const UInt8 *src = (const UInt8*)data;
+
+	if (position < flushed) {
+		UInt32 count = MIN(length, flushed - position);
+
+		err = SeekOut(position);
+		if (err == noErr) err = WriteOut(src, count);
+		if (err == noErr) err = SeekOut(-1);
+
+		position += count;
+		src += count;
+		length -= count;
+	}
+
+	if (length && err == noErr)
+		memcpy(buffer + (position - flushed), src, length);
+}
+
+
+void TByteSink::PatchLongBE(UInt32 position, UInt32 v) {
+	UInt8 bytes[4] = { (UInt8)(v >> 24), (UInt8)(v >> 16), (UInt8)(v >> 8), (UInt8)v };
+	Patch(position, bytes, sizeof(bytes));
+}
+
+
+void TByteSink::PatchLongLE(UInt32 position, UInt32 v) {
+	UInt8 bytes[4] = { (UInt8)v, (UInt8)(v >> 8), (UInt8)(v >> 16), (UInt8)(v >> 24) };
+	Patch(position, bytes, sizeof(bytes));
+}
+
+
+void TByteSink::Append(const TByteSink &src) {
+	if (err != noErr)
+		return;
+
+	if (src.err != noErr)
+		err = src.err;
+	else if (src.IsStreaming())
+		err = paramErr;
+	else
+		Bytes(src.buffer, src.used);
+}
+
+
+OSErr TByteSink::Finish() {
+	Flush();
+	return err;
+}
+
+
+#if !FP_PORTABLE
+Handle TByteSink::DetachHandle() {
+	Handle h = NULL;
+
+	if (err == noErr && !IsStreaming()) {
+		h = NewHandle(used);
+		if (h != NULL)
+			BlockMoveData(buffer, *h, used);
+		else
+			err = memFullErr;
+	}
+
+	used = 0;
+	return h;
+}
+#endif
+
+
+//
+// MakeRoom
+//
+//	A file or stream sink flushes its buffer. A memory
+//	sink doubles its buffer until there's room. Returns
+//	false if there can't be room, which also sets the error.
+//
+bool TByteSink::MakeRoom(UInt32 count) {
+	if (err != noErr)
+		return false;
+
+	if (IsStreaming()) {
+		Flush();
+		return err == noErr;
+	}
+
+	UInt32 newCapacity = capacity;
+	while (newCapacity - used < count) {
+		if (newCapacity > 0x7FFFFFFF) {
+			err = memFullErr;
+			return false;
+		}
+		newCapacity *= 2;
+	}
+
+	UInt8 *newBuffer = (UInt8*)realloc(buffer, newCapacity);
+	if (newBuffer == NULL) {
+		err = memFullErr;
+		return false;
+	}
+
+	buffer = newBuffer;
+	capacity = newCapacity;
+
+	return true;
+}
+
+
+void TByteSink::Flush() {
+	if (IsStreaming() && used && err == noErr) {
+		err = WriteOut(buffer, used);
+		flushed += used;
+	}
+
+	if (IsStreaming())
+		used = 0;
+}
+
+
+//
+// WriteOut
+//
+//	Write bytes at the file or stream's offset
+//
+OSErr TByteSink::WriteOut(const void *data, UInt32 length) {
+#if !FP_PORTABLE
+	if (file != NULL)
+		return file->Write(data, length);
+#endif
+
+	return (fwrite(data, 1, length, stream) == length) ? noErr : ioErr;
+}
+
+
+//
+// SeekOut
+//
+//	Move the file or stream's offset to a position,
+//	or to the end for -1
+//
+OSErr TByteSink::SeekOut(SInt32 position) {
+#if !FP_PORTABLE
+	if (file != NULL)
+		return (position < 0) ? file->SetOffsetEOF() : file->SetOffset(position);
+#endif
+
+	return (fseek(stream, (position < 0) ? 0 : position, (position < 0) ? SEEK_END : SEEK_SET) == 0) ? noErr : ioErr;
+}
+
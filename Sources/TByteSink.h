@@ -0,0 +1,119 @@
+/*!
+	@file TByteSink.h
+
+	@brief A bounds-checked byte buffer for building binary files
+
+	A byte sink collects bytes and multi-byte values in either byte
+	order. Every write checks the space left, so a writer can never
+	run past the end of its buffer.
+
+	A sink made with no file grows as needed and hands its bytes
+	over as a Handle at the end. A sink made with a file writes
+	through a fixed buffer instead, flushing it whenever it fills,
+	so a large export needs no more memory than the buffer. A
+	stdio stream works the same way, and is all the portable
+	build in Tests/Makefile has, since TFile needs Carbon.
+
+	Values such as chunk lengths, which aren't known until later,
+	can be patched at an earlier position. If that part was already
+	flushed the file is written in place.
+
+	Errors are sticky. After the first one nothing more is written
+	and Error() returns it.
+
+	FretPet X
+	Copyright © 2012 Scott Lahteine. All rights reserved.
+*/
+
+#ifndef TBYTESINK_H
+#define TBYTESINK_H
+
+#include <stdio.h>
+
+class TFile;
+
+#define kByteSinkChunkSize		0x1000		//!< The first size of a memory sink
+#define kByteSinkFileBuffer		0x10000		//!< The buffer size for a file sink
+
+class TByteSink {
+	private:
+		TFile			*file;			//!< The file to stream to, or NULL
+		FILE			*stream;		//!< The stdio stream to write to, or NULL
+		UInt8			*buffer;		//!< Bytes not yet flushed
+		UInt32			capacity;		//!< The size of the buffer
+		UInt32			used;			//!< Bytes used in the buffer
+		UInt32			flushed;		//!< Bytes already written to the file
+		OSErr			err;			//!< The first error
+
+	public:
+		/*! Constructor for a sink in memory.
+			@param initialSize the starting size of the buffer
+		*/
+		TByteSink(UInt32 initialSize=kByteSinkChunkSize);
+
+		/*! Constructor for a sink that streams to a file.
+			@param inFile a file opened for writing
+		*/
+		TByteSink(TFile &inFile);
+
+		/*! Constructor for a sink that streams to stdio.
+			Patching flushed bytes needs a stream that can seek.
+			@param inStream a stream opened for writing
+		*/
+		TByteSink(FILE *inStream);
+
+		~TByteSink();
+
+		inline void		Byte(UInt8 v)			{ if (used < capacity || MakeRoom(1)) buffer[used++] = v; }
+		void			Bytes(const void *data, UInt32 length);
+
+		inline void		WordBE(UInt16 v)		{ Byte(v >> 8); Byte(v); }
+		inline void		TrioBE(UInt32 v)		{ Byte(v >> 16); Byte(v >> 8); Byte(v); }
+		inline void		LongBE(UInt32 v)		{ Byte(v >> 24); Byte(v >> 16); Byte(v >> 8); Byte(v); }
+
+		inline void		WordLE(UInt16 v)		{ Byte(v); Byte(v >> 8); }
+		inline void		TrioLE(UInt32 v)		{ Byte(v); Byte(v >> 8); Byte(v >> 16); }
+		inline void		LongLE(UInt32 v)		{ Byte(v); Byte(v >> 8); Byte(v >> 16); Byte(v >> 24); }
+
+		//! The number of bytes written so far
+		inline UInt32	Position() const		{ return flushed + used; }
+
+		/*! Replace bytes written earlier.
+			@param position where the bytes start
+			@param data the new bytes
+			@param length the number of bytes
+		*/
+		void			Patch(UInt32 position, const void *data, UInt32 length);
+		void			PatchLongBE(UInt32 position, UInt32 v);
+		void			PatchLongLE(UInt32 position, UInt32 v);
+
+		/*! Append everything written to a memory sink.
+			An error in the other sink becomes this sink's error.
+			@param src the sink to copy from
+		*/
+		void			Append(const TByteSink &src);
+
+		/*! Write out whatever is buffered. For a file or stream sink.
+			@result the first error, if any
+		*/
+		OSErr			Finish();
+
+#if !FP_PORTABLE
+		/*! Move the bytes of a memory sink to a new Handle.
+			The sink is empty afterward.
+			@result the Handle, or NULL after an error
+		*/
+		Handle			DetachHandle();
+#endif
+
+		inline OSErr	Error() const			{ return err; }
+
+	private:
+		inline bool		IsStreaming() const		{ return file != NULL || stream != NULL; }
+		bool			MakeRoom(UInt32 count);
+		void			Flush();
+		OSErr			WriteOut(const void *data, UInt32 length);
+		OSErr			SeekOut(SInt32 position);
+};
+
+#endif
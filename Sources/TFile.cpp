@@ -424,6 +424,26 @@ OSStatus TFile::Create(const FSRef *parentRef, const UniChar *name, UniCharCount
 }
 
 
+OSStatus TFile::CreateSibling(const TFile &sibling, CFStringRef inName) {
+	FSRef		parentRef, newRef;
+	UniChar		name[255];
+	CFIndex		namelen = MIN(CFStringGetLength(inName), 255);
+
+	CFStringGetCharacters(inName, CFRangeMake(0, namelen), name);
+
+	OSStatus err = FSGetCatalogInfo(&sibling.FileRef(), kFSCatInfoNone, NULL, NULL, NULL, &parentRef);
+	if (err == noErr) {
+		err = FSMakeFSRefUnicode(&parentRef, namelen, name, kTextEncodingUnknown, &newRef);
+		if (err == noErr)
+			Specify(newRef);
+		else if (err == fnfErr)
+			err = Create(&parentRef, name, namelen);
+	}
+
+	return err;
+}
+
+
 OSErr TFile::Delete() {
 	OSErr err = FSDeleteObject(&fileRef);
 
@@ -315,6 +315,15 @@ public:
 	OSStatus Create(const FSRef *parentRef, const UniChar *name, UniCharCount namelen);
 
 
+	/*! Specify a file in the same folder as another file,
+		creating it if it doesn't exist yet.
+		@param sibling a file in the containing folder
+		@param inName the full name of the file
+		@result a result code
+	*/
+	OSStatus CreateSibling(const TFile &sibling, CFStringRef inName);
+
+
 	/*! Delete the file from disk
 		@result a result code
 	*/
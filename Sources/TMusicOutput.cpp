@@ -12,10 +12,25 @@
 #include "TMusicOutput.h"
 #include "TString.h"
 #include <QuickTime/QuickTime.h>
+#include <algorithm>
+
+#define kExpiryReserve	256			// Room for notes before the heap grows
 
 NoteAllocator TMusicOutput::helper_na = NULL;
 NoteChannel TMusicOutput::helper_nc = 0;
 TString TMusicOutput::nameCache[kLastFauxGS];
+NoteExpiryList TMusicOutput::expiry;
+pthread_mutex_t TMusicOutput::expiryMutex = PTHREAD_MUTEX_INITIALIZER;
+
+//
+// NoteEndsLater
+//
+//	Orders the expiry heap so the top is the note
+//	that ends first
+//
+static bool NoteEndsLater(const NoteExpiry &a, const NoteExpiry &b) {
+	return S64Compare(a.noteEnd, b.noteEnd) > 0;
+}
 
 TMusicOutput::TMusicOutput() {
 	Init(CFSTR("Music Output"));
@@ -29,9 +44,23 @@ void TMusicOutput::Init(CFStringRef inName) {
 	instrument = 1;
 	name = inName;
 	bzero(state, sizeof(state));
+
+	pthread_mutex_lock(&expiryMutex);
+	expiry.reserve(kExpiryReserve);
+	pthread_mutex_unlock(&expiryMutex);
 }
 
 TMusicOutput::~TMusicOutput() {
+	// Forget this output's notes before it goes away
+	pthread_mutex_lock(&expiryMutex);
+	UInt32 kept = 0;
+	for (UInt32 i=0; i<expiry.size(); i++)
+		if (expiry[i].output != this)
+			expiry[kept++] = expiry[i];
+	expiry.resize(kept);
+	std::make_heap(expiry.begin(), expiry.end(), NoteEndsLater);
+	pthread_mutex_unlock(&expiryMutex);
+
 	if (helper_nc) NADisposeNoteChannel(helper_na, helper_nc);
 	if (helper_na) CloseComponent(helper_na);
 }
@@ -39,11 +68,21 @@ TMusicOutput::~TMusicOutput() {
 #pragma mark -
 
 void TMusicOutput::NoteStart(Byte channel, Byte tone, UInt16 velocity, SInt64 stopTime) {
+	pthread_mutex_lock(&expiryMutex);
+
 	NoteStop(tone);
 	NoteOn(channel, tone, velocity);
 	state[tone].channel = channel;
 	state[tone].isPlaying = true;
 	state[tone].noteEnd = stopTime;
+
+	// A restarted tone leaves its old entry behind. It
+	// no longer matches the state so it won't stop the tone.
+	NoteExpiry entry = { stopTime, this, tone };
+	expiry.push_back(entry);
+	std::push_heap(expiry.begin(), expiry.end(), NoteEndsLater);
+
+	pthread_mutex_unlock(&expiryMutex);
 }
 
 
@@ -131,21 +170,9 @@ CFStringRef TMusicOutput::InstrumentName(Byte channel) {
 
 		// Finally fall back to a non-localized list
 		if (!didSetName) {
-			if (fauxGM >= kFirstFauxGM && fauxGM <= kLastFauxGM) {
-				static const char *names[] = {"Acoustic Grand Piano", "Bright Acoustic Piano", "Electric Grand Piano", "Honkytonk Piano", "Electric Piano", "Chorused Piano", "Harpsichord", "Clavi", "Celesta", "Glockenspiel", "Music Box", "Vibraphone", "Marimba", "Xylophone", "Tubular bells", "Dulcimer", "Drawbar Organ", "Percussive Organ", "Rock Organ", "Church Organ", "Reed Organ", "Accordion", "Harmonica", "Tango Accordion", "Acoustic Nylon Guitar", "Acoustic Steel Guitar", "Electric Jazz Guitar", "Electric Clean Guitar", "Electric Guitar Muted", "Overdriven Guitar", "Distortion Guitar", "Guitar Harmonics", "Acoustic Fretless Bass", "Electric Bass Fingered", "Electric Bass Picked", "Fretless Bass", "Slap Bass 1", "Slap Bass 2", "Synth Bass 1", "Synth Bass 2", "Violin", "Viola", "Cello", "Contrabass", "Tremolo Strings", "Pizzicato Strings", "Orchestral Harp", "Timpani", "Acoustic String Ensemble", "Acoustic String Ensemble 2 ", "SynthStrings 1", "SynthStrings 2", "Aah Choir", "Ooh Choir", "SynthVox", "Orchestra Hit", "Trumpet", "Trombone", "Tuba", "Muted Trumpet", "French Horn", "Brass Section", "Synth Brass 1", "Synth Brass 2", "Soprano Sax", "Alto Sax", "Tenor Sax", "Baritone Sax", "Oboe", "English Horn", "Bassoon", "Clarinet", "Piccolo", "Flute", "Recorder", "Pan Flute", "Bottle Blow", "Shakuhachi", "Whistle", "Ocarina", "Square Wave", "Saw Wave", "Calliope", "Chiffer", "Charang", "Solo Vox", "5th Saw Wave", "Bass & Lead", "Fantasy", "Warm", "Polysynth", "Choir", "Bowed", "Metal", "Halo", "Sweep", "Ice Rain", "Sound Tracks", "Crystal", "Atmosphere", "Brightness", "Goblins", "Echoes", "Space", "Sitar", "Banjo", "Shamisen", "Koto", "Kalimba", "Bag Pipe", "Fiddle", "Shannai", "Tinkle Bell", "Agogo", "Steel Drums", "Woodblock", "Taiko Drum", "Melodic Tom", "Synth Drum", "Reverse Cymbal", "Guitar Fret Noise", "Breath Noise", "Seashore", "Bird Tweet", "Telephone Ring", "Helicopter", "Applause", "Gunshot"};
-				iname = names[fauxGM - kFirstFauxGM];
-			}
-			else if (fauxGM <= kLastFauxDrum) {
-				static const char *drum_names[] = {"Standard Kit", "Room Kit", "Power Kit", "Electronic Kit", "Analog Kit", "Jazz Kit", "Brush Kit", "Orchestra Kit", "SFX Kit"};
-				iname = drum_names[fauxGM - kFirstFauxDrum];
-			}
-			else if (fauxGM >= kFirstFauxGS) {
-				static const char *gs_backup[] = {"GS SynthBass101", "GS Trombone 2", "GS Fr.Horn 2", "GS Square", "GS Saw", "GS Syn Mallet", "GS Echo Bell", "GS Sitar 2", "GS Gt.Cut Noise", "GS Fl.Key Click", "GS Rain", "GS Dog", "GS Telephone 2", "GS Car-Engine", "GS Laughing", "GS Machine Gun", "GS Echo Pan", "GS String Slap", "GS Thunder", "GS Horse-Gallop", "GS DoorCreaking", "GS Car-Stop", "GS Screaming", "GS Lasergun", "GS Wind", "GS Bird 2", "GS Door", "GS Car-Pass", "GS Punch", "GS Explosion", "GS Stream", "GS Scratch", "GS Car-Crash", "GS Heart Beat", "GS Bubble", "GS Wind Chimes", "GS Siren", "GS Footsteps", "GS Train", "GS Jetplane", "GS Piano 1", "GS Piano 2", "GS Piano 3", "GS Honky-tonk", "GS Detuned EP 1", "GS Detuned EP 2", "GS Coupled Hps.", "GS Vibraphone", "GS Marimba", "GS Church Bell", "GS Detuned Or.1", "GS Detuned Or.2", "GS Church Org.2", "GS Accordion It", "GS Ukulele", "GS 12-str.Gt", "GS Hawaiian Gt.", "GS Chorus Gt.", "GS Funk Gt.", "GS Feedback Gt.", "GS Gt. Feedback", "GS Synth Bass 3", "GS Synth Bass 4", "GS Slow Violin", "GS Orchestra", "GS Syn.Strings3", "GS Brass 2", "GS Synth Brass3", "GS Synth Brass4", "GS Sine Wave", "GS Doctor Solo", "GS Taisho Koto", "GS Castanets", "GS Concert BD", "GS Melo. Tom 2", "GS 808 Tom", "GS Starship", "GS Carillon", "GS Elec Perc.", "GS Burst Noise", "GS Piano 1d", "GS E.Piano 1v", "GS E.Piano 2v", "GS Harpsichord", "GS 60's Organ 1", "GS Church Org.3", "GS Nylon Gt.o", "GS Mandolin", "GS Funk Gt.2", "GS Rubber Bass", "GS AnalogBrass1", "GS AnalogBrass2", "GS 60's E.Piano", "GS Harpsi.o", "GS Organ 4", "GS Organ 5", "GS Nylon Gt.2", "GS Choir Aahs 2"};
-					if (fauxGM <= kLastFauxGS)
-						iname = gs_backup[fauxGM - kFirstFauxGS];
-					else
-						iname.SetWithFormat(CFSTR("GS %d"), instrument);
-			}
+			char backup[32];
+			FPMidiHelper::CopyInstrumentName(instrument, backup, sizeof(backup));
+			iname = backup;
 			didSetName = 1;
 		}
 
@@ -231,19 +258,28 @@ ComponentResult TMusicOutput::InitializeQuickTimeChannel(NoteAllocator &na, Note
 
 #pragma mark -
 
-void TMusicOutput::StopExpiredNotes(Byte stoplist[]) {
-	UInt64			time64 = Micro64();
-	SInt64			ot;
+UInt16 TMusicOutput::StopExpiredNotes(Byte stopped[], UInt16 size) {
+	SInt64			time64 = Micro64();
+	UInt16			count = 0;
 
-	for (int tone=0; tone < SYNTH_OCTAVES * OCTAVE; tone++) {
-		if (state[tone].isPlaying) {
-			ot = state[tone].noteEnd;
-			if (S64Compare(time64,ot)>=0) {
-				NoteStop(tone);
-				stoplist[tone] = 1;
-			}
+	if (pthread_mutex_trylock(&expiryMutex) != 0)
+		return 0;
+
+	while (count < size && !expiry.empty() && S64Compare(time64, expiry.front().noteEnd) >= 0) {
+		NoteExpiry entry = expiry.front();
+		std::pop_heap(expiry.begin(), expiry.end(), NoteEndsLater);
+		expiry.pop_back();
+
+		NoteState &note = entry.output->state[entry.tone];
+		if (note.isPlaying && note.noteEnd == entry.noteEnd) {
+			entry.output->NoteStop(entry.tone);
+			stopped[count++] = entry.tone;
 		}
 	}
+
+	pthread_mutex_unlock(&expiryMutex);
+
+	return count;
 }
 
 
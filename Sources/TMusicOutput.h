@@ -21,6 +21,10 @@
 
 #include "TString.h"
 #include <QuickTime/QuickTime.h>
+#include <pthread.h>
+#include <vector>
+
+class TMusicOutput;
 
 //! The state of a note in the MIDI channel.
 typedef struct {
@@ -29,10 +33,21 @@ typedef struct {
 	bool			isPlaying;		//!< a flag that the tone is playing
 } NoteState;
 
+//! A note waiting to be stopped, in the heap shared by all outputs.
+typedef struct {
+	SInt64			noteEnd;		//!< time of note end, in microseconds
+	TMusicOutput	*output;		//!< the output playing the note
+	Byte			tone;			//!< the tone to stop
+} NoteExpiry;
+
+typedef std::vector<NoteExpiry> NoteExpiryList;
+
 //! A rough MIDI output port wrapper.
 class TMusicOutput {
 private:
 	static TString nameCache[kLastFauxGS];
+	static NoteExpiryList expiry;						//!< Notes playing on every output, as a heap by end time
+	static pthread_mutex_t expiryMutex;					//!< Guards the heap and note states between threads
 
 public:
 	NoteState state[SYNTH_OCTAVES * OCTAVE];			//!< The state of all notes in the output
@@ -79,8 +94,9 @@ public:
 	static ComponentResult InitializeQuickTimeChannel(NoteAllocator &na, NoteRequest &nr, NoteChannel &nc);
 
 	/*! Start a MIDI note that will play for some duration.
-		To stop notes played with this method, periodically
-		call StopExpiredNotes.
+		The note is added to the shared expiry heap. To stop
+		notes played with this method, periodically call
+		StopExpiredNotes.
 		@param channel the channel for the note start event
 		@param tone the tone for the note start event
 		@param velocity the velocity for the note start event
@@ -95,10 +111,15 @@ public:
 	virtual void NoteStop(Byte tone);
 
 
-	/*! Stop all expired notes played through NoteStart.
-		@param stoplist a place to flag which notes ended
+	/*! Stop the expired notes of every output, in the order
+		they end. Only the notes that are due are looked at.
+		If another thread is starting a note the call does
+		nothing, so it never waits.
+		@param stopped a place to list the tones that ended
+		@param size the most tones to stop in one call
+		@return the number of tones stopped
 	*/
-	virtual void StopExpiredNotes(Byte stoplist[]);
+	static UInt16 StopExpiredNotes(Byte stopped[], UInt16 size);
 
 
 	//! Stop all notes played through NoteStart.
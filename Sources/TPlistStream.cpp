@@ -0,0 +1,599 @@
+/*
+ *  TPlistStream.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "TPlistStream.h"
+#include "TFile.h"
+
+#include <ctype.h>
+
+#define kPlistHeader	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n" \
+						"<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n" \
+						"<plist version=\"1.0\">\n"
+
+#define kPlistFooter	"</plist>\n"
+
+
+#pragma mark - TPlistWriter
+
+TPlistWriter::TPlistWriter(TFile &inFile) : file(inFile) {
+	buffer	= new char[kPlistBufferSize];
+	used	= 0;
+	depth	= 0;
+	err		= noErr;
+
+	Put(kPlistHeader);
+}
+
+
+TPlistWriter::~TPlistWriter() {
+	delete [] buffer;
+}
+
+
+void TPlistWriter::BeginDictionary(CFStringRef key) {
+	Key(key);
+	Indent();
+	Put("<dict>\n");
+	depth++;
+}
+
+
+void TPlistWriter::EndDictionary() {
+	depth--;
+	Indent();
+	Put("</dict>\n");
+}
+
+
+void TPlistWriter::BeginArray(CFStringRef key) {
+	Key(key);
+	Indent();
+	Put("<array>\n");
+	depth++;
+}
+
+
+void TPlistWriter::EndArray() {
+	depth--;
+	Indent();
+	Put("</array>\n");
+}
+
+
+void TPlistWriter::SetInteger(CFStringRef key, SInt32 value) {
+	char num[40];
+	Key(key);
+	Indent();
+	Put(num, snprintf(num, sizeof(num), "<integer>%ld</integer>\n", (long)value));
+}
+
+
+void TPlistWriter::SetBool(CFStringRef key, bool value) {
+	Key(key);
+	Indent();
+	Put(value ? "<true/>\n" : "<false/>\n");
+}
+
+
+void TPlistWriter::SetString(CFStringRef key, CFStringRef value) {
+	Key(key);
+	Indent();
+	Put("<string>");
+	if (value) PutString(value, true);
+	Put("</string>\n");
+}
+
+
+//
+// SetIntArray
+//
+//	Integer lists are stored as a comma-separated
+//	string, the same as TDictionary::SetIntArray
+//
+void TPlistWriter::SetIntArray(CFStringRef key, const SInt32 inList[], UInt16 inSize) {
+	char num[16];
+	Key(key);
+	Indent();
+	Put("<string>");
+
+	for (UInt16 i=0; i<inSize; i++)
+		Put(num, snprintf(num, sizeof(num), i ? ",%ld" : "%ld", (long)inList[i]));
+
+	Put("</string>\n");
+}
+
+
+//
+// Finish
+//
+//	Close the plist and write out whatever is left
+//
+OSErr TPlistWriter::Finish() {
+	Put(kPlistFooter);
+	Flush();
+	return err;
+}
+
+
+void TPlistWriter::Key(CFStringRef key) {
+	if (key != NULL) {
+		Indent();
+		Put("<key>");
+		PutString(key, true);
+		Put("</key>\n");
+	}
+}
+
+
+void TPlistWriter::Indent() {
+	for (UInt16 i=depth; i--;)
+		Put("\t", 1);
+}
+
+
+void TPlistWriter::Put(const char *text) {
+	Put(text, strlen(text));
+}
+
+
+void TPlistWriter::Put(const char *text, UInt32 length) {
+	while (length && err == noErr) {
+		UInt32 count = MIN(length, kPlistBufferSize - used);
+		memcpy(buffer + used, text, count);
+		used += count;
+		text += count;
+		length -= count;
+
+		if (used == kPlistBufferSize)
+			Flush();
+	}
+}
+
+
+void TPlistWriter::PutEscaped(const char *text, UInt32 length) {
+	UInt32 start = 0;
+
+	for (UInt32 i=0; i<length; i++) {
+		const char *entity = NULL;
+
+		switch (text[i]) {
+			case '&':	entity = "&amp;";	break;
+			case '<':	entity = "&lt;";	break;
+			case '>':	entity = "&gt;";	break;
+		}
+
+		if (entity != NULL) {
+			Put(text + start, i - start);
+			Put(entity);
+			start = i + 1;
+		}
+	}
+
+	Put(text + start, length - start);
+}
+
+
+void TPlistWriter::PutString(CFStringRef string, bool escape) {
+	const char	*ptr = CFStringGetCStringPtr(string, kCFStringEncodingUTF8);
+	char		*copy = NULL;
+
+	if (ptr == NULL) {
+		CFIndex size = CFStringGetMaximumSizeForEncoding(CFStringGetLength(string), kCFStringEncodingUTF8) + 1;
+		copy = new char[size];
+		if (!CFStringGetCString(string, copy, size, kCFStringEncodingUTF8))
+			copy[0] = '\0';
+		ptr = copy;
+	}
+
+	if (escape)
+		PutEscaped(ptr, strlen(ptr));
+	else
+		Put(ptr);
+
+	delete [] copy;
+}
+
+
+void TPlistWriter::Flush() {
+	if (used && err == noErr)
+		err = file.Write(buffer, used);
+
+	used = 0;
+}
+
+
+#pragma mark - TPlistReader
+
+TPlistReader::TPlistReader(TFile &inFile) : file(inFile) {
+	buffer			= new char[kPlistBufferSize];
+	bufferLength	= 0;
+	bufferPos		= 0;
+	remaining		= file.Length() - file.GetOffset();
+
+	textSize		= 256;
+	text			= new char[textSize];
+	text[0]			= '\0';
+	textLength		= 0;
+
+	token			= kPlistEnd;
+	pending			= kPlistEnd;
+}
+
+
+TPlistReader::~TPlistReader() {
+	delete [] buffer;
+	delete [] text;
+}
+
+
+//
+// Next
+//
+//	Parse up to the next element the caller cares about,
+//	passing over the XML declaration, the DOCTYPE, comments,
+//	and the <plist> element itself. The text of a scalar
+//	element is read and unescaped before returning.
+//
+TPlistToken TPlistReader::Next() {
+	if (token == kPlistError)
+		return token;
+
+	if (pending != kPlistEnd) {
+		token = pending;
+		pending = kPlistEnd;
+		return token;
+	}
+
+	for (;;) {
+		int c;
+
+		do { c = GetChar(); } while (c != EOF && isspace(c));
+
+		if (c == EOF)
+			return token = kPlistEnd;
+
+		if (c != '<')
+			return Fail();
+
+		c = PeekChar();
+
+		if (c == '?') {
+			if (!SkipPast("?>")) return Fail();
+			continue;
+		}
+
+		if (c == '!') {
+			(void)GetChar();
+			if (!SkipPast(PeekChar() == '-' ? "-->" : ">")) return Fail();
+			continue;
+		}
+
+		bool closing = (c == '/');
+		if (closing) (void)GetChar();
+
+		char name[16];
+		bool empty;
+		if (!ReadName(name, sizeof(name), empty))
+			return Fail();
+
+		if (!strcmp(name, "plist"))
+			continue;
+
+		if (closing) {
+			if (!strcmp(name, "dict"))	return token = kPlistDictEnd;
+			if (!strcmp(name, "array"))	return token = kPlistArrayEnd;
+			return Fail();
+		}
+
+		if (!strcmp(name, "dict")) {
+			if (empty) pending = kPlistDictEnd;
+			return token = kPlistDictBegin;
+		}
+
+		if (!strcmp(name, "array")) {
+			if (empty) pending = kPlistArrayEnd;
+			return token = kPlistArrayBegin;
+		}
+
+		TPlistToken	type;
+		if		(!strcmp(name, "key"))		type = kPlistKey;
+		else if (!strcmp(name, "string"))	type = kPlistString;
+		else if (!strcmp(name, "integer"))	type = kPlistInteger;
+		else if (!strcmp(name, "real"))		type = kPlistReal;
+		else if (!strcmp(name, "true"))		type = kPlistTrue;
+		else if (!strcmp(name, "false"))	type = kPlistFalse;
+		else if (!strcmp(name, "data"))		type = kPlistData;
+		else if (!strcmp(name, "date"))		type = kPlistDate;
+		else
+			return Fail();
+
+		textLength = 0;
+		text[0] = '\0';
+
+		if (!empty && !ReadContent(name))
+			return Fail();
+
+		return token = type;
+	}
+}
+
+
+//
+// Skip
+//
+//	Pass over the rest of the value that starts with the
+//	element just read. Scalars are already complete, so
+//	this only has work to do for a dictionary or array.
+//
+bool TPlistReader::Skip() {
+	if (token == kPlistDictBegin || token == kPlistArrayBegin) {
+		for (UInt32 level=1; level; ) {
+			switch (Next()) {
+				case kPlistDictBegin:
+				case kPlistArrayBegin:
+					level++;
+					break;
+				case kPlistDictEnd:
+				case kPlistArrayEnd:
+					level--;
+					break;
+				case kPlistEnd:
+					Fail();
+					// fall through
+				case kPlistError:
+					return false;
+				default:
+					break;
+			}
+		}
+	}
+
+	return token != kPlistError && token != kPlistEnd;
+}
+
+
+bool TPlistReader::IsKey(CFStringRef key) const {
+	if (token != kPlistKey)
+		return false;
+
+	const char *ptr = CFStringGetCStringPtr(key, kCFStringEncodingUTF8);
+	if (ptr != NULL)
+		return !strcmp(ptr, text);
+
+	char name[256];
+	return CFStringGetCString(key, name, sizeof(name), kCFStringEncodingUTF8) && !strcmp(name, text);
+}
+
+
+//
+// NextInteger / NextBool / CopyNextString / NextIntArray
+//
+//	Read one value, returning a default if it has
+//	some other type. The value is skipped either way.
+//
+SInt32 TPlistReader::NextInteger(SInt32 defaultVal) {
+	switch (Next()) {
+		case kPlistInteger:	return strtol(text, NULL, 10);
+		case kPlistReal:	return (SInt32)strtod(text, NULL);
+		default:			(void)Skip();
+	}
+
+	return defaultVal;
+}
+
+
+bool TPlistReader::NextBool(bool defaultVal) {
+	switch (Next()) {
+		case kPlistTrue:	return true;
+		case kPlistFalse:	return false;
+		default:			(void)Skip();
+	}
+
+	return defaultVal;
+}
+
+
+CFStringRef TPlistReader::CopyNextString() {
+	if (Next() == kPlistString)
+		return CFStringCreateWithBytes(kCFAllocatorDefault, (const UInt8*)text, textLength, kCFStringEncodingUTF8, false);
+
+	(void)Skip();
+	return NULL;
+}
+
+
+UInt16 TPlistReader::NextIntArray(SInt32 outList[], UInt16 maxItems) {
+	UInt16 count = 0;
+
+	if (Next() == kPlistString) {
+		for (const char *item = text; item != NULL && count < maxItems; count++) {
+			outList[count] = strtol(item, NULL, 10);
+			if ((item = strchr(item, ',')) != NULL)
+				item++;
+		}
+	}
+	else
+		(void)Skip();
+
+	return count;
+}
+
+
+#pragma mark -
+
+int TPlistReader::GetChar() {
+	if (bufferPos == bufferLength) {
+		if (remaining == 0)
+			return EOF;
+
+		UInt32 count = (UInt32)MIN(remaining, (UInt64)kPlistBufferSize);
+		if (file.Read(buffer, count) != noErr) {
+			remaining = 0;
+			return EOF;
+		}
+
+		bufferLength = count;
+		bufferPos = 0;
+		remaining -= count;
+	}
+
+	return (unsigned char)buffer[bufferPos++];
+}
+
+
+int TPlistReader::PeekChar() {
+	int c = GetChar();
+	if (c != EOF) bufferPos--;
+	return c;
+}
+
+
+//
+// SkipPast
+//
+//	Skip to just after a marker of up to 3 characters
+//
+bool TPlistReader::SkipPast(const char *marker) {
+	size_t	length = strlen(marker);
+	char	window[4] = { 0, 0, 0, 0 };
+	int		c;
+
+	while ((c = GetChar()) != EOF) {
+		window[0] = window[1];
+		window[1] = window[2];
+		window[2] = c;
+
+		if (!strncmp(window + 3 - length, marker, length))
+			return true;
+	}
+
+	return false;
+}
+
+
+//
+// ReadName
+//
+//	Read a tag name and skip its attributes, noting
+//	whether the tag closes itself, as in <true/>
+//
+bool TPlistReader::ReadName(char *name, UInt16 size, bool &empty) {
+	UInt16	length = 0;
+	bool	quoted = false;
+	int		c;
+
+	empty = false;
+
+	while ((c = GetChar()) != EOF && !isspace(c) && c != '/' && c != '>') {
+		if (length + 1 >= size)
+			return false;
+		name[length++] = c;
+	}
+
+	name[length] = '\0';
+
+	for (; c != EOF; c = GetChar()) {
+		if (c == '"')
+			quoted = !quoted;
+		else if (!quoted) {
+			if (c == '>')
+				return length > 0;
+			empty = (c == '/');
+		}
+	}
+
+	return false;
+}
+
+
+//
+// ReadContent
+//
+//	Read the text of an element up to its closing tag,
+//	replacing entity and character references
+//
+bool TPlistReader::ReadContent(const char *name) {
+	int c;
+
+	while ((c = GetChar()) != '<') {
+		if (c == EOF)
+			return false;
+
+		if (c != '&') {
+			AppendText(c);
+			continue;
+		}
+
+		char	entity[12];
+		UInt16	length = 0;
+
+		while ((c = GetChar()) != ';') {
+			if (c == EOF || length + 1 >= sizeof(entity))
+				return false;
+			entity[length++] = c;
+		}
+		entity[length] = '\0';
+
+		UInt32 code;
+		if		(!strcmp(entity, "lt"))		code = '<';
+		else if (!strcmp(entity, "gt"))		code = '>';
+		else if (!strcmp(entity, "amp"))	code = '&';
+		else if (!strcmp(entity, "quot"))	code = '"';
+		else if (!strcmp(entity, "apos"))	code = '\'';
+		else if (entity[0] == '#')
+			code = (entity[1] == 'x') ? strtoul(entity + 2, NULL, 16) : strtoul(entity + 1, NULL, 10);
+		else
+			return false;
+
+		// Encode the character as UTF-8
+		if (code < 0x80)
+			AppendText(code);
+		else if (code < 0x800) {
+			AppendText(0xC0 | (code >> 6));
+			AppendText(0x80 | (code & 0x3F));
+		}
+		else if (code < 0x10000) {
+			AppendText(0xE0 | (code >> 12));
+			AppendText(0x80 | ((code >> 6) & 0x3F));
+			AppendText(0x80 | (code & 0x3F));
+		}
+		else {
+			AppendText(0xF0 | (code >> 18));
+			AppendText(0x80 | ((code >> 12) & 0x3F));
+			AppendText(0x80 | ((code >> 6) & 0x3F));
+			AppendText(0x80 | (code & 0x3F));
+		}
+	}
+
+	char	closeName[16];
+	bool	empty;
+
+	return GetChar() == '/'
+		&& ReadName(closeName, sizeof(closeName), empty)
+		&& !strcmp(closeName, name);
+}
+
+
+void TPlistReader::AppendText(char c) {
+	if (textLength + 1 >= textSize) {
+		char *newText = new char[textSize * 2];
+		memcpy(newText, text, textLength);
+		delete [] text;
+		text = newText;
+		textSize *= 2;
+	}
+
+	text[textLength++] = c;
+	text[textLength] = '\0';
+}
+
+
+TPlistToken TPlistReader::Fail() {
+	return token = kPlistError;
+}
+
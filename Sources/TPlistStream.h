@@ -0,0 +1,138 @@
+/*!
+	@file TPlistStream.h
+
+	@brief Stream XML property lists to and from a file
+
+	TPlistWriter writes an XML property list one element at a time
+	through a small buffer. TPlistReader is a pull parser that
+	returns one element at a time, so a caller can build its own
+	objects as it goes. Neither one builds the property list tree
+	in memory, so memory use doesn't grow with the size of the file.
+
+	The output is the same XML that CFPropertyList writes, and the
+	reader accepts anything CFPropertyList writes except that it
+	doesn't decode <data> and <date> values.
+
+	FretPet X
+	Copyright © 2012 Scott Lahteine. All rights reserved.
+*/
+
+#ifndef TPLISTSTREAM_H
+#define TPLISTSTREAM_H
+
+class TFile;
+
+#define kPlistBufferSize	0x8000
+
+//! The elements returned by the reader
+enum TPlistToken {
+	kPlistEnd,						//!< The end of the file
+	kPlistError,					//!< The XML is malformed
+	kPlistDictBegin,				//!< <dict>
+	kPlistDictEnd,					//!< </dict>
+	kPlistArrayBegin,				//!< <array>
+	kPlistArrayEnd,					//!< </array>
+	kPlistKey,						//!< <key>
+	kPlistString,					//!< <string>
+	kPlistInteger,					//!< <integer>
+	kPlistReal,						//!< <real>
+	kPlistTrue,						//!< <true/>
+	kPlistFalse,					//!< <false/>
+	kPlistData,						//!< <data>, not decoded
+	kPlistDate						//!< <date>
+};
+
+#pragma mark -
+#pragma mark class TPlistWriter
+
+/*! Writes an XML property list to an open file.
+ *
+ * Dictionary values take a key; array items pass NULL.
+ * Call Finish() to close the plist and flush the buffer.
+ */
+class TPlistWriter {
+	private:
+		TFile			&file;			//!< The file being written
+		char			*buffer;		//!< Output waiting to be written
+		UInt32			used;			//!< Bytes used in the buffer
+		UInt16			depth;			//!< The current nesting level
+		OSErr			err;			//!< The first write error
+
+	public:
+		TPlistWriter(TFile &inFile);
+		~TPlistWriter();
+
+		void			BeginDictionary(CFStringRef key=NULL);
+		void			EndDictionary();
+		void			BeginArray(CFStringRef key=NULL);
+		void			EndArray();
+
+		void			SetInteger(CFStringRef key, SInt32 value);
+		void			SetBool(CFStringRef key, bool value);
+		void			SetString(CFStringRef key, CFStringRef value);
+		void			SetIntArray(CFStringRef key, const SInt32 inList[], UInt16 inSize);
+
+		OSErr			Finish();
+		inline OSErr	Error() const						{ return err; }
+
+	private:
+		void			Key(CFStringRef key);
+		void			Indent();
+		void			Put(const char *text, UInt32 length);
+		void			Put(const char *text);
+		void			PutEscaped(const char *text, UInt32 length);
+		void			PutString(CFStringRef string, bool escape);
+		void			Flush();
+};
+
+#pragma mark -
+#pragma mark class TPlistReader
+
+/*! Reads an XML property list from an open file.
+ *
+ * Next() returns the next element. The Next...() value
+ * methods read one value and convert it, skipping the
+ * value if it has the wrong type. Errors are sticky.
+ */
+class TPlistReader {
+	private:
+		TFile			&file;			//!< The file being read
+		char			*buffer;		//!< Input not yet parsed
+		UInt32			bufferLength;	//!< Bytes in the buffer
+		UInt32			bufferPos;		//!< The next byte to parse
+		UInt64			remaining;		//!< Bytes not yet read from the file
+		char			*text;			//!< The text of the last element
+		UInt32			textSize;		//!< Space allocated for text
+		UInt32			textLength;		//!< Length of the text
+		TPlistToken		token;			//!< The last element read
+		TPlistToken		pending;		//!< The end of an empty <dict/> or <array/>
+
+	public:
+		TPlistReader(TFile &inFile);
+		~TPlistReader();
+
+		TPlistToken		Next();
+		bool			Skip();
+		inline bool		SkipNext()							{ (void)Next(); return Skip(); }
+
+		inline TPlistToken	Token() const					{ return token; }
+		inline const char*	Text() const					{ return text; }
+		inline bool		HasError() const					{ return token == kPlistError; }
+		bool			IsKey(CFStringRef key) const;
+
+		SInt32			NextInteger(SInt32 defaultVal=0);
+		bool			NextBool(bool defaultVal=false);
+		CFStringRef		CopyNextString();
+		UInt16			NextIntArray(SInt32 outList[], UInt16 maxItems);
+
+	private:
+		int				GetChar();
+		int				PeekChar();
+		bool			SkipPast(const char *marker);
+		bool			ReadName(char *name, UInt16 size, bool &empty);
+		bool			ReadContent(const char *name);
+		void			AppendText(char c);
+		TPlistToken		Fail();
+};
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ *  TWorkGroup.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "TWorkGroup.h"
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#else
+#include <unistd.h>
+#endif
+
+#define MAX_WORK_THREADS	16
+
+
+TWorkGroup::TWorkGroup(TWorkProc inProc, void *inContext) {
+	proc		= inProc;
+	context		= inContext;
+	nextIndex	= 0;
+	count		= 0;
+	pthread_mutex_init(&mutex, NULL);
+}
+
+
+TWorkGroup::~TWorkGroup() {
+	pthread_mutex_destroy(&mutex);
+}
+
+
+UInt16 TWorkGroup::ProcessorCount() {
+#ifdef __APPLE__
+	int		ncpu = 1;
+	size_t	len = sizeof(ncpu);
+
+	if (sysctlbyname("hw.activecpu", &ncpu, &len, NULL, 0) != 0 || ncpu < 1)
+		ncpu = 1;
+#else
+	long	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (ncpu < 1)
+		ncpu = 1;
+#endif
+
+	return ncpu;
+}
+
+
+void TWorkGroup::Run(UInt32 jobCount, UInt16 maxThreads) {
+	nextIndex	= 0;
+	count		= jobCount;
+
+	if (maxThreads == 0)
+		maxThreads = ProcessorCount();
+
+	UInt16 threadCount = MIN(MIN(maxThreads, MAX_WORK_THREADS), jobCount);
+
+	// The calling thread is one of the workers
+	pthread_t	thread[MAX_WORK_THREADS];
+	UInt16		started = 0;
+	for (UInt16 t=1; t<threadCount; t++)
+		if (pthread_create(&thread[started], NULL, ThreadEntry, this) == 0)
+			started++;
+
+	(void)ThreadEntry(this);
+
+	for (UInt16 t=0; t<started; t++)
+		pthread_join(thread[t], NULL);
+}
+
+
+bool TWorkGroup::NextIndex(UInt32 &index) {
+	pthread_mutex_lock(&mutex);
+	bool more = (nextIndex < count);
+	if (more) index = nextIndex++;
+	pthread_mutex_unlock(&mutex);
+	return more;
+}
+
+
+void* TWorkGroup::ThreadEntry(void *group) {
+	TWorkGroup	*self = (TWorkGroup*)group;
+	UInt32		index;
+
+	while (self->NextIndex(index))
+		self->proc(self->context, index);
+
+	return NULL;
+}
+
@@ -0,0 +1,54 @@
+/*!
+	@file TWorkGroup.h
+
+	@brief A simple fork-join helper for running jobs on all cores
+
+	A work group runs a function once for every index in a range,
+	spreading the calls across a handful of POSIX threads. The calls
+	can finish in any order, so jobs should write their results into
+	a slot for their own index. Run() returns only when every job is
+	done, which keeps the results deterministic.
+
+	FretPet X
+	Copyright © 2012 Scott Lahteine. All rights reserved.
+*/
+
+#ifndef TWORKGROUP_H
+#define TWORKGROUP_H
+
+#include <pthread.h>
+
+//! A job to be run for each index
+typedef void (*TWorkProc)(void *context, UInt32 index);
+
+class TWorkGroup {
+	private:
+		pthread_mutex_t	mutex;			//!< Guards the next index
+		TWorkProc		proc;			//!< The job to run
+		void			*context;		//!< Data for the job
+		UInt32			nextIndex;		//!< The next job index to hand out
+		UInt32			count;			//!< The total number of jobs
+
+	public:
+		/*! Constructor.
+			@param inProc the job function
+			@param inContext a pointer passed to every job
+		*/
+		TWorkGroup(TWorkProc inProc, void *inContext);
+		~TWorkGroup();
+
+		/*! Run the job for indexes 0 to jobCount-1.
+			@param jobCount the number of jobs
+			@param maxThreads a thread limit, or 0 for one per core
+		*/
+		void			Run(UInt32 jobCount, UInt16 maxThreads=0);
+
+		//! The number of cores available to the process
+		static UInt16	ProcessorCount();
+
+	private:
+		bool			NextIndex(UInt32 &index);
+		static void*	ThreadEntry(void *group);
+};
+
+#endif
@@ -17,6 +17,10 @@
 #include "TString.h"
 #include "FPTuningInfo.h"
 #include "TError.h"
+#include "FPBatchProcessor.h"
+#include "FPArchiveConverter.h"
+#include "FPSelfTest.h"
+#include "FPExportFile.h"
 
 #if APPSTORE_SUPPORT
 #include "AppStoreValidation.h"
@@ -90,12 +94,92 @@ void initRandom() {
 	srandom(i);
 }
 
+//
+// Batch mode arguments:
+//	FretPet -batch "transpose +2, harmonize up, export midi" file1.fret file2.fret ...
+//
+//	"save xml" and "save binary" convert the documents in place.
+//	"export wave" renders each document to a WAV file.
+//	"export tab" and "export chart" write text tablature and chord charts.
+//	"export musicxml" writes a score with a tablature staff and chord symbols.
+//
+static int		batchFileCount = 0;
+static char		*batchScript = NULL, **batchFiles = NULL;
+
+int fretpet_batch() {
+	FPBatchProcessor batch;
+
+	if (!batch.ParseScript(batchScript))
+		return 2;
+
+	return (batch.Run(batchFileCount, batchFiles) == noErr) ? 0 : 1;
+}
+
+//
+// Convert mode arguments:
+//	FretPet -convert <source folder> <destination folder> [xml|binary]
+//
+//	Without a format the converter uses the save format preference.
+//
+static char		*convertSource = NULL, *convertDest = NULL, *convertFormat = NULL;
+
+int fretpet_convert() {
+#if DEMO_ONLY
+	fprintf(stderr, "FretPet: Converting is not available in the demo\n");
+	return 2;
+#else
+	bool toBinary;
+
+	if (convertFormat == NULL)
+		toBinary = preferences.GetBoolean(kPrefFormatBinary, FALSE);
+	else if (!strcasecmp(convertFormat, "binary"))
+		toBinary = true;
+	else if (!strcasecmp(convertFormat, "xml"))
+		toBinary = false;
+	else {
+		fprintf(stderr, "FretPet: Unknown save format \"%s\"\n", convertFormat);
+		return 2;
+	}
+
+	FPArchiveConverter converter(convertSource, convertDest, toBinary);
+	return (converter.Run() == noErr) ? 0 : 1;
+#endif
+}
+
+//
+// Test mode arguments:
+//	FretPet -test journal file.fp
+//
+//	Runs a self test on a copy of the document. See Tests/README.md.
+//
+static char		*testName = NULL, *testFile = NULL;
+
+int fretpet_test() {
+#if DEMO_ONLY
+	fprintf(stderr, "FretPet: Testing is not available in the demo\n");
+	return 2;
+#else
+	FPSelfTest test(testFile);
+	return test.Run(testName) ? 0 : 1;
+#endif
+}
+
 int fretpet_main(int argc) {
+	int result = noErr;
 	initRandom();
 	(void)Gestalt(gestaltSystemVersion, &systemVersion);
 	try {
 		fretpet = new FPApplication();
-		fretpet->Run();
+
+		// The event loop never runs in batch mode
+		if (batchScript != NULL)
+			result = fretpet_batch();
+		else if (convertSource != NULL)
+			result = fretpet_convert();
+		else if (testName != NULL)
+			result = fretpet_test();
+		else
+			fretpet->Run();
 	}
 	catch (TError &err) {
 		fretpet->hasShownSplash = true;
@@ -103,11 +187,26 @@ int fretpet_main(int argc) {
 		err.Fatal();
 	}
 	delete fretpet;
-	return noErr;
+	return result;
 }
 
 int main(int argc, char* argv[]) {
 
+	if (argc > 3 && !strcmp(argv[1], "-batch")) {
+		batchScript		= argv[2];
+		batchFiles		= &argv[3];
+		batchFileCount	= argc - 3;
+	}
+	else if (argc > 3 && !strcmp(argv[1], "-convert")) {
+		convertSource	= argv[2];
+		convertDest		= argv[3];
+		convertFormat	= (argc > 4) ? argv[4] : NULL;
+	}
+	else if (argc > 3 && !strcmp(argv[1], "-test")) {
+		testName		= argv[2];
+		testFile		= argv[3];
+	}
+
 #if APPSTORE_SUPPORT && !defined(CONFIG_Debug)
 
 	// If the app identifier in the receipt does not match the hard-coded app id then fail
@@ -0,0 +1,110 @@
+/*
+ *  FPClassicNotes.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ */
+
+#include "FPClassicNotes.h"
+#include "FPMidiHelper.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const SInt32 standardTuning[NUM_STRINGS] = { 4, 9, 14, 19, 23, 28 };
+
+
+/*!
+ * MapClassicFile
+ *
+ *	Map a whole file into memory, or return NULL
+ */
+const UInt8* MapClassicFile(const char *path, UInt64 &size) {
+	int fd = open(path, O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) != 0) {
+		if (fd >= 0) close(fd);
+		return NULL;
+	}
+
+	void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	size = info.st_size;
+	return (const UInt8*)data;
+}
+
+
+/*!
+ * ReadClassicNotes
+ *
+ *	Compile every line of a classic file into note data,
+ *	as many times over as copies. Parts the file doesn't
+ *	have are silent, as FPClassicParser::ReadGroups makes
+ *	them. Older files that name a built-in tuning by
+ *	number are played in Standard tuning.
+ */
+void ReadClassicNotes(const FPClassicParser &parser, FPNoteData &notes, UInt16 copies) {
+	const FPClassicHeader	&head = parser.Header();
+	const PartIndex			count = head.partCount;
+	SInt32					tone[NUM_STRINGS];
+	OldChordInfo			block[kClassicSwapBlock * OLD_NUM_PARTS];
+	FPNoteGroup				group;
+	FPNoteBlock				compiled;
+
+	for (int s=NUM_STRINGS; s--;)
+		tone[s] = head.hasTuning ? head.lowNote[s] : standardTuning[s];
+
+	bzero(&group, sizeof(group));
+
+	while (copies--) {
+		for (ChordIndex line=0; line<head.length; line+=kClassicSwapBlock) {
+			ChordIndex lines = MIN(kClassicSwapBlock, head.length - line);
+			parser.ReadChords(line, lines, block);
+
+			const OldChordInfo *info = block;
+			for (ChordIndex i=lines; i--; info += count) {
+				group.beats		= info[0].beats;
+				group.repeat	= info[0].repeat;
+
+				for (PartIndex p=0; p<DOC_PARTS; p++) {
+					FPNotePart &part = group.part[p];
+
+					part.bracket = (p < count) && info[p].bracketFlag;
+					for (int s=NUM_STRINGS; s--;) {
+						part.fretHeld[s]	= (p < count) ? info[p].fretHeld[s] : -1;
+						part.pick[s]		= (p < count) ? info[p].pick[s] : 0;
+					}
+				}
+
+				FPNoteData::CompileBlock(compiled, group, tone);
+				notes.AddLine(compiled);
+			}
+		}
+	}
+}
+
+
+/*!
+ * GetClassicPart
+ *
+ *	Get a part's instrument, velocity and sustain, as
+ *	FPDocument::ReadClassicFormat sets them. Beta 3 only
+ *	saved the first part, so the rest get the defaults.
+ */
+void GetClassicPart(const FPClassicHeader &head, PartIndex p, FPClassicNotePart &part) {
+	const FPClassicPart &src = head.part[p];
+
+	if (head.hasParts || p == 0)
+		part.trueGM = FPMidiHelper::FauxGMToTrueGM(src.fauxGMNumber);
+	else
+		part.trueGM = kFirstGMInstrument;
+
+	part.velocity	= head.hasParts ? src.velocity : 90;
+	part.sustain	= head.hasParts ? src.sustain : 15;
+}
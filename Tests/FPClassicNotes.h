@@ -0,0 +1,32 @@
+/*
+ *  FPClassicNotes.h
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ *	Helpers for the tools that play or export a classic
+ *	document without Carbon. They read the file into
+ *	FPNoteData the way the app reads it into chord groups.
+ *
+ */
+
+#ifndef FPCLASSICNOTES_H
+#define FPCLASSICNOTES_H
+
+#include "FPClassicFormat.h"
+#include "FPNoteData.h"
+
+/*!
+ *	What a tool needs to know about each part
+ */
+typedef struct {
+	UInt16		trueGM;				//!< A QuickTime instrument number
+	UInt16		velocity;			//!< The velocity
+	UInt16		sustain;			//!< The sustain as the document keeps it
+} FPClassicNotePart;
+
+const UInt8*	MapClassicFile(const char *path, UInt64 &size);
+void			ReadClassicNotes(const FPClassicParser &parser, FPNoteData &notes, UInt16 copies=1);
+void			GetClassicPart(const FPClassicHeader &head, PartIndex p, FPClassicNotePart &part);
+
+#endif
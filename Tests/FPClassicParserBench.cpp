@@ -0,0 +1,92 @@
+/*
+ *  FPClassicParserBench.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ *	Time FPClassicParser on a classic document, such as one
+ *	written by make_classic.py, and print the average time
+ *	to parse the header and read every group. The portable
+ *	build reads every chord record instead.
+ *
+ *	FPClassicParserBench file.fp [iterations]
+ *
+ *	See Tests/README.md for how to build it.
+ *
+ */
+
+#include "FPClassicFormat.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+
+static double Now() {
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	return t.tv_sec + t.tv_usec / 1000000.0;
+}
+
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s file.fp [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	int iterations = (argc > 2) ? atoi(argv[2]) : 20;
+	if (iterations < 1) iterations = 1;
+
+	int fd = open(argv[1], O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) != 0) {
+		fprintf(stderr, "%s: can't open %s\n", argv[0], argv[1]);
+		return 1;
+	}
+
+	void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "%s: can't map %s\n", argv[0], argv[1]);
+		return 1;
+	}
+
+	ChordIndex	lines = 0;
+	double		total = 0;
+
+	for (int i=0; i<iterations; i++) {
+		double start = Now();
+
+		FPClassicParser parser((const UInt8*)data, info.st_size);
+		if (parser.Parse() != noErr) {
+			fprintf(stderr, "%s: %s isn't a classic document\n", argv[0], argv[1]);
+			return 1;
+		}
+
+#if FP_PORTABLE
+		// Without Carbon there's no FPChord, so time the records
+		OldChordInfo block[kClassicSwapBlock * OLD_NUM_PARTS];
+		lines = parser.Header().length;
+		for (ChordIndex line=0; line<lines; line+=kClassicSwapBlock)
+			parser.ReadChords(line, MIN(kClassicSwapBlock, lines - line), block);
+#else
+		FPChordGroupArray groups;
+		parser.ReadGroups(groups);
+		lines = groups.size();
+#endif
+
+		total += Now() - start;
+	}
+
+	munmap(data, info.st_size);
+
+	double seconds = total / iterations;
+	printf("%ld lines, %lld bytes: %.3f ms per parse, %.0f lines/s, %.1f MB/s\n",
+			(long)lines, (long long)info.st_size, seconds * 1000.0,
+			lines / seconds, info.st_size / seconds / (1024.0 * 1024.0));
+
+	return 0;
+}
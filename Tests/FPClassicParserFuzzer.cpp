@@ -0,0 +1,61 @@
+/*
+ *  FPClassicParserFuzzer.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ *	A libFuzzer harness for FPClassicParser. Any input the
+ *	parser accepts has every chord record read, and each
+ *	one must come out in range. In the app's own build the
+ *	records are also made into chord groups.
+ *
+ *	See Tests/README.md for how to build and run it.
+ *
+ */
+
+#include "FPClassicFormat.h"
+
+
+extern "C" int LLVMFuzzerTestOneInput(const UInt8 *data, size_t size) {
+	FPClassicParser parser(data, size);
+
+	if (parser.Parse() != noErr)
+		return 0;
+
+	const FPClassicHeader &head = parser.Header();
+
+	if (head.partNum < 0 || head.partNum >= DOC_PARTS || head.topLine < 0 || head.cursor < 0
+		|| head.partCount < 1 || head.partCount > OLD_NUM_PARTS || head.tuningName[0] > 31)
+		abort();
+
+	OldChordInfo block[kClassicSwapBlock * OLD_NUM_PARTS];
+
+	for (ChordIndex line=0; line<head.length; line+=kClassicSwapBlock) {
+		ChordIndex lines = MIN(kClassicSwapBlock, head.length - line);
+		parser.ReadChords(line, lines, block);
+
+		for (ChordIndex i=lines*head.partCount; i--;) {
+			const OldChordInfo &info = block[i];
+
+			if (info.tones > 0x0FFF || info.root >= OCTAVE || info.key >= OCTAVE
+				|| info.beats < 1 || info.beats > MAX_BEATS
+				|| info.repeat > MAX_REPEAT
+				|| info.brakLow > info.brakHi || info.brakHi > MAX_FRETS)
+				abort();
+
+			for (int s=NUM_STRINGS; s--;)
+				if (info.fretHeld[s] < -1 || info.fretHeld[s] > MAX_FRETS)
+					abort();
+		}
+	}
+
+#if !FP_PORTABLE
+	FPChordGroupArray groups;
+	parser.ReadGroups(groups);
+
+	if ((ChordIndex)groups.size() != head.length)
+		abort();
+#endif
+
+	return 0;
+}
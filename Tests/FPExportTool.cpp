@@ -0,0 +1,252 @@
+/*
+ *  FPExportTool.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ *	Write a small built-in document with one of the text
+ *	exporters, for checking against the copies in golden/.
+ *	The MusicXML score has each part's tab staff and the
+ *	chord symbols.
+ *	The document has two parts, a repeat, a chord with its
+ *	bracket off, a missing fifth, two-digit frets, a key
+ *	with sharps and more bars than fit on one line.
+ *
+ *	The app names notes and chords with the scale palette,
+ *	which needs Carbon. This tool has its own FPExportNames
+ *	with fixed names, so the output never changes with the
+ *	app's preferences.
+ *
+ *	FPExportTool tab|chart|musicxml out
+ *
+ *	See Tests/README.md for how to build it.
+ *
+ */
+
+#include "FPExportNames.h"
+#include "FPMusicXMLWriter.h"
+#include "FPTabWriter.h"
+#include "TByteSink.h"
+
+static const SInt32 standardTuning[NUM_STRINGS] = { 4, 9, 14, 19, 23, 28 };
+
+static const char* const sharpName[12] = { "C ", "C#", "D ", "D#", "E ", "F ", "F#", "G ", "G#", "A ", "A#", "B " };
+static const char* const flatName[12] = { "C ", "Db", "D ", "Eb", "E ", "F ", "Gb", "G ", "Ab", "A ", "Bb", "B " };
+
+//! Chord extensions by their tones above the root
+static const struct { UInt16 tones; const char *ext; } chordKind[] = {
+	{ 0x091, "" },				// 1 3 5
+	{ 0x089, "m" },				// 1 b3 5
+	{ 0x491, "7" },				// 1 3 5 b7
+	{ 0x891, "\3067" },			// 1 3 5 7, with a MacRoman Delta
+	{ 0x489, "m7" }				// 1 b3 5 b7
+};
+
+
+#pragma mark -
+//-----------------------------------------------
+//
+// FPExportNames
+//
+//	Sharps in every key but F, Bb, Eb, Ab and Db. A chord
+//	not in the table, even with its fifth, is named "?".
+//
+
+const char* FPExportNames::NameOfNote(UInt16 key, UInt16 tone) {
+	const char* const *name = (BIT(NOTEMOD(key)) & (BIT(1) | BIT(3) | BIT(5) | BIT(8) | BIT(10))) ? flatName : sharpName;
+	return name[NOTEMOD(tone)];
+}
+
+
+const char* FPExportNames::NameOfNote(UInt16 tone) {
+	return NameOfNote(0, tone);
+}
+
+
+void FPExportNames::CopyChordName(const FPChord &chord, char *name, UInt16 size) {
+	UInt16 root = NOTEMOD(chord.root), rel = 0;
+
+	for (UInt16 t=0; t<12; t++)
+		if (chord.HasTone(root + t))
+			rel |= BIT(t);
+
+	const char *ext = "?", *missing = "";
+	for (UInt16 k=0; k<COUNT(chordKind); k++) {
+		if (rel == chordKind[k].tones) {
+			ext = chordKind[k].ext;
+			break;
+		}
+		if ((rel | BIT(7)) == chordKind[k].tones) {
+			ext = chordKind[k].ext;
+			missing = "(5)";
+			break;
+		}
+	}
+
+	snprintf(name, size, "%s:%s:%s", NameOfNote(chord.key, root), ext, missing);
+}
+
+
+#pragma mark -
+//-----------------------------------------------
+//
+// The document
+//
+
+//
+// SetChord
+//
+//	Finger a chord and pick it: every held string on the
+//	first beat, then one string every other beat from the
+//	lowest.
+//
+static void SetChord(FPChord &chord, UInt16 root, UInt16 key, const SInt16 fret[NUM_STRINGS], bool bracket=true) {
+	chord.Init();
+	chord.SetKey(key);
+	chord.SetRoot(root);
+	chord.bracketFlag = bracket;
+
+	UInt16 held[NUM_STRINGS], count = 0;
+	for (UInt16 s=0; s<NUM_STRINGS; s++) {
+		chord.fretHeld[s] = fret[s];
+		if (fret[s] >= 0) {
+			chord.AddTone(standardTuning[s] + fret[s]);
+			held[count++] = s;
+		}
+	}
+
+	for (UInt16 s=0; s<count; s++)
+		chord.SetPatternDot(held[s], 0);
+
+	for (UInt16 beat=2; beat<MAX_BEATS; beat+=2)
+		chord.SetPatternDot(held[(beat / 2 - 1) % count], beat);
+}
+
+
+//
+// BuildDocument
+//
+//	Fill in the four groups of the built-in document
+//
+static void BuildDocument(FPChordGroup group[4]) {
+	static const SInt16	cMajor[]	= { -1, 3, 2, 0, 1, 0 },
+						aMinor[]	= { -1, 0, 2, 2, 1, 0 },
+						aNoFifth[]	= { -1, 0, -1, 2, 1, -1 },
+						gSeventh[]	= { 3, 2, 0, 0, 0, 1 },
+						cMajor7[]	= { -1, 3, 2, 0, 0, 0 },
+						dMajor[]	= { -1, -1, 12, 11, 10, 10 };
+
+	SetChord(group[0][0], 0, 0, cMajor);
+	group[0].SetPatternSize(8);
+
+	SetChord(group[1][0], 9, 0, aMinor);
+	SetChord(group[1][1], 9, 0, aNoFifth);
+	group[1].SetPatternSize(8);
+	group[1].SetRepeat(2);
+
+	SetChord(group[2][0], 7, 0, gSeventh);
+	SetChord(group[2][1], 0, 0, cMajor7, false);
+	group[2].SetPatternSize(16);
+
+	SetChord(group[3][0], 2, 2, dMajor);
+	group[3].SetPatternSize(16);
+}
+
+
+//
+// WriteTab
+//
+//	Write the document as tablature or a chord chart
+//
+static OSErr WriteTab(TByteSink &sink, const FPChordGroup group[4], UInt16 style) {
+	FPTabWriter writer(sink, standardTuning, style);
+
+	writer.Begin("Golden");
+	for (UInt16 i=0; i<4; i++)
+		writer.AddGroup(group[i]);
+
+	return writer.Finish();
+}
+
+
+//
+// WriteMusicXML
+//
+//	Compile the document as FPNoteList does, then write
+//	both parts as a score
+//
+static OSErr WriteMusicXML(TByteSink &sink, const FPChordGroup group[4]) {
+	FPNoteData	notes;
+	FPNoteBlock	block;
+
+	for (UInt16 i=0; i<4; i++) {
+		FPNoteGroup g;
+
+		g.beats		= group[i].PatternSize();
+		g.repeat	= group[i].Repeat();
+
+		for (PartIndex p=0; p<DOC_PARTS; p++) {
+			const FPChord	&chord = group[i][p];
+			FPNotePart		&part = g.part[p];
+
+			part.bracket = chord.IsBracketEnabled();
+			memcpy(part.fretHeld, chord.fretHeld, sizeof(part.fretHeld));
+			memcpy(part.pick, chord.pick, sizeof(part.pick));
+		}
+
+		FPNoteData::CompileBlock(block, g, standardTuning);
+		notes.AddLine(block);
+	}
+
+	FPMusicXMLWriter writer(sink, notes, standardTuning);
+
+	writer.SetPart(0, "Guitar & Voice", 25, false);
+	writer.SetPart(1, "Bass", 34, false);
+	writer.Begin("Golden", 480);
+
+	for (PartIndex p=0; p<2; p++) {
+		writer.BeginPart(p);
+
+		for (UInt16 i=0; i<4; i++)
+			writer.AddMeasure(group[i]);
+
+		writer.EndPart();
+	}
+
+	return writer.Finish();
+}
+
+
+int main(int argc, char *argv[]) {
+	if (argc != 3 || (strcmp(argv[1], "tab") && strcmp(argv[1], "chart") && strcmp(argv[1], "musicxml"))) {
+		fprintf(stderr, "usage: %s tab|chart|musicxml out\n", argv[0]);
+		return 2;
+	}
+
+	FPChordGroup group[4];
+	BuildDocument(group);
+
+	FILE *out = fopen(argv[2], "wb");
+	if (out == NULL) {
+		fprintf(stderr, "%s: can't write %s\n", argv[0], argv[2]);
+		return 1;
+	}
+
+	TByteSink sink(out);
+	OSErr err;
+
+	if (!strcmp(argv[1], "musicxml"))
+		err = WriteMusicXML(sink, group);
+	else
+		err = WriteTab(sink, group, strcmp(argv[1], "tab") ? kTabStyleChart : kTabStyleTablature);
+
+	if (err == noErr) err = sink.Finish();
+	if (fclose(out) != 0 && err == noErr) err = ioErr;
+
+	if (err != noErr) {
+		fprintf(stderr, "%s: error %d writing %s\n", argv[0], err, argv[2]);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,227 @@
+/*
+ *  FPFuzzMain.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ *	Runs a libFuzzer harness where libFuzzer isn't available,
+ *	as with gcc. Every file given is run once as it is, then
+ *	random mutations of them are run. There's no coverage
+ *	feedback, so it finds less than libFuzzer, but any input
+ *	that trips the harness or a sanitizer is saved first.
+ *
+ *	FuzzerName [-runs=N] [-seed=S] [-max_len=L] corpus files or folders
+ *
+ *	See Tests/README.md for how to build and run it.
+ *
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+typedef std::vector<uint8_t> FuzzInput;
+
+static const char	*crashPath = "fuzz-crash";
+static FuzzInput	current;
+
+
+//
+// SaveCurrent
+//
+//	Write the input that's running, so a crash can be replayed
+//	by passing the file back in. Only async-safe calls are used.
+//
+static void SaveCurrent() {
+	int fd = open(crashPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd >= 0) {
+		if (!current.empty() && write(fd, &current[0], current.size()) < 0) {}
+		close(fd);
+	}
+}
+
+
+//
+// RunInput
+//
+//	Give the harness its own copy of exactly the input's size,
+//	so a sanitizer catches a read past the end
+//
+static void RunInput() {
+	uint8_t *data = current.empty() ? NULL : (uint8_t*)malloc(current.size());
+	if (data) memcpy(data, &current[0], current.size());
+	LLVMFuzzerTestOneInput(data, current.size());
+	free(data);
+}
+
+
+static void HandleCrash(int sig) {
+	SaveCurrent();
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+
+extern "C" void __sanitizer_set_death_callback(void (*callback)(void)) __attribute__((weak));
+
+
+//
+// ReadInputs
+//
+//	Read a file, or every file in a folder, into the corpus
+//
+static void ReadInputs(const std::string &path, std::vector<FuzzInput> &corpus) {
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+		return;
+
+	if (S_ISDIR(info.st_mode)) {
+		DIR *dir = opendir(path.c_str());
+		if (dir == NULL) return;
+
+		std::vector<std::string> names;
+		for (struct dirent *ent; (ent = readdir(dir)) != NULL;)
+			if (ent->d_name[0] != '.')
+				names.push_back(ent->d_name);
+		closedir(dir);
+
+		std::sort(names.begin(), names.end());
+		for (size_t i=0; i<names.size(); i++)
+			ReadInputs(path + "/" + names[i], corpus);
+	}
+	else if (S_ISREG(info.st_mode)) {
+		FILE *fp = fopen(path.c_str(), "rb");
+		if (fp == NULL) return;
+
+		FuzzInput input(info.st_size);
+		if (info.st_size == 0 || fread(&input[0], info.st_size, 1, fp) == 1)
+			corpus.push_back(input);
+		fclose(fp);
+	}
+}
+
+
+//
+// Mutate
+//
+//	Change an input a few times over. Besides flipping bits
+//	and bytes, the mutations set big-endian words to values
+//	at the edges of a range, since most of a file format's
+//	header is counts and sizes, and cut or grow the input.
+//
+static void Mutate(FuzzInput &input, size_t maxLen) {
+	static const uint16_t edges[] = { 0, 1, 2, 0x7F, 0x80, 0xFF, 0x7FFF, 0x8000, 0xFFFE, 0xFFFF };
+
+	for (int count = 1 + random() % 4; count--;) {
+		size_t size = input.size();
+
+		switch (random() % 7) {
+			case 0:
+				if (size) input[random() % size] ^= 1 << (random() % 8);
+				break;
+
+			case 1:
+				if (size) input[random() % size] = random();
+				break;
+
+			case 2:
+				if (size >= 2) {
+					size_t at = random() % (size - 1);
+					uint16_t v = edges[random() % (sizeof(edges) / sizeof(edges[0]))];
+					input[at] = v >> 8;
+					input[at + 1] = v;
+				}
+				break;
+
+			case 3:
+				if (size) input.resize(random() % size);
+				break;
+
+			case 4:
+				if (size < maxLen) {
+					size_t at = size ? random() % (size + 1) : 0;
+					input.insert(input.begin() + at, 1 + random() % 16, (uint8_t)random());
+				}
+				break;
+
+			case 5:
+				if (size) {
+					size_t at = random() % size, len = 1 + random() % std::min<size_t>(16, size - at);
+					input.erase(input.begin() + at, input.begin() + at + len);
+				}
+				break;
+
+			case 6:
+				if (size >= 2) {
+					size_t from = random() % size, to = random() % size,
+						len = 1 + random() % std::min(size - from, size - to);
+					memmove(&input[to], &input[from], len);
+				}
+				break;
+		}
+	}
+
+	if (input.size() > maxLen)
+		input.resize(maxLen);
+}
+
+
+int main(int argc, char *argv[]) {
+	long				runs = 100000;
+	unsigned			seed = 1;
+	size_t				maxLen = 1 << 20;
+	std::vector<FuzzInput> corpus;
+
+	for (int i=1; i<argc; i++) {
+		if (!strncmp(argv[i], "-runs=", 6))
+			runs = atol(argv[i] + 6);
+		else if (!strncmp(argv[i], "-seed=", 6))
+			seed = strtoul(argv[i] + 6, NULL, 10);
+		else if (!strncmp(argv[i], "-max_len=", 9))
+			maxLen = atol(argv[i] + 9);
+		else if (argv[i][0] == '-') {
+			fprintf(stderr, "usage: %s [-runs=N] [-seed=S] [-max_len=L] corpus...\n", argv[0]);
+			return 2;
+		}
+		else
+			ReadInputs(argv[i], corpus);
+	}
+
+	if (corpus.empty())
+		corpus.push_back(FuzzInput());
+
+	signal(SIGSEGV, HandleCrash);
+	signal(SIGBUS, HandleCrash);
+	signal(SIGABRT, HandleCrash);
+	signal(SIGFPE, HandleCrash);
+	if (__sanitizer_set_death_callback)
+		__sanitizer_set_death_callback(SaveCurrent);
+
+	srandom(seed);
+
+	for (size_t i=0; i<corpus.size(); i++) {
+		current = corpus[i];
+		RunInput();
+	}
+
+	for (long r=0; r<runs; r++) {
+		current = corpus[random() % corpus.size()];
+		Mutate(current, maxLen);
+		RunInput();
+	}
+
+	printf("Done %ld runs of %lu inputs, seed %u\n", runs, (unsigned long)corpus.size(), seed);
+	return 0;
+}
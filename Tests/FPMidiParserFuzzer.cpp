@@ -0,0 +1,95 @@
+/*
+ *  FPMidiParserFuzzer.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ *	A libFuzzer harness for FPMidiParser. Any input the
+ *	parser accepts has its parts checked and is cut into
+ *	every segment. The segments must follow one another
+ *	with no gaps, and hold every note in order. In the
+ *	app's own build each segment is also fingered.
+ *
+ *	See Tests/README.md for how to build and run it.
+ *
+ */
+
+#include "FPMidiFormat.h"
+
+#if !FP_PORTABLE
+static const SInt32 standardTuning[NUM_STRINGS] = { 4, 9, 14, 19, 23, 28 };
+#endif
+
+//
+// NoteBefore
+//
+//	The order the parser sorts notes in, with no doubles
+//
+static bool NoteBefore(const FPMidiNote &a, const FPMidiNote &b) {
+	if (a.step != b.step) return a.step < b.step;
+	if (a.part != b.part) return a.part < b.part;
+	return a.tone < b.tone;
+}
+
+
+extern "C" int LLVMFuzzerTestOneInput(const UInt8 *data, size_t size) {
+	FPMidiParser parser(data, size);
+
+	if (parser.Parse() != noErr)
+		return 0;
+
+	const FPMidiHeader &head = parser.Header();
+
+	if (head.format > 1 || head.division == 0 || head.usPerQuarter == 0)
+		abort();
+
+	// Parts go to the lowest channels, in order, with the rest empty
+	PartIndex parts = 0;
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		if (head.partChannel[p] == kMidiNoChannel)
+			continue;
+
+		if (parts != p || head.partChannel[p] >= TOTAL_CHANNELS
+			|| (p && head.partChannel[p] <= head.partChannel[p - 1])
+			|| head.velocity[p] == 0 || head.velocity[p] > 127)
+			abort();
+
+		parts++;
+	}
+
+	FPMidiSegment	seg;
+	UInt32			step = 0, note = 0;
+
+#if !FP_PORTABLE
+	FPChordGroup	group;
+#endif
+
+	while (parser.NextSegment(seg)) {
+		if (seg.step != step || seg.first != note || seg.end < seg.first || seg.end > head.noteCount
+			|| (seg.beats != 4 && seg.beats != 8 && seg.beats != MAX_BEATS) || seg.step % seg.beats
+			|| seg.repeat < 1 || seg.repeat > MAX_REPEAT || (seg.repeat > 1 && seg.end != seg.first))
+			abort();
+
+		for (UInt32 n=seg.first; n<seg.end; n++) {
+			const FPMidiNote &midi = parser[n];
+
+			if (midi.step < seg.step || midi.step >= seg.step + seg.beats
+				|| midi.part >= parts || midi.tone > 127 || midi.velocity == 0
+				|| (n && !NoteBefore(parser[n - 1], midi)))
+				abort();
+		}
+
+#if !FP_PORTABLE
+		parser.SetTones(seg, group, standardTuning);
+		parser.SetPattern(seg, group, standardTuning);
+#endif
+
+		step = seg.step + seg.beats * seg.repeat;
+		note = seg.end;
+	}
+
+	if (note != head.noteCount)
+		abort();
+
+	return 0;
+}
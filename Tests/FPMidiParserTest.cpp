@@ -0,0 +1,336 @@
+/*
+ *  FPMidiParserTest.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ *	Unit tests for FPMidiParser. Each test builds a small
+ *	Standard MIDI File in memory and checks the notes and
+ *	segments the parser makes of it: running status, chunks
+ *	and events cut short, bad variable-length numbers, the
+ *	rounding of ticks to sixteenths, and the compaction of
+ *	doubled notes and empty bars. The drum kit an imported
+ *	channel 10 program gets is checked against the export.
+ *
+ *	See Tests/README.md for how to build and run it.
+ *
+ */
+
+#include "FPMidiFormat.h"
+#include "FPMidiHelper.h"
+
+static int checks = 0, failures = 0;
+
+#define CHECK(x)	do { checks++; if (!(x)) { fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #x); failures++; } } while (0)
+
+
+//
+// FPTestFile
+//
+//	A MIDI file built up a byte at a time
+//
+class FPTestFile {
+	public:
+		std::vector<UInt8>	bytes;
+		UInt32				trackStart;
+
+		FPTestFile(UInt16 format=1, UInt16 tracks=1, UInt16 division=96) {
+			Long('MThd'); Long(6); Word(format); Word(tracks); Word(division);
+		}
+
+		void	Byte(UInt8 b)		{ bytes.push_back(b); }
+		void	Word(UInt16 w)		{ Byte(w >> 8); Byte(w); }
+		void	Long(UInt32 l)		{ Word(l >> 16); Word(l); }
+
+		void	VarLen(UInt32 v) {
+			UInt8 b[4];
+			int i = 3;
+			for (b[i] = v & 0x7F; (v >>= 7) && i; )
+				b[--i] = (v & 0x7F) | 0x80;
+			while (i < 4) Byte(b[i++]);
+		}
+
+		void	Event(UInt32 delta, UInt8 a, UInt8 b)			{ VarLen(delta); Byte(a); Byte(b); }
+		void	Event(UInt32 delta, UInt8 a, UInt8 b, UInt8 c)	{ VarLen(delta); Byte(a); Byte(b); Byte(c); }
+
+		void	BeginTrack()		{ Long('MTrk'); trackStart = bytes.size(); Long(0); }
+		void	EndTrack()			{ Event(0, 0xFF, 0x2F, 0x00); PatchLength(bytes.size() - trackStart - 4); }
+
+		void	PatchLength(UInt32 len) {
+			for (int i=4; i--; len >>= 8)
+				bytes[trackStart + i] = len;
+		}
+
+		inline const UInt8*	Data() const	{ return &bytes[0]; }
+		inline UInt32		Size() const	{ return bytes.size(); }
+};
+
+
+//
+// CheckNote
+//
+//	Check one note the parser kept
+//
+static bool CheckNote(const FPMidiParser &parser, UInt32 n, UInt32 step, UInt8 part, UInt8 tone) {
+	if (n >= parser.Header().noteCount)
+		return false;
+
+	const FPMidiNote &note = parser[n];
+	return note.step == step && note.part == part && note.tone == tone;
+}
+
+
+//
+// TestRunningStatus
+//
+//	Data bytes with no status byte reuse the last one.
+//	A meta event cancels it, so what follows is the end.
+//
+static void TestRunningStatus() {
+	FPTestFile f;
+	f.BeginTrack();
+	f.Event(0, 0x90, 60, 100);
+	f.Event(0, 62, 100);
+	f.Event(24, 64, 100);
+	f.Event(0, 60, 0);					// Off by running status
+	f.Event(0, 0xB0, 7, 90);
+	f.Event(24, 65, 100);				// Running status of the control change
+	f.Event(0, 0x91, 67, 80);
+	f.Event(0, 0xFF, 0x01, 0x00);		// Empty text
+	f.Event(0, 69, 100);				// No status any more
+	f.Event(0, 0x90, 71, 100);
+	f.EndTrack();
+
+	FPMidiParser parser(f.Data(), f.Size());
+	CHECK(parser.Parse() == noErr);
+
+	const FPMidiHeader &head = parser.Header();
+	CHECK(head.noteCount == 4);
+	CHECK(CheckNote(parser, 0, 0, 0, 60));
+	CHECK(CheckNote(parser, 1, 0, 0, 62));
+	CHECK(CheckNote(parser, 2, 1, 0, 64));
+	CHECK(CheckNote(parser, 3, 2, 1, 67));
+	CHECK(head.partChannel[0] == 0 && head.partChannel[1] == 1);
+	CHECK(head.velocity[0] == 100 && head.velocity[1] == 80);
+}
+
+
+//
+// TestTruncated
+//
+//	A track that claims to run past the end is read up to
+//	the end, and an event cut short ends its track. A file
+//	too short for its header isn't MIDI at all.
+//
+static void TestTruncated() {
+	FPTestFile f(1, 2);
+	f.BeginTrack();
+	f.Event(0, 0x90, 60, 100);
+	f.EndTrack();
+	f.BeginTrack();
+	f.Event(0, 0x92, 48, 100);
+	f.Event(24, 0x92, 50);				// No velocity
+	f.PatchLength(1000);
+
+	FPMidiParser parser(f.Data(), f.Size());
+	CHECK(parser.Parse() == noErr);
+	CHECK(parser.Header().noteCount == 2);
+	CHECK(CheckNote(parser, 0, 0, 0, 60));
+	CHECK(CheckNote(parser, 1, 0, 1, 48));
+
+	// A track of nothing but its chunk header
+	FPTestFile g;
+	g.BeginTrack();
+	FPMidiParser empty(g.Data(), g.Size());
+	CHECK(empty.Parse() == noErr);
+	CHECK(empty.Header().noteCount == 0);
+
+	FPMidiSegment seg;
+	CHECK(!empty.NextSegment(seg));
+
+	// The header's own chunk runs past the end
+	FPTestFile h;
+	h.bytes[7] = 100;
+	FPMidiParser longHead(h.Data(), h.Size());
+	CHECK(longHead.Parse() == kFPErrorBadFormat);
+
+	// Every length of a cut-off file either parses or is refused
+	for (UInt32 len=0; len<f.Size(); len++) {
+		FPMidiParser cut(f.Data(), len);
+		OSStatus err = cut.Parse();
+		CHECK(err == noErr || err == kFPErrorBadFormat);
+		CHECK(err != noErr || len >= kMidiMinSize + 8);
+	}
+}
+
+
+//
+// TestBadVarLen
+//
+//	A delta time or meta length longer than four bytes,
+//	or one that runs past the end, ends its track. The
+//	next track is still read.
+//
+static void TestBadVarLen() {
+	FPTestFile f(1, 3);
+	f.BeginTrack();
+	f.Event(0, 0x90, 60, 100);
+	f.Byte(0x81); f.Byte(0x80); f.Byte(0x80); f.Byte(0x80); f.Byte(0x00);
+	f.Byte(0x90); f.Byte(61); f.Byte(100);
+	f.EndTrack();
+	f.BeginTrack();
+	f.Event(0, 0x91, 62, 100);
+	f.VarLen(0); f.Byte(0xFF); f.Byte(0x01); f.Byte(0x8F); f.Byte(0xFF); f.Byte(0xFF); f.Byte(0x7F);
+	f.Event(0, 0x91, 63, 100);
+	f.EndTrack();
+	f.BeginTrack();
+	f.Event(0, 0x92, 64, 100);
+	f.Byte(0x80);						// A delta cut off by the end of the track
+	f.PatchLength(f.Size() - f.trackStart - 4);
+
+	FPMidiParser parser(f.Data(), f.Size());
+	CHECK(parser.Parse() == noErr);
+	CHECK(parser.Header().noteCount == 3);
+	CHECK(CheckNote(parser, 0, 0, 0, 60));
+	CHECK(CheckNote(parser, 1, 0, 1, 62));
+	CHECK(CheckNote(parser, 2, 0, 2, 64));
+}
+
+
+//
+// TestQuantize
+//
+//	Ticks round to the nearest sixteenth, halves up, and
+//	notes past the last step are dropped. SMPTE timing
+//	has no beats, so it's refused.
+//
+static void TestQuantize() {
+	FPTestFile f(0, 1, 96);
+	f.BeginTrack();
+	f.Event(0, 0x90, 60, 100);			// tick 0
+	f.Event(11, 0x90, 61, 100);			// tick 11, just under half
+	f.Event(1, 0x90, 62, 100);			// tick 12, half
+	f.Event(24, 0x90, 63, 100);			// tick 36
+	f.Event(11, 0x90, 64, 100);			// tick 47
+	f.Event(0x0FFFFFFF, 0xB0, 7, 90);
+	f.Event(0x0FFFFFFF, 0x90, 65, 100);	// Past the last step
+	f.EndTrack();
+
+	FPMidiParser parser(f.Data(), f.Size());
+	CHECK(parser.Parse() == noErr);
+	CHECK(parser.Header().noteCount == 5);
+	CHECK(CheckNote(parser, 0, 0, 0, 60));
+	CHECK(CheckNote(parser, 1, 0, 0, 61));
+	CHECK(CheckNote(parser, 2, 1, 0, 62));
+	CHECK(CheckNote(parser, 3, 2, 0, 63));
+	CHECK(CheckNote(parser, 4, 2, 0, 64));
+	CHECK(parser.Header().usPerQuarter == kMidiDefaultTempo);
+
+	FPTestFile smpte(0, 1, 0xE728);
+	smpte.BeginTrack();
+	smpte.Event(0, 0x90, 60, 100);
+	smpte.EndTrack();
+
+	FPMidiParser refused(smpte.Data(), smpte.Size());
+	CHECK(refused.Parse() == kFPErrorBadFormat);
+}
+
+
+//
+// TestCompaction
+//
+//	Doubled notes are kept once, channels past the parts
+//	are dropped, and a run of empty bars is one repeated
+//	segment. A bar with more tones than strings is halved.
+//
+static void TestCompaction() {
+	FPTestFile f(0, 1, 4);				// A tick is a sixteenth
+	f.BeginTrack();
+	f.Event(0, 0xC9, 25);
+	f.Event(0, 0xC2, 30);
+	f.Event(0, 0xC2, 31);				// Only the first program counts
+	f.Event(0, 0xFF, 0x51, 0x03); f.Byte(0x07); f.Byte(0xA1); f.Byte(0x20);
+	f.Event(0, 0xFF, 0x51, 0x03); f.Byte(0x0F); f.Byte(0x42); f.Byte(0x40);
+	for (UInt8 t=0; t<7; t++)
+		f.Event(t ? 1 : 0, 0x99, 36 + t, 100);
+	f.Event(0, 0x92, 60, 100);
+	f.Event(0, 0x92, 60, 90);			// A double
+	f.Event(0, 0x93, 61, 100);
+	f.Event(0, 0x94, 62, 100);
+	f.Event(0, 0x9A, 63, 100);			// A fifth channel
+	f.Event(20 * MAX_BEATS - 6, 0x92, 64, 100);
+	f.EndTrack();
+
+	FPMidiParser parser(f.Data(), f.Size());
+	CHECK(parser.Parse() == noErr);
+
+	const FPMidiHeader &head = parser.Header();
+	CHECK(head.noteCount == 11);
+	CHECK(head.partChannel[0] == 2 && head.partChannel[1] == 3 && head.partChannel[2] == 4 && head.partChannel[3] == 9);
+	CHECK(head.program[0] == 30 && head.program[1] == kMidiNoProgram && head.program[3] == 25);
+	CHECK(head.usPerQuarter == 500000);
+	CHECK(head.velocity[0] == 100);
+
+	static const FPMidiSegment expect[] = {
+		{ 0, 4, 1, 0, 4 },				// 7 drum tones halve the bar twice
+		{ 4, 4, 1, 4, 10 },
+		{ 8, 8, 1, 10, 10 },
+		{ 16, 16, 16, 10, 10 },			// 19 empty bars
+		{ 272, 16, 3, 10, 10 },
+		{ 320, 16, 1, 10, 11 }
+	};
+
+	FPMidiSegment seg;
+	UInt16 count = 0;
+	while (parser.NextSegment(seg)) {
+		if (count < sizeof(expect) / sizeof(expect[0])) {
+			const FPMidiSegment &e = expect[count];
+			CHECK(seg.step == e.step && seg.beats == e.beats && seg.repeat == e.repeat
+				&& seg.first == e.first && seg.end == e.end);
+		}
+		count++;
+	}
+	CHECK(count == sizeof(expect) / sizeof(expect[0]));
+}
+
+
+//
+// TestDrumkits
+//
+//	A channel 10 program gets back the kit the export
+//	sent, and other programs get the kit they vary
+//
+static void TestDrumkits() {
+	for (UInt16 fauxGM=kFirstFauxDrum; fauxGM<=kLastFauxDrum; fauxGM++) {
+		UInt16 kit = FPMidiHelper::FauxGMToTrueGM(fauxGM);
+		CHECK(FPMidiHelper::DrumkitForProgram((kit - 1) & 0x7F) == kit);
+	}
+
+	for (UInt16 program=0; program<128; program++) {
+		UInt16 kit = FPMidiHelper::DrumkitForProgram(program);
+		UInt16 fauxGM = FPMidiHelper::TrueGMToFauxGM(kit);
+		CHECK(fauxGM >= kFirstFauxDrum && fauxGM <= kLastFauxDrum);
+		CHECK(((kit - 1) & 0x7F) <= program);
+	}
+
+	CHECK(FPMidiHelper::DrumkitForProgram(1) == FPMidiHelper::FauxGMToTrueGM(kFirstFauxDrum));
+	CHECK(FPMidiHelper::DrumkitForProgram(127) == FPMidiHelper::FauxGMToTrueGM(kLastFauxDrum));
+}
+
+
+int main(int argc, char *argv[]) {
+	TestRunningStatus();
+	TestTruncated();
+	TestBadVarLen();
+	TestQuantize();
+	TestCompaction();
+	TestDrumkits();
+
+	if (failures) {
+		fprintf(stderr, "%s: %d of %d checks failed\n", argv[0], failures, checks);
+		return 1;
+	}
+
+	printf("%d checks passed\n", checks);
+	return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ *  FPMidiWriteTool.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ *	Export a classic document, such as one written by
+ *	make_classic.py, as a Standard MIDI File with
+ *	FPMidiWriter. The document can be cloned end to end
+ *	first, as the app's "clone" batch command does, to
+ *	go past the 65535 lines a classic file can hold.
+ *
+ *	Parts, tempo and a saved tuning come from the header,
+ *	as in FPWaveRenderTool. Running status is never used,
+ *	as with the app's "Verbose MIDI" preference.
+ *
+ *	FPMidiWriteTool [-clone=N] [-format=0|1] file.fp out.mid
+ *
+ *	See Tests/README.md for how to build it.
+ *
+ */
+
+#include "FPClassicNotes.h"
+#include "FPMidiHelper.h"
+#include "FPMidiWriter.h"
+#include "TByteSink.h"
+
+#include <sys/mman.h>
+
+
+int main(int argc, char *argv[]) {
+	UInt16	copies = 1, format = 1;
+	int		arg = 1;
+
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (!strncmp(argv[arg], "-clone=", 7))
+			copies = MAX(atoi(argv[arg] + 7), 1);
+		else if (!strncmp(argv[arg], "-format=", 8))
+			format = atoi(argv[arg] + 8);
+		else
+			break;
+	}
+
+	if (argc - arg != 2 || format > 1) {
+		fprintf(stderr, "usage: %s [-clone=N] [-format=0|1] file.fp out.mid\n", argv[0]);
+		return 2;
+	}
+
+	const char *inPath = argv[arg], *outPath = argv[arg + 1];
+
+	UInt64 size;
+	const UInt8 *data = MapClassicFile(inPath, size);
+	if (data == NULL) {
+		fprintf(stderr, "%s: can't open %s\n", argv[0], inPath);
+		return 1;
+	}
+
+	FPClassicParser parser(data, size);
+	if (parser.Parse() != noErr) {
+		fprintf(stderr, "%s: %s isn't a classic document\n", argv[0], inPath);
+		return 1;
+	}
+
+	const FPClassicHeader &head = parser.Header();
+
+	FPNoteData notes;
+	ReadClassicNotes(parser, notes, copies);
+
+	// FPDocument::Interim is one sixteenth in microseconds
+	UInt32 interim = 60 * 1000000 / MAX(head.tempo * MAX(head.tempoX, 1), 1);
+	FPMidiWriter writer(notes, interim * 4, true);
+
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		FPClassicNotePart part;
+		char name[kMidiNameSize];
+		GetClassicPart(head, p, part);
+		FPMidiHelper::CopyInstrumentName(part.trueGM, name, sizeof(name));
+		writer.SetPart(p, name, part.trueGM, part.velocity, part.sustain);
+	}
+
+	FILE *out = fopen(outPath, "wb");
+	if (out == NULL) {
+		fprintf(stderr, "%s: can't write %s\n", argv[0], outPath);
+		return 1;
+	}
+
+	TByteSink sink(out);
+	OSErr err = format ? writer.WriteFormat1(sink) : writer.WriteFormat0(sink);
+	if (err == noErr) err = sink.Finish();
+	if (fclose(out) != 0 && err == noErr) err = ioErr;
+
+	munmap((void*)data, size);
+
+	if (err != noErr) {
+		fprintf(stderr, "%s: error %d writing %s\n", argv[0], err, outPath);
+		return 1;
+	}
+
+	printf("%u lines, %u notes, format %d\n", (unsigned)head.length * copies, (unsigned)notes.Size(), format);
+	return 0;
+}
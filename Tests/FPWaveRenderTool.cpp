@@ -0,0 +1,109 @@
+/*
+ *  FPWaveRenderTool.cpp
+ *
+ *	FretPet X
+ *  Copyright © 2012 Scott Lahteine. All rights reserved.
+ *
+ *	Render a classic document, such as one written by
+ *	make_classic.py, to a WAV file with FPWaveRenderer, and
+ *	print a hash of the file. The same document and thread
+ *	count must always give the same hash.
+ *
+ *	Parts, tempo and a saved tuning come from the header.
+ *	Older files that name a built-in tuning by number are
+ *	played in Standard tuning.
+ *
+ *	FPWaveRenderTool [-threads=N] file.fp out.wav
+ *
+ *	See Tests/README.md for how to build it.
+ *
+ */
+
+#include "FPClassicNotes.h"
+#include "FPWaveRenderer.h"
+#include "TByteSink.h"
+
+#include <sys/mman.h>
+
+
+//
+// HashFile
+//
+//	FNV-1a of a whole file
+//
+static UInt64 HashFile(const char *path) {
+	UInt64	hash = 0xCBF29CE484222325ULL;
+	FILE	*fp = fopen(path, "rb");
+
+	if (fp != NULL) {
+		for (int c; (c = getc(fp)) != EOF;)
+			hash = (hash ^ (UInt8)c) * 0x100000001B3ULL;
+		fclose(fp);
+	}
+
+	return hash;
+}
+
+
+int main(int argc, char *argv[]) {
+	UInt16	threads = 0;
+	int		arg = 1;
+
+	if (arg < argc && !strncmp(argv[arg], "-threads=", 9))
+		threads = atoi(argv[arg++] + 9);
+
+	if (argc - arg != 2) {
+		fprintf(stderr, "usage: %s [-threads=N] file.fp out.wav\n", argv[0]);
+		return 2;
+	}
+
+	const char *inPath = argv[arg], *outPath = argv[arg + 1];
+
+	UInt64 size;
+	const UInt8 *data = MapClassicFile(inPath, size);
+	if (data == NULL) {
+		fprintf(stderr, "%s: can't open %s\n", argv[0], inPath);
+		return 1;
+	}
+
+	FPClassicParser parser(data, size);
+	if (parser.Parse() != noErr) {
+		fprintf(stderr, "%s: %s isn't a classic document\n", argv[0], inPath);
+		return 1;
+	}
+
+	const FPClassicHeader &head = parser.Header();
+
+	FPNoteData notes;
+	ReadClassicNotes(parser, notes);
+
+	FPWaveRenderer renderer(notes, head.tempo * MAX(head.tempoX, 1));
+
+	for (PartIndex p=0; p<DOC_PARTS; p++) {
+		FPClassicNotePart part;
+		GetClassicPart(head, p, part);
+		bool drum = part.trueGM >= kFirstDrumkit && part.trueGM <= kLastDrumkit;
+		renderer.SetPart(p, part.velocity, part.sustain, drum);
+	}
+
+	FILE *out = fopen(outPath, "wb");
+	if (out == NULL) {
+		fprintf(stderr, "%s: can't write %s\n", argv[0], outPath);
+		return 1;
+	}
+
+	TByteSink sink(out);
+	OSErr err = renderer.Render(sink, threads);
+	if (err == noErr) err = sink.Finish();
+	if (fclose(out) != 0 && err == noErr) err = ioErr;
+
+	munmap((void*)data, size);
+
+	if (err != noErr) {
+		fprintf(stderr, "%s: error %d writing %s\n", argv[0], err, outPath);
+		return 1;
+	}
+
+	printf("%d lines, %u notes, hash %016llx\n", (int)head.length, (unsigned)notes.Size(), (unsigned long long)HashFile(outPath));
+	return 0;
+}
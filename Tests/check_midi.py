@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+#
+#  check_midi.py
+#
+#	FretPet X
+#  Copyright © 2012 Scott Lahteine. All rights reserved.
+#
+#	Check that a Standard MIDI File is well formed. Every chunk
+#	length must match its contents, every event must parse, each
+#	track must end with End of Track, and every note that starts
+#	must stop. Prints a summary, or the first problem found.
+#
+#	check_midi.py [--min-notes N] file.mid
+#
+
+import argparse
+import struct
+import sys
+
+
+class MidiError(Exception):
+	pass
+
+
+def read_varlen(data, pos, end):
+	value = 0
+	for i in range(4):
+		if pos >= end:
+			raise MidiError('variable-length value runs past the track')
+		b = data[pos]
+		pos += 1
+		value = (value << 7) | (b & 0x7F)
+		if not b & 0x80:
+			return value, pos
+	raise MidiError('variable-length value is longer than 4 bytes')
+
+
+def check_track(data, pos, end, number):
+	status = None
+	held = {}
+	notes = 0
+	ended = False
+
+	while pos < end:
+		if ended:
+			raise MidiError('track %d has events after End of Track' % number)
+
+		delta, pos = read_varlen(data, pos, end)
+
+		if pos >= end:
+			raise MidiError('track %d ends after a delta time' % number)
+
+		if data[pos] & 0x80:
+			status = data[pos]
+			pos += 1
+		elif status is None or status >= 0xF0:
+			raise MidiError('track %d uses running status with no status byte' % number)
+
+		kind = status & 0xF0
+
+		if status == 0xFF:
+			if pos >= end:
+				raise MidiError('track %d has a truncated meta event' % number)
+			meta = data[pos]
+			length, pos = read_varlen(data, pos + 1, end)
+			pos += length
+			if meta == 0x2F:
+				ended = True
+			status = None
+		elif status in (0xF0, 0xF7):
+			length, pos = read_varlen(data, pos, end)
+			pos += length
+			status = None
+		elif kind in (0xC0, 0xD0):
+			pos += 1
+		elif kind in (0x80, 0x90, 0xA0, 0xB0, 0xE0):
+			if pos + 2 > end:
+				raise MidiError('track %d has a truncated channel event' % number)
+			if kind in (0x80, 0x90):
+				key = (status & 0x0F, data[pos])
+				if kind == 0x90 and data[pos + 1] > 0:
+					held[key] = held.get(key, 0) + 1
+					notes += 1
+				elif held.get(key, 0) > 0:
+					held[key] -= 1
+			pos += 2
+		else:
+			raise MidiError('track %d has an unknown status byte %02X' % (number, status))
+
+		if pos > end:
+			raise MidiError('track %d has an event that runs past its end' % number)
+
+	if not ended:
+		raise MidiError('track %d has no End of Track' % number)
+
+	stuck = sum(held.values())
+	if stuck:
+		raise MidiError('track %d leaves %d notes on' % (number, stuck))
+
+	return notes
+
+
+def check_file(data):
+	if len(data) < 14 or data[:4] != b'MThd':
+		raise MidiError('no MThd chunk')
+
+	length, fmt, ntracks, division = struct.unpack('>IHHH', data[4:14])
+	if length != 6:
+		raise MidiError('MThd length is %d, not 6' % length)
+	if fmt > 1:
+		raise MidiError('format %d is not written by FretPet' % fmt)
+
+	pos = 14
+	tracks = 0
+	notes = 0
+
+	while pos < len(data):
+		if pos + 8 > len(data):
+			raise MidiError('truncated chunk header at %d' % pos)
+		tag, length = struct.unpack('>4sI', data[pos:pos + 8])
+		pos += 8
+		if pos + length > len(data):
+			raise MidiError('chunk at %d is %d bytes, past the end of the file' % (pos - 8, length))
+		if tag == b'MTrk':
+			notes += check_track(data, pos, pos + length, tracks)
+			tracks += 1
+		pos += length
+
+	if tracks != ntracks:
+		raise MidiError('MThd says %d tracks but the file has %d' % (ntracks, tracks))
+
+	return fmt, tracks, notes
+
+
+def main():
+	parser = argparse.ArgumentParser(description='Check that a Standard MIDI File is well formed')
+	parser.add_argument('--min-notes', type=int, default=0)
+	parser.add_argument('file')
+	args = parser.parse_args()
+
+	with open(args.file, 'rb') as f:
+		data = f.read()
+
+	try:
+		fmt, tracks, notes = check_file(data)
+		if notes < args.min_notes:
+			raise MidiError('only %d notes, expected at least %d' % (notes, args.min_notes))
+	except MidiError as e:
+		sys.exit('%s: %s' % (args.file, e))
+
+	print('%s: format %d, %d tracks, %d notes, %d bytes' % (args.file, fmt, tracks, notes, len(data)))
+
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+#  journal_replay.sh
+#
+#	FretPet X
+#  Copyright © 2012 Scott Lahteine. All rights reserved.
+#
+#	Run the app's journal self test on a small document. It
+#	clones a part over a few lines, replays the journal in a
+#	second window, and checks undo and redo of the clone.
+#
+#	journal_replay.sh /path/to/FretPet.app/Contents/MacOS/FretPet
+#
+
+APP="$1"
+TESTS=$(cd "$(dirname "$0")" && pwd)
+
+if [ ! -x "$APP" ]; then
+	echo "usage: $0 /path/to/FretPet.app/Contents/MacOS/FretPet" >&2
+	exit 2
+fi
+
+WORK=$(mktemp -d /tmp/fretpet-journal.XXXXXX) || exit 2
+trap 'rm -rf "$WORK"' EXIT
+
+"$TESTS/make_classic.py" --lines 8 --unique 8 --seed 30 "$WORK/journal.fp" || exit 2
+
+"$APP" -test journal "$WORK/journal.fp"
@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+#
+#  make_classic.py
+#
+#	FretPet X
+#  Copyright © 2012 Scott Lahteine. All rights reserved.
+#
+#	Write a FretPet Classic (Format 21) document of random
+#	chords for the tests. Lines are drawn from a smaller set
+#	of unique lines, so exporters see repeated chords.
+#
+#	make_classic.py [--lines N] [--unique U] [--seed S] out.fp
+#
+
+import argparse
+import random
+import struct
+import sys
+
+OLD_NUM_PARTS	= 4
+NUM_STRINGS		= 6
+MAX_FRETS		= 24
+MAX_BEATS		= 16
+MAX_REPEAT		= 16
+MAX_LINES		= 0xFFFF		# The length is a 16-bit word
+
+STANDARD_TUNING	= (4, 9, 14, 19, 23, 28)
+
+
+def random_chord(rng, beats, repeat):
+	frets = [rng.choice((-1, rng.randint(0, 12))) for s in range(NUM_STRINGS)]
+	pick = [rng.getrandbits(beats) for s in range(NUM_STRINGS)]
+	low = rng.randint(0, MAX_FRETS - 4)
+
+	# tones root key rootType rootLock bracketFlag brakLow brakHi fretHeld[6] beats repeat pick[6]
+	return struct.pack('>4H2?2H6h2H6H',
+		rng.getrandbits(12), rng.randint(0, 11), rng.randint(0, 11), 0,
+		rng.random() < 0.25, rng.random() < 0.25, low, low + 4,
+		*(frets + [beats, repeat] + pick))
+
+
+def random_line(rng):
+	beats = rng.randint(1, MAX_BEATS)
+	repeat = rng.randint(1, 4) if rng.random() < 0.1 else 1
+	return b''.join(random_chord(rng, beats, repeat) for p in range(OLD_NUM_PARTS))
+
+
+def header(length):
+	name = b'\x08Standard'.ljust(32, b'\0')
+
+	# fileType lastPoint tempo scaleMode enharmonic tuning length topLine cursor
+	common = struct.pack('>4s2h6Hh', b'FP21', 0, 0, 240, 0, 0, 0, length, 0, 0)
+
+	# partNum fauxGMNumbers velocity sustain tempoX reserved2-4 tuningName lowNote
+	head21 = struct.pack('>h4h4h4hh3h32s6h', 0,
+		25, 26, 33, 0,
+		90, 90, 90, 90,
+		15, 15, 15, 15,
+		1, 0, 0, 0,
+		name, *STANDARD_TUNING)
+
+	return common + head21
+
+
+def main():
+	parser = argparse.ArgumentParser(description='Write a FretPet Classic document of random chords')
+	parser.add_argument('--lines', type=int, default=1000)
+	parser.add_argument('--unique', type=int, default=64)
+	parser.add_argument('--seed', type=int, default=1)
+	parser.add_argument('output')
+	args = parser.parse_args()
+
+	if not 0 < args.lines <= MAX_LINES:
+		sys.exit('make_classic.py: --lines must be 1 to %d' % MAX_LINES)
+
+	rng = random.Random(args.seed)
+	pool = [random_line(rng) for i in range(max(1, args.unique))]
+
+	with open(args.output, 'wb') as out:
+		out.write(header(args.lines))
+		for i in range(args.lines):
+			out.write(rng.choice(pool))
+
+
+if __name__ == '__main__':
+	main()
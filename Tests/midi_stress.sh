@@ -0,0 +1,44 @@
+#!/bin/sh
+#
+#  midi_stress.sh
+#
+#	FretPet X
+#  Copyright © 2012 Scott Lahteine. All rights reserved.
+#
+#	Export a 100,000-line document as Format 0 and Format 1
+#	MIDI with the app's batch mode and check both files.
+#	Classic documents hold at most 65535 lines, so a 50,000
+#	line document is cloned once to reach 100,000.
+#
+#	midi_stress.sh /path/to/FretPet.app/Contents/MacOS/FretPet
+#
+
+APP="$1"
+TESTS=$(cd "$(dirname "$0")" && pwd)
+
+if [ ! -x "$APP" ]; then
+	echo "usage: $0 /path/to/FretPet.app/Contents/MacOS/FretPet" >&2
+	exit 2
+fi
+
+WORK=$(mktemp -d /tmp/fretpet-stress.XXXXXX) || exit 2
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir "$WORK/f0" "$WORK/f1"
+"$TESTS/make_classic.py" --lines 50000 --unique 2000 --seed 40 "$WORK/f0/bank.fp" || exit 2
+cp "$WORK/f0/bank.fp" "$WORK/f1/bank.fp"
+
+status=0
+
+for f in 0 1; do
+	if ! "$APP" -batch "clone 2; export midi$f" "$WORK/f$f/bank.fp"; then
+		echo "FAIL: Format $f export of 100,000 lines" >&2
+		status=1
+	elif ! "$TESTS/check_midi.py" --min-notes 100000 "$WORK/f$f/bank.mid"; then
+		echo "FAIL: Format $f file is damaged" >&2
+		status=1
+	fi
+done
+
+[ $status -eq 0 ] && echo "PASS: 100,000-line MIDI exports are well formed"
+exit $status
@@ -0,0 +1,65 @@
+#!/bin/sh
+#
+#  sunvox_compare.sh
+#
+#	FretPet X
+#  Copyright © 2012 Scott Lahteine. All rights reserved.
+#
+#	Export the same documents to Sunvox with two builds of
+#	the app and check that the files are byte-identical. The
+#	reference build is one from before a change to the
+#	exporter, such as the commit before the pattern lookup
+#	moved to the chord group store. It must be new enough to
+#	take instruments from the document, or every file will
+#	differ. Generated documents are always compared. Any
+#	documents given after the two apps are compared too.
+#
+#	sunvox_compare.sh reference-app app [document ...]
+#
+
+REF="$1"
+APP="$2"
+TESTS=$(cd "$(dirname "$0")" && pwd)
+
+if [ ! -x "$REF" ] || [ ! -x "$APP" ]; then
+	echo "usage: $0 reference-app app [document ...]" >&2
+	exit 2
+fi
+
+shift 2
+
+WORK=$(mktemp -d /tmp/fretpet-sunvox.XXXXXX) || exit 2
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir "$WORK/docs" "$WORK/ref" "$WORK/new"
+
+# Few unique lines clone a lot, many unique lines clone little
+"$TESTS/make_classic.py" --lines 1    --unique 1    --seed 1 "$WORK/docs/single.fp" || exit 2
+"$TESTS/make_classic.py" --lines 500  --unique 3    --seed 2 "$WORK/docs/repeats.fp" || exit 2
+"$TESTS/make_classic.py" --lines 2000 --unique 200  --seed 3 "$WORK/docs/mixed.fp" || exit 2
+"$TESTS/make_classic.py" --lines 2000 --unique 2000 --seed 4 "$WORK/docs/unique.fp" || exit 2
+
+for doc in "$@"; do
+	cp "$doc" "$WORK/docs/" || exit 2
+done
+
+for doc in "$WORK/docs/"*; do
+	cp "$doc" "$WORK/ref/"
+	cp "$doc" "$WORK/new/"
+done
+
+"$REF" -batch "export sunvox" "$WORK/ref/"* || { echo "FAIL: the reference app couldn't export" >&2; exit 1; }
+"$APP" -batch "export sunvox" "$WORK/new/"* || { echo "FAIL: the app couldn't export" >&2; exit 1; }
+
+status=0
+
+for ref in "$WORK/ref/"*.sunvox; do
+	name=$(basename "$ref")
+	if ! cmp "$ref" "$WORK/new/$name"; then
+		echo "FAIL: $name differs from the reference" >&2
+		status=1
+	fi
+done
+
+[ $status -eq 0 ] && echo "PASS: Sunvox exports match the reference"
+exit $status